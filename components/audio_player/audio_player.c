@@ -66,7 +66,9 @@ esp_err_t audio_player_init(void)
     }
 
     if (!s_event_handler_registered) {
-        esp_err_t err = event_bus_register_handler(on_event);
+        const event_bus_mask_t events = EVENT_BUS_MASK(EVENT_AUDIO_PLAY) | EVENT_BUS_MASK(EVENT_VOLUME_SET);
+        const event_bus_subscribe_opts_t opts = {.name = "audio"};
+        esp_err_t err = event_bus_subscribe_ex(events, on_event, &opts);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "failed to register event handler: %s", esp_err_to_name(err));
             return err;
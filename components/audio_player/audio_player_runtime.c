@@ -12,6 +12,7 @@
 #include "esp_log.h"
 #include "error_monitor.h"
 #include "sd_storage.h"
+#include "broker_affinity.h"
 
 #define AUDIO_QUEUE_LEN 4
 #define AUDIO_READER_STOP_TIMEOUT_MS 500
@@ -316,7 +317,8 @@ esp_err_t audio_player_runtime_start(void)
         return ESP_ERR_INVALID_STATE;
     }
     if (!s_task) {
-        BaseType_t ok = xTaskCreate(audio_runtime_task, "audio_task", 8192, NULL, 6, &s_task);
+        BaseType_t ok = xTaskCreatePinnedToCore(audio_runtime_task, "audio_task", 8192, NULL, 6, &s_task,
+                                                BROKER_APP_CORE);
         if (ok != pdPASS) {
             return ESP_FAIL;
         }
@@ -13,7 +13,12 @@ esp_err_t automation_engine_init(void)
     ESP_RETURN_ON_ERROR(automation_engine_execution_init(), TAG, "execution init failed");
     ESP_RETURN_ON_ERROR(automation_engine_flags_init(), TAG, "flags init failed");
     ESP_RETURN_ON_ERROR(automation_engine_context_init(), TAG, "context init failed");
-    ESP_RETURN_ON_ERROR(event_bus_register_handler(automation_handle_event), TAG, "event reg failed");
+    // Запуск сценария берет device_manager_lock_config(): отдельная задача, чтобы не держать шину.
+    // EVENT_MQTT_MESSAGE не подписан, пока automation_engine_handle_mqtt - заглушка: иначе весь
+    // MQTT трафик шел бы через очередь этой задачи впустую.
+    const event_bus_mask_t events = EVENT_BUS_MASK(EVENT_SCENARIO_TRIGGER);
+    const event_bus_subscribe_opts_t opts = {.name = "automation", .depth = 16};
+    ESP_RETURN_ON_ERROR(event_bus_subscribe_ex(events, automation_handle_event, &opts), TAG, "event reg failed");
     return ESP_OK;
 }
 
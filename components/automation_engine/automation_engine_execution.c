@@ -8,6 +8,7 @@
 #include "esp_log.h"
 #include "audio_player.h"
 #include "mqtt_core.h"
+#include "broker_affinity.h"
 
 #define AUTOMATION_QUEUE_LENGTH 16
 #define AUTOMATION_WORKER_STACK 4096
@@ -35,12 +36,13 @@ esp_err_t automation_engine_execution_start(void)
         if (!s_workers[i]) {
             char name[16];
             snprintf(name, sizeof(name), "automation%u", (unsigned)i);
-            BaseType_t ok = xTaskCreate(automation_worker,
-                                        name,
-                                        AUTOMATION_WORKER_STACK,
-                                        NULL,
-                                        AUTOMATION_WORKER_PRIO,
-                                        &s_workers[i]);
+            BaseType_t ok = xTaskCreatePinnedToCore(automation_worker,
+                                                    name,
+                                                    AUTOMATION_WORKER_STACK,
+                                                    NULL,
+                                                    AUTOMATION_WORKER_PRIO,
+                                                    &s_workers[i],
+                                                    BROKER_APP_CORE);
             if (ok != pdPASS) {
                 return ESP_FAIL;
             }
@@ -150,15 +152,19 @@ static void automation_execute_job(const automation_job_t *job)
                 ESP_LOGW(TAG, "unknown event action: %s", step->data.event.event);
                 break;
             }
-            event_bus_message_t msg = {
-                .type = type,
-            };
+            char topic[DEVICE_MANAGER_TOPIC_MAX_LEN] = {0};
+            char payload[DEVICE_MANAGER_PAYLOAD_MAX_LEN] = {0};
             if (step->data.event.topic[0]) {
-                automation_engine_render_template(step->data.event.topic, msg.topic, sizeof(msg.topic));
+                automation_engine_render_template(step->data.event.topic, topic, sizeof(topic));
             }
             if (step->data.event.payload[0]) {
-                automation_engine_render_template(step->data.event.payload, msg.payload, sizeof(msg.payload));
+                automation_engine_render_template(step->data.event.payload, payload, sizeof(payload));
             }
+            event_bus_message_t msg = {
+                .type = type,
+                .topic = topic,
+                .payload = payload,
+            };
             event_bus_post(&msg, pdMS_TO_TICKS(50));
             break;
         }
@@ -112,11 +112,9 @@ void automation_engine_set_flag_internal(const char *name, bool value)
         if (changed) {
             event_bus_message_t msg = {
                 .type = EVENT_FLAG_CHANGED,
+                .topic = slot->name,
+                .payload = value ? "true" : "false",
             };
-            strncpy(msg.topic, slot->name, sizeof(msg.topic) - 1);
-            strncpy(msg.payload, value ? "true" : "false", sizeof(msg.payload) - 1);
-            msg.topic[sizeof(msg.topic) - 1] = 0;
-            msg.payload[sizeof(msg.payload) - 1] = 0;
             event_bus_post(&msg, pdMS_TO_TICKS(20));
         }
     } else {
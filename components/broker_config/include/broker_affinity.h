@@ -0,0 +1,14 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+// План привязки задач к ядрам: сеть/брокер на одном ядре, runtime/automation/audio на другом.
+// Данные между ними идут через event_bus (SPSC-каналы от MQTT воркеров).
+#if CONFIG_BROKER_TASK_AFFINITY && !CONFIG_FREERTOS_UNICORE
+#define BROKER_NET_CORE CONFIG_BROKER_NET_CORE
+#define BROKER_APP_CORE CONFIG_BROKER_APP_CORE
+#else
+#define BROKER_NET_CORE tskNO_AFFINITY
+#define BROKER_APP_CORE tskNO_AFFINITY
+#endif
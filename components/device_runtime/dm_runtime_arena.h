@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+// Арена записей одного вида: записи лежат подряд в блоках по DM_RUNTIME_ARENA_BLOCK_BYTES
+// (не больше DEVICE_MANAGER_MAX_DEVICES в блоке) и не двигаются, пока живут, так что на них
+// можно ссылаться из индексов и таймеров. Освобожденная запись уходит в список свободных того же вида,
+// сброс возвращает все блоки под следующее поколение конфигурации без обращений к куче.
+#define DM_RUNTIME_ARENA_BLOCK_BYTES (16 * 1024)
+
+typedef struct dm_runtime_arena_block dm_runtime_arena_block_t;
+
+typedef struct {
+    size_t item_size;
+    size_t block_capacity;
+    dm_runtime_arena_block_t *blocks;
+    // Блок, из которого берутся новые записи; блоки до него заполнены.
+    dm_runtime_arena_block_t *current;
+    void *free_items;
+    size_t live;
+    size_t block_count;
+} dm_runtime_arena_t;
+
+#define DM_RUNTIME_ARENA_INIT(size) {.item_size = (size)}
+
+void *dm_runtime_arena_alloc(dm_runtime_arena_t *arena);
+void dm_runtime_arena_free(dm_runtime_arena_t *arena, void *item);
+// Все записи считаются свободными, блоки остаются за ареной.
+void dm_runtime_arena_reset(dm_runtime_arena_t *arena);
+// Вернуть блоки в кучу.
+void dm_runtime_arena_release(dm_runtime_arena_t *arena);
@@ -10,6 +10,10 @@ typedef struct {
         bool state;
         char flag[DEVICE_MANAGER_FLAG_NAME_MAX_LEN];
     } rules[DM_CONDITION_TEMPLATE_MAX_RULES];
+    // Правила, чье текущее состояние (false, пока флаг не пришел) совпадает или нет с required_state:
+    // результат считается по счетчикам, без обхода правил.
+    uint8_t true_count;
+    uint8_t false_count;
     bool last_result;
     bool has_last_result;
 } dm_condition_runtime_t;
@@ -20,3 +24,6 @@ bool dm_condition_runtime_handle_flag(dm_condition_runtime_t *rt,
                                       bool new_state,
                                       bool *result_changed,
                                       bool *current_result);
+// Обновить одно правило по индексу; результат пересчитывает dm_condition_runtime_update_result.
+void dm_condition_runtime_set_rule(dm_condition_runtime_t *rt, uint8_t rule_index, bool new_state);
+bool dm_condition_runtime_update_result(dm_condition_runtime_t *rt, bool *result_changed);
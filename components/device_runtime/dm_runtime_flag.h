@@ -17,3 +17,7 @@ void dm_flag_trigger_runtime_init(dm_flag_trigger_runtime_t *rt, const dm_flag_t
 const dm_flag_trigger_rule_t *dm_flag_trigger_runtime_handle(dm_flag_trigger_runtime_t *rt,
                                                              const char *flag_name,
                                                              bool new_state);
+// То же для одного правила по индексу: вызывающий уже знает, что флаг правила совпал.
+const dm_flag_trigger_rule_t *dm_flag_trigger_runtime_handle_rule(dm_flag_trigger_runtime_t *rt,
+                                                                  uint8_t rule_index,
+                                                                  bool new_state);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "dm_runtime_wheel.h"
+
+// Планировщик template_runtime: одно колесо таймеров на все записи, его обслуживает своя задача.
+// Колбэки таймеров выполняются в этой задаче под блокировкой runtime, той же, что берет весь
+// публичный API template_runtime, поэтому состояние записей не видит гонок между задачами.
+esp_err_t dm_runtime_scheduler_start(void);
+void dm_runtime_scheduler_lock(void);
+void dm_runtime_scheduler_unlock(void);
+// Вызывается после каждого снятия блокировки, в том числе задачей колеса: здесь template_runtime
+// выполняет отложенные побочные действия (аудио, публикации, сценарии) уже без блокировки.
+void dm_runtime_scheduler_set_unlock_hook(void (*hook)(void));
+// Снятие блокировки без вызова хука: его выполнит задача колеса. Для синхронного обработчика шины,
+// который не должен ждать аудио и брокер в задаче шины.
+void dm_runtime_scheduler_unlock_deferred(void);
+
+// Вызываются под блокировкой. Таймер встроен в запись и сам служит токеном отмены:
+// cancel после освобождения записи не нужен, но до него обязателен.
+void dm_runtime_scheduler_arm(dm_runtime_timer_t *timer, uint32_t delay_ms, uint32_t period_ms);
+void dm_runtime_scheduler_cancel(dm_runtime_timer_t *timer);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Колесо таймеров template_runtime: слот = срок в тиках по модулю DM_RUNTIME_WHEEL_SLOTS, так что
+// постановка и отмена - O(1), а продвижение смотрит только слоты прошедших тиков. Время задает
+// вызывающий (мс), колесо не знает ни о задачах, ни о блокировках.
+#define DM_RUNTIME_WHEEL_TICK_MS 10
+#define DM_RUNTIME_WHEEL_SLOTS 64
+
+typedef void (*dm_runtime_timer_cb_t)(void *arg);
+
+// Таймер живет в записи, которой он принадлежит: памяти и создания в куче он не требует.
+// pprev != NULL - таймер взведен; отмена убирает его из слота, даже если он уже ждет вызова
+// в текущем продвижении.
+typedef struct dm_runtime_timer {
+    struct dm_runtime_timer *next;
+    struct dm_runtime_timer **pprev;
+    uint64_t expires_tick;
+    uint32_t period_ticks;
+    dm_runtime_timer_cb_t cb;
+    void *arg;
+} dm_runtime_timer_t;
+
+typedef struct {
+    dm_runtime_timer_t *slots[DM_RUNTIME_WHEEL_SLOTS];
+    uint64_t now_tick;
+    size_t armed;
+} dm_runtime_wheel_t;
+
+void dm_runtime_wheel_init(dm_runtime_wheel_t *wheel, uint64_t now_ms);
+void dm_runtime_timer_init(dm_runtime_timer_t *timer, dm_runtime_timer_cb_t cb, void *arg);
+bool dm_runtime_timer_armed(const dm_runtime_timer_t *timer);
+// Взвести (или перевзвести) на now_ms + delay_ms; period_ms > 0 - периодический. Срок округляется
+// вверх до тика и не раньше следующего тика.
+void dm_runtime_wheel_schedule(dm_runtime_wheel_t *wheel,
+                               dm_runtime_timer_t *timer,
+                               uint64_t now_ms,
+                               uint32_t delay_ms,
+                               uint32_t period_ms);
+void dm_runtime_wheel_cancel(dm_runtime_wheel_t *wheel, dm_runtime_timer_t *timer);
+// Вызвать колбэки всех таймеров со сроком не позже now_ms; возвращает число вызовов.
+size_t dm_runtime_wheel_advance(dm_runtime_wheel_t *wheel, uint64_t now_ms);
+// Ближайший срок взведенного таймера; false - взведенных нет.
+bool dm_runtime_wheel_next_deadline(const dm_runtime_wheel_t *wheel, uint64_t *deadline_ms);
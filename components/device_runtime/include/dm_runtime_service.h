@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "esp_err.h"
 
 #include "device_model.h"
@@ -8,3 +10,14 @@
 esp_err_t dm_runtime_service_init(void);
 esp_err_t dm_runtime_service_rebuild(const device_manager_config_t *cfg);
 esp_err_t dm_runtime_service_register_template(const dm_template_config_t *tpl, const char *device_id);
+
+// Итог последнего dm_runtime_service_rebuild: устройства без изменений, новые, замененные и снятые.
+typedef struct {
+    uint32_t kept;
+    uint32_t added;
+    uint32_t updated;
+    uint32_t removed;
+    int64_t duration_us;
+} dm_runtime_rebuild_stats_t;
+
+void dm_runtime_service_get_rebuild_stats(dm_runtime_rebuild_stats_t *out);
@@ -0,0 +1,120 @@
+#include "dm_runtime_arena.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+#include "dm_limits.h"
+
+struct dm_runtime_arena_block {
+    dm_runtime_arena_block_t *next;
+    size_t used;
+    alignas(max_align_t) uint8_t items[];
+};
+
+static size_t item_stride(const dm_runtime_arena_t *arena)
+{
+    size_t align = alignof(max_align_t);
+    size_t size = arena->item_size < sizeof(void *) ? sizeof(void *) : arena->item_size;
+    return (size + align - 1) & ~(align - 1);
+}
+
+static dm_runtime_arena_block_t *arena_add_block(dm_runtime_arena_t *arena)
+{
+    size_t stride = item_stride(arena);
+    if (!arena->block_capacity) {
+        size_t capacity = DM_RUNTIME_ARENA_BLOCK_BYTES / stride;
+        if (capacity < 1) {
+            capacity = 1;
+        } else if (capacity > DEVICE_MANAGER_MAX_DEVICES) {
+            capacity = DEVICE_MANAGER_MAX_DEVICES;
+        }
+        arena->block_capacity = capacity;
+    }
+    size_t bytes = sizeof(dm_runtime_arena_block_t) + stride * arena->block_capacity;
+    dm_runtime_arena_block_t *block = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!block) {
+        block = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->used = 0;
+    if (arena->current) {
+        arena->current->next = block;
+    } else {
+        arena->blocks = block;
+    }
+    arena->block_count++;
+    return block;
+}
+
+void *dm_runtime_arena_alloc(dm_runtime_arena_t *arena)
+{
+    if (!arena || !arena->item_size) {
+        return NULL;
+    }
+    void *item = arena->free_items;
+    if (item) {
+        memcpy(&arena->free_items, item, sizeof(void *));
+    } else {
+        dm_runtime_arena_block_t *block = arena->current ? arena->current : arena->blocks;
+        while (block && block->used >= arena->block_capacity) {
+            arena->current = block;
+            block = block->next;
+        }
+        if (!block) {
+            block = arena_add_block(arena);
+            if (!block) {
+                return NULL;
+            }
+        }
+        arena->current = block;
+        item = block->items + item_stride(arena) * block->used++;
+    }
+    memset(item, 0, arena->item_size);
+    arena->live++;
+    return item;
+}
+
+void dm_runtime_arena_free(dm_runtime_arena_t *arena, void *item)
+{
+    if (!arena || !item) {
+        return;
+    }
+    memcpy(item, &arena->free_items, sizeof(void *));
+    arena->free_items = item;
+    arena->live--;
+}
+
+void dm_runtime_arena_reset(dm_runtime_arena_t *arena)
+{
+    if (!arena) {
+        return;
+    }
+    for (dm_runtime_arena_block_t *block = arena->blocks; block; block = block->next) {
+        block->used = 0;
+    }
+    arena->current = NULL;
+    arena->free_items = NULL;
+    arena->live = 0;
+}
+
+void dm_runtime_arena_release(dm_runtime_arena_t *arena)
+{
+    if (!arena) {
+        return;
+    }
+    dm_runtime_arena_block_t *block = arena->blocks;
+    while (block) {
+        dm_runtime_arena_block_t *next = block->next;
+        heap_caps_free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->block_count = 0;
+    dm_runtime_arena_reset(arena);
+}
@@ -5,38 +5,6 @@
 
 #include "device_model_utils.h"
 
-static bool evaluate_condition(const dm_condition_runtime_t *rt, bool *ready)
-{
-    if (!rt || rt->config.rule_count == 0) {
-        if (ready) {
-            *ready = false;
-        }
-        return false;
-    }
-    bool have_ready = true;
-    bool any_true = false;
-    bool all_true = true;
-    for (uint8_t i = 0; i < rt->config.rule_count && i < DM_CONDITION_TEMPLATE_MAX_RULES; ++i) {
-        const dm_condition_rule_t *rule = &rt->config.rules[i];
-        bool state_valid = rt->rules[i].valid;
-        bool state = rt->rules[i].state;
-        if (!state_valid) {
-            have_ready = false;
-            state = false;
-        }
-        bool matches = state == rule->required_state;
-        any_true |= matches;
-        all_true &= matches;
-        if (rt->config.mode == DEVICE_CONDITION_ALL && !matches) {
-            // continue to ensure ready flag computed
-        }
-    }
-    if (ready) {
-        *ready = have_ready;
-    }
-    return (rt->config.mode == DEVICE_CONDITION_ALL) ? all_true : any_true;
-}
-
 void dm_condition_runtime_init(dm_condition_runtime_t *rt, const dm_condition_template_t *tpl)
 {
     if (!rt) {
@@ -50,11 +18,57 @@ void dm_condition_runtime_init(dm_condition_runtime_t *rt, const dm_condition_te
     memset(rt->rules, 0, sizeof(rt->rules));
     rt->has_last_result = false;
     rt->last_result = false;
+    rt->true_count = 0;
+    rt->false_count = 0;
     for (uint8_t i = 0; tpl && i < tpl->rule_count && i < DM_CONDITION_TEMPLATE_MAX_RULES; ++i) {
         dm_str_copy(rt->rules[i].flag, sizeof(rt->rules[i].flag), tpl->rules[i].flag);
+        // Флаг, который еще не приходил, считается false.
+        if (!tpl->rules[i].required_state) {
+            rt->true_count++;
+        } else {
+            rt->false_count++;
+        }
     }
 }
 
+void dm_condition_runtime_set_rule(dm_condition_runtime_t *rt, uint8_t rule_index, bool new_state)
+{
+    if (!rt || rule_index >= rt->config.rule_count || rule_index >= DM_CONDITION_TEMPLATE_MAX_RULES) {
+        return;
+    }
+    bool required = rt->config.rules[rule_index].required_state;
+    bool was_true = (rt->rules[rule_index].valid ? rt->rules[rule_index].state : false) == required;
+    bool is_true = new_state == required;
+    rt->rules[rule_index].valid = true;
+    rt->rules[rule_index].state = new_state;
+    if (was_true == is_true) {
+        return;
+    }
+    if (is_true) {
+        rt->true_count++;
+        rt->false_count--;
+    } else {
+        rt->true_count--;
+        rt->false_count++;
+    }
+}
+
+bool dm_condition_runtime_update_result(dm_condition_runtime_t *rt, bool *result_changed)
+{
+    if (!rt) {
+        return false;
+    }
+    bool result = (rt->config.mode == DEVICE_CONDITION_ALL) ? (rt->true_count > 0 && rt->false_count == 0)
+                                                            : (rt->true_count > 0);
+    bool changed = (!rt->has_last_result) || (result != rt->last_result);
+    rt->last_result = result;
+    rt->has_last_result = true;
+    if (result_changed) {
+        *result_changed = changed;
+    }
+    return result;
+}
+
 bool dm_condition_runtime_handle_flag(dm_condition_runtime_t *rt,
                                       const char *flag_name,
                                       bool new_state,
@@ -68,22 +82,14 @@ bool dm_condition_runtime_handle_flag(dm_condition_runtime_t *rt,
     for (uint8_t i = 0; i < rt->config.rule_count && i < DM_CONDITION_TEMPLATE_MAX_RULES; ++i) {
         if (rt->config.rules[i].flag[0] &&
             strcasecmp(rt->config.rules[i].flag, flag_name) == 0) {
-            rt->rules[i].valid = true;
-            rt->rules[i].state = new_state;
+            dm_condition_runtime_set_rule(rt, i, new_state);
             matched = true;
         }
     }
     if (!matched) {
         return false;
     }
-    bool ready = false;
-    bool result = evaluate_condition(rt, &ready);
-    bool changed = (!rt->has_last_result) || (result != rt->last_result);
-    rt->last_result = result;
-    rt->has_last_result = true;
-    if (result_changed) {
-        *result_changed = changed;
-    }
+    bool result = dm_condition_runtime_update_result(rt, result_changed);
     if (current_result) {
         *current_result = result;
     }
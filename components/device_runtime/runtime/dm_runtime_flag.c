@@ -18,6 +18,26 @@ void dm_flag_trigger_runtime_init(dm_flag_trigger_runtime_t *rt, const dm_flag_t
     memset(rt->rules, 0, sizeof(rt->rules));
 }
 
+const dm_flag_trigger_rule_t *dm_flag_trigger_runtime_handle_rule(dm_flag_trigger_runtime_t *rt,
+                                                                  uint8_t rule_index,
+                                                                  bool new_state)
+{
+    if (!rt || rule_index >= rt->config.rule_count || rule_index >= DM_FLAG_TRIGGER_MAX_RULES) {
+        return NULL;
+    }
+    const dm_flag_trigger_rule_t *rule = &rt->config.rules[rule_index];
+    if (!rule->flag[0] || !rule->scenario[0]) {
+        return NULL;
+    }
+    bool changed = (!rt->rules[rule_index].valid) || (rt->rules[rule_index].last_state != new_state);
+    rt->rules[rule_index].valid = true;
+    rt->rules[rule_index].last_state = new_state;
+    if (new_state == rule->required_state && changed) {
+        return rule;
+    }
+    return NULL;
+}
+
 const dm_flag_trigger_rule_t *dm_flag_trigger_runtime_handle(dm_flag_trigger_runtime_t *rt,
                                                              const char *flag_name,
                                                              bool new_state)
@@ -27,17 +47,12 @@ const dm_flag_trigger_rule_t *dm_flag_trigger_runtime_handle(dm_flag_trigger_run
     }
     for (uint8_t i = 0; i < rt->config.rule_count && i < DM_FLAG_TRIGGER_MAX_RULES; ++i) {
         const dm_flag_trigger_rule_t *rule = &rt->config.rules[i];
-        if (!rule->flag[0] || !rule->scenario[0]) {
-            continue;
-        }
-        if (strcasecmp(rule->flag, flag_name) != 0) {
+        if (!rule->flag[0] || strcasecmp(rule->flag, flag_name) != 0) {
             continue;
         }
-        bool changed = (!rt->rules[i].valid) || (rt->rules[i].last_state != new_state);
-        rt->rules[i].valid = true;
-        rt->rules[i].last_state = new_state;
-        if (new_state == rule->required_state && changed) {
-            return rule;
+        const dm_flag_trigger_rule_t *fired = dm_flag_trigger_runtime_handle_rule(rt, i, new_state);
+        if (fired) {
+            return fired;
         }
     }
     return NULL;
@@ -0,0 +1,158 @@
+#include "dm_runtime_wheel.h"
+
+#include <string.h>
+
+static void timer_link(dm_runtime_timer_t **head, dm_runtime_timer_t *timer)
+{
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void timer_unlink(dm_runtime_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void wheel_insert(dm_runtime_wheel_t *wheel, dm_runtime_timer_t *timer)
+{
+    timer_link(&wheel->slots[timer->expires_tick % DM_RUNTIME_WHEEL_SLOTS], timer);
+    wheel->armed++;
+}
+
+static uint32_t ms_to_ticks(uint32_t ms)
+{
+    return (ms + DM_RUNTIME_WHEEL_TICK_MS - 1) / DM_RUNTIME_WHEEL_TICK_MS;
+}
+
+void dm_runtime_wheel_init(dm_runtime_wheel_t *wheel, uint64_t now_ms)
+{
+    if (!wheel) {
+        return;
+    }
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now_tick = now_ms / DM_RUNTIME_WHEEL_TICK_MS;
+}
+
+void dm_runtime_timer_init(dm_runtime_timer_t *timer, dm_runtime_timer_cb_t cb, void *arg)
+{
+    if (!timer) {
+        return;
+    }
+    memset(timer, 0, sizeof(*timer));
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+bool dm_runtime_timer_armed(const dm_runtime_timer_t *timer)
+{
+    return timer && timer->pprev != NULL;
+}
+
+void dm_runtime_wheel_schedule(dm_runtime_wheel_t *wheel,
+                               dm_runtime_timer_t *timer,
+                               uint64_t now_ms,
+                               uint32_t delay_ms,
+                               uint32_t period_ms)
+{
+    if (!wheel || !timer) {
+        return;
+    }
+    dm_runtime_wheel_cancel(wheel, timer);
+    // now_ms может опережать now_tick колеса, которое давно не продвигали: срок считается
+    // от настоящего времени и поэтому всегда позже now_tick.
+    uint64_t expires = (now_ms + delay_ms + DM_RUNTIME_WHEEL_TICK_MS - 1) / DM_RUNTIME_WHEEL_TICK_MS;
+    if (expires <= wheel->now_tick) {
+        expires = wheel->now_tick + 1;
+    }
+    timer->expires_tick = expires;
+    timer->period_ticks = period_ms ? ms_to_ticks(period_ms) : 0;
+    wheel_insert(wheel, timer);
+}
+
+void dm_runtime_wheel_cancel(dm_runtime_wheel_t *wheel, dm_runtime_timer_t *timer)
+{
+    if (!wheel || !timer || !timer->pprev) {
+        return;
+    }
+    timer_unlink(timer);
+    wheel->armed--;
+}
+
+size_t dm_runtime_wheel_advance(dm_runtime_wheel_t *wheel, uint64_t now_ms)
+{
+    if (!wheel) {
+        return 0;
+    }
+    uint64_t target = now_ms / DM_RUNTIME_WHEEL_TICK_MS;
+    if (target <= wheel->now_tick) {
+        return 0;
+    }
+    // Больше оборота - каждый слот один раз: все сроки в них уже не позже target или ждут следующих оборотов.
+    uint64_t steps = target - wheel->now_tick;
+    if (steps > DM_RUNTIME_WHEEL_SLOTS) {
+        steps = DM_RUNTIME_WHEEL_SLOTS;
+    }
+    // Сначала все наступившие сроки уходят в отдельный список: колбэк может отменить или перевзвести
+    // любой таймер, в том числе еще не вызванный из этого списка.
+    dm_runtime_timer_t *due = NULL;
+    for (uint64_t i = 1; i <= steps; ++i) {
+        dm_runtime_timer_t *timer = wheel->slots[(wheel->now_tick + i) % DM_RUNTIME_WHEEL_SLOTS];
+        while (timer) {
+            dm_runtime_timer_t *next = timer->next;
+            if (timer->expires_tick <= target) {
+                timer_unlink(timer);
+                timer_link(&due, timer);
+            }
+            timer = next;
+        }
+    }
+    wheel->now_tick = target;
+
+    size_t fired = 0;
+    while (due) {
+        dm_runtime_timer_t *timer = due;
+        timer_unlink(timer);
+        wheel->armed--;
+        if (timer->period_ticks) {
+            // Опоздавший периодический таймер не догоняет пропущенные периоды.
+            timer->expires_tick += timer->period_ticks;
+            if (timer->expires_tick <= target) {
+                timer->expires_tick = target + 1;
+            }
+            wheel_insert(wheel, timer);
+        }
+        fired++;
+        if (timer->cb) {
+            timer->cb(timer->arg);
+        }
+    }
+    return fired;
+}
+
+bool dm_runtime_wheel_next_deadline(const dm_runtime_wheel_t *wheel, uint64_t *deadline_ms)
+{
+    if (!wheel || !wheel->armed) {
+        return false;
+    }
+    uint64_t best = UINT64_MAX;
+    for (size_t s = 0; s < DM_RUNTIME_WHEEL_SLOTS; ++s) {
+        for (const dm_runtime_timer_t *timer = wheel->slots[s]; timer; timer = timer->next) {
+            if (timer->expires_tick < best) {
+                best = timer->expires_tick;
+            }
+        }
+    }
+    if (deadline_ms) {
+        *deadline_ms = best * DM_RUNTIME_WHEEL_TICK_MS;
+    }
+    return true;
+}
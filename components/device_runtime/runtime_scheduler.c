@@ -0,0 +1,128 @@
+#include "dm_runtime_scheduler.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "broker_affinity.h"
+
+#define SCHEDULER_TASK_STACK 4096
+#define SCHEDULER_TASK_PRIORITY 5
+// Дольше задача не спит, даже если ближайший срок дальше: ожидание укладывается в TickType_t.
+#define SCHEDULER_MAX_SLEEP_MS (60 * 1000)
+
+static const char *TAG = "dm_runtime_sched";
+
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_task = NULL;
+// Нулевое колесо уже рабочее: первое продвижение просто обойдет все слоты.
+static dm_runtime_wheel_t s_wheel;
+// Срок, до которого спит задача; постановка более раннего срока из другой задачи будит ее.
+static uint64_t s_wake_ms = UINT64_MAX;
+static void (*s_unlock_hook)(void) = NULL;
+
+static uint64_t scheduler_now_ms(void)
+{
+    return (uint64_t)(esp_timer_get_time() / 1000);
+}
+
+static void scheduler_task(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        uint64_t now_ms = scheduler_now_ms();
+        dm_runtime_wheel_advance(&s_wheel, now_ms);
+        uint64_t deadline_ms = UINT64_MAX;
+        dm_runtime_wheel_next_deadline(&s_wheel, &deadline_ms);
+        s_wake_ms = deadline_ms;
+        xSemaphoreGive(s_lock);
+        if (s_unlock_hook) {
+            s_unlock_hook();
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (deadline_ms != UINT64_MAX) {
+            uint64_t left_ms = deadline_ms > now_ms ? deadline_ms - now_ms : 0;
+            if (left_ms > SCHEDULER_MAX_SLEEP_MS) {
+                left_ms = SCHEDULER_MAX_SLEEP_MS;
+            }
+            wait = pdMS_TO_TICKS((uint32_t)left_ms);
+            if (wait == 0) {
+                wait = 1;
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+esp_err_t dm_runtime_scheduler_start(void)
+{
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (!s_task && xTaskCreatePinnedToCore(scheduler_task, "dm_runtime", SCHEDULER_TASK_STACK, NULL,
+                                           SCHEDULER_TASK_PRIORITY, &s_task, BROKER_APP_CORE) != pdPASS) {
+        s_task = NULL;
+        ESP_LOGE(TAG, "scheduler task create failed");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void dm_runtime_scheduler_lock(void)
+{
+    if (s_lock) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+}
+
+void dm_runtime_scheduler_unlock(void)
+{
+    if (s_lock) {
+        xSemaphoreGive(s_lock);
+    }
+    if (s_unlock_hook) {
+        s_unlock_hook();
+    }
+}
+
+void dm_runtime_scheduler_unlock_deferred(void)
+{
+    if (s_lock) {
+        xSemaphoreGive(s_lock);
+    }
+    if (s_task && s_unlock_hook) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void dm_runtime_scheduler_set_unlock_hook(void (*hook)(void))
+{
+    s_unlock_hook = hook;
+}
+
+void dm_runtime_scheduler_arm(dm_runtime_timer_t *timer, uint32_t delay_ms, uint32_t period_ms)
+{
+    if (!timer) {
+        return;
+    }
+    uint64_t now_ms = scheduler_now_ms();
+    dm_runtime_wheel_schedule(&s_wheel, timer, now_ms, delay_ms, period_ms);
+    // Своя задача пересчитает сон сама после текущего продвижения.
+    if (s_task && now_ms + delay_ms < s_wake_ms && xTaskGetCurrentTaskHandle() != s_task) {
+        s_wake_ms = now_ms + delay_ms;
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void dm_runtime_scheduler_cancel(dm_runtime_timer_t *timer)
+{
+    // Ранний сон из-за отмененного срока безвреден: задача проснется и заснет снова.
+    dm_runtime_wheel_cancel(&s_wheel, timer);
+}
@@ -1,13 +1,246 @@
 #include "dm_runtime_service.h"
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "device_model_utils.h"
 #include "dm_template_runtime.h"
 
 static const char *TAG = "dm_runtime_srv";
 
+// Устройства с записями в template_runtime и хэш шаблона, с которым они зарегистрированы:
+// rebuild трогает только устройства, у которых шаблон изменился, и не сбрасывает живое состояние остальных.
+typedef struct {
+    char device_id[DEVICE_MANAGER_ID_MAX_LEN];
+    uint32_t hash;
+} registered_device_t;
+
+static registered_device_t s_registered[DEVICE_MANAGER_MAX_DEVICES];
+static size_t s_registered_count = 0;
+static dm_runtime_rebuild_stats_t s_last_rebuild;
+
+// FNV-1a по значениям полей шаблона: строки до NUL, массивы до своих счетчиков. Выравнивание,
+// хвосты строк и неиспользуемые записи не меняют хэш, иначе rebuild заменял бы устройство впустую.
+#define HASH_STR(h, field) hash_str((h), (field), sizeof(field))
+
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t hash_u32(uint32_t h, uint32_t value)
+{
+    uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+    return hash_bytes(h, bytes, sizeof(bytes));
+}
+
+// Длина с разделителем: "ab" + "c" и "a" + "bc" дают разные хэши.
+static uint32_t hash_str(uint32_t h, const char *str, size_t cap)
+{
+    size_t len = strnlen(str, cap);
+    return hash_u32(hash_bytes(h, str, len), (uint32_t)len);
+}
+
+static uint8_t clamp_count(uint8_t count, uint8_t max)
+{
+    return count > max ? max : count;
+}
+
+static uint32_t hash_uid(uint32_t h, const dm_uid_template_t *t)
+{
+    uint8_t slots = clamp_count(t->slot_count, DM_UID_TEMPLATE_MAX_SLOTS);
+    h = hash_u32(h, slots);
+    for (uint8_t i = 0; i < slots; ++i) {
+        const dm_uid_slot_t *slot = &t->slots[i];
+        uint8_t values = clamp_count(slot->value_count, DM_UID_TEMPLATE_MAX_VALUES);
+        h = HASH_STR(h, slot->source_id);
+        h = HASH_STR(h, slot->label);
+        h = hash_u32(h, values);
+        for (uint8_t v = 0; v < values; ++v) {
+            h = HASH_STR(h, slot->values[v]);
+        }
+    }
+    h = HASH_STR(h, t->start_topic);
+    h = HASH_STR(h, t->start_payload);
+    h = HASH_STR(h, t->broadcast_topic);
+    h = HASH_STR(h, t->broadcast_payload);
+    h = HASH_STR(h, t->success_topic);
+    h = HASH_STR(h, t->success_payload);
+    h = HASH_STR(h, t->fail_topic);
+    h = HASH_STR(h, t->fail_payload);
+    h = HASH_STR(h, t->success_audio_track);
+    h = HASH_STR(h, t->fail_audio_track);
+    h = HASH_STR(h, t->bg_track);
+    h = HASH_STR(h, t->bg_start_topic);
+    h = HASH_STR(h, t->success_signal_topic);
+    h = HASH_STR(h, t->success_signal_payload);
+    h = HASH_STR(h, t->fail_signal_topic);
+    h = HASH_STR(h, t->fail_signal_payload);
+    h = HASH_STR(h, t->success_scenario);
+    return HASH_STR(h, t->fail_scenario);
+}
+
+static uint32_t hash_signal(uint32_t h, const dm_signal_hold_template_t *t)
+{
+    h = HASH_STR(h, t->signal_topic);
+    h = HASH_STR(h, t->signal_payload_on);
+    h = HASH_STR(h, t->signal_payload_off);
+    h = hash_u32(h, t->signal_on_ms);
+    h = HASH_STR(h, t->heartbeat_topic);
+    h = HASH_STR(h, t->reset_topic);
+    h = hash_u32(h, t->required_hold_ms);
+    h = hash_u32(h, t->heartbeat_timeout_ms);
+    h = HASH_STR(h, t->hold_track);
+    h = hash_u32(h, t->hold_track_loop);
+    return HASH_STR(h, t->complete_track);
+}
+
+static uint32_t hash_mqtt(uint32_t h, const dm_mqtt_trigger_template_t *t)
+{
+    uint8_t rules = clamp_count(t->rule_count, DM_MQTT_TRIGGER_MAX_RULES);
+    h = hash_u32(h, rules);
+    for (uint8_t i = 0; i < rules; ++i) {
+        const dm_mqtt_trigger_rule_t *rule = &t->rules[i];
+        h = HASH_STR(h, rule->name);
+        h = HASH_STR(h, rule->topic);
+        h = HASH_STR(h, rule->payload);
+        h = HASH_STR(h, rule->scenario);
+        h = hash_u32(h, rule->payload_required);
+    }
+    return h;
+}
+
+static uint32_t hash_flag(uint32_t h, const dm_flag_trigger_template_t *t)
+{
+    uint8_t rules = clamp_count(t->rule_count, DM_FLAG_TRIGGER_MAX_RULES);
+    h = hash_u32(h, rules);
+    for (uint8_t i = 0; i < rules; ++i) {
+        const dm_flag_trigger_rule_t *rule = &t->rules[i];
+        h = HASH_STR(h, rule->name);
+        h = HASH_STR(h, rule->flag);
+        h = hash_u32(h, rule->required_state);
+        h = HASH_STR(h, rule->scenario);
+    }
+    return h;
+}
+
+static uint32_t hash_condition(uint32_t h, const dm_condition_template_t *t)
+{
+    uint8_t rules = clamp_count(t->rule_count, DM_CONDITION_TEMPLATE_MAX_RULES);
+    h = hash_u32(h, (uint32_t)t->mode);
+    h = hash_u32(h, rules);
+    for (uint8_t i = 0; i < rules; ++i) {
+        h = HASH_STR(h, t->rules[i].flag);
+        h = hash_u32(h, t->rules[i].required_state);
+    }
+    h = HASH_STR(h, t->true_scenario);
+    return HASH_STR(h, t->false_scenario);
+}
+
+static uint32_t hash_sequence(uint32_t h, const dm_sequence_template_t *t)
+{
+    uint8_t steps = clamp_count(t->step_count, DM_SEQUENCE_TEMPLATE_MAX_STEPS);
+    h = hash_u32(h, steps);
+    for (uint8_t i = 0; i < steps; ++i) {
+        const dm_sequence_step_t *step = &t->steps[i];
+        h = HASH_STR(h, step->topic);
+        h = HASH_STR(h, step->payload);
+        h = hash_u32(h, step->payload_required);
+        h = HASH_STR(h, step->hint_topic);
+        h = HASH_STR(h, step->hint_payload);
+        h = HASH_STR(h, step->hint_audio_track);
+    }
+    h = hash_u32(h, t->timeout_ms);
+    h = hash_u32(h, t->reset_on_error);
+    h = HASH_STR(h, t->success_topic);
+    h = HASH_STR(h, t->success_payload);
+    h = HASH_STR(h, t->success_audio_track);
+    h = HASH_STR(h, t->success_scenario);
+    h = HASH_STR(h, t->fail_topic);
+    h = HASH_STR(h, t->fail_payload);
+    h = HASH_STR(h, t->fail_audio_track);
+    return HASH_STR(h, t->fail_scenario);
+}
+
+static uint32_t template_hash(const dm_template_config_t *tpl)
+{
+    uint32_t h = hash_u32(2166136261u, (uint32_t)tpl->type);
+    switch (tpl->type) {
+    case DM_TEMPLATE_TYPE_UID:
+        return hash_uid(h, &tpl->data.uid);
+    case DM_TEMPLATE_TYPE_SIGNAL_HOLD:
+        return hash_signal(h, &tpl->data.signal);
+    case DM_TEMPLATE_TYPE_MQTT_TRIGGER:
+        return hash_mqtt(h, &tpl->data.mqtt);
+    case DM_TEMPLATE_TYPE_FLAG_TRIGGER:
+        return hash_flag(h, &tpl->data.flag);
+    case DM_TEMPLATE_TYPE_IF_CONDITION:
+        return hash_condition(h, &tpl->data.condition);
+    case DM_TEMPLATE_TYPE_INTERVAL_TASK:
+        h = hash_u32(h, tpl->data.interval.interval_ms);
+        return HASH_STR(h, tpl->data.interval.scenario);
+    case DM_TEMPLATE_TYPE_SEQUENCE_LOCK:
+        return hash_sequence(h, &tpl->data.sequence);
+    default:
+        return h;
+    }
+}
+
+static registered_device_t *find_registered(const char *device_id)
+{
+    for (size_t i = 0; i < s_registered_count; ++i) {
+        if (strcmp(s_registered[i].device_id, device_id) == 0) {
+            return &s_registered[i];
+        }
+    }
+    return NULL;
+}
+
+static void forget_registered(registered_device_t *rec)
+{
+    *rec = s_registered[--s_registered_count];
+}
+
+// Таблица на DEVICE_MANAGER_MAX_DEVICES: rebuild берет не больше устройств, register_template
+// отказывает новому устройству заранее. Сюда переполнение доходит только при нарушении этого.
+static bool remember_registered(const char *device_id, uint32_t hash)
+{
+    registered_device_t *rec = find_registered(device_id);
+    if (!rec) {
+        if (s_registered_count >= DEVICE_MANAGER_MAX_DEVICES) {
+            ESP_LOGE(TAG, "registered table full (%u), %s is not tracked", (unsigned)DEVICE_MANAGER_MAX_DEVICES,
+                     device_id);
+            return false;
+        }
+        rec = &s_registered[s_registered_count++];
+        dm_str_copy(rec->device_id, sizeof(rec->device_id), device_id);
+    }
+    rec->hash = hash;
+    return true;
+}
+
+static const device_descriptor_t *find_assigned(const device_manager_config_t *cfg, uint8_t limit, const char *id)
+{
+    for (uint8_t i = 0; i < cfg->device_count && i < limit; ++i) {
+        const device_descriptor_t *dev = &cfg->devices[i];
+        if (dev->template_assigned && strcmp(dev->id, id) == 0) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
 esp_err_t dm_runtime_service_init(void)
 {
+    s_registered_count = 0;
     return dm_template_runtime_init();
 }
 
@@ -17,28 +250,88 @@ esp_err_t dm_runtime_service_rebuild(const device_manager_config_t *cfg)
         return ESP_ERR_INVALID_ARG;
     }
 
-    ESP_LOGI(TAG, "rebuild runtime from config");
-    dm_template_runtime_reset();
-
+    int64_t start_us = esp_timer_get_time();
+    dm_runtime_rebuild_stats_t st = {0};
     uint8_t limit = cfg->device_capacity ? cfg->device_capacity : DEVICE_MANAGER_MAX_DEVICES;
+    if (limit > DEVICE_MANAGER_MAX_DEVICES) {
+        limit = DEVICE_MANAGER_MAX_DEVICES;
+    }
+    if (cfg->device_count > limit) {
+        ESP_LOGW(TAG, "runtime takes first %u of %u devices", (unsigned)limit, (unsigned)cfg->device_count);
+    }
+
+    for (size_t i = 0; i < s_registered_count;) {
+        if (find_assigned(cfg, limit, s_registered[i].device_id)) {
+            ++i;
+            continue;
+        }
+        dm_template_runtime_unregister(s_registered[i].device_id);
+        forget_registered(&s_registered[i]);
+        st.removed++;
+    }
+
     for (uint8_t i = 0; i < cfg->device_count && i < limit; ++i) {
         const device_descriptor_t *dev = &cfg->devices[i];
         if (!dev->template_assigned) {
             continue;
         }
-        esp_err_t err = dm_template_runtime_register(&dev->template_config, dev->id);
+        uint32_t hash = template_hash(&dev->template_config);
+        registered_device_t *rec = find_registered(dev->id);
+        if (rec && rec->hash == hash) {
+            st.kept++;
+            continue;
+        }
+        esp_err_t err = dm_template_runtime_replace(&dev->template_config, dev->id);
         if (err != ESP_OK) {
             ESP_LOGW(TAG, "template runtime register failed for %s: %s", dev->id, esp_err_to_name(err));
+            if (rec) {
+                forget_registered(rec);
+            }
+            continue;
+        }
+        if (rec) {
+            st.updated++;
+        } else {
+            st.added++;
+        }
+        if (!remember_registered(dev->id, hash)) {
+            // Без записи следующий rebuild не снимет устройство, поэтому снимаем сразу.
+            dm_template_runtime_unregister(dev->id);
         }
     }
 
+    st.duration_us = esp_timer_get_time() - start_us;
+    s_last_rebuild = st;
+    ESP_LOGI(TAG, "runtime rebuilt in %lld us: kept=%u added=%u updated=%u removed=%u", (long long)st.duration_us,
+             (unsigned)st.kept, (unsigned)st.added, (unsigned)st.updated, (unsigned)st.removed);
     return ESP_OK;
 }
 
+void dm_runtime_service_get_rebuild_stats(dm_runtime_rebuild_stats_t *out)
+{
+    if (out) {
+        *out = s_last_rebuild;
+    }
+}
+
 esp_err_t dm_runtime_service_register_template(const dm_template_config_t *tpl, const char *device_id)
 {
     if (!tpl || !device_id || !device_id[0]) {
         return ESP_ERR_INVALID_ARG;
     }
-    return dm_template_runtime_register(tpl, device_id);
+    if (!find_registered(device_id) && s_registered_count >= DEVICE_MANAGER_MAX_DEVICES) {
+        ESP_LOGE(TAG, "cannot register %s: %u devices already registered", device_id,
+                 (unsigned)DEVICE_MANAGER_MAX_DEVICES);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = dm_template_runtime_replace(tpl, device_id);
+    if (err == ESP_OK) {
+        remember_registered(device_id, template_hash(tpl));
+    } else {
+        registered_device_t *rec = find_registered(device_id);
+        if (rec) {
+            forget_registered(rec);
+        }
+    }
+    return err;
 }
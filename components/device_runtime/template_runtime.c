@@ -1,8 +1,11 @@
 #include "dm_template_runtime.h"
 
+#include <ctype.h>
 #include <string.h>
 #include <strings.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "esp_heap_caps.h"
@@ -14,78 +17,169 @@
 #include "dm_runtime_condition.h"
 #include "dm_runtime_interval.h"
 #include "dm_runtime_sequence.h"
+#include "dm_runtime_arena.h"
+#include "dm_runtime_scheduler.h"
 #include "device_model_utils.h"
 #include "audio_player.h"
 #include "event_bus.h"
 #include "mqtt_core.h"
 #include "config_store.h"
+#include "topic_intern.h"
 
 static const char *TAG = "template_runtime";
-#define UID_AUDIO_RESUME_TIMEOUT_US (60ULL * 1000ULL * 1000ULL)
+#define UID_AUDIO_RESUME_TIMEOUT_MS (60U * 1000U)
+// Очередь побочных действий растет блоками по столько записей: веер сценариев или проход колеса
+// не упирается в ее размер.
+#define RUNTIME_EFFECTS_BLOCK 16
+#define RUNTIME_SCENARIO_POST_WAIT_MS 100
+// Открытая адресация по topic_id; в индексе не больше TOPIC_INTERN_CAPACITY топиков,
+// так что таблица заполнена не больше чем наполовину.
+#define TOPIC_INDEX_SIZE (TOPIC_INTERN_CAPACITY * 2)
+
+// Индекс топик -> записи шаблонов, которые его слушают. Строится при регистрации, чтобы
+// MQTT сообщение трогало только свои записи, а чужой топик стоил одного поиска.
+typedef enum {
+    TOPIC_REF_UID = 0,
+    TOPIC_REF_SIGNAL,
+    TOPIC_REF_MQTT,
+    TOPIC_REF_SEQUENCE,
+    TOPIC_REF_KIND_COUNT,
+} topic_ref_kind_t;
+
+// Ссылки живут в самих записях: регистрация не выделяет память под индекс.
+typedef struct index_ref {
+    void *entry;
+    // Топики UID: слоты, читающие топик; флаги: правила записи с этим флагом.
+    uint32_t mask;
+    struct index_ref *next;
+} index_ref_t;
+
+// Ссылки по видам, в порядке списков записей: обработка идет в том же порядке, что и обход списков.
+typedef struct {
+    topic_id_t topic_id;
+    index_ref_t *refs[TOPIC_REF_KIND_COUNT];
+} topic_index_node_t;
+
+// Индекс имя флага (в нижнем регистре) -> правила flag trigger и if_condition с этим флагом.
+// Растет вдвое при заполнении наполовину.
+#define FLAG_INDEX_MIN_SIZE 32
+
+typedef enum {
+    FLAG_REF_TRIGGER = 0,
+    FLAG_REF_CONDITION,
+    FLAG_REF_KIND_COUNT,
+} flag_ref_kind_t;
+
+typedef struct {
+    char name[DEVICE_MANAGER_FLAG_NAME_MAX_LEN];
+    uint32_t hash;
+    index_ref_t *refs[FLAG_REF_KIND_COUNT];
+} flag_index_node_t;
 
 typedef struct uid_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
     dm_uid_runtime_t runtime;
-    char topics[DM_UID_TEMPLATE_MAX_SLOTS][DEVICE_MANAGER_TOPIC_MAX_LEN];
+    // Топики интернированы; строки живут в runtime.config.
+    topic_id_t topics[DM_UID_TEMPLATE_MAX_SLOTS];
     size_t topic_count;
     dm_uid_event_type_t last_action_event;
     uint64_t last_action_ts_ms;
     uint64_t last_start_ts_ms;
     uint64_t last_bg_start_ts_ms;
-    char start_topic[DEVICE_MANAGER_TOPIC_MAX_LEN];
-    char start_payload[DEVICE_MANAGER_PAYLOAD_MAX_LEN];
-    char broadcast_topic[DEVICE_MANAGER_TOPIC_MAX_LEN];
-    char broadcast_payload[DEVICE_MANAGER_PAYLOAD_MAX_LEN];
-    char bg_start_topic[DEVICE_MANAGER_TOPIC_MAX_LEN];
+    topic_id_t start_topic;
+    topic_id_t bg_start_topic;
+    index_ref_t index_refs[DM_UID_TEMPLATE_MAX_SLOTS + 2];
+    size_t index_ref_count;
     struct uid_runtime_entry *next;
 } uid_runtime_entry_t;
 
 typedef struct signal_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
     dm_signal_runtime_t runtime;
-    char heartbeat_topic[DEVICE_MANAGER_TOPIC_MAX_LEN];
-    char reset_topic[DEVICE_MANAGER_TOPIC_MAX_LEN];
+    topic_id_t heartbeat_topic;
+    topic_id_t reset_topic;
     bool hold_started;
     bool hold_paused;
     bool hold_active;
-    esp_timer_handle_t timeout_timer;
+    dm_runtime_timer_t timeout_timer;
+    index_ref_t index_refs[2];
+    size_t index_ref_count;
     struct signal_runtime_entry *next;
 } signal_runtime_entry_t;
 
 typedef struct mqtt_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
     dm_mqtt_trigger_runtime_t runtime;
+    topic_id_t rule_topics[DM_MQTT_TRIGGER_MAX_RULES];
+    index_ref_t index_refs[DM_MQTT_TRIGGER_MAX_RULES];
+    size_t index_ref_count;
     struct mqtt_runtime_entry *next;
 } mqtt_runtime_entry_t;
 
 typedef struct flag_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
     dm_flag_trigger_runtime_t runtime;
+    index_ref_t index_refs[DM_FLAG_TRIGGER_MAX_RULES];
+    size_t index_ref_count;
     struct flag_runtime_entry *next;
 } flag_runtime_entry_t;
 
 typedef struct condition_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
     dm_condition_runtime_t runtime;
+    index_ref_t index_refs[DM_CONDITION_TEMPLATE_MAX_RULES];
+    size_t index_ref_count;
     struct condition_runtime_entry *next;
 } condition_runtime_entry_t;
 
 typedef struct interval_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
    dm_interval_task_runtime_t runtime;
-    esp_timer_handle_t timer;
+    dm_runtime_timer_t timer;
     struct interval_runtime_entry *next;
 } interval_runtime_entry_t;
 
 typedef struct sequence_runtime_entry {
     char device_id[DEVICE_MANAGER_ID_MAX_LEN];
     dm_sequence_runtime_t runtime;
-    esp_timer_handle_t timeout_timer;
+    dm_runtime_timer_t timeout_timer;
     dm_sequence_event_type_t last_event;
     bool last_timeout;
+    topic_id_t step_topics[DM_SEQUENCE_TEMPLATE_MAX_STEPS];
+    index_ref_t index_refs[DM_SEQUENCE_TEMPLATE_MAX_STEPS];
+    size_t index_ref_count;
+    // Топик шага не поместился в topic_intern: запись получает все сообщения, как до индекса.
+    bool unindexed;
     struct sequence_runtime_entry *next;
 } sequence_runtime_entry_t;
 
+// Аудио, публикации и сценарии не выполняются под блокировкой runtime: очередь аудио ждет до 50 мс,
+// mqtt_core_publish берет блокировку брокера. Они копируются сюда и выполняются после снятия
+// блокировки (dm_runtime_scheduler_set_unlock_hook) в том же порядке, в каком были поставлены.
+typedef enum {
+    RUNTIME_EFFECT_SCENARIO = 0,
+    RUNTIME_EFFECT_PUBLISH,
+    RUNTIME_EFFECT_AUDIO_PLAY,
+    RUNTIME_EFFECT_AUDIO_PAUSE,
+    RUNTIME_EFFECT_AUDIO_RESUME,
+    RUNTIME_EFFECT_AUDIO_STOP,
+} runtime_effect_kind_t;
+
+typedef struct {
+    runtime_effect_kind_t kind;
+    // Для AUDIO_PLAY: < 0 - с начала, иначе audio_player_play_seek.
+    float seek_ratio;
+    // device_id сценария, топик публикации или трек.
+    char target[DEVICE_MANAGER_TRACK_NAME_MAX_LEN];
+    // Сценарий или payload.
+    char value[DEVICE_MANAGER_PAYLOAD_MAX_LEN];
+} runtime_effect_t;
+
+typedef struct runtime_effect_block {
+    struct runtime_effect_block *next;
+    runtime_effect_t items[RUNTIME_EFFECTS_BLOCK];
+} runtime_effect_block_t;
+
 typedef struct {
     bool pending;
     char fail_track[DEVICE_MANAGER_TRACK_NAME_MAX_LEN];
@@ -93,6 +187,14 @@ typedef struct {
     float resume_ratio;
 } uid_audio_resume_state_t;
 
+// Записи одного вида лежат подряд в своей арене; списки задают порядок обработки.
+static dm_runtime_arena_t s_uid_arena = DM_RUNTIME_ARENA_INIT(sizeof(uid_runtime_entry_t));
+static dm_runtime_arena_t s_signal_arena = DM_RUNTIME_ARENA_INIT(sizeof(signal_runtime_entry_t));
+static dm_runtime_arena_t s_mqtt_arena = DM_RUNTIME_ARENA_INIT(sizeof(mqtt_runtime_entry_t));
+static dm_runtime_arena_t s_flag_arena = DM_RUNTIME_ARENA_INIT(sizeof(flag_runtime_entry_t));
+static dm_runtime_arena_t s_condition_arena = DM_RUNTIME_ARENA_INIT(sizeof(condition_runtime_entry_t));
+static dm_runtime_arena_t s_interval_arena = DM_RUNTIME_ARENA_INIT(sizeof(interval_runtime_entry_t));
+static dm_runtime_arena_t s_sequence_arena = DM_RUNTIME_ARENA_INIT(sizeof(sequence_runtime_entry_t));
 static uid_runtime_entry_t *s_uid_entries;
 static signal_runtime_entry_t *s_signal_entries;
 static mqtt_runtime_entry_t *s_mqtt_entries;
@@ -100,9 +202,26 @@ static flag_runtime_entry_t *s_flag_entries;
 static condition_runtime_entry_t *s_condition_entries;
 static interval_runtime_entry_t *s_interval_entries;
 static sequence_runtime_entry_t *s_sequence_entries;
+static size_t s_sequence_unindexed = 0;
+static topic_index_node_t *s_topic_index = NULL;
+static flag_index_node_t *s_flag_index = NULL;
+static size_t s_flag_index_size = 0;
+static size_t s_flag_index_count = 0;
 static bool s_event_handler_registered = false;
 static uid_audio_resume_state_t s_uid_audio_resume = {0};
-static esp_timer_handle_t s_uid_audio_resume_timer = NULL;
+static dm_runtime_timer_t s_uid_audio_resume_timer;
+// Ставят под блокировкой runtime в хвостовой блок, забирает только держатель s_effects_lock:
+// слот освобождается после выполнения, поэтому копировать его под s_effects_mux не нужно.
+// Разобранный блок остается запасным, лишние освобождаются.
+static runtime_effect_block_t *s_effects_head_block = NULL;
+static runtime_effect_block_t *s_effects_tail_block = NULL;
+static runtime_effect_block_t *s_effects_spare = NULL;
+static size_t s_effects_head = 0;
+static size_t s_effects_tail = 0;
+static uint32_t s_effects_dropped = 0;
+static uint32_t s_effects_failed = 0;
+static portMUX_TYPE s_effects_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t s_effects_lock = NULL;
 
 static const char *signal_event_str(dm_signal_event_type_t ev);
 static bool diagnostics_verbose_enabled(void);
@@ -112,6 +231,8 @@ static void signal_timeout_timer_cb(void *arg);
 static void restart_signal_timeout_timer(signal_runtime_entry_t *entry);
 static void stop_signal_timeout_timer(signal_runtime_entry_t *entry);
 static void sequence_timeout_timer_cb(void *arg);
+static bool handle_mqtt_interned(const char *topic, topic_id_t topic_id, const char *payload);
+static bool handle_flag_locked(const char *flag_name, bool state);
 static void restart_sequence_timeout_timer(sequence_runtime_entry_t *entry);
 static void stop_sequence_timeout_timer(sequence_runtime_entry_t *entry);
 static void reset_signal_entry(signal_runtime_entry_t *entry, const char *topic);
@@ -124,18 +245,178 @@ static const char *sequence_state_str(const sequence_runtime_entry_t *entry);
 static const char *signal_state_str(const signal_runtime_entry_t *entry);
 static void reset_sequence_entry(sequence_runtime_entry_t *entry);
 
+static void *runtime_alloc(size_t size);
+
+// Под блокировкой runtime: ставит только один поток за раз.
+static esp_err_t runtime_effect_push(runtime_effect_kind_t kind, const char *target, const char *value, float seek_ratio)
+{
+    if (!s_effects_tail_block) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    runtime_effect_block_t *block = s_effects_tail_block;
+    size_t slot = s_effects_tail;
+    if (slot == RUNTIME_EFFECTS_BLOCK) {
+        portENTER_CRITICAL(&s_effects_mux);
+        block = s_effects_spare;
+        s_effects_spare = NULL;
+        portEXIT_CRITICAL(&s_effects_mux);
+        if (!block) {
+            block = runtime_alloc(sizeof(*block));
+        }
+        if (!block) {
+            s_effects_dropped++;
+            ESP_LOGE(TAG, "no memory for effect queue, %s dropped (total %u)", target ? target : "",
+                     (unsigned)s_effects_dropped);
+            return ESP_ERR_NO_MEM;
+        }
+        block->next = NULL;
+        slot = 0;
+    }
+    runtime_effect_t *effect = &block->items[slot];
+    effect->kind = kind;
+    effect->seek_ratio = seek_ratio;
+    dm_str_copy(effect->target, sizeof(effect->target), target ? target : "");
+    dm_str_copy(effect->value, sizeof(effect->value), value ? value : "");
+    portENTER_CRITICAL(&s_effects_mux);
+    if (block != s_effects_tail_block) {
+        s_effects_tail_block->next = block;
+        s_effects_tail_block = block;
+    }
+    s_effects_tail = slot + 1;
+    portEXIT_CRITICAL(&s_effects_mux);
+    return ESP_OK;
+}
+
+static void runtime_effect_run(const runtime_effect_t *effect)
+{
+    esp_err_t err = ESP_OK;
+    switch (effect->kind) {
+    case RUNTIME_EFFECT_SCENARIO: {
+        event_bus_message_t msg = {
+            .type = EVENT_SCENARIO_TRIGGER,
+            .topic = effect->target,
+            .payload = effect->value,
+        };
+        // Не в задаче шины: ее обработчик откладывает действия в задачу колеса, так что место
+        // в кольце можно подождать.
+        err = event_bus_post(&msg, pdMS_TO_TICKS(RUNTIME_SCENARIO_POST_WAIT_MS));
+        break;
+    }
+    case RUNTIME_EFFECT_PUBLISH:
+        err = mqtt_core_publish(effect->target, effect->value);
+        break;
+    case RUNTIME_EFFECT_AUDIO_PLAY:
+        err = effect->seek_ratio >= 0.0f ? audio_player_play_seek(effect->target, effect->seek_ratio)
+                                         : audio_player_play(effect->target);
+        break;
+    case RUNTIME_EFFECT_AUDIO_PAUSE:
+        audio_player_pause();
+        break;
+    case RUNTIME_EFFECT_AUDIO_RESUME:
+        audio_player_resume();
+        break;
+    case RUNTIME_EFFECT_AUDIO_STOP:
+        audio_player_stop();
+        break;
+    }
+    if (err != ESP_OK) {
+        s_effects_failed++;
+        ESP_LOGW(TAG, "effect %d %s/%s failed: %s (total %u)", (int)effect->kind, effect->target, effect->value,
+                 esp_err_to_name(err), (unsigned)s_effects_failed);
+    }
+}
+
+// Следующее действие или NULL; разобранный головной блок уходит в запас или освобождается.
+static runtime_effect_t *runtime_effect_next(void)
+{
+    runtime_effect_block_t *retired = NULL;
+    runtime_effect_t *effect = NULL;
+    portENTER_CRITICAL(&s_effects_mux);
+    if (s_effects_head == RUNTIME_EFFECTS_BLOCK && s_effects_head_block->next) {
+        retired = s_effects_head_block;
+        s_effects_head_block = retired->next;
+        s_effects_head = 0;
+        if (!s_effects_spare) {
+            s_effects_spare = retired;
+            retired = NULL;
+        }
+    }
+    if (s_effects_head_block != s_effects_tail_block || s_effects_head != s_effects_tail) {
+        effect = &s_effects_head_block->items[s_effects_head];
+    }
+    portEXIT_CRITICAL(&s_effects_mux);
+    heap_caps_free(retired);
+    return effect;
+}
+
+static bool runtime_effects_empty(void)
+{
+    portENTER_CRITICAL(&s_effects_mux);
+    bool empty = s_effects_head_block == s_effects_tail_block && s_effects_head == s_effects_tail;
+    portEXIT_CRITICAL(&s_effects_mux);
+    return empty;
+}
+
+// Хук снятия блокировки runtime. Выполняет одна задача за раз, поэтому действия разных заходов
+// не переставляются. Остальные не ждут ее: их действия она выполнит сама, а поставленные после
+// ее последней проверки она увидит при повторной проверке после освобождения.
+static void runtime_effects_flush(void)
+{
+    if (!s_effects_lock) {
+        return;
+    }
+    do {
+        if (xSemaphoreTake(s_effects_lock, 0) != pdTRUE) {
+            return;
+        }
+        runtime_effect_t *effect;
+        while ((effect = runtime_effect_next()) != NULL) {
+            runtime_effect_run(effect);
+            portENTER_CRITICAL(&s_effects_mux);
+            s_effects_head++;
+            portEXIT_CRITICAL(&s_effects_mux);
+        }
+        xSemaphoreGive(s_effects_lock);
+    } while (!runtime_effects_empty());
+}
+
+static esp_err_t runtime_effects_init(void)
+{
+    if (!s_effects_lock) {
+        s_effects_lock = xSemaphoreCreateMutex();
+        if (!s_effects_lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (!s_effects_tail_block) {
+        s_effects_tail_block = runtime_alloc(sizeof(runtime_effect_block_t));
+        if (!s_effects_tail_block) {
+            ESP_LOGE(TAG, "no memory for effect queue");
+            return ESP_ERR_NO_MEM;
+        }
+        s_effects_head_block = s_effects_tail_block;
+    }
+    dm_runtime_scheduler_set_unlock_hook(runtime_effects_flush);
+    return ESP_OK;
+}
+
+static void runtime_audio_play(const char *track, float seek_ratio)
+{
+    runtime_effect_push(RUNTIME_EFFECT_AUDIO_PLAY, track, NULL, seek_ratio);
+}
+
+static void runtime_audio(runtime_effect_kind_t kind)
+{
+    runtime_effect_push(kind, NULL, NULL, -1.0f);
+}
+
+// Сценарий уходит в шину после снятия блокировки; ошибка здесь - только нехватка памяти под очередь.
 static esp_err_t request_scenario_trigger(const char *device_id, const char *scenario_id)
 {
     if (!device_id || !device_id[0] || !scenario_id || !scenario_id[0]) {
         return ESP_ERR_INVALID_ARG;
     }
-
-    event_bus_message_t msg = {
-        .type = EVENT_SCENARIO_TRIGGER,
-    };
-    dm_str_copy(msg.topic, sizeof(msg.topic), device_id);
-    dm_str_copy(msg.payload, sizeof(msg.payload), scenario_id);
-    return event_bus_post(&msg, pdMS_TO_TICKS(100));
+    return runtime_effect_push(RUNTIME_EFFECT_SCENARIO, device_id, scenario_id, -1.0f);
 }
 
 static bool payload_to_bool(const char *payload)
@@ -182,9 +463,7 @@ static void uid_audio_resume_clear(void)
     s_uid_audio_resume.fail_track[0] = '\0';
     s_uid_audio_resume.resume_track[0] = '\0';
     s_uid_audio_resume.resume_ratio = -1.0f;
-    if (s_uid_audio_resume_timer) {
-        esp_timer_stop(s_uid_audio_resume_timer);
-    }
+    dm_runtime_scheduler_cancel(&s_uid_audio_resume_timer);
 }
 
 static void uid_audio_resume_timeout_cb(void *arg)
@@ -210,7 +489,7 @@ static void uid_audio_resume_arm(const char *fail_track, const char *bg_track)
     if (strcmp(status.path, fail_track) == 0) {
         return;
     }
-    audio_player_pause();
+    runtime_audio(RUNTIME_EFFECT_AUDIO_PAUSE);
     s_uid_audio_resume.pending = true;
     dm_str_copy(s_uid_audio_resume.fail_track, sizeof(s_uid_audio_resume.fail_track), fail_track);
     dm_str_copy(s_uid_audio_resume.resume_track, sizeof(s_uid_audio_resume.resume_track), status.path);
@@ -224,10 +503,7 @@ static void uid_audio_resume_arm(const char *fail_track, const char *bg_track)
         }
         s_uid_audio_resume.resume_ratio = ratio;
     }
-    if (s_uid_audio_resume_timer) {
-        esp_timer_stop(s_uid_audio_resume_timer);
-        esp_timer_start_once(s_uid_audio_resume_timer, UID_AUDIO_RESUME_TIMEOUT_US);
-    }
+    dm_runtime_scheduler_arm(&s_uid_audio_resume_timer, UID_AUDIO_RESUME_TIMEOUT_MS, 0);
 }
 
 static void uid_audio_resume_handle_finished(const char *path)
@@ -243,11 +519,7 @@ static void uid_audio_resume_handle_finished(const char *path)
         return;
     }
     if (s_uid_audio_resume.resume_track[0]) {
-        if (s_uid_audio_resume.resume_ratio >= 0.0f) {
-            audio_player_play_seek(s_uid_audio_resume.resume_track, s_uid_audio_resume.resume_ratio);
-        } else {
-            audio_player_play(s_uid_audio_resume.resume_track);
-        }
+        runtime_audio_play(s_uid_audio_resume.resume_track, s_uid_audio_resume.resume_ratio);
     }
     uid_audio_resume_clear();
 }
@@ -257,18 +529,19 @@ static void template_event_handler(const event_bus_message_t *msg)
     if (!msg) {
         return;
     }
+    dm_runtime_scheduler_lock();
     switch (msg->type) {
     case EVENT_MQTT_MESSAGE:
-        if (!msg->topic[0]) {
-            return;
+        if (msg->topic[0]) {
+            handle_mqtt_interned(msg->topic,
+                                 msg->topic_id != TOPIC_ID_NONE ? msg->topic_id : topic_intern_find(msg->topic),
+                                 msg->payload[0] ? msg->payload : "");
         }
-        dm_template_runtime_handle_mqtt(msg->topic, msg->payload[0] ? msg->payload : "");
         break;
     case EVENT_FLAG_CHANGED:
-        if (!msg->topic[0]) {
-            return;
+        if (msg->topic[0]) {
+            handle_flag_locked(msg->topic, payload_to_bool(msg->payload));
         }
-        dm_template_runtime_handle_flag(msg->topic, payload_to_bool(msg->payload));
         break;
     case EVENT_AUDIO_FINISHED:
         uid_audio_resume_handle_finished(msg->payload);
@@ -276,6 +549,15 @@ static void template_event_handler(const event_bus_message_t *msg)
     default:
         break;
     }
+    dm_runtime_scheduler_unlock_deferred();
+}
+
+static void release_topic_ids(topic_id_t *ids, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        topic_intern_release(ids[i]);
+        ids[i] = TOPIC_ID_NONE;
+    }
 }
 
 static void *runtime_alloc(size_t size)
@@ -287,62 +569,313 @@ static void *runtime_alloc(size_t size)
     return ptr;
 }
 
-static void free_uid_entries(void)
+static bool topic_index_ready(void)
+{
+    if (!s_topic_index) {
+        s_topic_index = runtime_alloc(sizeof(topic_index_node_t) * TOPIC_INDEX_SIZE);
+        if (!s_topic_index) {
+            ESP_LOGE(TAG, "no memory for topic index");
+        }
+    }
+    return s_topic_index != NULL;
+}
+
+static void topic_index_clear(void)
+{
+    if (s_topic_index) {
+        memset(s_topic_index, 0, sizeof(topic_index_node_t) * TOPIC_INDEX_SIZE);
+    }
+}
+
+// Младшие биты topic_id - номер слота topic_intern, поэтому остаток почти не дает коллизий.
+static size_t topic_index_pos(topic_id_t topic_id)
+{
+    return (size_t)(topic_id % TOPIC_INDEX_SIZE);
+}
+
+static const topic_index_node_t *topic_index_find(topic_id_t topic_id)
+{
+    if (topic_id == TOPIC_ID_NONE || !s_topic_index) {
+        return NULL;
+    }
+    size_t pos = topic_index_pos(topic_id);
+    for (size_t probe = 0; probe < TOPIC_INDEX_SIZE; ++probe) {
+        const topic_index_node_t *node = &s_topic_index[pos];
+        if (node->topic_id == topic_id) {
+            return node;
+        }
+        if (node->topic_id == TOPIC_ID_NONE) {
+            return NULL;
+        }
+        pos = (pos + 1) % TOPIC_INDEX_SIZE;
+    }
+    return NULL;
+}
+
+// Все ссылки одной записи добавляются подряд, поэтому повторный ключ той же записи всегда
+// находится в голове списка и только дополняет mask.
+static void index_ref_add(index_ref_t **head, void *entry, index_ref_t *refs, size_t *ref_count, uint32_t mask)
+{
+    if (*head && (*head)->entry == entry) {
+        (*head)->mask |= mask;
+        return;
+    }
+    index_ref_t *ref = &refs[(*ref_count)++];
+    ref->entry = entry;
+    ref->mask = mask;
+    ref->next = *head;
+    *head = ref;
+}
+
+static void topic_index_link(topic_ref_kind_t kind,
+                             void *entry,
+                             index_ref_t *refs,
+                             size_t *ref_count,
+                             topic_id_t topic_id,
+                             uint32_t mask)
+{
+    if (topic_id == TOPIC_ID_NONE || !s_topic_index) {
+        return;
+    }
+    size_t pos = topic_index_pos(topic_id);
+    topic_index_node_t *node = NULL;
+    for (size_t probe = 0; probe < TOPIC_INDEX_SIZE; ++probe) {
+        topic_index_node_t *cur = &s_topic_index[pos];
+        if (cur->topic_id == topic_id || cur->topic_id == TOPIC_ID_NONE) {
+            node = cur;
+            break;
+        }
+        pos = (pos + 1) % TOPIC_INDEX_SIZE;
+    }
+    if (!node) {
+        ESP_LOGE(TAG, "topic index full");
+        return;
+    }
+    node->topic_id = topic_id;
+    index_ref_add(&node->refs[kind], entry, refs, ref_count, mask);
+}
+
+static bool flag_index_ready(size_t extra)
+{
+    size_t need = (s_flag_index_count + extra) * 2;
+    if (s_flag_index && need <= s_flag_index_size) {
+        return true;
+    }
+    size_t size = s_flag_index_size ? s_flag_index_size : FLAG_INDEX_MIN_SIZE;
+    while (size < need) {
+        size *= 2;
+    }
+    flag_index_node_t *table = runtime_alloc(sizeof(flag_index_node_t) * size);
+    if (!table) {
+        ESP_LOGE(TAG, "no memory for flag index (%u names)", (unsigned)(s_flag_index_count + extra));
+        return false;
+    }
+    // Ссылки указывают в записи, а не в узлы: при переносе узлы копируются как есть.
+    for (size_t i = 0; i < s_flag_index_size; ++i) {
+        const flag_index_node_t *node = &s_flag_index[i];
+        if (!node->name[0]) {
+            continue;
+        }
+        size_t pos = node->hash % size;
+        while (table[pos].name[0]) {
+            pos = (pos + 1) % size;
+        }
+        table[pos] = *node;
+    }
+    heap_caps_free(s_flag_index);
+    s_flag_index = table;
+    s_flag_index_size = size;
+    return true;
+}
+
+static void flag_index_clear(void)
+{
+    if (s_flag_index) {
+        memset(s_flag_index, 0, sizeof(flag_index_node_t) * s_flag_index_size);
+    }
+    s_flag_index_count = 0;
+}
+
+// Имя флага в нижнем регистре и его хэш; false, если имя длиннее любого флага из конфигурации.
+static bool flag_fold(const char *name, char *out, uint32_t *hash)
+{
+    uint32_t h = 2166136261u;
+    size_t len = 0;
+    for (; name[len]; ++len) {
+        if (len + 1 >= DEVICE_MANAGER_FLAG_NAME_MAX_LEN) {
+            return false;
+        }
+        char c = (char)tolower((unsigned char)name[len]);
+        out[len] = c;
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+    out[len] = '\0';
+    *hash = h;
+    return len > 0;
+}
+
+static flag_index_node_t *flag_index_slot(const char *folded, uint32_t hash, bool insert)
+{
+    if (!s_flag_index) {
+        return NULL;
+    }
+    size_t pos = hash % s_flag_index_size;
+    for (size_t probe = 0; probe < s_flag_index_size; ++probe) {
+        flag_index_node_t *node = &s_flag_index[pos];
+        if (!node->name[0]) {
+            if (!insert) {
+                return NULL;
+            }
+            memcpy(node->name, folded, sizeof(node->name));
+            node->hash = hash;
+            s_flag_index_count++;
+            return node;
+        }
+        if (node->hash == hash && strcmp(node->name, folded) == 0) {
+            return node;
+        }
+        pos = (pos + 1) % s_flag_index_size;
+    }
+    return NULL;
+}
+
+// Место под имена записи резервирует flag_index_ready до вызова.
+static void flag_index_link(flag_ref_kind_t kind,
+                            void *entry,
+                            index_ref_t *refs,
+                            size_t *ref_count,
+                            const char *flag_name,
+                            uint8_t rule_index)
+{
+    char folded[DEVICE_MANAGER_FLAG_NAME_MAX_LEN];
+    uint32_t hash = 0;
+    if (!flag_fold(flag_name, folded, &hash)) {
+        return;
+    }
+    flag_index_node_t *node = flag_index_slot(folded, hash, true);
+    if (!node) {
+        ESP_LOGE(TAG, "flag index full");
+        return;
+    }
+    index_ref_add(&node->refs[kind], entry, refs, ref_count, 1u << rule_index);
+}
+
+static void link_uid_entry(uid_runtime_entry_t *entry)
+{
+    topic_index_link(TOPIC_REF_UID, entry, entry->index_refs, &entry->index_ref_count, entry->bg_start_topic, 0);
+    topic_index_link(TOPIC_REF_UID, entry, entry->index_refs, &entry->index_ref_count, entry->start_topic, 0);
+    for (size_t i = 0; i < entry->topic_count && i < DM_UID_TEMPLATE_MAX_SLOTS; ++i) {
+        topic_index_link(TOPIC_REF_UID, entry, entry->index_refs, &entry->index_ref_count, entry->topics[i],
+                         1u << i);
+    }
+}
+
+static void link_signal_entry(signal_runtime_entry_t *entry)
+{
+    topic_index_link(TOPIC_REF_SIGNAL, entry, entry->index_refs, &entry->index_ref_count, entry->reset_topic, 0);
+    topic_index_link(TOPIC_REF_SIGNAL, entry, entry->index_refs, &entry->index_ref_count, entry->heartbeat_topic, 0);
+}
+
+static void link_mqtt_entry(mqtt_runtime_entry_t *entry)
+{
+    for (uint8_t i = 0; i < entry->runtime.config.rule_count && i < DM_MQTT_TRIGGER_MAX_RULES; ++i) {
+        topic_index_link(TOPIC_REF_MQTT, entry, entry->index_refs, &entry->index_ref_count, entry->rule_topics[i], 0);
+    }
+}
+
+static void link_flag_entry(flag_runtime_entry_t *entry)
+{
+    const dm_flag_trigger_template_t *tpl = &entry->runtime.config;
+    for (uint8_t i = 0; i < tpl->rule_count && i < DM_FLAG_TRIGGER_MAX_RULES; ++i) {
+        // Правило без сценария ничего не запускает.
+        if (tpl->rules[i].scenario[0]) {
+            flag_index_link(FLAG_REF_TRIGGER, entry, entry->index_refs, &entry->index_ref_count, tpl->rules[i].flag, i);
+        }
+    }
+}
+
+static void link_condition_entry(condition_runtime_entry_t *entry)
+{
+    const dm_condition_template_t *tpl = &entry->runtime.config;
+    for (uint8_t i = 0; i < tpl->rule_count && i < DM_CONDITION_TEMPLATE_MAX_RULES; ++i) {
+        flag_index_link(FLAG_REF_CONDITION, entry, entry->index_refs, &entry->index_ref_count, tpl->rules[i].flag, i);
+    }
+}
+
+static void link_sequence_entry(sequence_runtime_entry_t *entry)
+{
+    if (entry->unindexed) {
+        s_sequence_unindexed++;
+        return;
+    }
+    for (uint8_t i = 0; i < entry->runtime.config.step_count && i < DM_SEQUENCE_TEMPLATE_MAX_STEPS; ++i) {
+        topic_index_link(TOPIC_REF_SEQUENCE, entry, entry->index_refs, &entry->index_ref_count,
+                         entry->step_topics[i], 0);
+    }
+}
+
+static void free_uid_list(uid_runtime_entry_t *entry)
 {
-    uid_runtime_entry_t *entry = s_uid_entries;
     while (entry) {
         uid_runtime_entry_t *next = entry->next;
-        heap_caps_free(entry);
+        release_topic_ids(entry->topics, DM_UID_TEMPLATE_MAX_SLOTS);
+        topic_intern_release(entry->start_topic);
+        topic_intern_release(entry->bg_start_topic);
+        dm_runtime_arena_free(&s_uid_arena, entry);
         entry = next;
     }
+}
+
+static void free_uid_entries(void)
+{
+    free_uid_list(s_uid_entries);
     s_uid_entries = NULL;
+    dm_runtime_arena_reset(&s_uid_arena);
 }
 
-static void free_signal_entries(void)
+static void free_signal_list(signal_runtime_entry_t *entry)
 {
-    signal_runtime_entry_t *entry = s_signal_entries;
     while (entry) {
         signal_runtime_entry_t *next = entry->next;
-        if (entry->timeout_timer) {
-            esp_timer_stop(entry->timeout_timer);
-            esp_timer_delete(entry->timeout_timer);
-        }
-        heap_caps_free(entry);
+        dm_runtime_scheduler_cancel(&entry->timeout_timer);
+        topic_intern_release(entry->heartbeat_topic);
+        topic_intern_release(entry->reset_topic);
+        dm_runtime_arena_free(&s_signal_arena, entry);
         entry = next;
     }
+}
+
+static void free_signal_entries(void)
+{
+    free_signal_list(s_signal_entries);
     s_signal_entries = NULL;
+    dm_runtime_arena_reset(&s_signal_arena);
 }
 
-static uint64_t signal_timeout_interval_us(const signal_runtime_entry_t *entry)
+static uint32_t signal_timeout_interval_ms(const signal_runtime_entry_t *entry)
 {
     if (!entry) {
         return 0;
     }
-    uint32_t timeout_ms = entry->runtime.config.heartbeat_timeout_ms
-                              ? entry->runtime.config.heartbeat_timeout_ms
-                              : 1000;
-    return (uint64_t)timeout_ms * 1000ULL;
+    return entry->runtime.config.heartbeat_timeout_ms ? entry->runtime.config.heartbeat_timeout_ms : 1000;
 }
 
 static void restart_signal_timeout_timer(signal_runtime_entry_t *entry)
 {
-    if (!entry || !entry->timeout_timer) {
-        return;
-    }
-    uint64_t timeout_us = signal_timeout_interval_us(entry);
-    if (timeout_us == 0) {
+    uint32_t timeout_ms = signal_timeout_interval_ms(entry);
+    if (timeout_ms == 0) {
         return;
     }
-    esp_timer_stop(entry->timeout_timer);
-    esp_timer_start_once(entry->timeout_timer, timeout_us);
+    dm_runtime_scheduler_arm(&entry->timeout_timer, timeout_ms, 0);
 }
 
 static void stop_signal_timeout_timer(signal_runtime_entry_t *entry)
 {
-    if (!entry || !entry->timeout_timer) {
+    if (!entry) {
         return;
     }
-    esp_timer_stop(entry->timeout_timer);
+    dm_runtime_scheduler_cancel(&entry->timeout_timer);
 }
 
 static void signal_timeout_timer_cb(void *arg)
@@ -380,7 +913,7 @@ static void reset_signal_entry(signal_runtime_entry_t *entry, const char *topic)
     entry->hold_paused = false;
     entry->hold_active = false;
     stop_signal_timeout_timer(entry);
-    audio_player_stop();
+    runtime_audio(RUNTIME_EFFECT_AUDIO_STOP);
     if (diagnostics_verbose_enabled()) {
         ESP_LOGI(TAG,
                  "[Signal] dev=%s reset topic=%s",
@@ -406,67 +939,89 @@ static const char *signal_state_str(const signal_runtime_entry_t *entry)
     return "idle";
 }
 
-static void free_mqtt_entries(void)
+static void free_mqtt_list(mqtt_runtime_entry_t *entry)
 {
-    mqtt_runtime_entry_t *entry = s_mqtt_entries;
     while (entry) {
         mqtt_runtime_entry_t *next = entry->next;
-        heap_caps_free(entry);
+        release_topic_ids(entry->rule_topics, DM_MQTT_TRIGGER_MAX_RULES);
+        dm_runtime_arena_free(&s_mqtt_arena, entry);
         entry = next;
     }
+}
+
+static void free_mqtt_entries(void)
+{
+    free_mqtt_list(s_mqtt_entries);
     s_mqtt_entries = NULL;
+    dm_runtime_arena_reset(&s_mqtt_arena);
 }
 
-static void free_flag_entries(void)
+static void free_flag_list(flag_runtime_entry_t *entry)
 {
-    flag_runtime_entry_t *entry = s_flag_entries;
     while (entry) {
         flag_runtime_entry_t *next = entry->next;
-        heap_caps_free(entry);
+        dm_runtime_arena_free(&s_flag_arena, entry);
         entry = next;
     }
+}
+
+static void free_flag_entries(void)
+{
+    free_flag_list(s_flag_entries);
     s_flag_entries = NULL;
+    dm_runtime_arena_reset(&s_flag_arena);
 }
 
-static void free_condition_entries(void)
+static void free_condition_list(condition_runtime_entry_t *entry)
 {
-    condition_runtime_entry_t *entry = s_condition_entries;
     while (entry) {
         condition_runtime_entry_t *next = entry->next;
-        heap_caps_free(entry);
+        dm_runtime_arena_free(&s_condition_arena, entry);
         entry = next;
     }
+}
+
+static void free_condition_entries(void)
+{
+    free_condition_list(s_condition_entries);
     s_condition_entries = NULL;
+    dm_runtime_arena_reset(&s_condition_arena);
 }
 
-static void free_interval_entries(void)
+static void free_interval_list(interval_runtime_entry_t *entry)
 {
-    interval_runtime_entry_t *entry = s_interval_entries;
     while (entry) {
         interval_runtime_entry_t *next = entry->next;
-        if (entry->timer) {
-            esp_timer_stop(entry->timer);
-            esp_timer_delete(entry->timer);
-        }
-        heap_caps_free(entry);
+        dm_runtime_scheduler_cancel(&entry->timer);
+        dm_runtime_arena_free(&s_interval_arena, entry);
         entry = next;
     }
+}
+
+static void free_interval_entries(void)
+{
+    free_interval_list(s_interval_entries);
     s_interval_entries = NULL;
+    dm_runtime_arena_reset(&s_interval_arena);
 }
 
-static void free_sequence_entries(void)
+static void free_sequence_list(sequence_runtime_entry_t *entry)
 {
-    sequence_runtime_entry_t *entry = s_sequence_entries;
     while (entry) {
         sequence_runtime_entry_t *next = entry->next;
-        if (entry->timeout_timer) {
-            esp_timer_stop(entry->timeout_timer);
-            esp_timer_delete(entry->timeout_timer);
-        }
-        heap_caps_free(entry);
+        dm_runtime_scheduler_cancel(&entry->timeout_timer);
+        release_topic_ids(entry->step_topics, DM_SEQUENCE_TEMPLATE_MAX_STEPS);
+        dm_runtime_arena_free(&s_sequence_arena, entry);
         entry = next;
     }
+}
+
+static void free_sequence_entries(void)
+{
+    free_sequence_list(s_sequence_entries);
     s_sequence_entries = NULL;
+    dm_runtime_arena_reset(&s_sequence_arena);
+    s_sequence_unindexed = 0;
 }
 
 static const char *uid_event_str(dm_uid_event_type_t type)
@@ -487,6 +1042,16 @@ static const char *uid_event_str(dm_uid_event_type_t type)
 
 esp_err_t dm_template_runtime_init(void)
 {
+    esp_err_t err = dm_runtime_scheduler_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "runtime scheduler start failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    err = runtime_effects_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    dm_runtime_scheduler_lock();
     free_uid_entries();
     free_signal_entries();
     free_mqtt_entries();
@@ -494,20 +1059,19 @@ esp_err_t dm_template_runtime_init(void)
     free_condition_entries();
     free_interval_entries();
     free_sequence_entries();
+    // Ссылки индексов жили в освобожденных записях.
+    topic_index_clear();
+    flag_index_clear();
     uid_audio_resume_clear();
-    if (!s_uid_audio_resume_timer) {
-        esp_timer_create_args_t args = {
-            .callback = uid_audio_resume_timeout_cb,
-            .name = "uid_audio_resume",
-        };
-        esp_err_t err = esp_timer_create(&args, &s_uid_audio_resume_timer);
-        if (err != ESP_OK) {
-            s_uid_audio_resume_timer = NULL;
-            ESP_LOGW(TAG, "uid resume timer create failed: %s", esp_err_to_name(err));
-        }
-    }
+    dm_runtime_timer_init(&s_uid_audio_resume_timer, uid_audio_resume_timeout_cb, NULL);
+    dm_runtime_scheduler_unlock();
     if (!s_event_handler_registered) {
-        esp_err_t err = event_bus_register_handler(template_event_handler);
+        const event_bus_mask_t events = EVENT_BUS_MASK(EVENT_MQTT_MESSAGE) | EVENT_BUS_MASK(EVENT_FLAG_CHANGED) |
+                                        EVENT_BUS_MASK(EVENT_AUDIO_FINISHED);
+        // В задаче шины: своя очередь отбрасывала бы MQTT при всплеске. Блокировку runtime держат
+        // недолго, а аудио, публикации и сценарии после нее выполняет задача колеса, не шина.
+        const event_bus_subscribe_opts_t opts = {.name = "template"};
+        err = event_bus_subscribe_ex(events, template_event_handler, &opts);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "event handler register failed: %s", esp_err_to_name(err));
             return err;
@@ -527,7 +1091,10 @@ static esp_err_t register_uid_runtime(const dm_uid_template_t *tpl, const char *
     if (!tpl || tpl->slot_count == 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    uid_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    if (!topic_index_ready()) {
+        return ESP_ERR_NO_MEM;
+    }
+    uid_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_uid_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for uid runtime");
         return ESP_ERR_NO_MEM;
@@ -536,13 +1103,11 @@ static esp_err_t register_uid_runtime(const dm_uid_template_t *tpl, const char *
     dm_uid_runtime_init(&entry->runtime, tpl);
     entry->topic_count = tpl->slot_count;
     for (uint8_t i = 0; i < tpl->slot_count && i < DM_UID_TEMPLATE_MAX_SLOTS; ++i) {
-        dm_str_copy(entry->topics[i], sizeof(entry->topics[i]), tpl->slots[i].source_id);
+        entry->topics[i] = topic_intern_acquire(tpl->slots[i].source_id);
     }
-    dm_str_copy(entry->start_topic, sizeof(entry->start_topic), tpl->start_topic);
-    dm_str_copy(entry->start_payload, sizeof(entry->start_payload), tpl->start_payload);
-    dm_str_copy(entry->broadcast_topic, sizeof(entry->broadcast_topic), tpl->broadcast_topic);
-    dm_str_copy(entry->broadcast_payload, sizeof(entry->broadcast_payload), tpl->broadcast_payload);
-    dm_str_copy(entry->bg_start_topic, sizeof(entry->bg_start_topic), tpl->bg_start_topic);
+    entry->start_topic = topic_intern_acquire(tpl->start_topic);
+    entry->bg_start_topic = topic_intern_acquire(tpl->bg_start_topic);
+    link_uid_entry(entry);
     entry->next = s_uid_entries;
     s_uid_entries = entry;
     ESP_LOGI(TAG, "registered UID runtime for device %s with %zu slots", entry->device_id, entry->topic_count);
@@ -554,35 +1119,26 @@ static esp_err_t register_signal_runtime(const dm_signal_hold_template_t *tpl, c
     if (!tpl || !tpl->heartbeat_topic[0]) {
         return ESP_ERR_INVALID_ARG;
     }
-    signal_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    if (!topic_index_ready()) {
+        return ESP_ERR_NO_MEM;
+    }
+    signal_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_signal_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for signal runtime");
         return ESP_ERR_NO_MEM;
     }
     dm_str_copy(entry->device_id, sizeof(entry->device_id), device_id);
     dm_signal_runtime_init(&entry->runtime, tpl);
-    dm_str_copy(entry->heartbeat_topic, sizeof(entry->heartbeat_topic), tpl->heartbeat_topic);
-    dm_str_copy(entry->reset_topic, sizeof(entry->reset_topic), tpl->reset_topic);
+    entry->heartbeat_topic = topic_intern_acquire(tpl->heartbeat_topic);
+    entry->reset_topic = topic_intern_acquire(tpl->reset_topic);
     entry->hold_started = false;
     entry->hold_paused = false;
     entry->hold_active = false;
-    entry->timeout_timer = NULL;
-    esp_timer_create_args_t args = {
-        .callback = signal_timeout_timer_cb,
-        .arg = entry,
-        .name = "dm_signal_timeout",
-        .dispatch_method = ESP_TIMER_TASK,
-    };
-    esp_err_t timer_err = esp_timer_create(&args, &entry->timeout_timer);
-    if (timer_err != ESP_OK) {
-        entry->timeout_timer = NULL;
-        ESP_LOGW(TAG, "signal timeout timer create failed for %s: %s",
-                 entry->device_id,
-                 esp_err_to_name(timer_err));
-    }
+    dm_runtime_timer_init(&entry->timeout_timer, signal_timeout_timer_cb, entry);
+    link_signal_entry(entry);
     entry->next = s_signal_entries;
     s_signal_entries = entry;
-    ESP_LOGI(TAG, "registered signal runtime for device %s topic %s", entry->device_id, entry->heartbeat_topic);
+    ESP_LOGI(TAG, "registered signal runtime for device %s topic %s", entry->device_id, tpl->heartbeat_topic);
     return ESP_OK;
 }
 
@@ -591,13 +1147,20 @@ static esp_err_t register_mqtt_runtime(const dm_mqtt_trigger_template_t *tpl, co
     if (!tpl || tpl->rule_count == 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    mqtt_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    if (!topic_index_ready()) {
+        return ESP_ERR_NO_MEM;
+    }
+    mqtt_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_mqtt_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for mqtt trigger runtime");
         return ESP_ERR_NO_MEM;
     }
     dm_str_copy(entry->device_id, sizeof(entry->device_id), device_id);
     dm_mqtt_trigger_runtime_init(&entry->runtime, tpl);
+    for (uint8_t i = 0; i < tpl->rule_count && i < DM_MQTT_TRIGGER_MAX_RULES; ++i) {
+        entry->rule_topics[i] = topic_intern_acquire(tpl->rules[i].topic);
+    }
+    link_mqtt_entry(entry);
     entry->next = s_mqtt_entries;
     s_mqtt_entries = entry;
     ESP_LOGI(TAG, "registered MQTT trigger runtime for %s (%u rules)", entry->device_id, tpl->rule_count);
@@ -609,13 +1172,17 @@ static esp_err_t register_flag_runtime(const dm_flag_trigger_template_t *tpl, co
     if (!tpl || tpl->rule_count == 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    flag_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    if (!flag_index_ready(tpl->rule_count)) {
+        return ESP_ERR_NO_MEM;
+    }
+    flag_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_flag_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for flag trigger runtime");
         return ESP_ERR_NO_MEM;
     }
     dm_str_copy(entry->device_id, sizeof(entry->device_id), device_id);
     dm_flag_trigger_runtime_init(&entry->runtime, tpl);
+    link_flag_entry(entry);
     entry->next = s_flag_entries;
     s_flag_entries = entry;
     ESP_LOGI(TAG, "registered flag trigger runtime for %s (%u rules)", entry->device_id, tpl->rule_count);
@@ -627,13 +1194,17 @@ static esp_err_t register_condition_runtime(const dm_condition_template_t *tpl,
     if (!tpl || tpl->rule_count == 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    condition_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    if (!flag_index_ready(tpl->rule_count)) {
+        return ESP_ERR_NO_MEM;
+    }
+    condition_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_condition_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for condition runtime");
         return ESP_ERR_NO_MEM;
     }
     dm_str_copy(entry->device_id, sizeof(entry->device_id), device_id);
     dm_condition_runtime_init(&entry->runtime, tpl);
+    link_condition_entry(entry);
     entry->next = s_condition_entries;
     s_condition_entries = entry;
     ESP_LOGI(TAG, "registered condition runtime for %s (%u rules)", entry->device_id, tpl->rule_count);
@@ -666,36 +1237,15 @@ static esp_err_t register_interval_runtime(const dm_interval_task_template_t *tp
     if (!tpl || tpl->interval_ms == 0 || !tpl->scenario[0]) {
         return ESP_ERR_INVALID_ARG;
     }
-    interval_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    interval_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_interval_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for interval runtime");
         return ESP_ERR_NO_MEM;
     }
     dm_str_copy(entry->device_id, sizeof(entry->device_id), device_id);
     dm_interval_task_runtime_init(&entry->runtime, tpl);
-    esp_timer_create_args_t args = {
-        .callback = interval_timer_callback,
-        .arg = entry,
-        .name = "dm_interval",
-        .dispatch_method = ESP_TIMER_TASK,
-    };
-    esp_err_t err = esp_timer_create(&args, &entry->timer);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "interval timer create failed: %s", esp_err_to_name(err));
-        heap_caps_free(entry);
-        return err;
-    }
-    uint64_t interval_us = (uint64_t)entry->runtime.config.interval_ms * 1000ULL;
-    if (interval_us < 1000ULL) {
-        interval_us = 1000ULL;
-    }
-    err = esp_timer_start_periodic(entry->timer, interval_us);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "interval timer start failed: %s", esp_err_to_name(err));
-        esp_timer_delete(entry->timer);
-        heap_caps_free(entry);
-        return err;
-    }
+    dm_runtime_timer_init(&entry->timer, interval_timer_callback, entry);
+    dm_runtime_scheduler_arm(&entry->timer, entry->runtime.config.interval_ms, entry->runtime.config.interval_ms);
     entry->next = s_interval_entries;
     s_interval_entries = entry;
     ESP_LOGI(TAG, "registered interval runtime for %s every %u ms",
@@ -709,29 +1259,30 @@ static esp_err_t register_sequence_runtime(const dm_sequence_template_t *tpl, co
     if (!tpl || tpl->step_count == 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    sequence_runtime_entry_t *entry = runtime_alloc(sizeof(*entry));
+    if (!topic_index_ready()) {
+        return ESP_ERR_NO_MEM;
+    }
+    sequence_runtime_entry_t *entry = dm_runtime_arena_alloc(&s_sequence_arena);
     if (!entry) {
         ESP_LOGE(TAG, "no memory for sequence runtime");
         return ESP_ERR_NO_MEM;
     }
     dm_str_copy(entry->device_id, sizeof(entry->device_id), device_id);
     dm_sequence_runtime_init(&entry->runtime, tpl);
-    entry->timeout_timer = NULL;
+    dm_runtime_timer_init(&entry->timeout_timer, sequence_timeout_timer_cb, entry);
     entry->last_event = DM_SEQUENCE_EVENT_NONE;
     entry->last_timeout = false;
-    const esp_timer_create_args_t args = {
-        .callback = sequence_timeout_timer_cb,
-        .arg = entry,
-        .name = "dm_sequence_timeout",
-    };
-    esp_err_t timer_err = esp_timer_create(&args, &entry->timeout_timer);
-    if (timer_err != ESP_OK) {
-        ESP_LOGE(TAG, "sequence timer create failed for %s: %s",
-                 device_id,
-                 esp_err_to_name(timer_err));
-        heap_caps_free(entry);
-        return timer_err;
+    for (uint8_t i = 0; i < tpl->step_count && i < DM_SEQUENCE_TEMPLATE_MAX_STEPS; ++i) {
+        const char *step_topic = tpl->steps[i].topic;
+        entry->step_topics[i] = topic_intern_acquire(step_topic);
+        if (step_topic[0] && entry->step_topics[i] == TOPIC_ID_NONE) {
+            entry->unindexed = true;
+        }
+    }
+    if (entry->unindexed) {
+        ESP_LOGW(TAG, "sequence %s: step topics not interned, matching every message", entry->device_id);
     }
+    link_sequence_entry(entry);
     entry->next = s_sequence_entries;
     s_sequence_entries = entry;
     ESP_LOGI(TAG, "registered sequence runtime for %s (%u steps)",
@@ -740,11 +1291,8 @@ static esp_err_t register_sequence_runtime(const dm_sequence_template_t *tpl, co
     return ESP_OK;
 }
 
-esp_err_t dm_template_runtime_register(const dm_template_config_t *tpl, const char *device_id)
+static esp_err_t register_template(const dm_template_config_t *tpl, const char *device_id)
 {
-    if (!tpl || !device_id) {
-        return ESP_ERR_INVALID_ARG;
-    }
     switch (tpl->type) {
     case DM_TEMPLATE_TYPE_UID:
         return register_uid_runtime(&tpl->data.uid, device_id);
@@ -765,13 +1313,336 @@ esp_err_t dm_template_runtime_register(const dm_template_config_t *tpl, const ch
     }
 }
 
-esp_err_t dm_template_runtime_get_uid_snapshot(const char *device_id, dm_uid_runtime_snapshot_t *out)
+esp_err_t dm_template_runtime_register(const dm_template_config_t *tpl, const char *device_id)
 {
-    if (!device_id || !out) {
+    if (!tpl || !device_id) {
         return ESP_ERR_INVALID_ARG;
     }
-    memset(out, 0, sizeof(*out));
-    for (uid_runtime_entry_t *entry = s_uid_entries; entry; entry = entry->next) {
+    dm_runtime_scheduler_lock();
+    esp_err_t err = register_template(tpl, device_id);
+    dm_runtime_scheduler_unlock();
+    return err;
+}
+
+// Записи одного устройства, снятые со списков на время замены шаблона.
+typedef struct {
+    uid_runtime_entry_t *uid;
+    signal_runtime_entry_t *signal;
+    mqtt_runtime_entry_t *mqtt;
+    flag_runtime_entry_t *flag;
+    condition_runtime_entry_t *condition;
+    interval_runtime_entry_t *interval;
+    sequence_runtime_entry_t *sequence;
+} device_entries_t;
+
+#define DETACH_DEVICE_ENTRIES(type, list, out, device_id)      \
+    do {                                                       \
+        type **link_ = &(list);                                \
+        while (*link_) {                                       \
+            type *entry_ = *link_;                             \
+            if (strcmp(entry_->device_id, (device_id)) == 0) { \
+                *link_ = entry_->next;                         \
+                entry_->next = (out);                          \
+                (out) = entry_;                                \
+            } else {                                           \
+                link_ = &entry_->next;                         \
+            }                                                  \
+        }                                                      \
+    } while (0)
+
+static bool detach_device_entries(const char *device_id, device_entries_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    DETACH_DEVICE_ENTRIES(uid_runtime_entry_t, s_uid_entries, out->uid, device_id);
+    DETACH_DEVICE_ENTRIES(signal_runtime_entry_t, s_signal_entries, out->signal, device_id);
+    DETACH_DEVICE_ENTRIES(mqtt_runtime_entry_t, s_mqtt_entries, out->mqtt, device_id);
+    DETACH_DEVICE_ENTRIES(flag_runtime_entry_t, s_flag_entries, out->flag, device_id);
+    DETACH_DEVICE_ENTRIES(condition_runtime_entry_t, s_condition_entries, out->condition, device_id);
+    DETACH_DEVICE_ENTRIES(interval_runtime_entry_t, s_interval_entries, out->interval, device_id);
+    DETACH_DEVICE_ENTRIES(sequence_runtime_entry_t, s_sequence_entries, out->sequence, device_id);
+    return out->uid || out->signal || out->mqtt || out->flag || out->condition || out->interval || out->sequence;
+}
+
+static void free_device_entries(device_entries_t *entries)
+{
+    free_uid_list(entries->uid);
+    free_signal_list(entries->signal);
+    free_mqtt_list(entries->mqtt);
+    free_flag_list(entries->flag);
+    free_condition_list(entries->condition);
+    free_interval_list(entries->interval);
+    free_sequence_list(entries->sequence);
+    memset(entries, 0, sizeof(*entries));
+}
+
+// Списки обходятся с хвоста: ссылки индекса добавляются в голову, и порядок обработки
+// остается порядком списков, как после регистрации. Записей не больше, чем устройств.
+static void relink_uid_entries(uid_runtime_entry_t *entry)
+{
+    if (entry) {
+        relink_uid_entries(entry->next);
+        entry->index_ref_count = 0;
+        link_uid_entry(entry);
+    }
+}
+
+static void relink_signal_entries(signal_runtime_entry_t *entry)
+{
+    if (entry) {
+        relink_signal_entries(entry->next);
+        entry->index_ref_count = 0;
+        link_signal_entry(entry);
+    }
+}
+
+static void relink_mqtt_entries(mqtt_runtime_entry_t *entry)
+{
+    if (entry) {
+        relink_mqtt_entries(entry->next);
+        entry->index_ref_count = 0;
+        link_mqtt_entry(entry);
+    }
+}
+
+static void relink_flag_entries(flag_runtime_entry_t *entry)
+{
+    if (entry) {
+        relink_flag_entries(entry->next);
+        entry->index_ref_count = 0;
+        link_flag_entry(entry);
+    }
+}
+
+static void relink_condition_entries(condition_runtime_entry_t *entry)
+{
+    if (entry) {
+        relink_condition_entries(entry->next);
+        entry->index_ref_count = 0;
+        link_condition_entry(entry);
+    }
+}
+
+static void relink_sequence_entries(sequence_runtime_entry_t *entry)
+{
+    if (entry) {
+        relink_sequence_entries(entry->next);
+        entry->index_ref_count = 0;
+        link_sequence_entry(entry);
+    }
+}
+
+// Индексы собираются заново из списков: снятые записи не должны остаться в цепочках.
+// Таблица флагов не растет: имен не больше, чем было до снятия плюс зарезервированные новой записью.
+static void relink_indexes(void)
+{
+    topic_index_clear();
+    flag_index_clear();
+    s_sequence_unindexed = 0;
+    relink_uid_entries(s_uid_entries);
+    relink_signal_entries(s_signal_entries);
+    relink_mqtt_entries(s_mqtt_entries);
+    relink_flag_entries(s_flag_entries);
+    relink_condition_entries(s_condition_entries);
+    relink_sequence_entries(s_sequence_entries);
+}
+
+// Перезапуск таймаута с оставшимся от last_ms временем, а не с полным интервалом.
+static void start_timer_remaining(dm_runtime_timer_t *timer, uint64_t last_ms, uint32_t timeout_ms)
+{
+    if (timeout_ms == 0) {
+        return;
+    }
+    uint64_t now_ms = (uint64_t)(esp_timer_get_time() / 1000);
+    uint64_t deadline_ms = last_ms + timeout_ms;
+    uint32_t left_ms = deadline_ms > now_ms ? (uint32_t)(deadline_ms - now_ms) : 0;
+    dm_runtime_scheduler_arm(timer, left_ms, 0);
+}
+
+static bool uid_slots_equal(const dm_uid_template_t *a, const dm_uid_template_t *b)
+{
+    if (a->slot_count != b->slot_count) {
+        return false;
+    }
+    for (uint8_t i = 0; i < a->slot_count && i < DM_UID_TEMPLATE_MAX_SLOTS; ++i) {
+        const dm_uid_slot_t *sa = &a->slots[i];
+        const dm_uid_slot_t *sb = &b->slots[i];
+        if (strcmp(sa->source_id, sb->source_id) != 0 || sa->value_count != sb->value_count) {
+            return false;
+        }
+        for (uint8_t v = 0; v < sa->value_count && v < DM_UID_TEMPLATE_MAX_VALUES; ++v) {
+            if (strcmp(sa->values[v], sb->values[v]) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Битовые карты UID привязаны к слотам и их значениям: при других слотах прогресс сбрасывается.
+static bool migrate_uid_entry(const uid_runtime_entry_t *old, uid_runtime_entry_t *entry)
+{
+    if (!uid_slots_equal(&old->runtime.config, &entry->runtime.config)) {
+        return false;
+    }
+    entry->runtime.state = old->runtime.state;
+    memcpy(entry->runtime.slots, old->runtime.slots, sizeof(entry->runtime.slots));
+    entry->last_action_event = old->last_action_event;
+    entry->last_action_ts_ms = old->last_action_ts_ms;
+    entry->last_start_ts_ms = old->last_start_ts_ms;
+    entry->last_bg_start_ts_ms = old->last_bg_start_ts_ms;
+    return true;
+}
+
+static bool migrate_signal_entry(const signal_runtime_entry_t *old, signal_runtime_entry_t *entry)
+{
+    if (strcmp(old->runtime.config.heartbeat_topic, entry->runtime.config.heartbeat_topic) != 0) {
+        return false;
+    }
+    entry->runtime.state = old->runtime.state;
+    entry->hold_started = old->hold_started;
+    entry->hold_paused = old->hold_paused;
+    entry->hold_active = old->hold_active;
+    if (entry->runtime.state.active && !entry->runtime.state.finished) {
+        start_timer_remaining(&entry->timeout_timer, entry->runtime.state.last_tick_ms,
+                              signal_timeout_interval_ms(entry));
+    }
+    return true;
+}
+
+static bool sequence_steps_equal(const dm_sequence_template_t *a, const dm_sequence_template_t *b)
+{
+    if (a->step_count != b->step_count) {
+        return false;
+    }
+    for (uint8_t i = 0; i < a->step_count && i < DM_SEQUENCE_TEMPLATE_MAX_STEPS; ++i) {
+        const dm_sequence_step_t *sa = &a->steps[i];
+        const dm_sequence_step_t *sb = &b->steps[i];
+        if (strcmp(sa->topic, sb->topic) != 0 || strcmp(sa->payload, sb->payload) != 0 ||
+            sa->payload_required != sb->payload_required) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Подсказки, сценарии и таймаут могут меняться: номер шага остается верным при тех же шагах.
+static bool migrate_sequence_entry(const sequence_runtime_entry_t *old, sequence_runtime_entry_t *entry)
+{
+    if (!sequence_steps_equal(&old->runtime.config, &entry->runtime.config)) {
+        return false;
+    }
+    entry->runtime.current_index = old->runtime.current_index;
+    entry->runtime.last_step_ms = old->runtime.last_step_ms;
+    entry->last_event = old->last_event;
+    entry->last_timeout = old->last_timeout;
+    if (entry->runtime.current_index > 0) {
+        start_timer_remaining(&entry->timeout_timer, entry->runtime.last_step_ms, entry->runtime.config.timeout_ms);
+    }
+    return true;
+}
+
+// Правила флагов переносят последнее состояние по имени флага, а не по номеру правила.
+static bool migrate_flag_entry(const flag_runtime_entry_t *old, flag_runtime_entry_t *entry)
+{
+    bool migrated = false;
+    for (uint8_t i = 0; i < entry->runtime.config.rule_count && i < DM_FLAG_TRIGGER_MAX_RULES; ++i) {
+        for (uint8_t j = 0; j < old->runtime.config.rule_count && j < DM_FLAG_TRIGGER_MAX_RULES; ++j) {
+            if (old->runtime.rules[j].valid &&
+                strcasecmp(old->runtime.config.rules[j].flag, entry->runtime.config.rules[i].flag) == 0) {
+                entry->runtime.rules[i].valid = true;
+                entry->runtime.rules[i].last_state = old->runtime.rules[j].last_state;
+                migrated = true;
+                break;
+            }
+        }
+    }
+    return migrated;
+}
+
+static bool migrate_condition_entry(const condition_runtime_entry_t *old, condition_runtime_entry_t *entry)
+{
+    bool migrated = false;
+    for (uint8_t i = 0; i < entry->runtime.config.rule_count && i < DM_CONDITION_TEMPLATE_MAX_RULES; ++i) {
+        for (uint8_t j = 0; j < old->runtime.config.rule_count && j < DM_CONDITION_TEMPLATE_MAX_RULES; ++j) {
+            if (old->runtime.rules[j].valid && strcasecmp(old->runtime.rules[j].flag, entry->runtime.rules[i].flag) == 0) {
+                dm_condition_runtime_set_rule(&entry->runtime, i, old->runtime.rules[j].state);
+                migrated = true;
+                break;
+            }
+        }
+    }
+    if (migrated) {
+        // Сценарий запустится на следующем флаге, если результат по новым правилам другой.
+        entry->runtime.has_last_result = old->runtime.has_last_result;
+        entry->runtime.last_result = old->runtime.last_result;
+    }
+    return migrated;
+}
+
+// register_* кладет новую запись в голову списка; старые записи того же вида уже сняты.
+static bool migrate_device_state(const device_entries_t *old, const char *device_id)
+{
+    if (old->uid && s_uid_entries && strcmp(s_uid_entries->device_id, device_id) == 0) {
+        return migrate_uid_entry(old->uid, s_uid_entries);
+    }
+    if (old->signal && s_signal_entries && strcmp(s_signal_entries->device_id, device_id) == 0) {
+        return migrate_signal_entry(old->signal, s_signal_entries);
+    }
+    if (old->flag && s_flag_entries && strcmp(s_flag_entries->device_id, device_id) == 0) {
+        return migrate_flag_entry(old->flag, s_flag_entries);
+    }
+    if (old->condition && s_condition_entries && strcmp(s_condition_entries->device_id, device_id) == 0) {
+        return migrate_condition_entry(old->condition, s_condition_entries);
+    }
+    if (old->sequence && s_sequence_entries && strcmp(s_sequence_entries->device_id, device_id) == 0) {
+        return migrate_sequence_entry(old->sequence, s_sequence_entries);
+    }
+    return false;
+}
+
+esp_err_t dm_template_runtime_replace(const dm_template_config_t *tpl, const char *device_id)
+{
+    if (!tpl || !device_id || !device_id[0]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dm_runtime_scheduler_lock();
+    device_entries_t old;
+    bool existed = detach_device_entries(device_id, &old);
+    // Снятые записи остаются в цепочках индексов до relink_indexes и освобождаются только после нее.
+    esp_err_t err = register_template(tpl, device_id);
+    bool migrated = err == ESP_OK && existed && migrate_device_state(&old, device_id);
+    relink_indexes();
+    free_device_entries(&old);
+    dm_runtime_scheduler_unlock();
+    if (existed && err == ESP_OK) {
+        ESP_LOGI(TAG, "replaced runtime for %s (state %s)", device_id, migrated ? "kept" : "reset");
+    }
+    return err;
+}
+
+esp_err_t dm_template_runtime_unregister(const char *device_id)
+{
+    if (!device_id || !device_id[0]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dm_runtime_scheduler_lock();
+    device_entries_t old;
+    bool existed = detach_device_entries(device_id, &old);
+    if (existed) {
+        relink_indexes();
+        free_device_entries(&old);
+    }
+    dm_runtime_scheduler_unlock();
+    if (!existed) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "unregistered runtime for %s", device_id);
+    return ESP_OK;
+}
+
+static esp_err_t get_uid_snapshot_locked(const char *device_id, dm_uid_runtime_snapshot_t *out)
+{
+    for (uid_runtime_entry_t *entry = s_uid_entries; entry; entry = entry->next) {
         if (strcmp(entry->device_id, device_id) != 0) {
             continue;
         }
@@ -795,17 +1666,24 @@ esp_err_t dm_template_runtime_get_uid_snapshot(const char *device_id, dm_uid_run
     return ESP_ERR_NOT_FOUND;
 }
 
+esp_err_t dm_template_runtime_get_uid_snapshot(const char *device_id, dm_uid_runtime_snapshot_t *out)
+{
+    if (!device_id || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(out, 0, sizeof(*out));
+    dm_runtime_scheduler_lock();
+    esp_err_t err = get_uid_snapshot_locked(device_id, out);
+    dm_runtime_scheduler_unlock();
+    return err;
+}
+
 static void publish_mqtt_payload(const char *topic, const char *payload)
 {
     if (!topic || !topic[0]) {
         return;
     }
-    const char *body = (payload && payload[0]) ? payload : "";
-    esp_err_t err = mqtt_core_publish(topic, body);
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "mqtt publish failed (%s): %s", topic, esp_err_to_name(err));
-        return;
-    }
+    runtime_effect_push(RUNTIME_EFFECT_PUBLISH, topic, payload, -1.0f);
 }
 
 static bool payload_matches(const char *expected, const char *actual)
@@ -827,12 +1705,12 @@ static void reset_uid_entry(uid_runtime_entry_t *entry)
     dm_uid_runtime_reset(&entry->runtime);
 }
 
-static bool handle_uid_bg_start_event(uid_runtime_entry_t *entry, const char *topic)
+static bool handle_uid_bg_start_event(uid_runtime_entry_t *entry, const char *topic, topic_id_t topic_id)
 {
-    if (!entry || !entry->bg_start_topic[0] || !topic) {
+    if (!entry || entry->bg_start_topic == TOPIC_ID_NONE || !topic) {
         return false;
     }
-    if (strcmp(entry->bg_start_topic, topic) != 0) {
+    if (entry->bg_start_topic != topic_id) {
         return false;
     }
     if (!entry->runtime.config.bg_track[0]) {
@@ -860,19 +1738,22 @@ static bool handle_uid_bg_start_event(uid_runtime_entry_t *entry, const char *to
              entry->device_id,
              topic,
              entry->runtime.config.bg_track);
-    audio_player_play(entry->runtime.config.bg_track);
+    runtime_audio_play(entry->runtime.config.bg_track, -1.0f);
     return true;
 }
 
-static bool handle_uid_start_event(uid_runtime_entry_t *entry, const char *topic, const char *payload)
+static bool handle_uid_start_event(uid_runtime_entry_t *entry,
+                                   const char *topic,
+                                   topic_id_t topic_id,
+                                   const char *payload)
 {
-    if (!entry || !entry->start_topic[0] || !topic) {
+    if (!entry || entry->start_topic == TOPIC_ID_NONE || !topic) {
         return false;
     }
-    if (strcmp(entry->start_topic, topic) != 0) {
+    if (entry->start_topic != topic_id) {
         return false;
     }
-    if (!payload_matches(entry->start_payload, payload)) {
+    if (!payload_matches(entry->runtime.config.start_payload, payload)) {
         return false;
     }
     uint64_t now_ms = (uint64_t)(esp_timer_get_time() / 1000);
@@ -894,8 +1775,8 @@ static bool handle_uid_start_event(uid_runtime_entry_t *entry, const char *topic
              topic,
              payload ? payload : "");
     reset_uid_entry(entry);
-    if (entry->broadcast_topic[0]) {
-        publish_mqtt_payload(entry->broadcast_topic, entry->broadcast_payload);
+    if (entry->runtime.config.broadcast_topic[0]) {
+        publish_mqtt_payload(entry->runtime.config.broadcast_topic, entry->runtime.config.broadcast_payload);
     }
     return true;
 }
@@ -936,7 +1817,7 @@ static void apply_uid_action(uid_runtime_entry_t *entry, const dm_uid_action_t *
         if (entry && action->event == DM_UID_EVENT_INVALID) {
             uid_audio_resume_arm(action->audio_track, entry->runtime.config.bg_track);
         }
-        audio_player_play(action->audio_track);
+        runtime_audio_play(action->audio_track, -1.0f);
     }
     if (entry) {
         if (action->event == DM_UID_EVENT_SUCCESS) {
@@ -967,34 +1848,36 @@ static bool uid_action_is_duplicate(uid_runtime_entry_t *entry, dm_uid_event_typ
     return false;
 }
 
-static bool handle_uid_message(const char *topic, const char *payload)
+static bool handle_uid_message(uid_runtime_entry_t *entry,
+                               uint32_t slot_mask,
+                               const char *topic,
+                               topic_id_t topic_id,
+                               const char *payload)
 {
     bool handled = false;
     const char *body = payload ? payload : "";
-    for (uid_runtime_entry_t *entry = s_uid_entries; entry; entry = entry->next) {
-        if (handle_uid_bg_start_event(entry, topic)) {
-            handled = true;
-        }
-        if (handle_uid_start_event(entry, topic, body)) {
-            handled = true;
+    if (handle_uid_bg_start_event(entry, topic, topic_id)) {
+        handled = true;
+    }
+    if (handle_uid_start_event(entry, topic, topic_id, body)) {
+        return true;
+    }
+    for (size_t t = 0; t < entry->topic_count; ++t) {
+        if (!(slot_mask & (1u << t))) {
             continue;
         }
-        for (size_t t = 0; t < entry->topic_count; ++t) {
-            if (entry->topics[t][0] && strcmp(entry->topics[t], topic) == 0) {
-                handled = true;
-                dm_uid_action_t action = dm_uid_runtime_handle_value(&entry->runtime, topic, body);
-                ESP_LOGD(TAG, "[UID] dev=%s topic=%s event=%s payload='%s'",
-                         entry->device_id,
-                         topic,
-                         uid_event_str(action.event),
-                         body);
-                if (uid_action_is_duplicate(entry, action.event)) {
-                    ESP_LOGD(TAG, "[UID] dev=%s suppress duplicate event=%s", entry->device_id, uid_event_str(action.event));
-                    continue;
-                }
-                apply_uid_action(entry, &action);
-            }
+        handled = true;
+        dm_uid_action_t action = dm_uid_runtime_handle_value(&entry->runtime, topic, body);
+        ESP_LOGD(TAG, "[UID] dev=%s topic=%s event=%s payload='%s'",
+                 entry->device_id,
+                 topic,
+                 uid_event_str(action.event),
+                 body);
+        if (uid_action_is_duplicate(entry, action.event)) {
+            ESP_LOGD(TAG, "[UID] dev=%s suppress duplicate event=%s", entry->device_id, uid_event_str(action.event));
+            continue;
         }
+        apply_uid_action(entry, &action);
     }
     return handled;
 }
@@ -1008,20 +1891,15 @@ static void handle_signal_audio(signal_runtime_entry_t *entry, dm_signal_event_t
     switch (ev) {
     case DM_SIGNAL_EVENT_START:
         if (!entry->hold_started) {
-            if (audio_player_play(cfg->hold_track) == ESP_OK) {
-                if (diagnostics_verbose_enabled()) {
-                    ESP_LOGI(TAG, "[Signal] dev=%s hold track play %s", entry->device_id, cfg->hold_track);
-                }
-            } else {
-                if (diagnostics_verbose_enabled()) {
-                    ESP_LOGW(TAG, "[Signal] dev=%s failed to play hold track %s", entry->device_id, cfg->hold_track);
-                }
+            runtime_audio_play(cfg->hold_track, -1.0f);
+            if (diagnostics_verbose_enabled()) {
+                ESP_LOGI(TAG, "[Signal] dev=%s hold track play %s", entry->device_id, cfg->hold_track);
             }
             entry->hold_started = true;
             entry->hold_paused = false;
             entry->hold_active = true;
         } else if (entry->hold_paused) {
-            audio_player_resume();
+            runtime_audio(RUNTIME_EFFECT_AUDIO_RESUME);
             if (diagnostics_verbose_enabled()) {
                 ESP_LOGI(TAG, "[Signal] dev=%s hold track resume %s", entry->device_id, cfg->hold_track);
             }
@@ -1031,7 +1909,7 @@ static void handle_signal_audio(signal_runtime_entry_t *entry, dm_signal_event_t
         break;
     case DM_SIGNAL_EVENT_STOP:
         if (entry->hold_active) {
-            audio_player_pause();
+            runtime_audio(RUNTIME_EFFECT_AUDIO_PAUSE);
             if (diagnostics_verbose_enabled()) {
                 ESP_LOGI(TAG, "[Signal] dev=%s hold track pause %s", entry->device_id, cfg->hold_track);
             }
@@ -1041,7 +1919,7 @@ static void handle_signal_audio(signal_runtime_entry_t *entry, dm_signal_event_t
         break;
     case DM_SIGNAL_EVENT_COMPLETED:
         if (entry->hold_active || entry->hold_paused) {
-            audio_player_stop();
+            runtime_audio(RUNTIME_EFFECT_AUDIO_STOP);
             if (diagnostics_verbose_enabled()) {
                 ESP_LOGI(TAG, "[Signal] dev=%s hold track stop %s", entry->device_id, cfg->hold_track);
             }
@@ -1050,14 +1928,9 @@ static void handle_signal_audio(signal_runtime_entry_t *entry, dm_signal_event_t
         entry->hold_paused = false;
         entry->hold_active = false;
         if (cfg->complete_track[0]) {
-            if (audio_player_play(cfg->complete_track) == ESP_OK) {
-                if (diagnostics_verbose_enabled()) {
-                    ESP_LOGI(TAG, "[Signal] dev=%s complete track %s", entry->device_id, cfg->complete_track);
-                }
-            } else {
-                if (diagnostics_verbose_enabled()) {
-                    ESP_LOGW(TAG, "[Signal] dev=%s failed to play complete track %s", entry->device_id, cfg->complete_track);
-                }
+            runtime_audio_play(cfg->complete_track, -1.0f);
+            if (diagnostics_verbose_enabled()) {
+                ESP_LOGI(TAG, "[Signal] dev=%s complete track %s", entry->device_id, cfg->complete_track);
             }
         }
         break;
@@ -1100,7 +1973,7 @@ static void apply_sequence_step_hint(const dm_sequence_step_t *step)
         publish_mqtt_payload(step->hint_topic, step->hint_payload);
     }
     if (step->hint_audio_track[0]) {
-        audio_player_play(step->hint_audio_track);
+        runtime_audio_play(step->hint_audio_track, -1.0f);
     }
 }
 
@@ -1112,7 +1985,7 @@ static void apply_sequence_success(sequence_runtime_entry_t *entry)
     const dm_sequence_template_t *cfg = &entry->runtime.config;
     publish_mqtt_payload(cfg->success_topic, cfg->success_payload);
     if (cfg->success_audio_track[0]) {
-        audio_player_play(cfg->success_audio_track);
+        runtime_audio_play(cfg->success_audio_track, -1.0f);
     }
     trigger_device_scenario(entry->device_id, cfg->success_scenario);
 }
@@ -1125,7 +1998,7 @@ static void apply_sequence_fail(sequence_runtime_entry_t *entry)
     const dm_sequence_template_t *cfg = &entry->runtime.config;
     publish_mqtt_payload(cfg->fail_topic, cfg->fail_payload);
     if (cfg->fail_audio_track[0]) {
-        audio_player_play(cfg->fail_audio_track);
+        runtime_audio_play(cfg->fail_audio_track, -1.0f);
     }
     trigger_device_scenario(entry->device_id, cfg->fail_scenario);
 }
@@ -1141,33 +2014,20 @@ static void reset_sequence_entry(sequence_runtime_entry_t *entry)
     entry->last_timeout = false;
 }
 
-static uint64_t sequence_timeout_interval_us(const sequence_runtime_entry_t *entry)
-{
-    if (!entry) {
-        return 0;
-    }
-    return entry->runtime.config.timeout_ms ? ((uint64_t)entry->runtime.config.timeout_ms * 1000ULL) : 0;
-}
-
 static void restart_sequence_timeout_timer(sequence_runtime_entry_t *entry)
 {
-    if (!entry || !entry->timeout_timer) {
-        return;
-    }
-    uint64_t timeout_us = sequence_timeout_interval_us(entry);
-    if (timeout_us == 0) {
+    if (!entry || entry->runtime.config.timeout_ms == 0) {
         return;
     }
-    esp_timer_stop(entry->timeout_timer);
-    esp_timer_start_once(entry->timeout_timer, timeout_us);
+    dm_runtime_scheduler_arm(&entry->timeout_timer, entry->runtime.config.timeout_ms, 0);
 }
 
 static void stop_sequence_timeout_timer(sequence_runtime_entry_t *entry)
 {
-    if (!entry || !entry->timeout_timer) {
+    if (!entry) {
         return;
     }
-    esp_timer_stop(entry->timeout_timer);
+    dm_runtime_scheduler_cancel(&entry->timeout_timer);
 }
 
 static void sequence_timeout_timer_cb(void *arg)
@@ -1205,76 +2065,67 @@ static const char *sequence_state_str(const sequence_runtime_entry_t *entry)
     return "idle";
 }
 
-static bool handle_sequence_message(const char *topic, const char *payload)
+static bool handle_sequence_message(sequence_runtime_entry_t *entry, const char *topic, const char *payload)
 {
-    if (!topic || !topic[0]) {
+    if (!topic[0]) {
         return false;
     }
-    bool handled = false;
     uint64_t now_ms = (uint64_t)(esp_timer_get_time() / 1000);
-    for (sequence_runtime_entry_t *entry = s_sequence_entries; entry; entry = entry->next) {
-        dm_sequence_action_t action =
-            dm_sequence_runtime_handle(&entry->runtime, topic, payload, now_ms);
-        if (action.type == DM_SEQUENCE_EVENT_NONE && !action.step) {
-            continue;
+    dm_sequence_action_t action = dm_sequence_runtime_handle(&entry->runtime, topic, payload, now_ms);
+    if (action.type == DM_SEQUENCE_EVENT_NONE && !action.step) {
+        return false;
+    }
+    const char *step_topic = action.step && action.step->topic[0] ? action.step->topic : topic;
+    switch (action.type) {
+    case DM_SEQUENCE_EVENT_STEP_OK:
+        entry->last_event = action.type;
+        entry->last_timeout = false;
+        ESP_LOGI(TAG, "[Sequence] dev=%s step ok topic=%s payload='%s'",
+                 entry->device_id,
+                 step_topic,
+                 payload ? payload : "");
+        restart_sequence_timeout_timer(entry);
+        if (action.step) {
+            apply_sequence_step_hint(action.step);
         }
-        handled = true;
-        const char *step_topic = action.step && action.step->topic[0] ? action.step->topic : topic;
-        switch (action.type) {
-        case DM_SEQUENCE_EVENT_STEP_OK:
-            entry->last_event = action.type;
-            entry->last_timeout = false;
-            ESP_LOGI(TAG, "[Sequence] dev=%s step ok topic=%s payload='%s'",
-                     entry->device_id,
-                     step_topic,
-                     payload ? payload : "");
-            restart_sequence_timeout_timer(entry);
-            if (action.step) {
-                apply_sequence_step_hint(action.step);
-            }
-            break;
-        case DM_SEQUENCE_EVENT_COMPLETED:
-            entry->last_event = action.type;
-            entry->last_timeout = false;
-            ESP_LOGI(TAG, "[Sequence] dev=%s completed topic=%s payload='%s'",
-                     entry->device_id,
-                     step_topic,
-                     payload ? payload : "");
-            stop_sequence_timeout_timer(entry);
-            if (action.step) {
-                apply_sequence_step_hint(action.step);
-            }
-            apply_sequence_success(entry);
-            break;
-        case DM_SEQUENCE_EVENT_FAILED:
-            entry->last_event = action.type;
-            entry->last_timeout = action.timeout;
-            ESP_LOGW(TAG, "[Sequence] dev=%s failed topic=%s payload='%s'%s",
-                     entry->device_id,
-                     step_topic,
-                     payload ? payload : "",
-                     action.timeout ? " (timeout)" : "");
-            stop_sequence_timeout_timer(entry);
-            apply_sequence_fail(entry);
-            break;
-        case DM_SEQUENCE_EVENT_NONE:
-        default:
-            ESP_LOGD(TAG, "[Sequence] dev=%s ignored topic=%s payload='%s'",
-                     entry->device_id,
-                     step_topic,
-                     payload ? payload : "");
-            break;
+        break;
+    case DM_SEQUENCE_EVENT_COMPLETED:
+        entry->last_event = action.type;
+        entry->last_timeout = false;
+        ESP_LOGI(TAG, "[Sequence] dev=%s completed topic=%s payload='%s'",
+                 entry->device_id,
+                 step_topic,
+                 payload ? payload : "");
+        stop_sequence_timeout_timer(entry);
+        if (action.step) {
+            apply_sequence_step_hint(action.step);
         }
+        apply_sequence_success(entry);
+        break;
+    case DM_SEQUENCE_EVENT_FAILED:
+        entry->last_event = action.type;
+        entry->last_timeout = action.timeout;
+        ESP_LOGW(TAG, "[Sequence] dev=%s failed topic=%s payload='%s'%s",
+                 entry->device_id,
+                 step_topic,
+                 payload ? payload : "",
+                 action.timeout ? " (timeout)" : "");
+        stop_sequence_timeout_timer(entry);
+        apply_sequence_fail(entry);
+        break;
+    case DM_SEQUENCE_EVENT_NONE:
+    default:
+        ESP_LOGD(TAG, "[Sequence] dev=%s ignored topic=%s payload='%s'",
+                 entry->device_id,
+                 step_topic,
+                 payload ? payload : "");
+        break;
     }
-    return handled;
+    return true;
 }
 
-esp_err_t dm_template_runtime_get_sequence_snapshot(const char *device_id, dm_sequence_runtime_snapshot_t *out)
+static esp_err_t get_sequence_snapshot_locked(const char *device_id, dm_sequence_runtime_snapshot_t *out)
 {
-    if (!device_id || !out) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    memset(out, 0, sizeof(*out));
     for (sequence_runtime_entry_t *entry = s_sequence_entries; entry; entry = entry->next) {
         if (strcmp(entry->device_id, device_id) != 0) {
             continue;
@@ -1306,12 +2157,20 @@ esp_err_t dm_template_runtime_get_sequence_snapshot(const char *device_id, dm_se
     return ESP_ERR_NOT_FOUND;
 }
 
-esp_err_t dm_template_runtime_get_signal_snapshot(const char *device_id, dm_signal_runtime_snapshot_t *out)
+esp_err_t dm_template_runtime_get_sequence_snapshot(const char *device_id, dm_sequence_runtime_snapshot_t *out)
 {
     if (!device_id || !out) {
         return ESP_ERR_INVALID_ARG;
     }
     memset(out, 0, sizeof(*out));
+    dm_runtime_scheduler_lock();
+    esp_err_t err = get_sequence_snapshot_locked(device_id, out);
+    dm_runtime_scheduler_unlock();
+    return err;
+}
+
+static esp_err_t get_signal_snapshot_locked(const char *device_id, dm_signal_runtime_snapshot_t *out)
+{
     for (signal_runtime_entry_t *entry = s_signal_entries; entry; entry = entry->next) {
         if (strcmp(entry->device_id, device_id) != 0) {
             continue;
@@ -1339,11 +2198,20 @@ esp_err_t dm_template_runtime_get_signal_snapshot(const char *device_id, dm_sign
     return ESP_ERR_NOT_FOUND;
 }
 
-esp_err_t dm_template_runtime_reset_signal(const char *device_id)
+esp_err_t dm_template_runtime_get_signal_snapshot(const char *device_id, dm_signal_runtime_snapshot_t *out)
 {
-    if (!device_id || !device_id[0]) {
+    if (!device_id || !out) {
         return ESP_ERR_INVALID_ARG;
     }
+    memset(out, 0, sizeof(*out));
+    dm_runtime_scheduler_lock();
+    esp_err_t err = get_signal_snapshot_locked(device_id, out);
+    dm_runtime_scheduler_unlock();
+    return err;
+}
+
+static esp_err_t reset_signal_locked(const char *device_id)
+{
     for (signal_runtime_entry_t *entry = s_signal_entries; entry; entry = entry->next) {
         if (strcmp(entry->device_id, device_id) != 0) {
             continue;
@@ -1355,11 +2223,19 @@ esp_err_t dm_template_runtime_reset_signal(const char *device_id)
     return ESP_ERR_NOT_FOUND;
 }
 
-esp_err_t dm_template_runtime_reset_sequence(const char *device_id)
+esp_err_t dm_template_runtime_reset_signal(const char *device_id)
 {
     if (!device_id || !device_id[0]) {
         return ESP_ERR_INVALID_ARG;
     }
+    dm_runtime_scheduler_lock();
+    esp_err_t err = reset_signal_locked(device_id);
+    dm_runtime_scheduler_unlock();
+    return err;
+}
+
+static esp_err_t reset_sequence_locked(const char *device_id)
+{
     for (sequence_runtime_entry_t *entry = s_sequence_entries; entry; entry = entry->next) {
         if (strcmp(entry->device_id, device_id) != 0) {
             continue;
@@ -1371,68 +2247,106 @@ esp_err_t dm_template_runtime_reset_sequence(const char *device_id)
     return ESP_ERR_NOT_FOUND;
 }
 
-static bool handle_signal_message(const char *topic, const char *payload)
+esp_err_t dm_template_runtime_reset_sequence(const char *device_id)
 {
-    bool handled = false;
+    if (!device_id || !device_id[0]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dm_runtime_scheduler_lock();
+    esp_err_t err = reset_sequence_locked(device_id);
+    dm_runtime_scheduler_unlock();
+    return err;
+}
+
+static bool handle_signal_message(signal_runtime_entry_t *entry,
+                                  const char *topic,
+                                  topic_id_t topic_id,
+                                  const char *payload)
+{
+    if (entry->reset_topic == topic_id) {
+        reset_signal_entry(entry, topic);
+        return true;
+    }
+    if (entry->heartbeat_topic != topic_id) {
+        return false;
+    }
     uint64_t now_ms = (uint64_t)(esp_timer_get_time() / 1000);
-    for (signal_runtime_entry_t *entry = s_signal_entries; entry; entry = entry->next) {
-        if (entry->reset_topic[0] && strcmp(entry->reset_topic, topic) == 0) {
-            handled = true;
-            reset_signal_entry(entry, topic);
-            continue;
-        }
-        if (entry->heartbeat_topic[0] && strcmp(entry->heartbeat_topic, topic) == 0) {
-            handled = true;
-            dm_signal_action_t action = dm_signal_runtime_handle_tick(&entry->runtime, now_ms);
-            if (action.event == DM_SIGNAL_EVENT_COMPLETED || action.event == DM_SIGNAL_EVENT_STOP) {
-                stop_signal_timeout_timer(entry);
-            } else if (action.event != DM_SIGNAL_EVENT_NONE) {
-                restart_signal_timeout_timer(entry);
-            }
-            if (diagnostics_verbose_enabled()) {
-                ESP_LOGI(TAG,
-                         "[Signal] dev=%s heartbeat topic=%s payload='%s' event=%s acc=%ums",
-                         entry->device_id,
-                         topic,
-                         payload ? payload : "",
-                         signal_event_str(action.event),
-                         (unsigned)action.accumulated_ms);
-            }
-            handle_signal_audio(entry, action.event);
-            apply_signal_mqtt_action(entry, &action);
-            if (action.event == DM_SIGNAL_EVENT_COMPLETED) {
-                trigger_uid_scenario(entry->device_id, "signal_complete");
-            }
-        }
+    dm_signal_action_t action = dm_signal_runtime_handle_tick(&entry->runtime, now_ms);
+    if (action.event == DM_SIGNAL_EVENT_COMPLETED || action.event == DM_SIGNAL_EVENT_STOP) {
+        stop_signal_timeout_timer(entry);
+    } else if (action.event != DM_SIGNAL_EVENT_NONE) {
+        restart_signal_timeout_timer(entry);
     }
-    return handled;
+    if (diagnostics_verbose_enabled()) {
+        ESP_LOGI(TAG,
+                 "[Signal] dev=%s heartbeat topic=%s payload='%s' event=%s acc=%ums",
+                 entry->device_id,
+                 topic,
+                 payload ? payload : "",
+                 signal_event_str(action.event),
+                 (unsigned)action.accumulated_ms);
+    }
+    handle_signal_audio(entry, action.event);
+    apply_signal_mqtt_action(entry, &action);
+    if (action.event == DM_SIGNAL_EVENT_COMPLETED) {
+        trigger_uid_scenario(entry->device_id, "signal_complete");
+    }
+    return true;
 }
 
-static bool handle_mqtt_trigger_message(const char *topic, const char *payload)
+static bool handle_mqtt_trigger_message(mqtt_runtime_entry_t *entry, const char *topic, const char *payload)
 {
-    bool handled = false;
-    for (mqtt_runtime_entry_t *entry = s_mqtt_entries; entry; entry = entry->next) {
-        const dm_mqtt_trigger_rule_t *rule =
-            dm_mqtt_trigger_runtime_match(&entry->runtime, topic, payload);
-        if (!rule) {
-            ESP_LOGD(TAG, "[MQTT trigger] dev=%s no match topic=%s payload='%s'",
-                     entry->device_id,
-                     topic,
-                     payload ? payload : "");
-            continue;
-        }
-        handled = true;
-        ESP_LOGI(TAG, "[MQTT trigger] dev=%s topic=%s scenario=%s payload='%s'",
+    const dm_mqtt_trigger_rule_t *rule = dm_mqtt_trigger_runtime_match(&entry->runtime, topic, payload);
+    if (!rule) {
+        ESP_LOGD(TAG, "[MQTT trigger] dev=%s no match topic=%s payload='%s'",
                  entry->device_id,
                  topic,
-                 rule->scenario,
                  payload ? payload : "");
-        esp_err_t err = request_scenario_trigger(entry->device_id, rule->scenario);
-        if (err != ESP_OK) {
-            ESP_LOGW(TAG, "scenario %s/%s failed: %s",
-                     entry->device_id,
-                     rule->scenario,
-                     esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(TAG, "[MQTT trigger] dev=%s topic=%s scenario=%s payload='%s'",
+             entry->device_id,
+             topic,
+             rule->scenario,
+             payload ? payload : "");
+    esp_err_t err = request_scenario_trigger(entry->device_id, rule->scenario);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "scenario %s/%s failed: %s",
+                 entry->device_id,
+                 rule->scenario,
+                 esp_err_to_name(err));
+    }
+    return true;
+}
+
+static bool handle_mqtt_interned(const char *topic, topic_id_t topic_id, const char *payload)
+{
+    if (!topic) {
+        return false;
+    }
+    bool handled = false;
+    // Все топики шаблонов интернированы при регистрации: топик без узла в индексе не слушает никто.
+    // Таймауты последовательностей отрабатывает их таймер, чужие топики им не нужны.
+    const topic_index_node_t *node = topic_index_find(topic_id);
+    if (node) {
+        for (index_ref_t *ref = node->refs[TOPIC_REF_UID]; ref; ref = ref->next) {
+            handled |= handle_uid_message(ref->entry, ref->mask, topic, topic_id, payload);
+        }
+        for (index_ref_t *ref = node->refs[TOPIC_REF_SIGNAL]; ref; ref = ref->next) {
+            handled |= handle_signal_message(ref->entry, topic, topic_id, payload);
+        }
+        for (index_ref_t *ref = node->refs[TOPIC_REF_MQTT]; ref; ref = ref->next) {
+            handled |= handle_mqtt_trigger_message(ref->entry, topic, payload);
+        }
+        for (index_ref_t *ref = node->refs[TOPIC_REF_SEQUENCE]; ref; ref = ref->next) {
+            handled |= handle_sequence_message(ref->entry, topic, payload);
+        }
+    }
+    if (s_sequence_unindexed) {
+        for (sequence_runtime_entry_t *entry = s_sequence_entries; entry; entry = entry->next) {
+            if (entry->unindexed) {
+                handled |= handle_sequence_message(entry, topic, payload);
+            }
         }
     }
     return handled;
@@ -1443,23 +2357,44 @@ bool dm_template_runtime_handle_mqtt(const char *topic, const char *payload)
     if (!topic) {
         return false;
     }
-    bool handled = false;
-    handled |= handle_uid_message(topic, payload);
-    handled |= handle_signal_message(topic, payload);
-    handled |= handle_mqtt_trigger_message(topic, payload);
-    handled |= handle_sequence_message(topic, payload);
+    dm_runtime_scheduler_lock();
+    bool handled = handle_mqtt_interned(topic, topic_intern_find(topic), payload);
+    dm_runtime_scheduler_unlock();
     return handled;
 }
 
-bool dm_template_runtime_handle_flag(const char *flag_name, bool state)
+static const dm_flag_trigger_rule_t *handle_flag_trigger_rules(flag_runtime_entry_t *entry,
+                                                               uint32_t rule_mask,
+                                                               bool state)
 {
-    if (!flag_name) {
+    for (uint8_t i = 0; i < DM_FLAG_TRIGGER_MAX_RULES; ++i) {
+        if (!(rule_mask & (1u << i))) {
+            continue;
+        }
+        // Как и поиск по имени: срабатывает первое правило, следующие ждут своего изменения.
+        const dm_flag_trigger_rule_t *rule = dm_flag_trigger_runtime_handle_rule(&entry->runtime, i, state);
+        if (rule) {
+            return rule;
+        }
+    }
+    return NULL;
+}
+
+static bool handle_flag_locked(const char *flag_name, bool state)
+{
+    char folded[DEVICE_MANAGER_FLAG_NAME_MAX_LEN];
+    uint32_t hash = 0;
+    if (!flag_fold(flag_name, folded, &hash)) {
+        return false;
+    }
+    const flag_index_node_t *node = flag_index_slot(folded, hash, false);
+    if (!node) {
         return false;
     }
     bool handled = false;
-    for (flag_runtime_entry_t *entry = s_flag_entries; entry; entry = entry->next) {
-        const dm_flag_trigger_rule_t *rule =
-            dm_flag_trigger_runtime_handle(&entry->runtime, flag_name, state);
+    for (index_ref_t *ref = node->refs[FLAG_REF_TRIGGER]; ref; ref = ref->next) {
+        flag_runtime_entry_t *entry = ref->entry;
+        const dm_flag_trigger_rule_t *rule = handle_flag_trigger_rules(entry, ref->mask, state);
         if (!rule) {
             continue;
         }
@@ -1477,26 +2412,41 @@ bool dm_template_runtime_handle_flag(const char *flag_name, bool state)
                      esp_err_to_name(err));
         }
     }
-    for (condition_runtime_entry_t *entry = s_condition_entries; entry; entry = entry->next) {
-        bool changed = false;
-        bool result = false;
-        if (dm_condition_runtime_handle_flag(&entry->runtime, flag_name, state, &changed, &result)) {
-            handled = true;
-            if (!changed) {
-                continue;
+    for (index_ref_t *ref = node->refs[FLAG_REF_CONDITION]; ref; ref = ref->next) {
+        condition_runtime_entry_t *entry = ref->entry;
+        handled = true;
+        for (uint8_t i = 0; i < DM_CONDITION_TEMPLATE_MAX_RULES; ++i) {
+            if (ref->mask & (1u << i)) {
+                dm_condition_runtime_set_rule(&entry->runtime, i, state);
             }
-            const char *scenario = result ? entry->runtime.config.true_scenario
-                                          : entry->runtime.config.false_scenario;
-            if (scenario[0]) {
-                esp_err_t err = request_scenario_trigger(entry->device_id, scenario);
-                if (err != ESP_OK) {
-                    ESP_LOGW(TAG, "if_condition trigger %s/%s failed: %s",
-                             entry->device_id,
-                             scenario,
-                             esp_err_to_name(err));
-                }
+        }
+        bool changed = false;
+        bool result = dm_condition_runtime_update_result(&entry->runtime, &changed);
+        if (!changed) {
+            continue;
+        }
+        const char *scenario = result ? entry->runtime.config.true_scenario
+                                      : entry->runtime.config.false_scenario;
+        if (scenario[0]) {
+            esp_err_t err = request_scenario_trigger(entry->device_id, scenario);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "if_condition trigger %s/%s failed: %s",
+                         entry->device_id,
+                         scenario,
+                         esp_err_to_name(err));
             }
         }
     }
     return handled;
 }
+
+bool dm_template_runtime_handle_flag(const char *flag_name, bool state)
+{
+    if (!flag_name) {
+        return false;
+    }
+    dm_runtime_scheduler_lock();
+    bool handled = handle_flag_locked(flag_name, state);
+    dm_runtime_scheduler_unlock();
+    return handled;
+}
@@ -62,7 +62,9 @@ esp_err_t error_monitor_init(void)
         }
     }
     ESP_RETURN_ON_ERROR(status_led_init(), TAG, "led init");
-    ESP_RETURN_ON_ERROR(event_bus_register_handler(on_event), TAG, "event reg");
+    const event_bus_mask_t events = EVENT_BUS_MASK(EVENT_CARD_OK) | EVENT_BUS_MASK(EVENT_CARD_BAD);
+    const event_bus_subscribe_opts_t opts = {.name = "error_monitor"};
+    ESP_RETURN_ON_ERROR(event_bus_subscribe_ex(events, on_event, &opts), TAG, "event reg");
     xSemaphoreTake(s_lock, portMAX_DELAY);
     s_wifi_ok = false;
     s_sd_present = false;
@@ -1,72 +1,534 @@
 #include "event_bus.h"
+#include "event_bus_internal.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 
-#define EVENT_BUS_QUEUE_LEN 64
-#define EVENT_BUS_MAX_HANDLERS 8
+#include "broker_affinity.h"
+
+#define EVENT_BUS_MAX_HANDLERS 16
+#define EVENT_BUS_MAX_CHANNELS 64
+// Сколько сообщений из одного источника (кольцо или канал) разбирается подряд, прежде чем
+// задача шины перейдет к следующему: общий поток не задерживает каналы и наоборот.
+#define EVENT_BUS_BATCH 16
+// Период опроса очередей обработчиков, пока шина под давлением и ей больше нечего разбирать.
+#define EVENT_BUS_PRESSURE_POLL (pdMS_TO_TICKS(10) ? pdMS_TO_TICKS(10) : 1)
+#define EVENT_BUS_ASYNC_STACK 4096
+#define EVENT_BUS_ASYNC_PRIORITY 5
+#define EVENT_BUS_SLOW_HANDLER_US ((uint32_t)CONFIG_BROKER_EVENT_BUS_SLOW_HANDLER_MS * 1000u)
+
+_Static_assert(EVENT_TYPE_COUNT <= 32, "event_bus_mask_t has one bit per event type");
+
+// head пишет только производитель, tail - только задача шины; счетчики свободно растут.
+struct event_bus_channel {
+    event_bus_block_t **slots;
+    uint32_t depth;
+    uint32_t head;
+    uint32_t tail;
+};
+
+// Кольцо класса приоритета со своей емкостью. Производители, ждущие места, спят на space_sem;
+// задача шины будит их после каждой разобранной пачки этого класса.
+typedef struct {
+    event_bus_ring_t ring;
+    uint32_t space_waiters;
+    SemaphoreHandle_t space_sem;
+    uint32_t drops;
+    uint32_t warned_drops;
+    // Наибольшая глубина кольца, которую видела задача шины перед пачкой.
+    uint32_t hwm;
+    // Публикации, ждавшие места в кольце, и время ожидания (под s_drop_lock).
+    uint32_t blocked;
+    uint32_t blocked_max_us;
+    uint64_t blocked_us;
+} bus_class_t;
+
+// Подписчик. Счетчики вызовов и времени пишет тот, кто вызывает обработчик (задача шины или его
+// собственная задача), drops, stalls и max_backlog - задача шины; читатели статистики видят их без блокировки.
+// У асинхронного обработчика две очереди по depth: управляющие события не стоят за телеметрией.
+typedef struct {
+    event_bus_handler_t handler;
+    char name[16];
+    QueueHandle_t queue;
+    QueueHandle_t control;
+    // Будит задачу обработчика; не уведомление задачи, чтобы не мешать ожиданиям внутри обработчика.
+    SemaphoreHandle_t wake;
+    uint32_t depth;
+    uint32_t calls;
+    uint32_t drops;
+    uint32_t stalls;
+    uint32_t max_us;
+    uint32_t max_backlog;
+    uint64_t total_us;
+    // Асинхронный обработчик сейчас обрабатывает сообщение (для event_bus_is_idle).
+    uint32_t busy;
+} bus_handler_t;
 
 static const char *TAG = "event_bus";
-static QueueHandle_t s_queue = NULL;
-static event_bus_handler_t s_handlers[EVENT_BUS_MAX_HANDLERS];
+static const char *const k_prio_names[EVENT_BUS_PRIO_COUNT] = {"control", "telemetry"};
+static bus_class_t s_class[EVENT_BUS_PRIO_COUNT];
+static bool s_ready = false;
+// 1, пока задача шины собирается уснуть или спит; производитель, сбросивший флаг, будит ее.
+static uint32_t s_sleeping = 0;
+static bus_handler_t s_handlers[EVENT_BUS_MAX_HANDLERS];
 static size_t s_handler_count = 0;
+// Таблица по типам строится при подписке. Записи только добавляются: слот заполняется до
+// публикации счетчика, поэтому dispatch читает ее без блокировки.
+static bus_handler_t *s_type_handlers[EVENT_TYPE_COUNT][EVENT_BUS_MAX_HANDLERS];
+static size_t s_type_count[EVENT_TYPE_COUNT];
 static TaskHandle_t s_task = NULL;
 static portMUX_TYPE s_handler_lock = portMUX_INITIALIZER_UNLOCKED;
 static portMUX_TYPE s_drop_lock = portMUX_INITIALIZER_UNLOCKED;
-static uint32_t s_drop_count = 0;
-static uint32_t s_warned_drop = 0;
+static event_bus_channel_t *s_channels[EVENT_BUS_MAX_CHANNELS];
+static size_t s_channel_count = 0;
+static event_bus_tap_t s_tap = NULL;
+// posted увеличивают производители (атомарно), delivered и s_channel_hwm - только задача шины.
+static uint32_t s_posted[EVENT_TYPE_COUNT];
+static uint32_t s_delivered[EVENT_TYPE_COUNT];
+static uint32_t s_channel_hwm = 0;
 
-static void event_bus_task(void *param)
+#if CONFIG_BROKER_EVENT_BUS_LOW_WATERMARK >= CONFIG_BROKER_EVENT_BUS_HIGH_WATERMARK
+#error "CONFIG_BROKER_EVENT_BUS_LOW_WATERMARK must be below CONFIG_BROKER_EVENT_BUS_HIGH_WATERMARK"
+#endif
+
+// Перегрузка: наибольшее заполнение очередей за проход задачи шины (в процентах) с гистерезисом
+// между водяными знаками. Состояние и время меняет только задача шины.
+typedef struct {
+    event_bus_pressure_cb_t cb;
+    void *arg;
+} pressure_listener_t;
+
+static uint32_t s_pass_fill = 0;
+static uint32_t s_pressure = 0;
+static uint32_t s_pressure_episodes = 0;
+static int64_t s_pressure_since_us = 0;
+static uint64_t s_pressure_us = 0;
+static pressure_listener_t s_pressure_listeners[EVENT_BUS_PRESSURE_LISTENERS];
+static size_t s_pressure_listener_count = 0;
+
+_Static_assert(EVENT_TYPE_COUNT == 13, "update k_type_names with event_bus_type_t");
+static const char *const k_type_names[EVENT_TYPE_COUNT] = {
+    "none", "card_ok", "card_bad", "relay_cmd", "audio_play", "audio_finished", "volume_set", "web_command",
+    "system_status", "scenario_trigger", "device_config_changed", "mqtt_message", "flag_changed",
+};
+
+static inline void note_fill(uint32_t depth, uint32_t capacity)
 {
-    (void)param;
-    event_bus_message_t msg;
-    while (xQueueReceive(s_queue, &msg, portMAX_DELAY) == pdTRUE) {
-        event_bus_handler_t local[EVENT_BUS_MAX_HANDLERS] = {0};
-        size_t count = 0;
-        taskENTER_CRITICAL(&s_handler_lock);
-        count = s_handler_count;
-        if (count > EVENT_BUS_MAX_HANDLERS) {
-            count = EVENT_BUS_MAX_HANDLERS;
+    uint32_t fill = depth * 100 / capacity;
+    if (fill > s_pass_fill) {
+        s_pass_fill = fill;
+    }
+}
+
+static void run_handler(bus_handler_t *h, const event_bus_message_t *msg)
+{
+    int64_t start = esp_timer_get_time();
+    h->handler(msg);
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    h->calls++;
+    h->total_us += us;
+    if (us > h->max_us) {
+        h->max_us = us;
+        if (us >= EVENT_BUS_SLOW_HANDLER_US) {
+            ESP_LOGW(TAG, "handler %s took %" PRIu32 " ms (type %d)", h->name, us / 1000, (int)msg->type);
         }
-        memcpy(local, s_handlers, count * sizeof(event_bus_handler_t));
-        taskEXIT_CRITICAL(&s_handler_lock);
+    }
+}
+
+static void update_pressure(uint32_t fill);
+
+static uint32_t handler_backlog(const bus_handler_t *h)
+{
+    return (uint32_t)(uxQueueMessagesWaiting(h->queue) + uxQueueMessagesWaiting(h->control));
+}
+
+// Заполнение более полной из двух очередей обработчика, в процентах.
+static uint32_t handler_fill(const bus_handler_t *h)
+{
+    UBaseType_t control = uxQueueMessagesWaiting(h->control);
+    UBaseType_t telemetry = uxQueueMessagesWaiting(h->queue);
+    return (uint32_t)(control > telemetry ? control : telemetry) * 100 / h->depth;
+}
+
+// Асинхронный обработчик получает свою ссылку на блок. Телеметрия при полной очереди отбрасывается
+// для этого обработчика; управляющее событие не теряется: задача шины ждет места, а шина на это
+// время считается перегруженной, и производители ждут места в кольцах.
+static void enqueue_async(bus_handler_t *h, event_bus_block_t *block)
+{
+    __atomic_add_fetch(&block->refs, 1, __ATOMIC_RELAXED);
+    if (event_bus_type_prio(block->msg.type) == EVENT_BUS_PRIO_CONTROL) {
+        if (xQueueSend(h->control, &block, 0) != pdTRUE) {
+            uint32_t stalls = ++h->stalls;
+            if (stalls == 1 || stalls % 50 == 0) {
+                ESP_LOGW(TAG, "handler %s control backlog full, bus waits (stalls=%" PRIu32 ")", h->name, stalls);
+            }
+            note_fill(h->depth, h->depth);
+            update_pressure(100);
+            while (xQueueSend(h->control, &block, EVENT_BUS_PRESSURE_POLL) != pdTRUE) {
+            }
+        }
+    } else if (xQueueSend(h->queue, &block, 0) != pdTRUE) {
+        event_bus_block_release(block);
+        note_fill(h->depth, h->depth);
+        uint32_t drops = ++h->drops;
+        if (drops == 1 || drops % 50 == 0) {
+            ESP_LOGW(TAG, "handler %s backlog full (drops=%" PRIu32 ")", h->name, drops);
+        }
+        return;
+    }
+    xSemaphoreGive(h->wake);
+    uint32_t backlog = handler_backlog(h);
+    if (backlog > h->max_backlog) {
+        h->max_backlog = backlog;
+    }
+    uint32_t fill = handler_fill(h);
+    if (fill > s_pass_fill) {
+        s_pass_fill = fill;
+    }
+}
+
+static void dispatch_block(event_bus_block_t *block)
+{
+    const event_bus_message_t *msg = &block->msg;
+    event_bus_tap_t tap = __atomic_load_n(&s_tap, __ATOMIC_ACQUIRE);
+    if (tap) {
+        tap(msg, block->posted_us);
+    }
+    if ((unsigned)msg->type < EVENT_TYPE_COUNT) {
+        s_delivered[msg->type]++;
+        bus_handler_t **handlers = s_type_handlers[msg->type];
+        size_t count = __atomic_load_n(&s_type_count[msg->type], __ATOMIC_ACQUIRE);
         for (size_t i = 0; i < count; ++i) {
-            if (local[i]) {
-                local[i](&msg);
+            if (handlers[i]->queue) {
+                enqueue_async(handlers[i], block);
+            } else {
+                run_handler(handlers[i], msg);
             }
         }
     }
-    taskENTER_CRITICAL(&s_handler_lock);
-    s_task = NULL;
-    taskEXIT_CRITICAL(&s_handler_lock);
-    vTaskDelete(NULL);
+    event_bus_block_release(block);
 }
 
-esp_err_t event_bus_init(void)
+static void handler_task(void *param)
 {
-    if (!s_queue) {
-        s_queue = xQueueCreate(EVENT_BUS_QUEUE_LEN, sizeof(event_bus_message_t));
+    bus_handler_t *h = param;
+    QueueHandle_t control = h->control;
+    QueueHandle_t queue = h->queue;
+    SemaphoreHandle_t wake = h->wake;
+    event_bus_block_t *block = NULL;
+    for (;;) {
+        xSemaphoreTake(wake, portMAX_DELAY);
+        // busy выставляется, пока сообщение еще в очереди: event_bus_is_idle не видит окна между ними.
+        // Управляющая очередь разбирается первой перед каждым сообщением телеметрии.
+        for (;;) {
+            __atomic_store_n(&h->busy, 1, __ATOMIC_RELEASE);
+            if (xQueueReceive(control, &block, 0) != pdTRUE && xQueueReceive(queue, &block, 0) != pdTRUE) {
+                __atomic_store_n(&h->busy, 0, __ATOMIC_RELEASE);
+                break;
+            }
+            run_handler(h, &block->msg);
+            event_bus_block_release(block);
+        }
     }
-    if (!s_queue) {
-        return ESP_ERR_NO_MEM;
+}
+
+event_bus_prio_t event_bus_type_prio(event_bus_type_t type)
+{
+    switch (type) {
+    case EVENT_MQTT_MESSAGE:
+    case EVENT_SYSTEM_STATUS:
+        return EVENT_BUS_PRIO_TELEMETRY;
+    default:
+        return EVENT_BUS_PRIO_CONTROL;
+    }
+}
+
+static size_t drain_ring(bus_class_t *cls, size_t limit)
+{
+    size_t handled = 0;
+    event_bus_block_t *block = NULL;
+    uint32_t depth = event_bus_ring_depth(&cls->ring);
+    if (depth > cls->hwm) {
+        cls->hwm = depth;
+    }
+    note_fill(depth, EVENT_BUS_RING_LEN);
+    while (handled < limit && (block = event_bus_ring_pop(&cls->ring)) != NULL) {
+        dispatch_block(event_bus_coalesce_take(block));
+        handled++;
+    }
+    if (handled) {
+        // Пара к барьеру в push_wait: либо ждущий увидит освободившийся слот, либо мы - его счетчик.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&cls->space_waiters, __ATOMIC_RELAXED)) {
+            xSemaphoreGive(cls->space_sem);
+        }
+    }
+    return handled;
+}
+
+// Все накопленные управляющие события; вызывается перед каждой пачкой телеметрии, так что
+// управляющее событие ждет не дольше одной пачки.
+static size_t drain_control(void)
+{
+    return drain_ring(&s_class[EVENT_BUS_PRIO_CONTROL], EVENT_BUS_RING_LEN);
+}
+
+static size_t drain_channels(void)
+{
+    size_t count = __atomic_load_n(&s_channel_count, __ATOMIC_ACQUIRE);
+    size_t handled = 0;
+    uint32_t total_depth = 0;
+    uint32_t total_cap = 0;
+    for (size_t i = 0; i < count; ++i) {
+        event_bus_channel_t *ch = s_channels[i];
+        handled += drain_control();
+        uint32_t tail = ch->tail;
+        uint32_t depth = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE) - tail;
+        if (depth > s_channel_hwm) {
+            s_channel_hwm = depth;
+        }
+        total_depth += depth;
+        total_cap += ch->depth;
+        for (size_t n = 0; n < EVENT_BUS_BATCH && tail != __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE); ++n) {
+            event_bus_block_t *block = ch->slots[tail % ch->depth];
+            tail++;
+            __atomic_store_n(&ch->tail, tail, __ATOMIC_RELEASE);
+            dispatch_block(block);
+            handled++;
+        }
+    }
+    // Один заполненный канал - это его производитель ждет своей очереди на разбор; перегрузкой
+    // шины считается общая глубина каналов.
+    if (total_cap) {
+        note_fill(total_depth, total_cap);
+    }
+    return handled;
+}
+
+// Очереди асинхронных обработчиков разбирают их собственные задачи. Пока перегрузка держится,
+// задача шины опрашивает их сама: иначе пустой проход снял бы давление раньше, чем обработчики догонят.
+static uint32_t handler_backlog_fill(void)
+{
+    uint32_t fill = 0;
+    size_t count = __atomic_load_n(&s_handler_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; ++i) {
+        const bus_handler_t *h = &s_handlers[i];
+        if (h->queue && h->depth) {
+            uint32_t f = handler_fill(h);
+            if (f > fill) {
+                fill = f;
+            }
+        }
+    }
+    return fill;
+}
+
+static void update_pressure(uint32_t fill)
+{
+    bool on = __atomic_load_n(&s_pressure, __ATOMIC_RELAXED);
+    if (on && fill <= CONFIG_BROKER_EVENT_BUS_LOW_WATERMARK) {
+        uint32_t backlog = handler_backlog_fill();
+        if (backlog > fill) {
+            fill = backlog;
+        }
+    }
+    if (!on && fill >= CONFIG_BROKER_EVENT_BUS_HIGH_WATERMARK) {
+        s_pressure_since_us = esp_timer_get_time();
+        __atomic_add_fetch(&s_pressure_episodes, 1, __ATOMIC_RELAXED);
+    } else if (on && fill <= CONFIG_BROKER_EVENT_BUS_LOW_WATERMARK) {
+        __atomic_add_fetch(&s_pressure_us, (uint64_t)(esp_timer_get_time() - s_pressure_since_us), __ATOMIC_RELAXED);
+    } else {
+        return;
+    }
+    __atomic_store_n(&s_pressure, on ? 0 : 1, __ATOMIC_RELEASE);
+    size_t count = __atomic_load_n(&s_pressure_listener_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; ++i) {
+        s_pressure_listeners[i].cb(!on, s_pressure_listeners[i].arg);
+    }
+}
+
+static bool work_pending(void)
+{
+    for (size_t p = 0; p < EVENT_BUS_PRIO_COUNT; ++p) {
+        if (event_bus_ring_peek(&s_class[p].ring)) {
+            return true;
+        }
+    }
+    size_t count = __atomic_load_n(&s_channel_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; ++i) {
+        event_bus_channel_t *ch = s_channels[i];
+        if (ch->tail != __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void event_bus_set_tap(event_bus_tap_t tap)
+{
+    __atomic_store_n(&s_tap, tap, __ATOMIC_RELEASE);
+}
+
+bool event_bus_is_idle(void)
+{
+    if (!__atomic_load_n(&s_sleeping, __ATOMIC_ACQUIRE) || work_pending()) {
+        return false;
+    }
+    size_t count = __atomic_load_n(&s_handler_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; ++i) {
+        bus_handler_t *h = &s_handlers[i];
+        if (h->queue && (handler_backlog(h) > 0 || __atomic_load_n(&h->busy, __ATOMIC_ACQUIRE))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Вызывается производителем после публикации сообщения.
+static void wake_consumer(void)
+{
+    // Пара к барьеру в event_bus_task: либо задача увидит новое сообщение, либо мы увидим s_sleeping.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s_sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&s_sleeping, 0, __ATOMIC_ACQ_REL)) {
+        TaskHandle_t task = __atomic_load_n(&s_task, __ATOMIC_ACQUIRE);
+        if (task) {
+            xTaskNotifyGive(task);
+        }
+    }
+}
+
+static void wake_consumer_from_isr(BaseType_t *woken)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s_sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&s_sleeping, 0, __ATOMIC_ACQ_REL)) {
+        TaskHandle_t task = __atomic_load_n(&s_task, __ATOMIC_ACQUIRE);
+        if (task) {
+            vTaskNotifyGiveFromISR(task, woken);
+        }
+    }
+}
+
+static bool push_wait(bus_class_t *cls, event_bus_block_t *block, TickType_t timeout)
+{
+    if (event_bus_ring_push(&cls->ring, block)) {
+        return true;
+    }
+    if (timeout == 0) {
+        return false;
+    }
+    TickType_t start = xTaskGetTickCount();
+    int64_t start_us = esp_timer_get_time();
+    __atomic_add_fetch(&cls->space_waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bool pushed = false;
+    for (;;) {
+        if (event_bus_ring_push(&cls->ring, block)) {
+            pushed = true;
+            break;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout) {
+            break;
+        }
+        xSemaphoreTake(cls->space_sem, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - elapsed);
+    }
+    // Семафор двоичный: передаем пробуждение следующему ждущему, если он есть.
+    if (__atomic_sub_fetch(&cls->space_waiters, 1, __ATOMIC_RELAXED) > 0 && pushed) {
+        xSemaphoreGive(cls->space_sem);
+    }
+    uint32_t waited_us = (uint32_t)(esp_timer_get_time() - start_us);
+    taskENTER_CRITICAL(&s_drop_lock);
+    cls->blocked++;
+    cls->blocked_us += waited_us;
+    if (waited_us > cls->blocked_max_us) {
+        cls->blocked_max_us = waited_us;
+    }
+    taskEXIT_CRITICAL(&s_drop_lock);
+    return pushed;
+}
+
+static void event_bus_task(void *param)
+{
+    (void)param;
+    __atomic_store_n(&s_task, xTaskGetCurrentTaskHandle(), __ATOMIC_RELEASE);
+    for (;;) {
+        // Сначала все управляющие события, затем пачки по EVENT_BUS_BATCH по очереди из кольца
+        // телеметрии и каналов, пока есть работа; одно уведомление будит задачу на все, что накопилось.
+        size_t handled = drain_control();
+        handled += drain_ring(&s_class[EVENT_BUS_PRIO_TELEMETRY], EVENT_BUS_BATCH);
+        handled += drain_channels();
+        update_pressure(s_pass_fill);
+        s_pass_fill = 0;
+        if (handled > 0) {
+            continue;
+        }
+        __atomic_store_n(&s_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (work_pending()) {
+            __atomic_store_n(&s_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        // Под давлением задача просыпается сама, чтобы снять его, когда обработчики разгрузятся.
+        ulTaskNotifyTake(pdTRUE, __atomic_load_n(&s_pressure, __ATOMIC_RELAXED) ? EVENT_BUS_PRESSURE_POLL : portMAX_DELAY);
+    }
+}
+
+esp_err_t event_bus_init(void)
+{
+    if (!s_ready) {
+        for (size_t p = 0; p < EVENT_BUS_PRIO_COUNT; ++p) {
+            s_class[p].space_sem = xSemaphoreCreateBinary();
+            if (!s_class[p].space_sem) {
+                return ESP_ERR_NO_MEM;
+            }
+            event_bus_ring_init(&s_class[p].ring);
+        }
+        if (event_bus_reserve_init() != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+        s_ready = true;
     }
     taskENTER_CRITICAL(&s_handler_lock);
+    // Задачи асинхронных обработчиков прежней инициализации остаются ждать свои очереди, в которые
+    // больше никто не пишет.
     memset(s_handlers, 0, sizeof(s_handlers));
+    memset(s_type_handlers, 0, sizeof(s_type_handlers));
+    memset(s_type_count, 0, sizeof(s_type_count));
     s_handler_count = 0;
     taskEXIT_CRITICAL(&s_handler_lock);
     taskENTER_CRITICAL(&s_drop_lock);
-    s_drop_count = 0;
-    s_warned_drop = 0;
+    for (size_t p = 0; p < EVENT_BUS_PRIO_COUNT; ++p) {
+        s_class[p].drops = 0;
+        s_class[p].warned_drops = 0;
+        s_class[p].hwm = 0;
+        s_class[p].blocked = 0;
+        s_class[p].blocked_max_us = 0;
+        s_class[p].blocked_us = 0;
+    }
     taskEXIT_CRITICAL(&s_drop_lock);
+    memset(s_posted, 0, sizeof(s_posted));
+    memset(s_delivered, 0, sizeof(s_delivered));
+    s_channel_hwm = 0;
+    // Подписчики на перегрузку сбрасываются вместе с обработчиками.
+    s_pressure_listener_count = 0;
+    s_pressure = 0;
+    s_pressure_episodes = 0;
+    s_pressure_us = 0;
     return ESP_OK;
 }
 
 esp_err_t event_bus_start(void)
 {
-    if (!s_queue) {
+    if (!s_ready) {
         return ESP_ERR_INVALID_STATE;
     }
     taskENTER_CRITICAL(&s_handler_lock);
@@ -78,55 +540,376 @@ esp_err_t event_bus_start(void)
     }
 
     TaskHandle_t task = NULL;
-    BaseType_t ok = xTaskCreate(event_bus_task, "event_bus", 4096, NULL, 5, &task);
+    BaseType_t ok = xTaskCreatePinnedToCore(event_bus_task, "event_bus", 4096, NULL, 5, &task, BROKER_APP_CORE);
     if (ok == pdPASS) {
         taskENTER_CRITICAL(&s_handler_lock);
         s_task = task;
         taskEXIT_CRITICAL(&s_handler_lock);
+        // Без метрик шина работает; ошибка уже в логе.
+        (void)event_bus_metrics_start();
         return ESP_OK;
     }
     return ESP_FAIL;
 }
 
-esp_err_t event_bus_post(const event_bus_message_t *message, TickType_t timeout)
+// Вызывается и из прерывания (warn = false): лог там недоступен.
+static void count_drop(event_bus_prio_t prio, bool warn)
 {
-    if (!message || !s_queue) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    if (xQueueSend(s_queue, message, timeout) == pdTRUE) {
-        return ESP_OK;
-    }
+    bus_class_t *cls = &s_class[prio];
     uint32_t drops = 0;
     bool should_warn = false;
-    taskENTER_CRITICAL(&s_drop_lock);
-    drops = ++s_drop_count;
-    if (drops == 1 || (drops % 50 == 0 && s_warned_drop < drops)) {
-        s_warned_drop = drops;
+    portENTER_CRITICAL_SAFE(&s_drop_lock);
+    drops = ++cls->drops;
+    if (warn && (drops == 1 || (drops % 50 == 0 && cls->warned_drops < drops))) {
+        cls->warned_drops = drops;
         should_warn = true;
     }
-    taskEXIT_CRITICAL(&s_drop_lock);
+    portEXIT_CRITICAL_SAFE(&s_drop_lock);
     if (should_warn) {
-        ESP_LOGW(TAG, "event bus queue full (drops=%" PRIu32 ")", drops);
+        ESP_LOGW(TAG, "event bus %s ring full (drops=%" PRIu32 ")", k_prio_names[prio], drops);
     }
-    return ESP_ERR_TIMEOUT;
 }
 
-esp_err_t event_bus_register_handler(event_bus_handler_t handler)
+static inline void count_posted(event_bus_type_t type)
+{
+    if ((unsigned)type < EVENT_TYPE_COUNT) {
+        __atomic_add_fetch(&s_posted[type], 1, __ATOMIC_RELAXED);
+    }
+}
+
+const char *event_bus_type_name(event_bus_type_t type)
+{
+    return (unsigned)type < EVENT_TYPE_COUNT ? k_type_names[type] : "unknown";
+}
+
+const char *event_bus_prio_name(event_bus_prio_t prio)
+{
+    return (unsigned)prio < EVENT_BUS_PRIO_COUNT ? k_prio_names[prio] : "unknown";
+}
+
+void event_bus_get_stats(event_bus_stats_t *out)
+{
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    for (size_t t = 0; t < EVENT_TYPE_COUNT; ++t) {
+        out->posted[t] = __atomic_load_n(&s_posted[t], __ATOMIC_RELAXED);
+        out->delivered[t] = s_delivered[t];
+    }
+    taskENTER_CRITICAL(&s_drop_lock);
+    for (size_t p = 0; p < EVENT_BUS_PRIO_COUNT; ++p) {
+        const bus_class_t *cls = &s_class[p];
+        out->drops[p] = cls->drops;
+        out->ring_hwm[p] = cls->hwm;
+        out->post_blocked[p] = cls->blocked;
+        out->post_blocked_us[p] = cls->blocked_us;
+        out->post_blocked_max_us[p] = cls->blocked_max_us;
+    }
+    taskEXIT_CRITICAL(&s_drop_lock);
+    out->channel_hwm = s_channel_hwm;
+    out->coalesced = event_bus_coalesced_count();
+    out->under_pressure = event_bus_under_pressure();
+    out->pressure_episodes = __atomic_load_n(&s_pressure_episodes, __ATOMIC_RELAXED);
+    out->pressure_us = __atomic_load_n(&s_pressure_us, __ATOMIC_RELAXED);
+    if (out->under_pressure) {
+        // Текущий эпизод еще не закрыт задачей шины.
+        out->pressure_us += (uint64_t)(esp_timer_get_time() - s_pressure_since_us);
+    }
+}
+
+bool event_bus_under_pressure(void)
+{
+    return __atomic_load_n(&s_pressure, __ATOMIC_ACQUIRE) != 0;
+}
+
+esp_err_t event_bus_add_pressure_listener(event_bus_pressure_cb_t cb, void *arg)
+{
+    if (!cb) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    taskENTER_CRITICAL(&s_handler_lock);
+    size_t idx = s_pressure_listener_count;
+    if (idx >= EVENT_BUS_PRESSURE_LISTENERS) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        s_pressure_listeners[idx] = (pressure_listener_t){.cb = cb, .arg = arg};
+        __atomic_store_n(&s_pressure_listener_count, idx + 1, __ATOMIC_RELEASE);
+    }
+    taskEXIT_CRITICAL(&s_handler_lock);
+    return err;
+}
+
+uint32_t event_bus_drop_count(event_bus_prio_t prio)
+{
+    if ((unsigned)prio >= EVENT_BUS_PRIO_COUNT) {
+        return 0;
+    }
+    taskENTER_CRITICAL(&s_drop_lock);
+    uint32_t drops = s_class[prio].drops;
+    taskEXIT_CRITICAL(&s_drop_lock);
+    return drops;
+}
+
+esp_err_t event_bus_post(const event_bus_message_t *message, TickType_t timeout)
+{
+    if (!message || !s_ready) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    event_bus_block_t *block = event_bus_block_create(message);
+    if (!block) {
+        return ESP_ERR_NO_MEM;
+    }
+    event_bus_prio_t prio = event_bus_type_prio(message->type);
+    if (event_bus_coalesce_enabled(message->type)) {
+        switch (event_bus_coalesce_post(&s_class[prio].ring, block)) {
+        case EVENT_BUS_COALESCE_REPLACED:
+            // Ожидающая запись уже в кольце, задача шины разбудится по ней.
+            count_posted(message->type);
+            return ESP_OK;
+        case EVENT_BUS_COALESCE_QUEUED:
+            count_posted(message->type);
+            wake_consumer();
+            return ESP_OK;
+        default:
+            break;
+        }
+    }
+    if (!push_wait(&s_class[prio], block, timeout)) {
+        event_bus_block_release(block);
+        count_drop(prio, true);
+        return ESP_ERR_TIMEOUT;
+    }
+    count_posted(message->type);
+    wake_consumer();
+    return ESP_OK;
+}
+
+// Без ожидания: блок из резерва (в задаче - из пула, если строки длиннее резервного блока),
+// одна попытка поставить в кольцо.
+static esp_err_t post_nowait(const event_bus_message_t *message, bool isr, BaseType_t *woken)
+{
+    if (!message || !s_ready) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    event_bus_prio_t prio = event_bus_type_prio(message->type);
+    event_bus_block_t *block = event_bus_block_create_reserved(message);
+    if (!block && !isr) {
+        block = event_bus_block_create(message);
+    }
+    if (!block) {
+        count_drop(prio, !isr);
+        return ESP_ERR_NO_MEM;
+    }
+    // Слияние освобождает замененный блок, который мог прийти из кучи, поэтому только в задаче.
+    if (!isr && event_bus_coalesce_enabled(message->type)) {
+        event_bus_coalesce_result_t res = event_bus_coalesce_post(&s_class[prio].ring, block);
+        if (res == EVENT_BUS_COALESCE_REPLACED) {
+            count_posted(message->type);
+            return ESP_OK;
+        }
+        if (res == EVENT_BUS_COALESCE_QUEUED) {
+            count_posted(message->type);
+            wake_consumer();
+            return ESP_OK;
+        }
+    }
+    if (!event_bus_ring_push(&s_class[prio].ring, block)) {
+        event_bus_block_release(block);
+        count_drop(prio, !isr);
+        return ESP_ERR_TIMEOUT;
+    }
+    count_posted(message->type);
+    if (isr) {
+        wake_consumer_from_isr(woken);
+    } else {
+        wake_consumer();
+    }
+    return ESP_OK;
+}
+
+esp_err_t event_bus_post_nowait(const event_bus_message_t *message)
+{
+    return post_nowait(message, false, NULL);
+}
+
+esp_err_t event_bus_post_from_isr(const event_bus_message_t *message, BaseType_t *woken)
+{
+    return post_nowait(message, true, woken);
+}
+
+static void delete_async_queues(QueueHandle_t queue, QueueHandle_t control, SemaphoreHandle_t wake)
+{
+    if (queue) {
+        vQueueDelete(queue);
+    }
+    if (control) {
+        vQueueDelete(control);
+    }
+    if (wake) {
+        vSemaphoreDelete(wake);
+    }
+}
+
+esp_err_t event_bus_subscribe_ex(event_bus_mask_t types, event_bus_handler_t handler,
+                                 const event_bus_subscribe_opts_t *opts)
 {
-    if (!handler) {
+    types &= EVENT_BUS_MASK_ALL;
+    if (!handler || !types) {
         return ESP_ERR_INVALID_ARG;
     }
+    QueueHandle_t queue = NULL;
+    QueueHandle_t control = NULL;
+    SemaphoreHandle_t wake = NULL;
+    if (opts && opts->depth > 0) {
+        queue = xQueueCreate(opts->depth, sizeof(event_bus_block_t *));
+        control = xQueueCreate(opts->depth, sizeof(event_bus_block_t *));
+        wake = xSemaphoreCreateBinary();
+        if (!queue || !control || !wake) {
+            delete_async_queues(queue, control, wake);
+            return ESP_ERR_NO_MEM;
+        }
+    }
     taskENTER_CRITICAL(&s_handler_lock);
     esp_err_t err = ESP_OK;
+    bus_handler_t *h = NULL;
     if (s_handler_count >= EVENT_BUS_MAX_HANDLERS) {
         err = ESP_ERR_NO_MEM;
     } else {
-        s_handlers[s_handler_count++] = handler;
+        h = &s_handlers[s_handler_count++];
+        h->handler = handler;
+        h->queue = queue;
+        h->control = control;
+        h->wake = wake;
+        h->depth = queue ? (uint32_t)opts->depth : 0;
     }
+    size_t count = s_handler_count;
     taskEXIT_CRITICAL(&s_handler_lock);
     if (err != ESP_OK) {
+        delete_async_queues(queue, control, wake);
         return err;
     }
-    ESP_LOGI(TAG, "handler registered (%d/%d)", (int)s_handler_count, EVENT_BUS_MAX_HANDLERS);
+    if (opts && opts->name) {
+        snprintf(h->name, sizeof(h->name), "%s", opts->name);
+    } else {
+        snprintf(h->name, sizeof(h->name), "#%u", (unsigned)count);
+    }
+    // Задача создается до публикации в таблице типов: очередь не копится без читателя.
+    if (queue) {
+        uint32_t stack = opts->stack_size ? opts->stack_size : EVENT_BUS_ASYNC_STACK;
+        UBaseType_t prio = opts->priority ? opts->priority : EVENT_BUS_ASYNC_PRIORITY;
+        char task_name[16];
+        snprintf(task_name, sizeof(task_name), "evb_%.11s", h->name);
+        if (xTaskCreatePinnedToCore(handler_task, task_name, stack, h, prio, NULL, BROKER_APP_CORE) != pdPASS) {
+            // Слот остается занятым, но в таблицу типов не попадает.
+            ESP_LOGE(TAG, "failed to start task for handler %s", h->name);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    taskENTER_CRITICAL(&s_handler_lock);
+    for (size_t t = 0; t < EVENT_TYPE_COUNT; ++t) {
+        if (types & EVENT_BUS_MASK(t)) {
+            size_t n = s_type_count[t];
+            s_type_handlers[t][n] = h;
+            __atomic_store_n(&s_type_count[t], n + 1, __ATOMIC_RELEASE);
+        }
+    }
+    taskEXIT_CRITICAL(&s_handler_lock);
+    ESP_LOGI(TAG, "handler %s registered (%d/%d, types=0x%" PRIx32 "%s)", h->name, (int)count,
+             EVENT_BUS_MAX_HANDLERS, (uint32_t)types, queue ? ", async" : "");
+    return ESP_OK;
+}
+
+esp_err_t event_bus_subscribe(event_bus_mask_t types, event_bus_handler_t handler)
+{
+    return event_bus_subscribe_ex(types, handler, NULL);
+}
+
+size_t event_bus_get_handler_stats(event_bus_handler_stats_t *out, size_t max)
+{
+    size_t count = __atomic_load_n(&s_handler_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count && i < max && out; ++i) {
+        const bus_handler_t *h = &s_handlers[i];
+        event_bus_handler_stats_t *st = &out[i];
+        memcpy(st->name, h->name, sizeof(st->name));
+        st->async = h->queue != NULL;
+        st->calls = h->calls;
+        st->drops = h->drops;
+        st->stalls = h->stalls;
+        st->max_us = h->max_us;
+        st->total_us = h->total_us;
+        st->avg_us = st->calls ? (uint32_t)(h->total_us / st->calls) : 0;
+        st->backlog = h->queue ? handler_backlog(h) : 0;
+        st->max_backlog = h->max_backlog;
+    }
+    return count;
+}
+
+esp_err_t event_bus_register_handler(event_bus_handler_t handler)
+{
+    return event_bus_subscribe(EVENT_BUS_MASK_ALL, handler);
+}
+
+esp_err_t event_bus_channel_open(size_t depth, event_bus_channel_t **out)
+{
+    if (!out || depth == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    event_bus_channel_t *ch = heap_caps_calloc(1, sizeof(*ch), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    event_bus_block_t **slots = heap_caps_calloc(depth, sizeof(event_bus_block_t *),
+                                                 MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!ch || !slots) {
+        heap_caps_free(ch);
+        heap_caps_free(slots);
+        return ESP_ERR_NO_MEM;
+    }
+    ch->slots = slots;
+    ch->depth = (uint32_t)depth;
+    taskENTER_CRITICAL(&s_handler_lock);
+    esp_err_t err = ESP_OK;
+    if (s_channel_count >= EVENT_BUS_MAX_CHANNELS) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        s_channels[s_channel_count] = ch;
+        __atomic_store_n(&s_channel_count, s_channel_count + 1, __ATOMIC_RELEASE);
+    }
+    taskEXIT_CRITICAL(&s_handler_lock);
+    if (err != ESP_OK) {
+        heap_caps_free(slots);
+        heap_caps_free(ch);
+        return err;
+    }
+    *out = ch;
+    return ESP_OK;
+}
+
+esp_err_t event_bus_channel_post(event_bus_channel_t *ch, const event_bus_message_t *message, TickType_t timeout)
+{
+    if (!ch || !message || !s_ready) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    event_bus_prio_t prio = event_bus_type_prio(message->type);
+    if (prio == EVENT_BUS_PRIO_CONTROL || event_bus_coalesce_enabled(message->type)) {
+        return event_bus_post(message, timeout);
+    }
+    uint32_t head = ch->head;
+    TickType_t waited = 0;
+    while (head - __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE) >= ch->depth) {
+        if (waited >= timeout) {
+            count_drop(prio, false);
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+        waited++;
+    }
+    event_bus_block_t *block = event_bus_block_create(message);
+    if (!block) {
+        return ESP_ERR_NO_MEM;
+    }
+    ch->slots[head % ch->depth] = block;
+    __atomic_store_n(&ch->head, head + 1, __ATOMIC_RELEASE);
+    count_posted(message->type);
+    wake_consumer();
     return ESP_OK;
 }
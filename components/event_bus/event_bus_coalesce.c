@@ -0,0 +1,109 @@
+#include "event_bus_internal.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+// Одновременно ожидающих ключей (тип + topic). Когда таблица занята, сообщения идут в кольцо
+// без слияния, так что переполнение таблицы ничего не теряет.
+#define EVENT_BUS_COALESCE_SLOTS 16
+
+// Изменения флагов запускают сценарии по каждому событию, поэтому сливаются только по опции.
+#if CONFIG_BROKER_EVENT_BUS_COALESCE_FLAGS
+#define EVENT_BUS_COALESCE_FLAG_MASK EVENT_BUS_MASK(EVENT_FLAG_CHANGED)
+#else
+#define EVENT_BUS_COALESCE_FLAG_MASK 0
+#endif
+
+// Занятый слот (latest != NULL) соответствует ровно одной записи в кольце.
+typedef struct {
+    event_bus_block_t *latest;
+} coalesce_slot_t;
+
+static coalesce_slot_t s_slots[EVENT_BUS_COALESCE_SLOTS];
+static event_bus_mask_t s_types = EVENT_BUS_MASK(EVENT_SYSTEM_STATUS) | EVENT_BUS_MASK(EVENT_VOLUME_SET) |
+                                  EVENT_BUS_COALESCE_FLAG_MASK;
+static uint32_t s_coalesced = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+bool event_bus_coalesce_enabled(event_bus_type_t type)
+{
+    return (unsigned)type < EVENT_TYPE_COUNT &&
+           (__atomic_load_n(&s_types, __ATOMIC_RELAXED) & EVENT_BUS_MASK(type)) != 0;
+}
+
+event_bus_coalesce_result_t event_bus_coalesce_post(event_bus_ring_t *ring, event_bus_block_t *block)
+{
+    event_bus_coalesce_result_t result = EVENT_BUS_COALESCE_NONE;
+    event_bus_block_t *replaced = NULL;
+    int free_slot = -1;
+    taskENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < EVENT_BUS_COALESCE_SLOTS; ++i) {
+        event_bus_block_t *latest = s_slots[i].latest;
+        if (!latest) {
+            if (free_slot < 0) {
+                free_slot = i;
+            }
+            continue;
+        }
+        if (latest->msg.type == block->msg.type && strcmp(latest->msg.topic, block->msg.topic) == 0) {
+            replaced = latest;
+            block->coalesce_slot = (int8_t)i;
+            s_slots[i].latest = block;
+            result = EVENT_BUS_COALESCE_REPLACED;
+            break;
+        }
+    }
+    if (result == EVENT_BUS_COALESCE_NONE && free_slot >= 0) {
+        // Вторая ссылка - у слота; ссылку записи в кольце освобождает event_bus_coalesce_take.
+        block->refs = 2;
+        block->coalesce_slot = (int8_t)free_slot;
+        s_slots[free_slot].latest = block;
+        if (event_bus_ring_push(ring, block)) {
+            result = EVENT_BUS_COALESCE_QUEUED;
+        } else {
+            s_slots[free_slot].latest = NULL;
+            block->coalesce_slot = -1;
+            block->refs = 1;
+        }
+    }
+    if (replaced) {
+        s_coalesced++;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+    // Замененное значение держал только слот (или слот и кольцо, если это первая запись).
+    event_bus_block_release(replaced);
+    return result;
+}
+
+event_bus_block_t *event_bus_coalesce_take(event_bus_block_t *queued)
+{
+    int slot = queued->coalesce_slot;
+    if (slot < 0) {
+        return queued;
+    }
+    taskENTER_CRITICAL(&s_lock);
+    event_bus_block_t *latest = s_slots[slot].latest;
+    s_slots[slot].latest = NULL;
+    taskEXIT_CRITICAL(&s_lock);
+    event_bus_block_release(queued);
+    return latest;
+}
+
+void event_bus_set_coalesce_types(event_bus_mask_t types)
+{
+    __atomic_store_n(&s_types, types & EVENT_BUS_MASK_ALL, __ATOMIC_RELAXED);
+}
+
+event_bus_mask_t event_bus_get_coalesce_types(void)
+{
+    return __atomic_load_n(&s_types, __ATOMIC_RELAXED);
+}
+
+uint32_t event_bus_coalesced_count(void)
+{
+    taskENTER_CRITICAL(&s_lock);
+    uint32_t count = s_coalesced;
+    taskEXIT_CRITICAL(&s_lock);
+    return count;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "event_bus.h"
+
+// Блок пула: сообщение для обработчиков, счетчик ссылок и строки topic/payload сразу за заголовком.
+typedef struct event_bus_block {
+    event_bus_message_t msg;
+    uint32_t refs;
+    int8_t size_class;
+    // Слот таблицы слияния, если блок стоит в кольце как ожидающее значение, иначе -1.
+    int8_t coalesce_slot;
+    struct event_bus_block *next;
+    // Время публикации по esp_timer (для записи трассы).
+    int64_t posted_us;
+    char data[];
+} event_bus_block_t;
+
+// Освобождение резервного блока допустимо и из прерывания.
+// Копия message с одной ссылкой; NULL, если памяти нет.
+event_bus_block_t *event_bus_block_create(const event_bus_message_t *message);
+// Строки резервного блока (topic + payload + два нуля).
+#define EVENT_BUS_RESERVED_BYTES 128
+esp_err_t event_bus_reserve_init(void);
+// Блок из резерва без кучи и без ожидания, можно из прерывания; NULL - резерв пуст или строки длиннее.
+event_bus_block_t *event_bus_block_create_reserved(const event_bus_message_t *message);
+void event_bus_block_release(event_bus_block_t *block);
+
+// Ограниченное кольцо multi-producer/single-consumer (схема Vyukov): производители занимают позицию
+// CAS по head и публикуют слот номером последовательности, читает только задача шины.
+#define EVENT_BUS_RING_LEN 64
+
+typedef struct {
+    uint32_t seq;
+    event_bus_block_t *block;
+} event_bus_ring_slot_t;
+
+typedef struct {
+    event_bus_ring_slot_t slots[EVENT_BUS_RING_LEN];
+    uint32_t head;
+    uint32_t tail;
+} event_bus_ring_t;
+
+void event_bus_ring_init(event_bus_ring_t *ring);
+// false - кольцо заполнено.
+bool event_bus_ring_push(event_bus_ring_t *ring, event_bus_block_t *block);
+// NULL - кольцо пусто (или ближайший слот занят, но еще не опубликован производителем).
+event_bus_block_t *event_bus_ring_pop(event_bus_ring_t *ring);
+// Есть ли опубликованное сообщение в голове кольца (только для читателя).
+bool event_bus_ring_peek(const event_bus_ring_t *ring);
+// Занятых позиций (только для читателя).
+uint32_t event_bus_ring_depth(const event_bus_ring_t *ring);
+
+// Слияние: пока сообщение сливаемого типа с тем же topic ждет в кольце, новое заменяет его
+// значение, а не занимает еще один слот. Запись в кольце указывает на слот таблицы; задача шины,
+// дойдя до нее, забирает последнее значение.
+typedef enum {
+    EVENT_BUS_COALESCE_NONE,      // слияние не применяется, блок ставится в кольцо как обычно
+    EVENT_BUS_COALESCE_QUEUED,    // блок поставлен в кольцо и занял слот таблицы
+    EVENT_BUS_COALESCE_REPLACED,  // блок заменил ожидающее значение, в кольцо ничего не добавлено
+} event_bus_coalesce_result_t;
+
+bool event_bus_coalesce_enabled(event_bus_type_t type);
+// Не ждет: при заполненном кольце или таблице возвращает EVENT_BUS_COALESCE_NONE.
+event_bus_coalesce_result_t event_bus_coalesce_post(event_bus_ring_t *ring, event_bus_block_t *block);
+// Для блока, вынутого из кольца: освобождает ссылку кольца и возвращает блок для обработчиков
+// (последнее значение слота или сам блок, если он не из таблицы).
+event_bus_block_t *event_bus_coalesce_take(event_bus_block_t *queued);
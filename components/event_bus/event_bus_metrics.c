@@ -0,0 +1,226 @@
+#include "event_bus.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#define METRICS_MAX_HANDLERS 16
+
+static const char *TAG = "event_bus_metrics";
+static esp_timer_handle_t s_timer = NULL;
+static portMUX_TYPE s_part_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_part_busy = false;
+static char s_part[EVENT_BUS_METRICS_PART_LEN];
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t off;
+} metrics_writer_t;
+
+static void put(metrics_writer_t *w, const char *fmt, ...)
+{
+    if (w->off >= w->len) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(w->buf + w->off, w->len - w->off, fmt, ap);
+    va_end(ap);
+    w->off = n < 0 ? w->len : w->off + (size_t)n;
+}
+
+static void put_type_counts(metrics_writer_t *w, const char *key, const uint32_t *counts)
+{
+    put(w, "\"%s\":{", key);
+    const char *sep = "";
+    for (size_t t = 0; t < EVENT_TYPE_COUNT; ++t) {
+        if (counts[t]) {
+            put(w, "%s\"%s\":%" PRIu32, sep, event_bus_type_name((event_bus_type_t)t), counts[t]);
+            sep = ",";
+        }
+    }
+    put(w, "}");
+}
+
+static void put_prio_counts(metrics_writer_t *w, const char *key, const uint32_t *counts)
+{
+    put(w, ",\"%s\":{", key);
+    for (size_t p = 0; p < EVENT_BUS_PRIO_COUNT; ++p) {
+        put(w, "%s\"%s\":%" PRIu32, p ? "," : "", event_bus_prio_name((event_bus_prio_t)p), counts[p]);
+    }
+    put(w, "}");
+}
+
+size_t event_bus_format_metrics(char *buf, size_t len)
+{
+    if (!buf || len == 0) {
+        return 0;
+    }
+    event_bus_stats_t st;
+    event_bus_get_stats(&st);
+    event_bus_handler_stats_t handlers[METRICS_MAX_HANDLERS];
+    size_t count = event_bus_get_handler_stats(handlers, METRICS_MAX_HANDLERS);
+    if (count > METRICS_MAX_HANDLERS) {
+        count = METRICS_MAX_HANDLERS;
+    }
+
+    metrics_writer_t w = {.buf = buf, .len = len};
+    put(&w, "{");
+    put_type_counts(&w, "posted", st.posted);
+    put(&w, ",");
+    put_type_counts(&w, "delivered", st.delivered);
+    put_prio_counts(&w, "drops", st.drops);
+    put_prio_counts(&w, "ring_hwm", st.ring_hwm);
+    put_prio_counts(&w, "post_blocked", st.post_blocked);
+    put_prio_counts(&w, "post_blocked_max_us", st.post_blocked_max_us);
+    put(&w, ",\"channel_hwm\":%" PRIu32 ",\"coalesced\":%" PRIu32, st.channel_hwm, st.coalesced);
+    put(&w, ",\"pressure\":{\"active\":%s,\"episodes\":%" PRIu32 ",\"total_ms\":%" PRIu64 "}",
+        st.under_pressure ? "true" : "false", st.pressure_episodes, st.pressure_us / 1000);
+    put(&w, ",\"handlers\":[");
+    for (size_t i = 0; i < count; ++i) {
+        const event_bus_handler_stats_t *h = &handlers[i];
+        put(&w,
+            "%s{\"name\":\"%s\",\"calls\":%" PRIu32 ",\"total_ms\":%" PRIu64 ",\"avg_us\":%" PRIu32
+            ",\"max_us\":%" PRIu32 ",\"drops\":%" PRIu32 ",\"stalls\":%" PRIu32 ",\"max_backlog\":%" PRIu32 "}",
+            i ? "," : "", h->name, h->calls, h->total_us / 1000, h->avg_us, h->max_us, h->drops, h->stalls, h->max_backlog);
+    }
+    put(&w, "]}");
+    if (w.off >= len) {
+        // Обрезанный JSON бесполезен для разбора: лучше ничего.
+        buf[0] = 0;
+        return 0;
+    }
+    return w.off;
+}
+
+static bool post_part(const char *topic, const metrics_writer_t *w)
+{
+    if (w->off >= w->len) {
+        ESP_LOGW(TAG, "metrics part %s does not fit %u bytes", topic, (unsigned)w->len);
+        return false;
+    }
+    event_bus_message_t msg = {
+        .type = EVENT_SYSTEM_STATUS,
+        .topic = topic,
+        .payload = w->buf,
+        .topic_id = TOPIC_ID_NONE,
+    };
+    // Не ждем (вызывается и из колбэка esp_timer); EVENT_SYSTEM_STATUS сливается по топику,
+    // так что неразобранная часть заменится новой. Шина копирует строки, буфер можно переиспользовать.
+    return event_bus_post_nowait(&msg) == ESP_OK;
+}
+
+esp_err_t event_bus_metrics_publish(void)
+{
+    taskENTER_CRITICAL(&s_part_lock);
+    bool busy = s_part_busy;
+    s_part_busy = true;
+    taskEXIT_CRITICAL(&s_part_lock);
+    if (busy) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_bus_stats_t st;
+    event_bus_get_stats(&st);
+    event_bus_handler_stats_t handlers[METRICS_MAX_HANDLERS];
+    size_t count = event_bus_get_handler_stats(handlers, METRICS_MAX_HANDLERS);
+    if (count > METRICS_MAX_HANDLERS) {
+        count = METRICS_MAX_HANDLERS;
+    }
+
+    bool ok = true;
+    metrics_writer_t w = {.buf = s_part, .len = sizeof(s_part)};
+    put(&w, "{\"channel_hwm\":%" PRIu32 ",\"coalesced\":%" PRIu32, st.channel_hwm, st.coalesced);
+    put_prio_counts(&w, "drops", st.drops);
+    put_prio_counts(&w, "ring_hwm", st.ring_hwm);
+    put_prio_counts(&w, "post_blocked", st.post_blocked);
+    put_prio_counts(&w, "post_blocked_max_us", st.post_blocked_max_us);
+    put(&w, ",\"pressure\":{\"active\":%s,\"episodes\":%" PRIu32 ",\"total_ms\":%" PRIu64 "},\"handlers\":%u}",
+        st.under_pressure ? "true" : "false", st.pressure_episodes, st.pressure_us / 1000, (unsigned)count);
+    ok &= post_part(EVENT_BUS_METRICS_TOPIC, &w);
+
+    w.off = 0;
+    put(&w, "{");
+    put_type_counts(&w, "posted", st.posted);
+    put(&w, "}");
+    ok &= post_part(EVENT_BUS_METRICS_TOPIC "/posted", &w);
+
+    w.off = 0;
+    put(&w, "{");
+    put_type_counts(&w, "delivered", st.delivered);
+    put(&w, "}");
+    ok &= post_part(EVENT_BUS_METRICS_TOPIC "/delivered", &w);
+
+    // Обработчики - порциями: очередной объект начинает новую часть, если не влезает вместе с "]}".
+    char topic[sizeof(EVENT_BUS_METRICS_TOPIC) + 16];
+    char item[192];
+    size_t part = 0;
+    size_t in_part = 0;
+    w.off = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const event_bus_handler_stats_t *h = &handlers[i];
+        int n = snprintf(item, sizeof(item),
+                         "{\"name\":\"%s\",\"calls\":%" PRIu32 ",\"total_ms\":%" PRIu64 ",\"avg_us\":%" PRIu32
+                         ",\"max_us\":%" PRIu32 ",\"drops\":%" PRIu32 ",\"stalls\":%" PRIu32 ",\"max_backlog\":%" PRIu32 "}",
+                         h->name, h->calls, h->total_us / 1000, h->avg_us, h->max_us, h->drops, h->stalls, h->max_backlog);
+        if (n < 0 || (size_t)n >= sizeof(item)) {
+            continue;
+        }
+        if (in_part > 0 && w.off + 1 + (size_t)n + 2 >= w.len) {
+            put(&w, "]}");
+            snprintf(topic, sizeof(topic), EVENT_BUS_METRICS_TOPIC "/handlers/%u", (unsigned)part++);
+            ok &= post_part(topic, &w);
+            w.off = 0;
+            in_part = 0;
+        }
+        if (in_part == 0) {
+            put(&w, "{\"handlers\":[");
+        }
+        put(&w, "%s%s", in_part ? "," : "", item);
+        in_part++;
+    }
+    if (in_part > 0) {
+        put(&w, "]}");
+        snprintf(topic, sizeof(topic), EVENT_BUS_METRICS_TOPIC "/handlers/%u", (unsigned)part);
+        ok &= post_part(topic, &w);
+    }
+
+    taskENTER_CRITICAL(&s_part_lock);
+    s_part_busy = false;
+    taskEXIT_CRITICAL(&s_part_lock);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+static void metrics_timer_cb(void *arg)
+{
+    (void)arg;
+    (void)event_bus_metrics_publish();
+}
+
+esp_err_t event_bus_metrics_start(void)
+{
+#if CONFIG_BROKER_EVENT_BUS_METRICS_S > 0
+    if (s_timer) {
+        return ESP_OK;
+    }
+    const esp_timer_create_args_t args = {
+        .callback = metrics_timer_cb,
+        .name = "evb_metrics",
+    };
+    esp_err_t err = esp_timer_create(&args, &s_timer);
+    if (err == ESP_OK) {
+        err = esp_timer_start_periodic(s_timer, (uint64_t)CONFIG_BROKER_EVENT_BUS_METRICS_S * 1000000ull);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "metrics timer failed: %s", esp_err_to_name(err));
+    }
+    return err;
+#else
+    return ESP_OK;
+#endif
+}
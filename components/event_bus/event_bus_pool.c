@@ -0,0 +1,182 @@
+#include "event_bus_internal.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+// Классы размеров под строки сообщения (topic + payload + два нуля). Большинство событий - флаги,
+// короткие команды и телеметрия и укладываются в первый класс; последний совпадает с прежним
+// фиксированным сообщением (64 + 256). Все, что больше, берется из кучи (PSRAM) и не кешируется.
+static const uint16_t k_class_bytes[] = {48, 128, 320};
+static const uint8_t k_class_keep[] = {32, 32, 16};
+#define EVENT_BUS_POOL_CLASSES (sizeof(k_class_bytes) / sizeof(k_class_bytes[0]))
+#define EVENT_BUS_BLOCK_HEAP (-1)
+// Резерв для event_bus_post_nowait / event_bus_post_from_isr: блоки выделяются один раз и берутся
+// без кучи и без ожидания (в том числе из прерывания); обычные публикации их не расходуют.
+#define EVENT_BUS_BLOCK_RESERVED (-2)
+#define EVENT_BUS_RESERVED_BLOCKS 16
+
+static event_bus_block_t *s_free[EVENT_BUS_POOL_CLASSES];
+static uint8_t s_free_count[EVENT_BUS_POOL_CLASSES];
+static portMUX_TYPE s_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static event_bus_block_t *s_reserved;
+static bool s_reserve_ready = false;
+static portMUX_TYPE s_reserved_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int pick_class(size_t bytes)
+{
+    for (size_t i = 0; i < EVENT_BUS_POOL_CLASSES; ++i) {
+        if (bytes <= k_class_bytes[i]) {
+            return (int)i;
+        }
+    }
+    return EVENT_BUS_BLOCK_HEAP;
+}
+
+static event_bus_block_t *block_alloc(size_t bytes)
+{
+    int cls = pick_class(bytes);
+    event_bus_block_t *block = NULL;
+    if (cls != EVENT_BUS_BLOCK_HEAP) {
+        taskENTER_CRITICAL(&s_pool_lock);
+        block = s_free[cls];
+        if (block) {
+            s_free[cls] = block->next;
+            s_free_count[cls]--;
+        }
+        taskEXIT_CRITICAL(&s_pool_lock);
+        if (!block) {
+            // Классы пула - горячие мелкие блоки, им место во внутренней RAM.
+            size_t size = sizeof(event_bus_block_t) + k_class_bytes[cls];
+            block = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            if (!block) {
+                block = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            }
+        }
+    } else {
+        size_t size = sizeof(event_bus_block_t) + bytes;
+        block = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!block) {
+            block = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+    }
+    if (block) {
+        block->size_class = (int8_t)cls;
+        block->next = NULL;
+    }
+    return block;
+}
+
+esp_err_t event_bus_reserve_init(void)
+{
+    if (s_reserve_ready) {
+        return ESP_OK;
+    }
+    size_t size = sizeof(event_bus_block_t) + EVENT_BUS_RESERVED_BYTES;
+    for (int i = 0; i < EVENT_BUS_RESERVED_BLOCKS; ++i) {
+        event_bus_block_t *block = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!block) {
+            return ESP_ERR_NO_MEM;
+        }
+        block->size_class = EVENT_BUS_BLOCK_RESERVED;
+        block->next = s_reserved;
+        s_reserved = block;
+    }
+    s_reserve_ready = true;
+    return ESP_OK;
+}
+
+static void block_fill(event_bus_block_t *block, const event_bus_message_t *message, const char *topic,
+                       size_t topic_len, const char *payload, size_t payload_len)
+{
+    char *data = block->data;
+    memcpy(data, topic, topic_len + 1);
+    memcpy(data + topic_len + 1, payload, payload_len + 1);
+    block->msg.type = message->type;
+    block->msg.topic_id = message->topic_id;
+    block->msg.topic = data;
+    block->msg.payload = data + topic_len + 1;
+    block->refs = 1;
+    block->coalesce_slot = -1;
+    block->posted_us = esp_timer_get_time();
+}
+
+event_bus_block_t *event_bus_block_create(const event_bus_message_t *message)
+{
+    const char *topic = message->topic ? message->topic : "";
+    const char *payload = message->payload ? message->payload : "";
+    size_t topic_len = strlen(topic);
+    size_t payload_len = strlen(payload);
+    event_bus_block_t *block = block_alloc(topic_len + payload_len + 2);
+    if (block) {
+        block_fill(block, message, topic, topic_len, payload, payload_len);
+    }
+    return block;
+}
+
+event_bus_block_t *event_bus_block_create_reserved(const event_bus_message_t *message)
+{
+    const char *topic = message->topic ? message->topic : "";
+    const char *payload = message->payload ? message->payload : "";
+    size_t topic_len = strlen(topic);
+    size_t payload_len = strlen(payload);
+    if (topic_len + payload_len + 2 > EVENT_BUS_RESERVED_BYTES) {
+        return NULL;
+    }
+    portENTER_CRITICAL_SAFE(&s_reserved_lock);
+    event_bus_block_t *block = s_reserved;
+    if (block) {
+        s_reserved = block->next;
+    }
+    portEXIT_CRITICAL_SAFE(&s_reserved_lock);
+    if (block) {
+        block->next = NULL;
+        block_fill(block, message, topic, topic_len, payload, payload_len);
+    }
+    return block;
+}
+
+void event_bus_block_release(event_bus_block_t *block)
+{
+    if (!block || __atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    int cls = block->size_class;
+    if (cls == EVENT_BUS_BLOCK_RESERVED) {
+        portENTER_CRITICAL_SAFE(&s_reserved_lock);
+        block->next = s_reserved;
+        s_reserved = block;
+        portEXIT_CRITICAL_SAFE(&s_reserved_lock);
+        return;
+    }
+    if (cls != EVENT_BUS_BLOCK_HEAP) {
+        bool cached = false;
+        taskENTER_CRITICAL(&s_pool_lock);
+        if (s_free_count[cls] < k_class_keep[cls]) {
+            block->next = s_free[cls];
+            s_free[cls] = block;
+            s_free_count[cls]++;
+            cached = true;
+        }
+        taskEXIT_CRITICAL(&s_pool_lock);
+        if (cached) {
+            return;
+        }
+    }
+    heap_caps_free(block);
+}
+
+// msg - первое поле блока, поэтому указатель сообщения обработчика и есть указатель блока.
+const event_bus_message_t *event_bus_message_retain(const event_bus_message_t *message)
+{
+    if (message) {
+        __atomic_add_fetch(&((event_bus_block_t *)message)->refs, 1, __ATOMIC_RELAXED);
+    }
+    return message;
+}
+
+void event_bus_message_release(const event_bus_message_t *message)
+{
+    event_bus_block_release((event_bus_block_t *)message);
+}
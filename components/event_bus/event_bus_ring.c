@@ -0,0 +1,66 @@
+#include "event_bus_internal.h"
+
+_Static_assert((EVENT_BUS_RING_LEN & (EVENT_BUS_RING_LEN - 1)) == 0, "ring length must be a power of two");
+
+#define RING_MASK (EVENT_BUS_RING_LEN - 1)
+
+void event_bus_ring_init(event_bus_ring_t *ring)
+{
+    for (uint32_t i = 0; i < EVENT_BUS_RING_LEN; ++i) {
+        ring->slots[i].seq = i;
+        ring->slots[i].block = NULL;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+bool event_bus_ring_push(event_bus_ring_t *ring, event_bus_block_t *block)
+{
+    uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for (;;) {
+        event_bus_ring_slot_t *slot = &ring->slots[pos & RING_MASK];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            // Слот свободен для позиции pos: занимаем его, если head никто не сдвинул.
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                slot->block = block;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            // pos обновлен CAS-ом, пробуем следующую позицию.
+        } else if (diff < 0) {
+            // Слот еще хранит сообщение предыдущего круга: кольцо заполнено.
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+event_bus_block_t *event_bus_ring_pop(event_bus_ring_t *ring)
+{
+    uint32_t pos = ring->tail;
+    event_bus_ring_slot_t *slot = &ring->slots[pos & RING_MASK];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return NULL;
+    }
+    event_bus_block_t *block = slot->block;
+    __atomic_store_n(&slot->seq, pos + EVENT_BUS_RING_LEN, __ATOMIC_RELEASE);
+    ring->tail = pos + 1;
+    return block;
+}
+
+bool event_bus_ring_peek(const event_bus_ring_t *ring)
+{
+    uint32_t pos = ring->tail;
+    return __atomic_load_n(&ring->slots[pos & RING_MASK].seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+uint32_t event_bus_ring_depth(const event_bus_ring_t *ring)
+{
+    // head может включать позиции, занятые, но еще не опубликованные: оценка сверху.
+    uint32_t depth = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) - ring->tail;
+    return depth > EVENT_BUS_RING_LEN ? EVENT_BUS_RING_LEN : depth;
+}
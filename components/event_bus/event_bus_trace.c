@@ -0,0 +1,454 @@
+#include "event_bus_trace.h"
+#include "event_bus.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "broker_affinity.h"
+
+// Половина двойного буфера; запись больше нее не помещается никогда и считается потерянной.
+#define TRACE_BUF_BYTES (16 * 1024)
+#define TRACE_FLUSH_MS 200
+#define TRACE_PATH_MAX 128
+#define TRACE_IDLE_TIMEOUT_MS 30000
+#define TRACE_TASK_STACK 4096
+#define TRACE_TASK_PRIORITY 3
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+} trace_file_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t dt_us;
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t topic_len;
+    uint16_t payload_len;
+} trace_record_t;
+
+static const char *TAG = "event_trace";
+static const char k_magic[4] = {'E', 'V', 'T', 'R'};
+
+// Отвод пишет только задача шины: под s_buf_lock резервирует место в активной половине и копирует
+// уже без блокировки; задача записи меняет половины и ждет, пока копирование в старую закончится.
+static uint8_t *s_buf[2];
+static size_t s_fill[2];
+static uint32_t s_copying[2];
+static int s_active = 0;
+static bool s_recording = false;
+static int64_t s_last_us = 0;
+static bool s_have_last = false;
+static uint32_t s_records = 0;
+static uint32_t s_lost = 0;
+static uint64_t s_bytes = 0;
+static portMUX_TYPE s_buf_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Файл и сброс буферов - под s_io_lock (задача записи и record_stop).
+static SemaphoreHandle_t s_io_lock = NULL;
+static FILE *s_file = NULL;
+static TaskHandle_t s_writer = NULL;
+
+static portMUX_TYPE s_replay_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_replaying = false;
+static bool s_has_replay = false;
+static event_trace_replay_stats_t s_last_replay;
+static char s_replay_path[TRACE_PATH_MAX];
+static uint32_t s_replay_speed = 0;
+
+static void trace_tap(const event_bus_message_t *msg, int64_t posted_us)
+{
+    size_t topic_len = strlen(msg->topic);
+    size_t payload_len = strlen(msg->payload);
+    if (topic_len > UINT16_MAX || payload_len > UINT16_MAX) {
+        taskENTER_CRITICAL(&s_buf_lock);
+        s_lost++;
+        taskEXIT_CRITICAL(&s_buf_lock);
+        return;
+    }
+    size_t need = sizeof(trace_record_t) + topic_len + payload_len;
+
+    taskENTER_CRITICAL(&s_buf_lock);
+    if (!s_recording) {
+        taskEXIT_CRITICAL(&s_buf_lock);
+        return;
+    }
+    int idx = s_active;
+    size_t off = s_fill[idx];
+    if (off + need > TRACE_BUF_BYTES) {
+        s_lost++;
+        taskEXIT_CRITICAL(&s_buf_lock);
+        xTaskNotifyGive(s_writer);
+        return;
+    }
+    // Управляющие события разбираются раньше телеметрии, опубликованной до них, поэтому время
+    // публикации может идти назад; интервал тогда нулевой.
+    int64_t dt = s_have_last ? posted_us - s_last_us : 0;
+    if (dt < 0) {
+        dt = 0;
+    } else {
+        s_last_us = posted_us;
+    }
+    s_have_last = true;
+    s_fill[idx] = off + need;
+    s_copying[idx]++;
+    s_records++;
+    s_bytes += need;
+    taskEXIT_CRITICAL(&s_buf_lock);
+
+    trace_record_t rec = {
+        .dt_us = dt > UINT32_MAX ? UINT32_MAX : (uint32_t)dt,
+        .type = (uint8_t)msg->type,
+        .topic_len = (uint16_t)topic_len,
+        .payload_len = (uint16_t)payload_len,
+    };
+    uint8_t *dst = s_buf[idx] + off;
+    memcpy(dst, &rec, sizeof(rec));
+    memcpy(dst + sizeof(rec), msg->topic, topic_len);
+    memcpy(dst + sizeof(rec) + topic_len, msg->payload, payload_len);
+
+    taskENTER_CRITICAL(&s_buf_lock);
+    s_copying[idx]--;
+    taskEXIT_CRITICAL(&s_buf_lock);
+    if (off + need > TRACE_BUF_BYTES / 2 && off <= TRACE_BUF_BYTES / 2) {
+        xTaskNotifyGive(s_writer);
+    }
+}
+
+// Под s_io_lock: отдает отводу другую половину и пишет накопленное в файл.
+static void flush_half(void)
+{
+    taskENTER_CRITICAL(&s_buf_lock);
+    int idx = s_active;
+    s_active ^= 1;
+    taskEXIT_CRITICAL(&s_buf_lock);
+    for (;;) {
+        taskENTER_CRITICAL(&s_buf_lock);
+        uint32_t copying = s_copying[idx];
+        taskEXIT_CRITICAL(&s_buf_lock);
+        if (!copying) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+    if (s_fill[idx] && s_file && fwrite(s_buf[idx], 1, s_fill[idx], s_file) != s_fill[idx]) {
+        ESP_LOGW(TAG, "trace write failed (%u bytes)", (unsigned)s_fill[idx]);
+    }
+    taskENTER_CRITICAL(&s_buf_lock);
+    s_fill[idx] = 0;
+    taskEXIT_CRITICAL(&s_buf_lock);
+}
+
+static void writer_task(void *param)
+{
+    (void)param;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TRACE_FLUSH_MS));
+        xSemaphoreTake(s_io_lock, portMAX_DELAY);
+        if (s_file) {
+            flush_half();
+            fflush(s_file);
+        }
+        xSemaphoreGive(s_io_lock);
+    }
+}
+
+static esp_err_t ensure_recorder(void)
+{
+    if (!s_io_lock) {
+        s_io_lock = xSemaphoreCreateMutex();
+        if (!s_io_lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (!s_buf[i]) {
+            s_buf[i] = heap_caps_malloc(TRACE_BUF_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (!s_buf[i]) {
+                s_buf[i] = heap_caps_malloc(TRACE_BUF_BYTES, MALLOC_CAP_8BIT);
+            }
+            if (!s_buf[i]) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    if (!s_writer && xTaskCreatePinnedToCore(writer_task, "evb_trace", TRACE_TASK_STACK, NULL, TRACE_TASK_PRIORITY,
+                                             &s_writer, BROKER_APP_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t event_trace_record_start(const char *path)
+{
+    if (!path || !path[0]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ensure_recorder();
+    if (err != ESP_OK) {
+        return err;
+    }
+    taskENTER_CRITICAL(&s_replay_lock);
+    bool replaying = s_replaying;
+    taskEXIT_CRITICAL(&s_replay_lock);
+    if (replaying) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+    if (s_file) {
+        xSemaphoreGive(s_io_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        xSemaphoreGive(s_io_lock);
+        ESP_LOGE(TAG, "cannot open %s", path);
+        return ESP_FAIL;
+    }
+    trace_file_header_t hdr = {.version = EVENT_TRACE_VERSION};
+    memcpy(hdr.magic, k_magic, sizeof(hdr.magic));
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        fclose(fp);
+        xSemaphoreGive(s_io_lock);
+        return ESP_FAIL;
+    }
+    s_file = fp;
+    taskENTER_CRITICAL(&s_buf_lock);
+    s_fill[0] = s_fill[1] = 0;
+    s_have_last = false;
+    s_records = 0;
+    s_lost = 0;
+    s_bytes = sizeof(hdr);
+    s_recording = true;
+    taskEXIT_CRITICAL(&s_buf_lock);
+    xSemaphoreGive(s_io_lock);
+    event_bus_set_tap(trace_tap);
+    ESP_LOGI(TAG, "recording to %s", path);
+    return ESP_OK;
+}
+
+esp_err_t event_trace_record_stop(event_trace_status_t *stats)
+{
+    if (!s_io_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_io_lock, portMAX_DELAY);
+    if (!s_file) {
+        xSemaphoreGive(s_io_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_bus_set_tap(NULL);
+    taskENTER_CRITICAL(&s_buf_lock);
+    s_recording = false;
+    taskEXIT_CRITICAL(&s_buf_lock);
+    // Обе половины: сначала накопленную раньше, затем текущую.
+    flush_half();
+    flush_half();
+    esp_err_t err = fclose(s_file) == 0 ? ESP_OK : ESP_FAIL;
+    s_file = NULL;
+    xSemaphoreGive(s_io_lock);
+    if (stats) {
+        event_trace_get_status(stats);
+    }
+    ESP_LOGI(TAG, "recording stopped: %" PRIu32 " records, %" PRIu32 " lost", s_records, s_lost);
+    return err;
+}
+
+static bool read_exact(FILE *fp, void *dst, size_t len)
+{
+    return len == 0 || fread(dst, 1, len, fp) == len;
+}
+
+// Шина считается разобравшей трассу после двух подряд проверок простоя с интервалом в тик.
+static bool wait_bus_idle(void)
+{
+    TickType_t start = xTaskGetTickCount();
+    int idle = 0;
+    while (idle < 2) {
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(TRACE_IDLE_TIMEOUT_MS)) {
+            return false;
+        }
+        idle = event_bus_is_idle() ? idle + 1 : 0;
+        if (idle < 2) {
+            vTaskDelay(1);
+        }
+    }
+    return true;
+}
+
+// Отвод при этом выключен: запись и воспроизведение взаимно исключены через s_replaying.
+static esp_err_t replay_file(const char *path, uint32_t speed, event_trace_replay_stats_t *stats)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ESP_LOGE(TAG, "cannot open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    trace_file_header_t hdr;
+    if (!read_exact(fp, &hdr, sizeof(hdr)) || memcmp(hdr.magic, k_magic, sizeof(k_magic)) != 0 ||
+        hdr.version != EVENT_TRACE_VERSION) {
+        fclose(fp);
+        ESP_LOGE(TAG, "%s is not an event trace", path);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    event_trace_replay_stats_t st = {0};
+    char *text = NULL;
+    size_t text_cap = 0;
+    esp_err_t err = ESP_OK;
+    int64_t start = esp_timer_get_time();
+    trace_record_t rec;
+    while (read_exact(fp, &rec, sizeof(rec))) {
+        size_t need = (size_t)rec.topic_len + rec.payload_len + 2;
+        if (need > text_cap) {
+            heap_caps_free(text);
+            text = heap_caps_malloc(need, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (!text) {
+                text = heap_caps_malloc(need, MALLOC_CAP_8BIT);
+            }
+            text_cap = text ? need : 0;
+            if (!text) {
+                err = ESP_ERR_NO_MEM;
+                break;
+            }
+        }
+        char *topic = text;
+        char *payload = text + rec.topic_len + 1;
+        if (!read_exact(fp, topic, rec.topic_len) || !read_exact(fp, payload, rec.payload_len)) {
+            ESP_LOGW(TAG, "truncated record after %" PRIu32 " events", st.events);
+            break;
+        }
+        topic[rec.topic_len] = 0;
+        payload[rec.payload_len] = 0;
+        st.trace_us += rec.dt_us;
+        if (speed > 0) {
+            int64_t due = start + (int64_t)(st.trace_us / speed);
+            int64_t wait_us = due - esp_timer_get_time();
+            if (wait_us >= 1000) {
+                vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+            }
+        }
+        if (rec.type >= EVENT_TYPE_COUNT) {
+            st.failed++;
+            continue;
+        }
+        event_bus_message_t msg = {
+            .type = (event_bus_type_t)rec.type,
+            .topic = topic,
+            .payload = payload,
+            .topic_id = TOPIC_ID_NONE,
+        };
+        if (event_bus_post(&msg, portMAX_DELAY) == ESP_OK) {
+            st.events++;
+        } else {
+            st.failed++;
+        }
+    }
+    fclose(fp);
+    heap_caps_free(text);
+    st.drained = wait_bus_idle();
+    st.elapsed_us = (uint64_t)(esp_timer_get_time() - start);
+    st.events_per_s = st.elapsed_us ? (uint32_t)((uint64_t)st.events * 1000000u / st.elapsed_us) : 0;
+    ESP_LOGI(TAG, "replayed %" PRIu32 " events (%" PRIu32 " failed) in %" PRIu64 " ms, %" PRIu32 " ev/s%s",
+             st.events, st.failed, st.elapsed_us / 1000, st.events_per_s, st.drained ? "" : ", bus not drained");
+    if (stats) {
+        *stats = st;
+    }
+    return err;
+}
+
+static bool claim_replay(void)
+{
+    taskENTER_CRITICAL(&s_buf_lock);
+    bool recording = s_recording;
+    taskEXIT_CRITICAL(&s_buf_lock);
+    taskENTER_CRITICAL(&s_replay_lock);
+    bool busy = s_replaying || recording;
+    if (!busy) {
+        s_replaying = true;
+    }
+    taskEXIT_CRITICAL(&s_replay_lock);
+    return !busy;
+}
+
+static void finish_replay(const event_trace_replay_stats_t *st)
+{
+    taskENTER_CRITICAL(&s_replay_lock);
+    s_last_replay = *st;
+    s_has_replay = true;
+    s_replaying = false;
+    taskEXIT_CRITICAL(&s_replay_lock);
+}
+
+esp_err_t event_trace_replay(const char *path, uint32_t speed, event_trace_replay_stats_t *stats)
+{
+    if (!path || !path[0]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!claim_replay()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_trace_replay_stats_t st = {0};
+    esp_err_t err = replay_file(path, speed, &st);
+    finish_replay(&st);
+    if (stats) {
+        *stats = st;
+    }
+    return err;
+}
+
+static void replay_task(void *param)
+{
+    (void)param;
+    event_trace_replay_stats_t st = {0};
+    replay_file(s_replay_path, s_replay_speed, &st);
+    finish_replay(&st);
+    vTaskDelete(NULL);
+}
+
+esp_err_t event_trace_replay_start(const char *path, uint32_t speed)
+{
+    if (!path || !path[0] || strlen(path) >= sizeof(s_replay_path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!claim_replay()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    snprintf(s_replay_path, sizeof(s_replay_path), "%s", path);
+    s_replay_speed = speed;
+    if (xTaskCreatePinnedToCore(replay_task, "evb_replay", TRACE_TASK_STACK, NULL, TRACE_TASK_PRIORITY, NULL,
+                                BROKER_APP_CORE) != pdPASS) {
+        taskENTER_CRITICAL(&s_replay_lock);
+        s_replaying = false;
+        taskEXIT_CRITICAL(&s_replay_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void event_trace_get_status(event_trace_status_t *out)
+{
+    if (!out) {
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    taskENTER_CRITICAL(&s_buf_lock);
+    out->recording = s_recording;
+    out->records = s_records;
+    out->lost = s_lost;
+    out->bytes = s_bytes;
+    taskEXIT_CRITICAL(&s_buf_lock);
+    taskENTER_CRITICAL(&s_replay_lock);
+    out->replaying = s_replaying;
+    out->has_replay = s_has_replay;
+    out->last_replay = s_last_replay;
+    taskEXIT_CRITICAL(&s_replay_lock);
+}
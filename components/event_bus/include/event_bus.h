@@ -1,8 +1,11 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "esp_err.h"
+#include "topic_intern.h"
 
 typedef enum {
     EVENT_NONE = 0,
@@ -18,17 +21,169 @@ typedef enum {
     EVENT_DEVICE_CONFIG_CHANGED,
     EVENT_MQTT_MESSAGE,
     EVENT_FLAG_CHANGED,
+    EVENT_TYPE_COUNT,
 } event_bus_type_t;
 
+// Набор типов для event_bus_subscribe: EVENT_BUS_MASK(EVENT_CARD_OK) | EVENT_BUS_MASK(EVENT_CARD_BAD).
+typedef uint32_t event_bus_mask_t;
+#define EVENT_BUS_MASK(type) ((event_bus_mask_t)1u << (type))
+#define EVENT_BUS_MASK_ALL (EVENT_BUS_MASK(EVENT_TYPE_COUNT) - 1u)
+
+// Производитель заполняет структуру на стеке и указывает на свои строки; event_bus_post копирует
+// topic и payload одним блоком из пула ровно по их длине, в очередь уходит только указатель.
+// Обработчики получают сообщение из блока: строки не NULL (пустые - ""), длина не ограничена.
 typedef struct {
     event_bus_type_t type;
-    char topic[64];
-    char payload[256];
+    const char *topic;
+    const char *payload;
+    // Интернированный id топика, если источник уже посчитал его (иначе TOPIC_ID_NONE).
+    topic_id_t topic_id;
 } event_bus_message_t;
 
+// Классы приоритета. Управляющие события (сценарии, флаги, карты, команды) идут через свое кольцо
+// с отдельной емкостью и разбираются раньше телеметрии, поэтому поток EVENT_MQTT_MESSAGE и
+// EVENT_SYSTEM_STATUS не вытесняет и не задерживает их.
+typedef enum {
+    EVENT_BUS_PRIO_CONTROL = 0,
+    EVENT_BUS_PRIO_TELEMETRY,
+    EVENT_BUS_PRIO_COUNT,
+} event_bus_prio_t;
+
+event_bus_prio_t event_bus_type_prio(event_bus_type_t type);
+// Сообщения класса, отброшенные с момента event_bus_init (заполненное кольцо или канал до timeout).
+uint32_t event_bus_drop_count(event_bus_prio_t prio);
+
+// Типы "последнего значения": пока сообщение такого типа с тем же topic ждет в очереди шины,
+// новое заменяет его на месте, и обработчики получают только последнее. По умолчанию
+// EVENT_SYSTEM_STATUS, EVENT_VOLUME_SET и, с CONFIG_BROKER_EVENT_BUS_COALESCE_FLAGS, EVENT_FLAG_CHANGED.
+void event_bus_set_coalesce_types(event_bus_mask_t types);
+event_bus_mask_t event_bus_get_coalesce_types(void);
+// Сколько сообщений заменено более новыми с момента старта.
+uint32_t event_bus_coalesced_count(void);
+
 typedef void (*event_bus_handler_t)(const event_bus_message_t *message);
 
+// Параметры подписки. depth == 0 - обработчик вызывается прямо в задаче шины (как event_bus_subscribe).
+// depth > 0 - у обработчика свои очереди и своя задача (priority, stack_size; 0 - значения по
+// умолчанию), так что медленный обработчик не задерживает шину и остальных. Очередей две, по depth
+// сообщений: управляющие события и телеметрия (event_bus_type_prio), и обработчик разбирает
+// управляющие первыми, так что поток телеметрии задерживает их не больше чем на одно сообщение. Отбрасывается только телеметрия, не поместившаяся в очередь, и только
+// для этого обработчика. Управляющее событие не теряется: при полной очереди задача шины ждет места
+// (stalls), шина на это время под давлением, а производители ждут места в кольцах.
+typedef struct {
+    const char *name;       // для логов и статистики, копируется (до 15 символов)
+    size_t depth;
+    UBaseType_t priority;
+    uint32_t stack_size;
+} event_bus_subscribe_opts_t;
+
+// Статистика обработчика с момента подписки. Время - по вызовам обработчика, backlog - текущее
+// число сообщений в очередях асинхронного обработчика (у синхронного всегда 0), drops - отброшенная
+// телеметрия, stalls - сколько раз задача шины ждала места для управляющего события.
+typedef struct {
+    char name[16];
+    bool async;
+    uint32_t calls;
+    uint32_t drops;
+    uint32_t stalls;
+    uint64_t total_us;
+    uint32_t avg_us;
+    uint32_t max_us;
+    uint32_t backlog;
+    uint32_t max_backlog;
+} event_bus_handler_stats_t;
+
 esp_err_t event_bus_init(void);
 esp_err_t event_bus_start(void);
 esp_err_t event_bus_post(const event_bus_message_t *message, TickType_t timeout);
+// Никогда не ждет: блок берется из резерва шины (16 блоков, topic + payload до 126 байт), при
+// более длинных строках - из пула. Для колбэков esp_timer и обработчиков шины, которым нельзя
+// блокироваться. ESP_ERR_TIMEOUT - кольцо класса заполнено, ESP_ERR_NO_MEM - нет блока.
+esp_err_t event_bus_post_nowait(const event_bus_message_t *message);
+// То же из обработчика прерывания: только резерв, без слияния; woken - как у FromISR API FreeRTOS.
+esp_err_t event_bus_post_from_isr(const event_bus_message_t *message, BaseType_t *woken);
+// Обработчик вызывается только для сообщений с типом из types; отписки нет.
+esp_err_t event_bus_subscribe(event_bus_mask_t types, event_bus_handler_t handler);
+// opts == NULL - то же, что event_bus_subscribe.
+esp_err_t event_bus_subscribe_ex(event_bus_mask_t types, event_bus_handler_t handler,
+                                 const event_bus_subscribe_opts_t *opts);
+// То же, что event_bus_subscribe(EVENT_BUS_MASK_ALL, handler).
 esp_err_t event_bus_register_handler(event_bus_handler_t handler);
+
+// Заполняет до max записей в порядке подписки; возвращает число обработчиков.
+size_t event_bus_get_handler_stats(event_bus_handler_stats_t *out, size_t max);
+
+// Счетчики шины с момента event_bus_init. Ведутся всегда: атомарный инкремент на публикацию,
+// остальное - в задаче шины или на пути ожидания места. posted - принято шиной (в том числе
+// замененное слиянием), delivered - передано обработчикам. Глубина колец - наибольшая, которую
+// задача шины застала перед пачкой; post_blocked* - публикации, ждавшие места в кольце класса.
+typedef struct {
+    uint32_t posted[EVENT_TYPE_COUNT];
+    uint32_t delivered[EVENT_TYPE_COUNT];
+    uint32_t drops[EVENT_BUS_PRIO_COUNT];
+    uint32_t ring_hwm[EVENT_BUS_PRIO_COUNT];
+    uint32_t post_blocked[EVENT_BUS_PRIO_COUNT];
+    uint64_t post_blocked_us[EVENT_BUS_PRIO_COUNT];
+    uint32_t post_blocked_max_us[EVENT_BUS_PRIO_COUNT];
+    uint32_t channel_hwm;
+    uint32_t coalesced;
+    // Перегрузка (event_bus_under_pressure): сейчас, число эпизодов и суммарная длительность.
+    bool under_pressure;
+    uint32_t pressure_episodes;
+    uint64_t pressure_us;
+} event_bus_stats_t;
+
+void event_bus_get_stats(event_bus_stats_t *out);
+// Короткое имя типа для статистики и метрик ("mqtt_message", "flag_changed", ...).
+const char *event_bus_type_name(event_bus_type_t type);
+const char *event_bus_prio_name(event_bus_prio_t prio);
+
+// Снимок event_bus_get_stats и статистики обработчиков одной строкой JSON; 0 - не поместился в len
+// (EVENT_BUS_METRICS_MAX_LEN хватает на все типы и 16 обработчиков).
+#define EVENT_BUS_METRICS_MAX_LEN 2048
+size_t event_bus_format_metrics(char *buf, size_t len);
+// event_bus_start публикует снимок каждые CONFIG_BROKER_EVENT_BUS_METRICS_S секунд как
+// EVENT_SYSTEM_STATUS; мост mqtt_core отправляет его подписчикам MQTT. Целиком снимок больше
+// payload MQTT, поэтому он делится на части не длиннее EVENT_BUS_METRICS_PART_LEN (с нулем):
+// EVENT_BUS_METRICS_TOPIC - кольца, ожидания и перегрузка, ".../posted" и ".../delivered" - счетчики
+// по типам, ".../handlers/<n>" - {"handlers":[...]} с очередной порцией обработчиков.
+#define EVENT_BUS_METRICS_TOPIC "sys/broker/metrics/event_bus"
+#define EVENT_BUS_METRICS_PART_LEN 512
+esp_err_t event_bus_metrics_start(void);
+// Опубликовать снимок частями сейчас (то же делает таймер); ESP_FAIL, если какая-то часть не ушла.
+esp_err_t event_bus_metrics_publish(void);
+
+// Обратное давление. Задача шины смотрит заполнение колец классов и каналов производителей (суммарно)
+// перед каждой пачкой, очередей асинхронных обработчиков - при постановке сообщения. Перегрузка
+// включается, когда какая-то из них заполнена на CONFIG_BROKER_EVENT_BUS_HIGH_WATERMARK процентов,
+// и снимается, когда все, включая очереди обработчиков, опустились до
+// CONFIG_BROKER_EVENT_BUS_LOW_WATERMARK. Производители, которые могут подождать (например, чтение
+// сокетов клиентов), придерживают новую работу, пока флаг поднят, вместо того чтобы упираться
+// в полные очереди и терять сообщения по таймауту.
+bool event_bus_under_pressure(void);
+// Колбэк вызывается задачей шины при каждой смене состояния; не должен блокироваться и публиковать
+// в шину с ожиданием. Подписки сбрасывает event_bus_init, отписки нет.
+typedef void (*event_bus_pressure_cb_t)(bool under_pressure, void *arg);
+#define EVENT_BUS_PRESSURE_LISTENERS 4
+esp_err_t event_bus_add_pressure_listener(event_bus_pressure_cb_t cb, void *arg);
+
+// Отвод для записи трассы: вызывается задачей шины для каждого сообщения перед обработчиками,
+// posted_us - время публикации по esp_timer. Не должен блокироваться. NULL - отключить.
+typedef void (*event_bus_tap_t)(const event_bus_message_t *message, int64_t posted_us);
+void event_bus_set_tap(event_bus_tap_t tap);
+// Очереди шины и асинхронных обработчиков пусты и все обработчики вернули управление.
+bool event_bus_is_idle(void);
+
+// Сообщение, полученное обработчиком, живет до его возврата. Чтобы сохранить его дольше
+// (например, передать в свою очередь), обработчик берет ссылку и позже освобождает ее.
+const event_bus_message_t *event_bus_message_retain(const event_bus_message_t *message);
+void event_bus_message_release(const event_bus_message_t *message);
+
+// Канал single-producer/single-consumer от одной задачи к задаче шины без мьютексов.
+// Писать в канал может только одна задача; каналы живут до перезагрузки.
+typedef struct event_bus_channel event_bus_channel_t;
+
+esp_err_t event_bus_channel_open(size_t depth, event_bus_channel_t **out);
+// При заполненном канале ждет освобождения места до timeout, затем ESP_ERR_TIMEOUT.
+// Управляющие и сливаемые события канал не задерживает: они уходят в кольцо своего класса, как event_bus_post.
+esp_err_t event_bus_channel_post(event_bus_channel_t *channel, const event_bus_message_t *message, TickType_t timeout);
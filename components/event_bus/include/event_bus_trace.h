@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Запись и воспроизведение трассы шины событий. Запись - отвод шины (event_bus_set_tap): каждое
+// разобранное сообщение с временем публикации уходит в двойной буфер, фоновая задача сбрасывает его
+// в файл (на устройстве - на SD, в host-сборке - в обычный файл). Воспроизведение публикует
+// сообщения трассы обратно в шину с исходными интервалами, ускоренными в speed раз, или без пауз
+// (speed == 0), и ждет, пока все обработчики разберут их.
+//
+// Формат файла (little-endian): заголовок "EVTR", u16 версия, u16 резерв; затем записи:
+// u32 интервал от предыдущей записи в мкс, u8 тип, u8 резерв, u16 длина topic, u16 длина payload,
+// строки topic и payload без нулей.
+
+#define EVENT_TRACE_VERSION 1
+
+typedef struct {
+    uint32_t events;       // опубликовано в шину
+    uint32_t failed;       // не удалось опубликовать или неизвестный тип
+    uint64_t trace_us;     // длительность трассы по записанным интервалам
+    uint64_t elapsed_us;   // от первой публикации до разбора последнего сообщения
+    uint32_t events_per_s;
+    bool drained;          // шина опустела до таймаута ожидания
+} event_trace_replay_stats_t;
+
+typedef struct {
+    bool recording;
+    uint32_t records;      // записано в текущей (или последней) сессии
+    uint32_t lost;         // не поместились в буфер, пока задача записи сбрасывала предыдущий
+    uint64_t bytes;
+    bool replaying;
+    bool has_replay;       // last_replay заполнен
+    event_trace_replay_stats_t last_replay;
+} event_trace_status_t;
+
+esp_err_t event_trace_record_start(const char *path);
+// Сбрасывает буферы и закрывает файл; stats - итог записи (может быть NULL).
+esp_err_t event_trace_record_stop(event_trace_status_t *stats);
+// Синхронное воспроизведение в задаче вызывающего. Во время записи недоступно (ESP_ERR_INVALID_STATE).
+esp_err_t event_trace_replay(const char *path, uint32_t speed, event_trace_replay_stats_t *stats);
+// То же в отдельной задаче; итог - в event_trace_get_status.
+esp_err_t event_trace_replay_start(const char *path, uint32_t speed);
+void event_trace_get_status(event_trace_status_t *out);
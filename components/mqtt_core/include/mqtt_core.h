@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 #ifndef MQTT_CORE_DEBUG
 #define MQTT_CORE_DEBUG 0
@@ -20,5 +24,77 @@ const char *mqtt_core_topic_for_event(event_bus_type_t type);
 uint8_t mqtt_core_client_count(void);
 typedef struct {
     uint8_t total;
+    uint8_t lagging;
+    uint8_t stuck;
+    uint8_t throttled;   // сейчас не читаются из-за перегрузки шины событий
 } mqtt_client_stats_t;
 void mqtt_core_get_client_stats(mqtt_client_stats_t *out);
+
+// Состояние исходящей очереди клиента: lagging - очередь старше CONFIG_BROKER_MQTT_LAG_MS
+// или заполнена больше чем наполовину, stuck - старше CONFIG_BROKER_MQTT_STUCK_MS (отключается).
+typedef enum {
+    MQTT_CLIENT_HEALTHY = 0,
+    MQTT_CLIENT_LAGGING,
+    MQTT_CLIENT_STUCK,
+} mqtt_client_health_t;
+
+typedef struct {
+    char client_id[32];
+    bool websocket;
+    mqtt_client_health_t health;
+    uint32_t backlog_bytes;
+    uint32_t backlog_peak;
+    uint32_t backlog_age_ms;
+    uint32_t send_latency_us;   // среднее время вызова send()
+    uint32_t dropped;           // публикации, отброшенные или замененные политикой
+    uint32_t publish_rate;      // входящие PUBLISH за последнюю секунду
+    uint32_t throttled_ms;      // сколько чтение клиента стояло из-за перегрузки шины событий
+} mqtt_client_info_t;
+
+// Заполнить до max записей о подключенных клиентах; возвращает число записей.
+size_t mqtt_core_list_clients(mqtt_client_info_t *out, size_t max);
+const char *mqtt_core_client_health_name(mqtt_client_health_t health);
+
+// Топики, для которых клиенту важно только последнее значение (через запятую, wildcards допустимы).
+// Неотправленная публикация на тот же топик заменяется новой вместо добавления в очередь клиента.
+esp_err_t mqtt_core_set_conflate_filters(const char *csv);
+
+// Внешний транспорт для MQTT-сессии (например, WebSocket на HTTP сервере).
+// Исходящие пакеты сессии копятся в той же очереди, что у TCP клиентов (та же политика lagging/stuck).
+// wake сообщает, что в пустую очередь пришел пакет: владелец должен вызвать mqtt_core_stream_flush()
+// из своего контекста. send вызывается только оттуда, по одному пакету, и может блокироваться;
+// возвращает число отправленных байт или <0. close должен инициировать закрытие соединения,
+// после которого владелец вызывает mqtt_core_stream_close().
+typedef struct {
+    int (*send)(void *ctx, const uint8_t *data, size_t len);
+    void (*close)(void *ctx);
+    esp_err_t (*wake)(void *ctx);
+} mqtt_core_transport_t;
+
+typedef uint32_t mqtt_core_stream_t;
+
+// Открыть сессию, которую кормят байтами снаружи; транспорт должен жить до stream_close.
+esp_err_t mqtt_core_stream_open(const mqtt_core_transport_t *transport, void *ctx, mqtt_core_stream_t *out);
+// Передать очередную порцию байт потока (MQTT пакеты могут быть разрезаны произвольно).
+esp_err_t mqtt_core_stream_feed(mqtt_core_stream_t stream, const uint8_t *data, size_t len);
+// Отправить накопленные пакеты сессии через transport->send; ошибка записи закрывает сессию.
+esp_err_t mqtt_core_stream_flush(mqtt_core_stream_t stream);
+// Закрыть сессию (отправляет will, если клиент не прислал DISCONNECT).
+void mqtt_core_stream_close(mqtt_core_stream_t stream);
+
+// Журнал последних публикаций (PSRAM кольцо, CONFIG_BROKER_MQTT_JOURNAL).
+// Строки действительны только внутри колбэка; ts_ms - время от загрузки.
+typedef struct {
+    int64_t ts_ms;
+    const char *topic;
+    const char *payload;
+    size_t payload_len;
+} mqtt_journal_record_t;
+
+typedef void (*mqtt_journal_visit_fn)(const mqtt_journal_record_t *rec, void *ctx);
+
+// Последние max записей, совпавших с фильтром (wildcards допустимы), от старых к новым.
+// Возвращает число переданных в колбэк записей.
+size_t mqtt_core_journal_query(const char *filter, size_t max, mqtt_journal_visit_fn fn, void *ctx);
+// Заменить список фильтров журнала (через запятую); уже записанное не трогается.
+esp_err_t mqtt_core_journal_set_filters(const char *csv);
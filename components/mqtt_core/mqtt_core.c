@@ -27,7 +27,9 @@ mqtt_session_t *s_sessions = NULL;
 StackType_t *s_session_stacks[MQTT_MAX_CLIENTS];
 StaticTask_t *s_session_tcbs[MQTT_MAX_CLIENTS];
 uint8_t *s_session_tx_bufs[MQTT_MAX_CLIENTS];
+uint8_t *s_session_rx_bufs[MQTT_MAX_CLIENTS];
 retain_entry_t *s_retain = NULL;
+mqtt_dedup_entry_t *s_dedup = NULL;
 SemaphoreHandle_t s_lock = NULL;
 uint8_t s_client_count = 0;
 int s_listen_sock = -1;
@@ -81,6 +83,17 @@ uint8_t *ensure_session_tx_buffer(size_t idx)
     return s_session_tx_bufs[idx];
 }
 
+uint8_t *ensure_session_rx_buffer(size_t idx)
+{
+    if (idx >= MQTT_MAX_CLIENTS) {
+        return NULL;
+    }
+    if (!s_session_rx_bufs[idx]) {
+        s_session_rx_bufs[idx] = heap_caps_malloc(MQTT_STREAM_RX_BUF, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    return s_session_rx_bufs[idx];
+}
+
 bool ensure_accept_task_storage(void)
 {
     if (!s_accept_stack) {
@@ -112,12 +125,53 @@ void mqtt_core_get_client_stats(mqtt_client_stats_t *out)
     for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
         if (!s_sessions[i].active) continue;
         out->total++;
+        mqtt_client_health_t health = outbox_health(&s_sessions[i]);
+        if (health == MQTT_CLIENT_LAGGING) {
+            out->lagging++;
+        } else if (health == MQTT_CLIENT_STUCK) {
+            out->stuck++;
+        }
+        if (__atomic_load_n(&s_sessions[i].throttled, __ATOMIC_RELAXED)) {
+            out->throttled++;
+        }
     }
     if (s_lock) {
         xSemaphoreGive(s_lock);
     }
 }
 
+size_t mqtt_core_list_clients(mqtt_client_info_t *out, size_t max)
+{
+    if (!out || !s_sessions) {
+        return 0;
+    }
+    size_t count = 0;
+    lock();
+    for (size_t i = 0; i < MQTT_MAX_CLIENTS && count < max; ++i) {
+        if (!s_sessions[i].active) {
+            continue;
+        }
+        mqtt_client_info_t *info = &out[count++];
+        outbox_fill_info(&s_sessions[i], info);
+        info->publish_rate = s_sessions[i].pub_rate;
+        info->throttled_ms = s_sessions[i].throttled_ms;
+    }
+    unlock();
+    return count;
+}
+
+const char *mqtt_core_client_health_name(mqtt_client_health_t health)
+{
+    switch (health) {
+    case MQTT_CLIENT_LAGGING:
+        return "lagging";
+    case MQTT_CLIENT_STUCK:
+        return "stuck";
+    default:
+        return "healthy";
+    }
+}
+
 uint8_t mqtt_core_client_count(void)
 {
     uint8_t count = 0;
@@ -153,7 +207,15 @@ void request_session_close(mqtt_session_t *sess, const char *reason, int err)
     }
     const char *cid = sess->client_id[0] ? sess->client_id : "<unknown>";
     ESP_LOGW(TAG, "%s for %s (err=%d)", reason ? reason : "session closing", cid, err);
+    bool was_closing = sess->closing;
     sess->closing = true;
+    if (sess->transport) {
+        // Владелец транспорта сам вызовет mqtt_core_stream_close() после закрытия соединения.
+        if (!was_closing && sess->transport->close) {
+            sess->transport->close(sess->transport_ctx);
+        }
+        return;
+    }
     if (sess->sock >= 0) {
         int sock = sess->sock;
         sess->sock = -1;
@@ -186,13 +248,36 @@ esp_err_t mqtt_core_init(void)
             return ESP_ERR_NO_MEM;
         }
     }
+    if (!s_dedup) {
+        s_dedup = heap_caps_calloc(MQTT_DEDUP_SLOTS, sizeof(mqtt_dedup_entry_t),
+                                   MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!s_dedup) {
+            // Без кольца дубликатов брокер работает как раньше (at-least-once).
+            ESP_LOGW(TAG, "failed to allocate QoS1 dedup table");
+        }
+    }
+    if (outbox_init() != ESP_OK) {
+        ESP_LOGE(TAG, "failed to create outbound queue locks");
+        return ESP_ERR_NO_MEM;
+    }
+    if (journal_init() != ESP_OK) {
+        // Журнал опционален: брокер работает и без истории.
+        ESP_LOGW(TAG, "message journal disabled");
+    }
     if (!s_event_handler_registered) {
-        esp_err_t err = event_bus_register_handler(on_event_bus_message);
+        // Мост публикует в сокеты и ждет s_lock: своя очередь и задача, чтобы не держать шину.
+        const event_bus_subscribe_opts_t opts = {.name = "mqtt_bridge", .depth = 32};
+        esp_err_t err = event_bus_subscribe_ex(MQTT_BRIDGE_EVENTS, on_event_bus_message, &opts);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "failed to register event handler: %s", esp_err_to_name(err));
             return err;
         }
         s_event_handler_registered = true;
+        // Без подписки на давление приостановленные воркеры просыпаются по своему интервалу.
+        err = throttle_init();
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "bus pressure listener: %s", esp_err_to_name(err));
+        }
     }
     return ESP_OK;
 }
@@ -211,11 +296,30 @@ esp_err_t mqtt_core_publish(const char *topic, const char *payload)
     if (!s_sessions || !s_lock) {
         return ESP_ERR_INVALID_STATE;
     }
-    publish_to_subscribers(topic, payload, 0, false, NULL);
+    publish_to_subscribers(topic, TOPIC_ID_NONE, payload, 0, false, NULL);
     return ESP_OK;
 }
 
 esp_err_t mqtt_core_inject_message(const char *topic, const char *payload)
+{
+    if (!topic || !payload) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return inject_message_interned(topic, topic_intern_find(topic), payload, NULL);
+}
+
+static esp_err_t post_to_bus(const event_bus_message_t *msg, event_bus_channel_t *channel)
+{
+    if (channel) {
+        return event_bus_channel_post(channel, msg, pdMS_TO_TICKS(100));
+    }
+    return event_bus_post(msg, pdMS_TO_TICKS(100));
+}
+
+esp_err_t inject_message_interned(const char *topic,
+                                  topic_id_t topic_id,
+                                  const char *payload,
+                                  event_bus_channel_t *channel)
 {
     if (!topic || !payload) {
         return ESP_ERR_INVALID_ARG;
@@ -224,19 +328,21 @@ esp_err_t mqtt_core_inject_message(const char *topic, const char *payload)
     if (type != EVENT_NONE) {
         event_bus_message_t typed = {
             .type = type,
+            .topic = topic,
+            .payload = payload,
+            .topic_id = topic_id,
         };
-        strncpy(typed.topic, topic, sizeof(typed.topic) - 1);
-        strncpy(typed.payload, payload, sizeof(typed.payload) - 1);
 #if MQTT_CORE_DEBUG
         ESP_LOGI(TAG, "[MQTT IN] %s -> event %d", topic, type);
 #endif
-        event_bus_post(&typed, pdMS_TO_TICKS(100));
+        post_to_bus(&typed, channel);
     }
 
     event_bus_message_t generic = {
         .type = EVENT_MQTT_MESSAGE,
+        .topic = topic,
+        .payload = payload,
+        .topic_id = topic_id,
     };
-    strncpy(generic.topic, topic, sizeof(generic.topic) - 1);
-    strncpy(generic.payload, payload, sizeof(generic.payload) - 1);
-    return event_bus_post(&generic, pdMS_TO_TICKS(100));
+    return post_to_bus(&generic, channel);
 }
@@ -96,3 +96,29 @@ bool topic_matches_filter(const char *filter, const char *topic)
         return false;
     }
 }
+
+size_t parse_filter_list(const char *csv, char (*out)[MQTT_MAX_TOPIC], size_t max)
+{
+    size_t count = 0;
+    const char *p = csv ? csv : "";
+    while (*p && count < max) {
+        while (*p == ',' || *p == ' ') {
+            ++p;
+        }
+        const char *end = p;
+        while (*end && *end != ',') {
+            ++end;
+        }
+        size_t n = (size_t)(end - p);
+        while (n > 0 && p[n - 1] == ' ') {
+            --n;
+        }
+        if (n > 0 && n < MQTT_MAX_TOPIC) {
+            memcpy(out[count], p, n);
+            out[count][n] = 0;
+            count++;
+        }
+        p = end;
+    }
+    return count;
+}
@@ -0,0 +1,91 @@
+#include "mqtt_core_internal.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "mqtt_core";
+
+// Вызывается под lock(): ищет кольцо клиента или занимает свободное/просроченное.
+void dedup_attach(mqtt_session_t *sess)
+{
+    if (!s_dedup || !sess || !sess->client_id[0]) {
+        return;
+    }
+    int64_t now = now_ms();
+    mqtt_dedup_entry_t *spare = NULL;
+    mqtt_dedup_entry_t *oldest = NULL;
+    for (size_t i = 0; i < MQTT_DEDUP_SLOTS; ++i) {
+        mqtt_dedup_entry_t *e = &s_dedup[i];
+        if (e->in_use && strcmp(e->client_id, sess->client_id) == 0) {
+            if (e->attached) {
+                // Клиент переподключился раньше, чем старая сессия закрылась - забираем кольцо.
+                for (size_t j = 0; j < MQTT_MAX_CLIENTS; ++j) {
+                    if (s_sessions[j].dedup == e && &s_sessions[j] != sess) {
+                        s_sessions[j].dedup = NULL;
+                    }
+                }
+            }
+            e->attached = true;
+            sess->dedup = e;
+            return;
+        }
+        if (!e->in_use || (!e->attached && now - e->released_ms >= MQTT_DEDUP_HOLD_MS)) {
+            if (!spare) {
+                spare = e;
+            }
+        } else if (!e->attached && (!oldest || e->released_ms < oldest->released_ms)) {
+            oldest = e;
+        }
+    }
+    if (!spare) {
+        spare = oldest;
+    }
+    if (!spare) {
+        ESP_LOGW(TAG, "no dedup slot for %s", sess->client_id);
+        return;
+    }
+    memset(spare, 0, sizeof(*spare));
+    spare->in_use = true;
+    spare->attached = true;
+    strncpy(spare->client_id, sess->client_id, sizeof(spare->client_id) - 1);
+    sess->dedup = spare;
+}
+
+// Вызывается под lock(): кольцо остается за client_id на MQTT_DEDUP_HOLD_MS.
+void dedup_detach(mqtt_session_t *sess)
+{
+    if (!sess || !sess->dedup) {
+        return;
+    }
+    sess->dedup->attached = false;
+    sess->dedup->released_ms = now_ms();
+    sess->dedup = NULL;
+}
+
+bool dedup_seen(const mqtt_session_t *sess, uint16_t pid)
+{
+    const mqtt_dedup_entry_t *e = sess ? sess->dedup : NULL;
+    if (!e) {
+        return false;
+    }
+    for (uint8_t i = 0; i < e->count; ++i) {
+        if (e->pids[i] == pid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void dedup_remember(mqtt_session_t *sess, uint16_t pid)
+{
+    mqtt_dedup_entry_t *e = sess ? sess->dedup : NULL;
+    if (!e) {
+        return;
+    }
+    e->pids[e->head] = pid;
+    e->head = (uint8_t)((e->head + 1) % MQTT_DEDUP_RING);
+    if (e->count < MQTT_DEDUP_RING) {
+        e->count++;
+    }
+}
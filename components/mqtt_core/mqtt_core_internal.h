@@ -12,8 +12,11 @@
 
 #include "config_store.h"
 #include "event_bus.h"
+#include "mqtt_core.h"
+#include "topic_intern.h"
 
 #define MQTT_MAX_CLIENTS       CONFIG_BROKER_MQTT_MAX_CLIENTS
+#define MQTT_PREWARM_WORKERS   ((CONFIG_BROKER_MQTT_PREWARM_WORKERS < MQTT_MAX_CLIENTS) ? CONFIG_BROKER_MQTT_PREWARM_WORKERS : MQTT_MAX_CLIENTS)
 #define MQTT_MAX_SUBS          8
 #define MQTT_MAX_TOPIC         96
 #define MQTT_MAX_PAYLOAD       512
@@ -21,17 +24,34 @@
 #define MQTT_RETAIN_MAX        32
 #define MQTT_CLIENT_STACK      6144
 #define MQTT_ACCEPT_STACK      4096
+#define MQTT_STREAM_RX_BUF     (MQTT_MAX_PACKET + 5)
+#define MQTT_WORKER_CHANNEL_DEPTH 16
+#define MQTT_OUTBOX_BYTES      (CONFIG_BROKER_MQTT_OUTBOX_KB * 1024)
+#define MQTT_OUTBOX_DEPTH      64
+#define MQTT_OUTBOX_POLL_MS    20
+#define MQTT_CONFLATE_MAX_FILTERS 8
+#define MQTT_IDLE_POLL_MS      1000
+#define MQTT_DEDUP_RING        16
+#define MQTT_DEDUP_SLOTS       (MQTT_MAX_CLIENTS * 2)
+#define MQTT_DEDUP_HOLD_MS     60000
+#define MQTT_JOURNAL_HISTORY_TOPIC   "$SYS/history"
+#define MQTT_JOURNAL_HISTORY_DEFAULT 20
+#define MQTT_JOURNAL_HISTORY_MAX     64
+#define MQTT_THROTTLE_MAX_MS   500
+#define MQTT_THROTTLE_SLICE_MS 10
 
 typedef struct {
     bool in_use;
-    char topic[MQTT_MAX_TOPIC];
+    topic_id_t topic_id;
     char *payload;
     size_t payload_len;
     uint8_t qos;
 } retain_entry_t;
 
+// Фильтр подписки интернирован; точные фильтры сравниваются по topic_id_t.
 typedef struct {
-    char topic[MQTT_MAX_TOPIC];
+    topic_id_t filter_id;
+    bool wildcard;
     uint8_t qos;
 } mqtt_subscription_t;
 
@@ -43,10 +63,45 @@ typedef struct {
     bool retain;
 } will_t;
 
+// Недавние входящие QoS1 packet id клиента; переживает переподключение с тем же client_id.
+typedef struct {
+    bool in_use;
+    bool attached;
+    char client_id[CONFIG_STORE_CLIENT_ID_MAX];
+    uint16_t pids[MQTT_DEDUP_RING];
+    uint8_t head;
+    uint8_t count;
+    int64_t released_ms;
+} mqtt_dedup_entry_t;
+
+// Пакет, который сокет не принял сразу; data в PSRAM, off - уже записанная часть.
+typedef struct {
+    uint8_t *data;
+    uint16_t len;
+    uint16_t off;
+    bool conflatable;      // PUBLISH, который можно заменить более новым на тот же топик
+    int64_t queued_ms;
+} mqtt_outbox_entry_t;
+
+typedef enum {
+    MQTT_OUT_SEND = 0,
+    MQTT_OUT_CONFLATE,
+    MQTT_OUT_DROP,
+    MQTT_OUT_CLOSE,
+} mqtt_out_action_t;
+
 typedef struct {
     int sock;
     TaskHandle_t task;
+    // SPSC канал воркера в event_bus (NULL для WebSocket сессий - тогда обычная очередь).
+    event_bus_channel_t *channel;
+    // Внешний транспорт (WebSocket): байты приходят через mqtt_core_stream_feed().
+    const mqtt_core_transport_t *transport;
+    void *transport_ctx;
+    uint16_t generation;
+    size_t rx_len;
     bool active;
+    bool connected;
     bool closing;
     bool suppress_will;
     char client_id[CONFIG_STORE_CLIENT_ID_MAX];
@@ -55,13 +110,37 @@ typedef struct {
     mqtt_subscription_t subs[MQTT_MAX_SUBS];
     size_t sub_count;
     will_t will;
+    mqtt_dedup_entry_t *dedup;
+    // Исходящая очередь сессии (mqtt_core_outbox.c), под своим мьютексом.
+    mqtt_outbox_entry_t outbox[MQTT_OUTBOX_DEPTH];
+    uint8_t out_head;
+    uint8_t out_count;
+    size_t out_bytes;
+    // Транспортная сессия: владелец уже разбужен; пакет, снятый из очереди, сейчас пишется.
+    bool out_wake_pending;
+    bool out_sending;
+    int64_t out_sending_ms;
+    uint32_t out_peak;
+    uint32_t out_dropped;
+    uint32_t send_lat_us;
+    // Входящие PUBLISH для обратного давления (mqtt_core_throttle.c): pub_count ведет воркер,
+    // pub_mark и pub_rate (за последнюю секунду) - обход сессий.
+    uint32_t pub_count;
+    uint32_t pub_mark;
+    uint32_t pub_rate;
+    // Воркер не читает сокет, пока шина перегружена; throttled_ms - сумма таких пауз.
+    bool throttled;
+    uint32_t throttled_ms;
 } mqtt_session_t;
 
 extern mqtt_session_t *s_sessions;
+// Стеки/TCB индексируются номером воркера пула, а не слотом сессии.
 extern StackType_t *s_session_stacks[MQTT_MAX_CLIENTS];
 extern StaticTask_t *s_session_tcbs[MQTT_MAX_CLIENTS];
 extern uint8_t *s_session_tx_bufs[MQTT_MAX_CLIENTS];
+extern uint8_t *s_session_rx_bufs[MQTT_MAX_CLIENTS];
 extern retain_entry_t *s_retain;
+extern mqtt_dedup_entry_t *s_dedup;
 extern SemaphoreHandle_t s_lock;
 extern uint8_t s_client_count;
 extern int s_listen_sock;
@@ -80,6 +159,7 @@ void free_session(mqtt_session_t *s);
 void sweep_idle_sessions(void);
 bool ensure_session_task_storage(size_t idx);
 uint8_t *ensure_session_tx_buffer(size_t idx);
+uint8_t *ensure_session_rx_buffer(size_t idx);
 bool ensure_accept_task_storage(void);
 int64_t now_ms(void);
 void request_session_close(mqtt_session_t *sess, const char *reason, int err);
@@ -89,14 +169,69 @@ esp_err_t mqtt_core_start_server(int port);
 bool acl_can_publish(const char *client_id, const char *topic);
 bool acl_can_subscribe(const char *client_id, const char *topic);
 bool topic_matches_filter(const char *filter, const char *topic);
+// Разобрать список фильтров через запятую (пробелы обрезаются); возвращает число фильтров.
+size_t parse_filter_list(const char *csv, char (*out)[MQTT_MAX_TOPIC], size_t max);
 
+// EVENT_MQTT_MESSAGE сам пришел из MQTT: мост его не публикует обратно (иначе подписчики получают копию
+// дважды). Типы без топика и без строки в k_outgoing_map мосту тоже не нужны.
+#define MQTT_BRIDGE_EVENTS                                                                                 \
+    (EVENT_BUS_MASK_ALL & ~(EVENT_BUS_MASK(EVENT_MQTT_MESSAGE) | EVENT_BUS_MASK(EVENT_DEVICE_CONFIG_CHANGED) | \
+                            EVENT_BUS_MASK(EVENT_AUDIO_FINISHED)))
 const char *find_topic_by_type(event_bus_type_t type);
 event_bus_type_t find_type_by_topic(const char *topic);
 void on_event_bus_message(const event_bus_message_t *msg);
 
+void dedup_attach(mqtt_session_t *sess);
+void dedup_detach(mqtt_session_t *sess);
+bool dedup_seen(const mqtt_session_t *sess, uint16_t pid);
+void dedup_remember(mqtt_session_t *sess, uint16_t pid);
+
+esp_err_t journal_init(void);
+void journal_record(const char *topic, const char *payload);
+// Вызывается из обработчика пакетов сессии без s_lock; <0 - ответ не отправлен, сессию закрыть.
+int journal_handle_history_request(mqtt_session_t *sess, const char *request);
+
+esp_err_t outbox_init(void);
+// Записать пакет без блокировки; непринятый остаток ставится в очередь сессии.
+// Пакеты транспортной сессии только ставятся в очередь и будят владельца транспорта.
+// conflate - PUBLISH заменяет еще не начатый пакет того же топика вместо добавления.
+int outbox_send(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool conflate);
+// Ответ клиенту из его собственного обработчика пакетов (воркер TCP сессии или владелец транспорта),
+// только без s_lock: при полной очереди ждет ее дозаписи, не дольше CONFIG_BROKER_MQTT_STUCK_MS.
+int outbox_send_wait(mqtt_session_t *sess, const uint8_t *buf, size_t len);
+// Топик попадает под CONFIG_BROKER_MQTT_CONFLATE_FILTERS; вызывать под s_lock.
+bool conflate_selected(const char *topic);
+// Дописать очередь транспортной сессии через transport->send (контекст владельца транспорта, без s_lock).
+int outbox_transport_flush(mqtt_session_t *sess, uint16_t generation);
+void outbox_reset(mqtt_session_t *sess);
+mqtt_client_health_t outbox_health(mqtt_session_t *sess);
+// Что делать с очередной публикацией для клиента с учетом его состояния и политики.
+mqtt_out_action_t outbox_admit(mqtt_session_t *sess, uint8_t qos);
+// Ожидание входящих данных воркером с дозаписью очереди: 1 - можно читать, 0 - таймаут, <0 - закрыть.
+int outbox_wait_readable(mqtt_session_t *sess);
+// То же без чтения, не дольше wait_ms; при пустой очереди ожидание прерывает уведомление задачи.
+int outbox_wait_writable(mqtt_session_t *sess, uint32_t wait_ms);
+void outbox_fill_info(mqtt_session_t *sess, mqtt_client_info_t *out);
+
+esp_err_t throttle_init(void);
+// Темп публикаций сессий за прошедшую секунду; вызывается обходом сессий под s_lock.
+void throttle_sweep(void);
+// Шина перегружена, а клиент публикует не реже среднего: не читать его сокет.
+bool throttle_should_pause(const mqtt_session_t *sess);
+// Ждать снятия перегрузки (не дольше MQTT_THROTTLE_MAX_MS), дописывая очередь; <0 - закрыть сессию.
+int throttle_wait(mqtt_session_t *sess);
+
 void retain_store(const char *topic, const char *payload, uint8_t qos);
-void deliver_retain(mqtt_session_t *sess, const char *filter);
+// Вызывается из обработчика SUBSCRIBE без s_lock; <0 - ответ не отправлен, сессию закрыть.
+int deliver_retain(mqtt_session_t *sess, const char *filter);
+void release_session_subscriptions(mqtt_session_t *sess);
+esp_err_t inject_message_interned(const char *topic,
+                                  topic_id_t topic_id,
+                                  const char *payload,
+                                  event_bus_channel_t *channel);
+// topic_id может быть TOPIC_ID_NONE - тогда он ищется один раз внутри.
 void publish_to_subscribers(const char *topic,
+                            topic_id_t topic_id,
                             const char *payload,
                             uint8_t qos,
                             bool retain_flag,
@@ -104,19 +239,41 @@ void publish_to_subscribers(const char *topic,
 
 int recv_all(int sock, uint8_t *buf, size_t len);
 int send_all(int sock, const uint8_t *buf, size_t len);
+// Ответ из обработчика пакетов сессии, без s_lock (может ждать место в очереди).
+int session_send(mqtt_session_t *sess, const uint8_t *buf, size_t len);
+// Рассылка под s_lock: никогда не ждет.
+int session_send_publish(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool conflate);
 int read_remaining_length(int sock, int *out_rem);
-int send_connack(int sock, uint8_t rc);
+// Кодек без сокетов (используется и host-бенчмарком mqtt_codec_bench).
+size_t encode_remaining_length(uint8_t *out, size_t rem_len);
+// Строка MQTT (u16 длина + байты) из buf[*offset] в out с 0 на конце; 0 - успех.
+int parse_utf8_str(const uint8_t *buf, size_t len, size_t *offset, char *out, size_t out_len);
+// Собрать PUBLISH в buf; длина пакета или 0, если он не помещается.
+size_t frame_publish(uint8_t *buf,
+                     size_t cap,
+                     const char *topic,
+                     size_t topic_len,
+                     const char *payload,
+                     size_t payload_len,
+                     uint8_t qos,
+                     bool retain,
+                     uint16_t pid);
+int send_connack(mqtt_session_t *sess, uint8_t rc);
 int send_suback(mqtt_session_t *sess, uint16_t pid, uint8_t *qos, size_t count);
-int send_unsuback(int sock, uint16_t pid);
-int send_puback(int sock, uint16_t pid);
-int send_pingresp(int sock);
-int send_publish_packet(mqtt_session_t *sess,
-                        const char *topic,
-                        const char *payload,
-                        uint8_t qos,
-                        bool retain,
-                        uint16_t pid);
+int send_unsuback(mqtt_session_t *sess, uint16_t pid);
+int send_puback(mqtt_session_t *sess, uint16_t pid);
+int send_pingresp(mqtt_session_t *sess);
+// Рассылка под s_lock; ошибка записи закрывает сессию.
+int send_publish_packet_ex(mqtt_session_t *sess,
+                           const char *topic,
+                           const char *payload,
+                           uint8_t qos,
+                           bool retain,
+                           uint16_t pid,
+                           bool conflate);
 int handle_connect(mqtt_session_t *sess, const uint8_t *buf, size_t len);
 int handle_subscribe(mqtt_session_t *sess, const uint8_t *buf, size_t len);
 int handle_unsubscribe(mqtt_session_t *sess, const uint8_t *buf, size_t len);
 int handle_publish(mqtt_session_t *sess, uint8_t header, const uint8_t *buf, size_t len);
+// 0 - продолжать, 1 - клиент прислал DISCONNECT, <0 - ошибка протокола.
+int session_process_packet(mqtt_session_t *sess, uint8_t header, const uint8_t *buf, size_t len);
@@ -0,0 +1,336 @@
+#include "mqtt_core.h"
+#include "mqtt_core_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "mqtt_journal";
+
+#if CONFIG_BROKER_MQTT_JOURNAL
+
+// Кольцо записей переменной длины: [hdr][topic\0][payload\0], выравнивание 8 байт.
+// Запись с len == 0 (или хвост короче заголовка) означает переход в начало буфера.
+typedef struct {
+    uint16_t len;
+    uint16_t topic_len;
+    uint16_t payload_len;
+    uint16_t reserved;
+    int64_t ts_ms;
+} journal_hdr_t;
+
+#define JOURNAL_CAPACITY   ((size_t)CONFIG_BROKER_MQTT_JOURNAL_SIZE_KB * 1024)
+#define JOURNAL_MAX_FILTERS 8
+#define JOURNAL_ALIGN(n)   (((n) + 7u) & ~(size_t)7u)
+
+static uint8_t *s_ring = NULL;
+static size_t s_head = 0;
+static size_t s_tail = 0;
+static size_t s_count = 0;
+static SemaphoreHandle_t s_journal_lock = NULL;
+static char s_filters[JOURNAL_MAX_FILTERS][MQTT_MAX_TOPIC];
+static size_t s_filter_count = 0;
+
+static void journal_lock(void)
+{
+    xSemaphoreTake(s_journal_lock, portMAX_DELAY);
+}
+
+static void journal_unlock(void)
+{
+    xSemaphoreGive(s_journal_lock);
+}
+
+static const journal_hdr_t *hdr_at(size_t off)
+{
+    return (const journal_hdr_t *)(s_ring + off);
+}
+
+// Смещение записи с учетом маркера перехода; вызывать только для живых записей.
+static size_t normalize(size_t off)
+{
+    if (JOURNAL_CAPACITY - off < sizeof(journal_hdr_t) || hdr_at(off)->len == 0) {
+        return 0;
+    }
+    return off;
+}
+
+static void evict_oldest(void)
+{
+    s_tail += hdr_at(s_tail)->len;
+    s_count--;
+    if (s_count == 0) {
+        s_head = 0;
+        s_tail = 0;
+        return;
+    }
+    s_tail = normalize(s_tail);
+}
+
+static bool filter_selected(const char *topic)
+{
+    if (topic[0] == '$') {
+        return false;
+    }
+    for (size_t i = 0; i < s_filter_count; ++i) {
+        if (topic_matches_filter(s_filters[i], topic)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void parse_filters(const char *csv)
+{
+    s_filter_count = parse_filter_list(csv, s_filters, JOURNAL_MAX_FILTERS);
+}
+
+esp_err_t journal_init(void)
+{
+    if (!s_journal_lock) {
+        s_journal_lock = xSemaphoreCreateMutex();
+        if (!s_journal_lock) {
+            return ESP_ERR_NO_MEM;
+        }
+        parse_filters(CONFIG_BROKER_MQTT_JOURNAL_FILTERS);
+    }
+    if (!s_ring) {
+        s_ring = heap_caps_malloc(JOURNAL_CAPACITY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!s_ring) {
+            ESP_LOGW(TAG, "failed to allocate %u byte journal", (unsigned)JOURNAL_CAPACITY);
+            return ESP_ERR_NO_MEM;
+        }
+        ESP_LOGI(TAG, "journal %u KB, %u filter(s)", (unsigned)(JOURNAL_CAPACITY / 1024),
+                 (unsigned)s_filter_count);
+    }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_core_journal_set_filters(const char *csv)
+{
+    if (!s_journal_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    journal_lock();
+    parse_filters(csv);
+    journal_unlock();
+    return ESP_OK;
+}
+
+// Вызывается без s_lock: порядок блокировок s_lock -> журнал (см. $SYS/history).
+void journal_record(const char *topic, const char *payload)
+{
+    if (!s_ring || !topic || !payload) {
+        return;
+    }
+    size_t topic_len = strlen(topic);
+    size_t payload_len = strlen(payload);
+    if (topic_len >= MQTT_MAX_TOPIC || payload_len >= MQTT_MAX_PAYLOAD) {
+        return;
+    }
+    size_t need = JOURNAL_ALIGN(sizeof(journal_hdr_t) + topic_len + 1 + payload_len + 1);
+
+    journal_lock();
+    if (!filter_selected(topic)) {
+        journal_unlock();
+        return;
+    }
+    // Свободно: [head, cap) и [0, tail) пока кольцо не обернулось, иначе [head, tail).
+    while (s_count > 0) {
+        if (s_tail < s_head) {
+            if (JOURNAL_CAPACITY - s_head >= need) {
+                break;
+            }
+            if (s_tail >= need) {
+                if (JOURNAL_CAPACITY - s_head >= sizeof(journal_hdr_t)) {
+                    memset(s_ring + s_head, 0, sizeof(journal_hdr_t));
+                }
+                s_head = 0;
+                break;
+            }
+        } else if (s_tail - s_head >= need) {
+            break;
+        }
+        evict_oldest();
+    }
+
+    journal_hdr_t hdr = {
+        .len = (uint16_t)need,
+        .topic_len = (uint16_t)topic_len,
+        .payload_len = (uint16_t)payload_len,
+        .ts_ms = now_ms(),
+    };
+    uint8_t *dst = s_ring + s_head;
+    memcpy(dst, &hdr, sizeof(hdr));
+    memcpy(dst + sizeof(hdr), topic, topic_len + 1);
+    memcpy(dst + sizeof(hdr) + topic_len + 1, payload, payload_len + 1);
+    s_head += need;
+    if (s_head == JOURNAL_CAPACITY) {
+        s_head = 0;
+    }
+    s_count++;
+    journal_unlock();
+}
+
+size_t mqtt_core_journal_query(const char *filter, size_t max, mqtt_journal_visit_fn fn, void *ctx)
+{
+    if (!s_ring || !filter || !fn || max == 0) {
+        return 0;
+    }
+    journal_lock();
+    size_t matched = 0;
+    size_t off = s_tail;
+    for (size_t i = 0; i < s_count; ++i) {
+        const journal_hdr_t *h = hdr_at(off);
+        if (topic_matches_filter(filter, (const char *)(h + 1))) {
+            matched++;
+        }
+        off = normalize(off + h->len);
+    }
+    // Второй проход: пропускаем старые совпадения, чтобы отдать только последние max.
+    size_t skip = matched > max ? matched - max : 0;
+    size_t sent = 0;
+    off = s_tail;
+    for (size_t i = 0; i < s_count && sent < max; ++i) {
+        const journal_hdr_t *h = hdr_at(off);
+        const char *topic = (const char *)(h + 1);
+        if (topic_matches_filter(filter, topic)) {
+            if (skip > 0) {
+                skip--;
+            } else {
+                mqtt_journal_record_t rec = {
+                    .ts_ms = h->ts_ms,
+                    .topic = topic,
+                    .payload = topic + h->topic_len + 1,
+                    .payload_len = h->payload_len,
+                };
+                fn(&rec, ctx);
+                sent++;
+            }
+        }
+        off = normalize(off + h->len);
+    }
+    journal_unlock();
+    return sent;
+}
+
+#else
+
+esp_err_t journal_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mqtt_core_journal_set_filters(const char *csv)
+{
+    (void)csv;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void journal_record(const char *topic, const char *payload)
+{
+    (void)topic;
+    (void)payload;
+}
+
+size_t mqtt_core_journal_query(const char *filter, size_t max, mqtt_journal_visit_fn fn, void *ctx)
+{
+    (void)filter;
+    (void)max;
+    (void)fn;
+    (void)ctx;
+    return 0;
+}
+
+#endif
+
+// Пакеты ответа собираются под journal_lock и отправляются после него: отправка может ждать
+// сокет клиента, а журнал пишут публикующие задачи.
+typedef struct {
+    uint8_t *frames[MQTT_JOURNAL_HISTORY_MAX];
+    size_t lens[MQTT_JOURNAL_HISTORY_MAX];
+    size_t count;
+} history_reply_t;
+
+static void collect_history_record(const mqtt_journal_record_t *rec, void *ctx)
+{
+    history_reply_t *reply = ctx;
+    if (reply->count >= MQTT_JOURNAL_HISTORY_MAX) {
+        return;
+    }
+    char topic[MQTT_MAX_TOPIC + 16];
+    char payload[MQTT_MAX_PAYLOAD + 24];
+    int topic_len = snprintf(topic, sizeof(topic), "$SYS/history/%s", rec->topic);
+    int payload_len = snprintf(payload, sizeof(payload), "%lld|%s", (long long)rec->ts_ms, rec->payload);
+    if (topic_len < 0 || payload_len < 0) {
+        return;
+    }
+    topic_len = topic_len < (int)sizeof(topic) ? topic_len : (int)sizeof(topic) - 1;
+    payload_len = payload_len < (int)sizeof(payload) ? payload_len : (int)sizeof(payload) - 1;
+    size_t cap = 1 + 4 + 2 + (size_t)topic_len + (size_t)payload_len;
+    uint8_t *frame = heap_caps_malloc(cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!frame) {
+        return;
+    }
+    size_t len = frame_publish(frame, cap, topic, (size_t)topic_len, payload, (size_t)payload_len, 0, false, 0);
+    if (len == 0) {
+        heap_caps_free(frame);
+        return;
+    }
+    reply->frames[reply->count] = frame;
+    reply->lens[reply->count] = len;
+    reply->count++;
+}
+
+// Payload запроса: "<filter> [count]". Ответ идет только запросившему клиенту:
+// $SYS/history/<topic> = "<ts_ms>|<payload>" для каждой записи и $SYS/history/end = "<filter> <n>".
+int journal_handle_history_request(mqtt_session_t *sess, const char *request)
+{
+    char filter[MQTT_MAX_TOPIC] = {0};
+    unsigned count = MQTT_JOURNAL_HISTORY_DEFAULT;
+    if (sscanf(request, "%95s %u", filter, &count) < 1) {
+        ESP_LOGW(TAG, "empty history request from %s", sess->client_id);
+        return 0;
+    }
+    if (count == 0) {
+        count = MQTT_JOURNAL_HISTORY_DEFAULT;
+    } else if (count > MQTT_JOURNAL_HISTORY_MAX) {
+        count = MQTT_JOURNAL_HISTORY_MAX;
+    }
+    history_reply_t *reply = heap_caps_calloc(1, sizeof(*reply), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!reply) {
+        ESP_LOGW(TAG, "history reply alloc failed for %s", sess->client_id);
+        return 0;
+    }
+    if (acl_can_subscribe(sess->client_id, filter)) {
+        mqtt_core_journal_query(filter, count, collect_history_record, reply);
+    } else {
+        ESP_LOGW(TAG, "ACL deny history %s -> %s", sess->client_id, filter);
+    }
+    int rc = 0;
+    size_t sent = 0;
+    for (size_t i = 0; i < reply->count; ++i) {
+        if (rc >= 0 && session_send(sess, reply->frames[i], reply->lens[i]) >= 0) {
+            sent++;
+        } else {
+            rc = -1;
+        }
+        heap_caps_free(reply->frames[i]);
+    }
+    heap_caps_free(reply);
+    if (rc < 0) {
+        return rc;
+    }
+    char done[MQTT_MAX_TOPIC + 16];
+    uint8_t frame[MQTT_MAX_TOPIC + 48];
+    int done_len = snprintf(done, sizeof(done), "%s %u", filter, (unsigned)sent);
+    static const char end_topic[] = MQTT_JOURNAL_HISTORY_TOPIC "/end";
+    size_t len = frame_publish(frame, sizeof(frame), end_topic, sizeof(end_topic) - 1, done, (size_t)done_len, 0,
+                               false, 0);
+    return (len > 0 && session_send(sess, frame, len) >= 0) ? 0 : -1;
+}
@@ -0,0 +1,550 @@
+#include "mqtt_core_internal.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+static const char *TAG = "mqtt_core";
+
+// Очередь сессии защищена своим мьютексом: в нее пишут и публикующие задачи (под s_lock),
+// и воркер сессии или владелец транспорта (без s_lock). Порядок захвата: s_lock -> out lock.
+static SemaphoreHandle_t s_out_locks[MQTT_MAX_CLIENTS];
+
+esp_err_t outbox_init(void)
+{
+    for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
+        if (!s_out_locks[i]) {
+            s_out_locks[i] = xSemaphoreCreateMutex();
+            if (!s_out_locks[i]) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+// Фильтры latest-value топиков; читаются и меняются под s_lock.
+static char s_conflate_filters[MQTT_CONFLATE_MAX_FILTERS][MQTT_MAX_TOPIC];
+static size_t s_conflate_count = 0;
+static bool s_conflate_parsed = false;
+
+bool conflate_selected(const char *topic)
+{
+    if (!s_conflate_parsed) {
+        s_conflate_count = parse_filter_list(CONFIG_BROKER_MQTT_CONFLATE_FILTERS, s_conflate_filters,
+                                             MQTT_CONFLATE_MAX_FILTERS);
+        s_conflate_parsed = true;
+    }
+    for (size_t i = 0; i < s_conflate_count; ++i) {
+        if (topic_matches_filter(s_conflate_filters[i], topic)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t mqtt_core_set_conflate_filters(const char *csv)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lock();
+    s_conflate_count = parse_filter_list(csv, s_conflate_filters, MQTT_CONFLATE_MAX_FILTERS);
+    s_conflate_parsed = true;
+    unlock();
+    return ESP_OK;
+}
+
+static bool out_lock(const mqtt_session_t *sess)
+{
+    size_t idx = session_index(sess);
+    if (idx >= MQTT_MAX_CLIENTS || !s_out_locks[idx]) {
+        return false;
+    }
+    xSemaphoreTake(s_out_locks[idx], portMAX_DELAY);
+    return true;
+}
+
+static void out_unlock(const mqtt_session_t *sess)
+{
+    xSemaphoreGive(s_out_locks[session_index(sess)]);
+}
+
+static void note_send_latency(mqtt_session_t *sess, int64_t started_us)
+{
+    uint32_t us = (uint32_t)(esp_timer_get_time() - started_us);
+    // Скользящее среднее с весом 1/8.
+    sess->send_lat_us = sess->send_lat_us ? sess->send_lat_us - (sess->send_lat_us >> 3) + (us >> 3) : us;
+}
+
+// Неблокирующая запись: байты, принятые сокетом, 0 если буфер сокета полон, <0 при ошибке.
+static int try_send(mqtt_session_t *sess, const uint8_t *buf, size_t len)
+{
+    if (sess->sock < 0) {
+        return -1;
+    }
+    int64_t started = esp_timer_get_time();
+    int r = send(sess->sock, buf, len, MSG_DONTWAIT);
+    int err = errno;
+    note_send_latency(sess, started);
+    if (r >= 0) {
+        return r;
+    }
+    if (err == EAGAIN || err == EWOULDBLOCK) {
+        return 0;
+    }
+    errno = err;
+    return -1;
+}
+
+static void pop_head(mqtt_session_t *sess)
+{
+    mqtt_outbox_entry_t *e = &sess->outbox[sess->out_head];
+    heap_caps_free(e->data);
+    memset(e, 0, sizeof(*e));
+    sess->out_head = (uint8_t)((sess->out_head + 1) % MQTT_OUTBOX_DEPTH);
+    sess->out_count--;
+}
+
+static int flush_locked(mqtt_session_t *sess)
+{
+    while (sess->out_count > 0) {
+        mqtt_outbox_entry_t *e = &sess->outbox[sess->out_head];
+        int r = try_send(sess, e->data + e->off, e->len - e->off);
+        if (r <= 0) {
+            return r;
+        }
+        e->off += (uint16_t)r;
+        sess->out_bytes -= (size_t)r;
+        if (e->off < e->len) {
+            return 0;
+        }
+        pop_head(sess);
+    }
+    return 0;
+}
+
+// Топик PUBLISH пакета: [header][remaining length 1-4][u16 len][topic]...
+static const uint8_t *publish_topic(const uint8_t *pkt, size_t len, size_t *topic_len)
+{
+    if (len < 2 || (pkt[0] >> 4) != 3) {
+        return NULL;
+    }
+    size_t idx = 1;
+    while (idx < len && idx < 4 && (pkt[idx] & 0x80)) {
+        ++idx;
+    }
+    idx++;
+    if (idx + 2 > len) {
+        return NULL;
+    }
+    size_t tlen = ((size_t)pkt[idx] << 8) | pkt[idx + 1];
+    idx += 2;
+    if (idx + tlen > len) {
+        return NULL;
+    }
+    *topic_len = tlen;
+    return pkt + idx;
+}
+
+// Заменить еще не начатый PUBLISH того же топика (latest-value); true если заменили.
+static bool replace_locked(mqtt_session_t *sess, const uint8_t *buf, size_t len)
+{
+    size_t topic_len = 0;
+    const uint8_t *topic = publish_topic(buf, len, &topic_len);
+    if (!topic) {
+        return false;
+    }
+    for (uint8_t i = 0; i < sess->out_count; ++i) {
+        mqtt_outbox_entry_t *e = &sess->outbox[(sess->out_head + i) % MQTT_OUTBOX_DEPTH];
+        if (!e->conflatable || e->off != 0) {
+            continue;
+        }
+        size_t queued_len = 0;
+        const uint8_t *queued = publish_topic(e->data, e->len, &queued_len);
+        if (!queued || queued_len != topic_len || memcmp(queued, topic, topic_len) != 0) {
+            continue;
+        }
+        if (sess->out_bytes - e->len + len > MQTT_OUTBOX_BYTES) {
+            return false;
+        }
+        uint8_t *data = heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!data) {
+            return false;
+        }
+        memcpy(data, buf, len);
+        heap_caps_free(e->data);
+        sess->out_bytes = sess->out_bytes - e->len + len;
+        e->data = data;
+        e->len = (uint16_t)len;
+        // queued_ms остается прежним: возраст очереди считается от первого ожидающего значения.
+        sess->out_dropped++;
+        return true;
+    }
+    return false;
+}
+
+// whole - пакет целиком (не хвост частично записанного), его можно заменить при conflate.
+static bool enqueue_locked(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool whole, bool conflate)
+{
+    if (whole && conflate && replace_locked(sess, buf, len)) {
+        return true;
+    }
+    if (sess->out_count >= MQTT_OUTBOX_DEPTH || sess->out_bytes + len > MQTT_OUTBOX_BYTES) {
+        return false;
+    }
+    uint8_t *data = heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!data) {
+        return false;
+    }
+    memcpy(data, buf, len);
+    mqtt_outbox_entry_t *e = &sess->outbox[(sess->out_head + sess->out_count) % MQTT_OUTBOX_DEPTH];
+    e->data = data;
+    e->len = (uint16_t)len;
+    e->off = 0;
+    e->conflatable = whole && (buf[0] >> 4) == 3;
+    e->queued_ms = now_ms();
+    sess->out_count++;
+    sess->out_bytes += len;
+    if (sess->out_bytes > sess->out_peak) {
+        sess->out_peak = (uint32_t)sess->out_bytes;
+    }
+    return true;
+}
+
+static bool wait_writable(int sock, uint32_t timeout_ms)
+{
+    if (sock < 0) {
+        return false;
+    }
+    fd_set wfds;
+    FD_ZERO(&wfds);
+    FD_SET(sock, &wfds);
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    return select(sock + 1, NULL, &wfds, NULL, &tv) > 0;
+}
+
+// Транспорт пишет только владелец (mqtt_core_stream_flush): здесь пакет лишь встает в очередь,
+// а первый пакет после опустошения очереди будит владельца. wait - вызов из обработчика пакетов,
+// то есть из контекста владельца: при полной очереди он дописывает ее сам.
+static int transport_enqueue(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool conflate, bool wait)
+{
+    int64_t deadline = now_ms() + CONFIG_BROKER_MQTT_STUCK_MS;
+    bool queued = false;
+    bool wake = false;
+    const mqtt_core_transport_t *transport = NULL;
+    void *ctx = NULL;
+    for (;;) {
+        if (!out_lock(sess)) {
+            return -1;
+        }
+        queued = enqueue_locked(sess, buf, len, true, conflate);
+        wake = queued && !sess->out_wake_pending;
+        if (wake) {
+            sess->out_wake_pending = true;
+        }
+        uint16_t generation = sess->generation;
+        transport = sess->transport;
+        ctx = sess->transport_ctx;
+        out_unlock(sess);
+        if (queued || !wait || now_ms() >= deadline || outbox_transport_flush(sess, generation) < 0) {
+            break;
+        }
+    }
+    if (!queued) {
+        ESP_LOGW(TAG, "outbound queue overflow for %s (%u bytes queued)",
+                 sess->client_id, (unsigned)sess->out_bytes);
+        errno = ENOBUFS;
+        return -1;
+    }
+    if (wake && transport && transport->wake(ctx) != ESP_OK) {
+        // Разбудить попробует следующий пакет; если владелец так и не заберет очередь,
+        // ее возраст закроет сессию как stuck.
+        out_lock(sess);
+        sess->out_wake_pending = false;
+        out_unlock(sess);
+    }
+    return (int)len;
+}
+
+int outbox_transport_flush(mqtt_session_t *sess, uint16_t generation)
+{
+    for (;;) {
+        if (!out_lock(sess)) {
+            return -1;
+        }
+        if (sess->generation != generation || sess->out_count == 0) {
+            if (sess->generation == generation) {
+                sess->out_wake_pending = false;
+            }
+            out_unlock(sess);
+            return 0;
+        }
+        // Головной пакет забирается из очереди: пока он пишется, его не заменит conflate и не освободит
+        // сброс сессии, а возраст для lagging/stuck считается от его постановки в очередь.
+        mqtt_outbox_entry_t e = sess->outbox[sess->out_head];
+        sess->outbox[sess->out_head].data = NULL;
+        pop_head(sess);
+        sess->out_sending = true;
+        sess->out_sending_ms = e.queued_ms;
+        const mqtt_core_transport_t *transport = sess->transport;
+        void *ctx = sess->transport_ctx;
+        out_unlock(sess);
+
+        int r = -1;
+        if (transport) {
+            int64_t started = esp_timer_get_time();
+            r = transport->send(ctx, e.data, e.len);
+            note_send_latency(sess, started);
+        }
+        heap_caps_free(e.data);
+
+        out_lock(sess);
+        if (sess->generation == generation && sess->out_sending) {
+            sess->out_bytes -= e.len;
+            sess->out_sending = false;
+        }
+        out_unlock(sess);
+        if (r < 0) {
+            return -1;
+        }
+    }
+}
+
+static int send_or_queue(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool conflate, bool wait)
+{
+    if (sess->transport) {
+        return transport_enqueue(sess, buf, len, conflate, wait);
+    }
+    if (!out_lock(sess)) {
+        return -1;
+    }
+    int rc = (int)len;
+    size_t off = 0;
+    if (flush_locked(sess) < 0) {
+        rc = -1;
+    } else if (sess->out_count == 0) {
+        int r = try_send(sess, buf, len);
+        if (r < 0) {
+            rc = -1;
+        } else {
+            off = (size_t)r;
+        }
+    }
+    if (rc >= 0 && off < len) {
+        // Хвост частично записанного пакета не заменяется: его начало уже ушло в сокет.
+        bool queued = enqueue_locked(sess, buf + off, len - off, off == 0, conflate);
+        // Собственный воркер сессии (ответы, retain, история) может подождать сокет сам:
+        // это задерживает только этого клиента, s_lock он не держит. off == 0, поэтому отпускать
+        // мьютекс очереди безопасно - из пакета еще ничего не записано.
+        int64_t deadline = now_ms() + CONFIG_BROKER_MQTT_STUCK_MS;
+        while (!queued && wait && off == 0 && sess->task == xTaskGetCurrentTaskHandle() && now_ms() < deadline) {
+            int sock = sess->sock;
+            if (sock < 0) {
+                break;
+            }
+            out_unlock(sess);
+            bool writable = wait_writable(sock, MQTT_OUTBOX_POLL_MS);
+            out_lock(sess);
+            if (writable && flush_locked(sess) < 0) {
+                break;
+            }
+            queued = enqueue_locked(sess, buf, len, true, conflate);
+        }
+        if (!queued) {
+            ESP_LOGW(TAG, "outbound queue overflow for %s (%u bytes queued)",
+                     sess->client_id, (unsigned)sess->out_bytes);
+            errno = ENOBUFS;
+            rc = -1;
+        }
+    }
+    out_unlock(sess);
+    return rc;
+}
+
+int outbox_send(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool conflate)
+{
+    return send_or_queue(sess, buf, len, conflate, false);
+}
+
+int outbox_send_wait(mqtt_session_t *sess, const uint8_t *buf, size_t len)
+{
+    return send_or_queue(sess, buf, len, false, true);
+}
+
+void outbox_reset(mqtt_session_t *sess)
+{
+    if (!out_lock(sess)) {
+        return;
+    }
+    while (sess->out_count > 0) {
+        pop_head(sess);
+    }
+    sess->out_head = 0;
+    sess->out_bytes = 0;
+    sess->out_wake_pending = false;
+    sess->out_sending = false;
+    out_unlock(sess);
+}
+
+// Время постановки самого старого неотправленного пакета, включая тот, что сейчас пишет транспорт.
+static bool oldest_queued_locked(const mqtt_session_t *sess, int64_t *queued_ms)
+{
+    if (sess->out_sending) {
+        *queued_ms = sess->out_sending_ms;
+        return true;
+    }
+    if (sess->out_count > 0) {
+        *queued_ms = sess->outbox[sess->out_head].queued_ms;
+        return true;
+    }
+    return false;
+}
+
+static mqtt_client_health_t health_locked(const mqtt_session_t *sess, int64_t now)
+{
+    int64_t queued_ms = 0;
+    if (!oldest_queued_locked(sess, &queued_ms)) {
+        return MQTT_CLIENT_HEALTHY;
+    }
+    int64_t age = now - queued_ms;
+    if (age >= CONFIG_BROKER_MQTT_STUCK_MS) {
+        return MQTT_CLIENT_STUCK;
+    }
+    if (age >= CONFIG_BROKER_MQTT_LAG_MS || sess->out_bytes > MQTT_OUTBOX_BYTES / 2 ||
+        sess->out_count > MQTT_OUTBOX_DEPTH / 2) {
+        return MQTT_CLIENT_LAGGING;
+    }
+    return MQTT_CLIENT_HEALTHY;
+}
+
+mqtt_client_health_t outbox_health(mqtt_session_t *sess)
+{
+    if (!out_lock(sess)) {
+        return MQTT_CLIENT_HEALTHY;
+    }
+    mqtt_client_health_t health = health_locked(sess, now_ms());
+    out_unlock(sess);
+    return health;
+}
+
+mqtt_out_action_t outbox_admit(mqtt_session_t *sess, uint8_t qos)
+{
+    if (!out_lock(sess)) {
+        return MQTT_OUT_SEND;
+    }
+    mqtt_out_action_t action = MQTT_OUT_SEND;
+    switch (health_locked(sess, now_ms())) {
+    case MQTT_CLIENT_STUCK:
+        action = MQTT_OUT_CLOSE;
+        break;
+    case MQTT_CLIENT_LAGGING:
+#if defined(CONFIG_BROKER_MQTT_SLOW_DISCONNECT)
+        action = MQTT_OUT_CLOSE;
+#elif defined(CONFIG_BROKER_MQTT_SLOW_LATEST)
+        action = MQTT_OUT_CONFLATE;
+#else
+        if (qos == 0) {
+            sess->out_dropped++;
+            action = MQTT_OUT_DROP;
+        }
+#endif
+        break;
+    default:
+        break;
+    }
+    out_unlock(sess);
+    return action;
+}
+
+// read - ждать и входящих данных; idle_ms - ожидание, когда дописывать нечего.
+static int wait_socket(mqtt_session_t *sess, bool read, uint32_t idle_ms)
+{
+    int sock = sess->sock;
+    if (sock < 0) {
+        return -1;
+    }
+    bool pending = false;
+    if (out_lock(sess)) {
+        pending = sess->out_count > 0;
+        out_unlock(sess);
+    }
+    if (!read && !pending) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idle_ms));
+        return 0;
+    }
+    fd_set rfds;
+    fd_set wfds;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    if (read) {
+        FD_SET(sock, &rfds);
+    }
+    if (pending) {
+        FD_SET(sock, &wfds);
+    }
+    uint32_t wait_ms = (pending && MQTT_OUTBOX_POLL_MS < idle_ms) ? MQTT_OUTBOX_POLL_MS : idle_ms;
+    struct timeval tv = {
+        .tv_sec = wait_ms / 1000,
+        .tv_usec = (wait_ms % 1000) * 1000,
+    };
+    int ready = select(sock + 1, read ? &rfds : NULL, pending ? &wfds : NULL, NULL, &tv);
+    if (ready < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (pending) {
+        mqtt_client_health_t health = MQTT_CLIENT_HEALTHY;
+        int rc = 0;
+        if (out_lock(sess)) {
+            if (FD_ISSET(sock, &wfds)) {
+                rc = flush_locked(sess);
+            }
+            health = health_locked(sess, now_ms());
+            out_unlock(sess);
+        }
+        if (rc < 0) {
+            request_session_close(sess, "outbound flush failed", errno);
+            return -1;
+        }
+        if (health == MQTT_CLIENT_STUCK) {
+            request_session_close(sess, "slow consumer stuck", 0);
+            return -1;
+        }
+    }
+    return (read && ready > 0 && FD_ISSET(sock, &rfds)) ? 1 : 0;
+}
+
+int outbox_wait_readable(mqtt_session_t *sess)
+{
+    return wait_socket(sess, true, MQTT_IDLE_POLL_MS);
+}
+
+int outbox_wait_writable(mqtt_session_t *sess, uint32_t wait_ms)
+{
+    return wait_socket(sess, false, wait_ms);
+}
+
+void outbox_fill_info(mqtt_session_t *sess, mqtt_client_info_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    strncpy(out->client_id, sess->client_id, sizeof(out->client_id) - 1);
+    out->websocket = sess->transport != NULL;
+    out->send_latency_us = sess->send_lat_us;
+    if (!out_lock(sess)) {
+        return;
+    }
+    int64_t now = now_ms();
+    out->health = health_locked(sess, now);
+    out->backlog_bytes = (uint32_t)sess->out_bytes;
+    out->backlog_peak = sess->out_peak;
+    int64_t queued_ms = 0;
+    out->backlog_age_ms = oldest_queued_locked(sess, &queued_ms) ? (uint32_t)(now - queued_ms) : 0;
+    out->dropped = sess->out_dropped;
+    out_unlock(sess);
+}
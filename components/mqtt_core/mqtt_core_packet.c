@@ -8,7 +8,7 @@
 
 static const char *TAG = "mqtt_core";
 
-static size_t encode_remaining_length(uint8_t *out, size_t rem_len)
+size_t encode_remaining_length(uint8_t *out, size_t rem_len)
 {
     size_t idx = 0;
     do {
@@ -48,6 +48,44 @@ int send_all(int sock, const uint8_t *buf, size_t len)
     return (int)sent;
 }
 
+int session_send_publish(mqtt_session_t *sess, const uint8_t *buf, size_t len, bool conflate)
+{
+    if (!sess || sess->closing) {
+        return -1;
+    }
+    if (!sess->transport && sess->sock < 0) {
+        return -1;
+    }
+    return outbox_send(sess, buf, len, conflate);
+}
+
+int session_send(mqtt_session_t *sess, const uint8_t *buf, size_t len)
+{
+    if (!sess || sess->closing) {
+        return -1;
+    }
+    if (!sess->transport && sess->sock < 0) {
+        return -1;
+    }
+    return outbox_send_wait(sess, buf, len);
+}
+
+int parse_utf8_str(const uint8_t *buf, size_t len, size_t *offset, char *out, size_t out_len)
+{
+    if (*offset + 2 > len) {
+        return -1;
+    }
+    uint16_t slen = (buf[*offset] << 8) | buf[*offset + 1];
+    *offset += 2;
+    if (*offset + slen > len || slen >= out_len) {
+        return -1;
+    }
+    memcpy(out, buf + *offset, slen);
+    out[slen] = 0;
+    *offset += slen;
+    return 0;
+}
+
 int read_remaining_length(int sock, int *out_rem)
 {
     int multiplier = 1;
@@ -67,18 +105,17 @@ int read_remaining_length(int sock, int *out_rem)
     return 0;
 }
 
-int send_connack(int sock, uint8_t rc)
+int send_connack(mqtt_session_t *sess, uint8_t rc)
 {
     uint8_t pkt[4] = {0x20, 0x02, 0x00, rc};
-    return send_all(sock, pkt, sizeof(pkt));
+    return session_send(sess, pkt, sizeof(pkt));
 }
 
 int send_suback(mqtt_session_t *sess, uint16_t pid, uint8_t *qos, size_t count)
 {
-    size_t slot = session_index(sess);
-    uint8_t *buf = ensure_session_tx_buffer(slot);
-    if (!buf) {
-        ESP_LOGE(TAG, "suback buffer alloc failed");
+    // Не буфер сессии: его под s_lock использует рассылка, а ответ собирается без s_lock.
+    uint8_t buf[4 + MQTT_MAX_SUBS];
+    if (count > MQTT_MAX_SUBS) {
         return -1;
     }
     size_t idx = 0;
@@ -90,57 +127,54 @@ int send_suback(mqtt_session_t *sess, uint16_t pid, uint8_t *qos, size_t count)
         buf[idx++] = qos[i];
     }
     buf[rem_idx] = (uint8_t)(idx - 2);
-    return send_all(sess->sock, buf, idx);
+    return session_send(sess, buf, idx);
 }
 
-int send_puback(int sock, uint16_t pid)
+int send_puback(mqtt_session_t *sess, uint16_t pid)
 {
     uint8_t buf[4] = {0x40, 0x02, (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF)};
-    return send_all(sock, buf, sizeof(buf));
+    return session_send(sess, buf, sizeof(buf));
 }
 
-int send_unsuback(int sock, uint16_t pid)
+int send_unsuback(mqtt_session_t *sess, uint16_t pid)
 {
     uint8_t buf[4] = {0xB0, 0x02, (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF)};
-    return send_all(sock, buf, sizeof(buf));
+    return session_send(sess, buf, sizeof(buf));
 }
 
-int send_pingresp(int sock)
+int send_pingresp(mqtt_session_t *sess)
 {
     uint8_t buf[2] = {0xD0, 0x00};
-    return send_all(sock, buf, sizeof(buf));
+    return session_send(sess, buf, sizeof(buf));
 }
 
-int send_publish_packet(mqtt_session_t *sess, const char *topic, const char *payload, uint8_t qos, bool retain, uint16_t pid)
+size_t frame_publish(uint8_t *buf,
+                     size_t cap,
+                     const char *topic,
+                     size_t topic_len,
+                     const char *payload,
+                     size_t payload_len,
+                     uint8_t qos,
+                     bool retain,
+                     uint16_t pid)
 {
-    if (!sess || !topic || !payload) {
-        return -1;
-    }
-    size_t slot = session_index(sess);
-    uint8_t *buf = ensure_session_tx_buffer(slot);
-    if (!buf) {
-        ESP_LOGE(TAG, "publish buffer alloc failed");
-        return -1;
-    }
-    size_t topic_len = strlen(topic);
-    size_t payload_len = strlen(payload);
     if (topic_len > UINT16_MAX) {
         ESP_LOGW(TAG, "publish topic too long (%zu)", topic_len);
-        return -1;
+        return 0;
     }
     size_t rem_len = 2 + topic_len + payload_len + (qos ? 2 : 0);
     if (rem_len > MQTT_MAX_PACKET) {
         ESP_LOGW(TAG, "publish payload too large (%zu)", rem_len);
-        return -1;
+        return 0;
     }
 
     uint8_t header = 0x30 | (qos << 1) | (retain ? 0x01 : 0x00);
     uint8_t rem_enc[4];
     size_t rem_enc_len = encode_remaining_length(rem_enc, rem_len);
     size_t total_len = 1 + rem_enc_len + rem_len;
-    if (rem_enc_len == 0 || total_len > MQTT_MAX_PACKET) {
+    if (rem_enc_len == 0 || total_len > cap) {
         ESP_LOGW(TAG, "publish packet exceeds buffer (topic=%zu payload=%zu total=%zu)", topic_len, payload_len, total_len);
-        return -1;
+        return 0;
     }
 
     size_t idx = 0;
@@ -157,7 +191,31 @@ int send_publish_packet(mqtt_session_t *sess, const char *topic, const char *pay
     }
     memcpy(&buf[idx], payload, payload_len);
     idx += payload_len;
-    int sent = send_all(sess->sock, buf, idx);
+    return idx;
+}
+
+int send_publish_packet_ex(mqtt_session_t *sess,
+                           const char *topic,
+                           const char *payload,
+                           uint8_t qos,
+                           bool retain,
+                           uint16_t pid,
+                           bool conflate)
+{
+    if (!sess || !topic || !payload) {
+        return -1;
+    }
+    size_t slot = session_index(sess);
+    uint8_t *buf = ensure_session_tx_buffer(slot);
+    if (!buf) {
+        ESP_LOGE(TAG, "publish buffer alloc failed");
+        return -1;
+    }
+    size_t len = frame_publish(buf, MQTT_MAX_PACKET, topic, strlen(topic), payload, strlen(payload), qos, retain, pid);
+    if (len == 0) {
+        return -1;
+    }
+    int sent = session_send_publish(sess, buf, len, conflate);
     if (sent < 0) {
         int err = errno;
         request_session_close(sess, "publish send failed", err);
@@ -9,22 +9,6 @@
 
 static const char *TAG = "mqtt_core";
 
-static int parse_utf8_str(const uint8_t *buf, size_t len, size_t *offset, char *out, size_t out_len)
-{
-    if (*offset + 2 > len) {
-        return -1;
-    }
-    uint16_t slen = (buf[*offset] << 8) | buf[*offset + 1];
-    *offset += 2;
-    if (*offset + slen > len || slen >= out_len) {
-        return -1;
-    }
-    memcpy(out, buf + *offset, slen);
-    out[slen] = 0;
-    *offset += slen;
-    return 0;
-}
-
 static bool mqtt_authenticate_client(const char *client_id, const char *username, const char *password)
 {
     const app_config_t *cfg = config_store_get();
@@ -50,25 +34,49 @@ static bool mqtt_authenticate_client(const char *client_id, const char *username
     return false;
 }
 
-void publish_to_subscribers(const char *topic, const char *payload, uint8_t qos, bool retain_flag, mqtt_session_t *exclude)
+void publish_to_subscribers(const char *topic,
+                            topic_id_t topic_id,
+                            const char *payload,
+                            uint8_t qos,
+                            bool retain_flag,
+                            mqtt_session_t *exclude)
 {
     if (!s_sessions || !s_lock) {
         ESP_LOGW(TAG, "publish ignored: mqtt core not initialized");
         return;
     }
+    if (topic_id == TOPIC_ID_NONE) {
+        // Не интернированный топик не может совпасть ни с одним точным фильтром.
+        topic_id = topic_intern_find(topic);
+    }
+    journal_record(topic, payload);
     lock();
     if (retain_flag) {
         retain_store(topic, payload, qos);
     }
+    bool conflate_topic = conflate_selected(topic);
     for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
         mqtt_session_t *s = &s_sessions[i];
-        if (!s->active || s == exclude) {
+        if (!s->active || s->closing || s == exclude) {
             continue;
         }
         for (size_t j = 0; j < s->sub_count; ++j) {
-            if (topic_matches_filter(s->subs[j].topic, topic)) {
+            const mqtt_subscription_t *sub = &s->subs[j];
+            bool match = sub->wildcard ? topic_matches_filter(topic_intern_str(sub->filter_id), topic)
+                                       : (topic_id != TOPIC_ID_NONE && sub->filter_id == topic_id);
+            if (match) {
+                mqtt_out_action_t action = outbox_admit(s, qos);
+                if (action == MQTT_OUT_CLOSE) {
+                    request_session_close(s, "slow consumer", 0);
+                    break;
+                }
+                // Latest-value топик не отбрасывается: замена в очереди уже ограничивает ее размер.
+                if (action == MQTT_OUT_DROP && !conflate_topic) {
+                    break;
+                }
                 uint16_t pid = (qos ? (uint16_t)(esp_random() & 0xFFFF) : 0);
-                if (send_publish_packet(s, topic, payload, qos, retain_flag, pid) < 0) {
+                if (send_publish_packet_ex(s, topic, payload, qos, retain_flag, pid,
+                                           conflate_topic || action == MQTT_OUT_CONFLATE) < 0) {
                     ESP_LOGW(TAG, "send publish failed to %s", s->client_id);
                 }
                 break;
@@ -154,6 +162,9 @@ int handle_connect(mqtt_session_t *sess, const uint8_t *buf, size_t len)
         ESP_LOGW(TAG, "MQTT auth failed for client_id=%s", client_id);
         return -1;
     }
+    lock();
+    dedup_attach(sess);
+    unlock();
     return 0;
 }
 
@@ -180,12 +191,40 @@ int handle_subscribe(mqtt_session_t *sess, const uint8_t *buf, size_t len)
             granted[granted_count++] = 0x80;
             continue;
         }
-        if (sess->sub_count < MQTT_MAX_SUBS) {
-            strncpy(sess->subs[sess->sub_count].topic, topic, sizeof(sess->subs[sess->sub_count].topic) - 1);
-            sess->subs[sess->sub_count].qos = rqos > 1 ? 1 : rqos;
-            sess->sub_count++;
-            granted[granted_count++] = rqos > 1 ? 1 : rqos;
-            deliver_retain(sess, topic);
+        uint8_t gqos = rqos > 1 ? 1 : rqos;
+        topic_id_t filter_id = topic_intern_acquire(topic);
+        if (filter_id == TOPIC_ID_NONE) {
+            granted[granted_count++] = 0x80;
+            continue;
+        }
+        lock();
+        mqtt_subscription_t *existing = NULL;
+        for (size_t i = 0; i < sess->sub_count; ++i) {
+            if (sess->subs[i].filter_id == filter_id) {
+                existing = &sess->subs[i];
+                break;
+            }
+        }
+        bool accepted = true;
+        if (existing) {
+            // Повторная подписка на тот же фильтр заменяет существующую (MQTT 3.1.1, 3.8.4).
+            existing->qos = gqos;
+            topic_intern_release(filter_id);
+        } else if (sess->sub_count < MQTT_MAX_SUBS) {
+            mqtt_subscription_t *sub = &sess->subs[sess->sub_count++];
+            sub->filter_id = filter_id;
+            sub->wildcard = strpbrk(topic, "+#") != NULL;
+            sub->qos = gqos;
+        } else {
+            topic_intern_release(filter_id);
+            accepted = false;
+        }
+        unlock();
+        if (accepted) {
+            granted[granted_count++] = gqos;
+            if (deliver_retain(sess, topic) < 0) {
+                return -1;
+            }
         } else {
             granted[granted_count++] = 0x80;
         }
@@ -209,8 +248,14 @@ int handle_unsubscribe(mqtt_session_t *sess, const uint8_t *buf, size_t len)
             return -1;
         }
 
+        topic_id_t filter_id = topic_intern_find(topic);
+        if (filter_id == TOPIC_ID_NONE) {
+            continue;
+        }
+        lock();
         for (size_t i = 0; i < sess->sub_count; ) {
-            if (strcmp(sess->subs[i].topic, topic) == 0) {
+            if (sess->subs[i].filter_id == filter_id) {
+                topic_intern_release(filter_id);
                 if (i + 1 < sess->sub_count) {
                     memmove(&sess->subs[i],
                             &sess->subs[i + 1],
@@ -222,9 +267,10 @@ int handle_unsubscribe(mqtt_session_t *sess, const uint8_t *buf, size_t len)
             }
             ++i;
         }
+        unlock();
     }
 
-    return send_unsuback(sess->sock, pid);
+    return send_unsuback(sess, pid);
 }
 
 int handle_publish(mqtt_session_t *sess, uint8_t header, const uint8_t *buf, size_t len)
@@ -253,10 +299,33 @@ int handle_publish(mqtt_session_t *sess, uint8_t header, const uint8_t *buf, siz
         pid = (buf[off] << 8) | buf[off + 1];
         off += 2;
     }
+    if (strcmp(topic, MQTT_JOURNAL_HISTORY_TOPIC "/get") == 0) {
+        // Запрос истории обрабатывается брокером и не рассылается подписчикам.
+        size_t req_len = len - off;
+        char request[MQTT_MAX_TOPIC + 16];
+        if (req_len >= sizeof(request)) {
+            req_len = sizeof(request) - 1;
+        }
+        memcpy(request, buf + off, req_len);
+        request[req_len] = 0;
+        if (journal_handle_history_request(sess, request) < 0) {
+            return -1;
+        }
+        if (qos == 1) {
+            send_puback(sess, pid);
+        }
+        return 0;
+    }
     if (!acl_can_publish(sess->client_id, topic)) {
         ESP_LOGW(TAG, "ACL deny pub %s -> %s", sess->client_id, topic);
         return 0;
     }
+    // Повтор QoS1 с DUP после потерянного PUBACK: только подтверждаем, без повторной обработки.
+    if (qos == 1 && (header & 0x08) && dedup_seen(sess, pid)) {
+        ESP_LOGW(TAG, "duplicate publish %s pid=%u", sess->client_id, pid);
+        send_puback(sess, pid);
+        return 0;
+    }
     size_t payload_len = len - off;
     if (payload_len >= MQTT_MAX_PAYLOAD) {
         payload_len = MQTT_MAX_PAYLOAD - 1;
@@ -265,11 +334,62 @@ int handle_publish(mqtt_session_t *sess, uint8_t header, const uint8_t *buf, siz
     memcpy(payload, buf + off, payload_len);
     payload[payload_len] = 0;
 
-    mqtt_core_inject_message(topic, payload);
-    publish_to_subscribers(topic, payload, qos, retain, NULL);
+    __atomic_add_fetch(&sess->pub_count, 1, __ATOMIC_RELAXED);
+    // Топик хэшируется один раз на входе; дальше bus/runtime/подписки сравнивают id.
+    topic_id_t topic_id = topic_intern_find(topic);
+    inject_message_interned(topic, topic_id, payload, sess->channel);
+    publish_to_subscribers(topic, topic_id, payload, qos, retain, NULL);
 
     if (qos == 1) {
-        send_puback(sess->sock, pid);
+        dedup_remember(sess, pid);
+        send_puback(sess, pid);
     }
     return 0;
 }
+
+int session_process_packet(mqtt_session_t *sess, uint8_t header, const uint8_t *buf, size_t len)
+{
+    uint8_t type = header >> 4;
+    if (!sess->connected) {
+        if (type != 1 || handle_connect(sess, buf, len) != 0) {
+            send_connack(sess, 0x02);
+            return -1;
+        }
+        sess->connected = true;
+        send_connack(sess, 0x00);
+        ESP_LOGI(TAG, "MQTT CONNECT %s keepalive=%u%s", sess->client_id, sess->keepalive,
+                 sess->transport ? " (ws)" : "");
+        return 0;
+    }
+
+    sess->last_rx_ms = now_ms();
+    switch (type) {
+    case 3:
+        if (handle_publish(sess, header, buf, len) != 0) {
+            ESP_LOGW(TAG, "publish parse fail");
+            return -1;
+        }
+        return 0;
+    case 8:
+        if (handle_subscribe(sess, buf, len) < 0) {
+            ESP_LOGW(TAG, "subscribe parse fail");
+            return -1;
+        }
+        return 0;
+    case 10:
+        if (handle_unsubscribe(sess, buf, len) < 0) {
+            ESP_LOGW(TAG, "unsubscribe parse fail");
+            return -1;
+        }
+        return 0;
+    case 12:
+        send_pingresp(sess);
+        return 0;
+    case 14:
+        sess->suppress_will = true;
+        return 1;
+    default:
+        ESP_LOGW(TAG, "unsupported packet type %u", type);
+        return -1;
+    }
+}
@@ -19,13 +19,13 @@ static void retain_free_entry(retain_entry_t *slot)
     slot->payload_len = 0;
 }
 
-static retain_entry_t *retain_get(const char *topic)
+static retain_entry_t *retain_get(topic_id_t topic_id)
 {
-    if (!s_retain || !topic) {
+    if (!s_retain || topic_id == TOPIC_ID_NONE) {
         return NULL;
     }
     for (size_t i = 0; i < MQTT_RETAIN_MAX; ++i) {
-        if (s_retain[i].in_use && strcmp(s_retain[i].topic, topic) == 0) {
+        if (s_retain[i].in_use && s_retain[i].topic_id == topic_id) {
             return &s_retain[i];
         }
     }
@@ -37,20 +37,22 @@ void retain_store(const char *topic, const char *payload, uint8_t qos)
     if (!s_retain || !topic || !payload) {
         return;
     }
-    retain_entry_t *slot = retain_get(topic);
+    retain_entry_t *slot = retain_get(topic_intern_find(topic));
     size_t len = strnlen(payload, MQTT_MAX_PAYLOAD - 1);
 
     // MQTT retained clear semantics: retained publish with empty payload deletes stored entry.
     if (len == 0) {
         if (slot) {
             retain_free_entry(slot);
+            topic_intern_release(slot->topic_id);
+            slot->topic_id = TOPIC_ID_NONE;
             slot->in_use = false;
-            slot->topic[0] = '\0';
             slot->qos = 0;
         }
         return;
     }
 
+    bool existing = slot != NULL;
     if (!slot) {
         for (size_t i = 0; i < MQTT_RETAIN_MAX; ++i) {
             if (!s_retain[i].in_use) {
@@ -63,36 +65,55 @@ void retain_store(const char *topic, const char *payload, uint8_t qos)
         ESP_LOGW(TAG, "retain table full, dropping %s", topic);
         return;
     }
+    topic_id_t topic_id = existing ? slot->topic_id : topic_intern_acquire(topic);
+    if (topic_id == TOPIC_ID_NONE) {
+        ESP_LOGW(TAG, "retain topic not interned, dropping %s", topic);
+        return;
+    }
     char *buf = heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
     if (!buf) {
         ESP_LOGW(TAG, "retain alloc failed for %s", topic);
+        if (!existing) {
+            topic_intern_release(topic_id);
+        }
         return;
     }
     memcpy(buf, payload, len);
     buf[len] = '\0';
     retain_free_entry(slot);
     slot->in_use = true;
-    strncpy(slot->topic, topic, sizeof(slot->topic) - 1);
-    slot->topic[sizeof(slot->topic) - 1] = '\0';
+    slot->topic_id = topic_id;
     slot->payload = buf;
     slot->payload_len = len;
     slot->qos = qos;
 }
 
-void deliver_retain(mqtt_session_t *sess, const char *filter)
+int deliver_retain(mqtt_session_t *sess, const char *filter)
 {
     if (!s_retain) {
-        return;
+        return 0;
     }
-    lock();
-    for (size_t i = 0; i < MQTT_RETAIN_MAX; ++i) {
-        if (!s_retain[i].in_use) {
-            continue;
-        }
-        if (topic_matches_filter(filter, s_retain[i].topic)) {
+    uint8_t *buf = heap_caps_malloc(MQTT_MAX_PACKET, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        ESP_LOGW(TAG, "retain reply alloc failed for %s", sess->client_id);
+        return 0;
+    }
+    // Пакет собирается под s_lock, а отправляется без него: ответ может ждать сокет клиента.
+    int rc = 0;
+    for (size_t i = 0; i < MQTT_RETAIN_MAX && rc >= 0; ++i) {
+        size_t len = 0;
+        lock();
+        const char *topic = s_retain[i].in_use ? topic_intern_str(s_retain[i].topic_id) : NULL;
+        if (topic && topic_matches_filter(filter, topic)) {
             const char *payload = s_retain[i].payload ? s_retain[i].payload : "";
-            send_publish_packet(sess, s_retain[i].topic, payload, s_retain[i].qos, true, 0);
+            len = frame_publish(buf, MQTT_MAX_PACKET, topic, strlen(topic), payload, strlen(payload),
+                                s_retain[i].qos, true, 0);
+        }
+        unlock();
+        if (len > 0 && session_send(sess, buf, len) < 0) {
+            rc = -1;
         }
     }
-    unlock();
+    heap_caps_free(buf);
+    return rc;
 }
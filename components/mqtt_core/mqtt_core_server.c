@@ -2,14 +2,23 @@
 
 #include <errno.h>
 
+#include "freertos/queue.h"
 #include "esp_log.h"
 #include "lwip/inet.h"
 #include "lwip/sockets.h"
 
+#include "broker_affinity.h"
+
 static const char *TAG = "mqtt_core";
 
 #define MQTT_SWEEP_PERIOD_US (1000 * 1000)
 
+static QueueHandle_t s_handoff_queue = NULL;
+static portMUX_TYPE s_pool_mux = portMUX_INITIALIZER_UNLOCKED;
+static size_t s_worker_count = 0;
+static int s_idle_workers = 0;
+static event_bus_channel_t *s_worker_channels[MQTT_MAX_CLIENTS];
+
 static void configure_session_recv_timeout(mqtt_session_t *sess)
 {
     if (!sess || sess->sock < 0) {
@@ -22,9 +31,24 @@ static void configure_session_recv_timeout(mqtt_session_t *sess)
     setsockopt(sess->sock, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
 }
 
-static void handle_client(void *param)
+static void configure_accepted_socket(int sock)
+{
+    int ka = 1;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &ka, sizeof(ka));
+    struct timeval tmo = {.tv_sec = 5, .tv_usec = 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+    // SO_SNDTIMEO не нужен: отправка неблокирующая, недописанное ждет в outbox сессии.
+}
+
+static bool keepalive_expired(const mqtt_session_t *sess)
+{
+    int64_t idle_ms = now_ms() - sess->last_rx_ms;
+    int64_t limit_ms = (sess->keepalive > 0) ? (int64_t)sess->keepalive * 1500 : 60000;
+    return idle_ms >= limit_ms;
+}
+
+static void serve_session(mqtt_session_t *sess)
 {
-    mqtt_session_t *sess = (mqtt_session_t *)param;
     uint8_t header = 0;
 
     int rem = 0;
@@ -35,16 +59,26 @@ static void handle_client(void *param)
     if (recv_all(sess->sock, pkt, rem) < 0) {
         goto cleanup;
     }
-    if ((header >> 4) != 1 || handle_connect(sess, pkt, rem) != 0) {
-        send_connack(sess->sock, 0x02);
+    if (session_process_packet(sess, header, pkt, rem) != 0) {
         goto cleanup;
     }
     configure_session_recv_timeout(sess);
-    send_connack(sess->sock, 0x00);
-    ESP_LOGI(TAG, "MQTT CONNECT %s keepalive=%u", sess->client_id, sess->keepalive);
 
     while (1) {
-        int r = recv(sess->sock, &header, 1, 0);
+        // Шина перегружена, а клиент - один из самых активных публикаторов: его пакеты подождут в TCP окне.
+        if (throttle_should_pause(sess) && throttle_wait(sess) < 0) {
+            break;
+        }
+        // Пока клиент ничего не шлет, воркер дописывает его исходящую очередь.
+        int ready = outbox_wait_readable(sess);
+        if (ready == 0) {
+            if (keepalive_expired(sess)) {
+                ESP_LOGW(TAG, "keepalive timeout %s", sess->client_id);
+                break;
+            }
+            continue;
+        }
+        int r = (ready > 0) ? recv(sess->sock, &header, 1, 0) : -1;
         if (r <= 0) {
             int err = errno;
             if (sess->closing) {
@@ -52,9 +86,7 @@ static void handle_client(void *param)
                 break;
             }
             if (err == EAGAIN || err == EWOULDBLOCK) {
-                int64_t idle_ms = now_ms() - sess->last_rx_ms;
-                int64_t limit_ms = (sess->keepalive > 0) ? (int64_t)sess->keepalive * 1500 : 60000;
-                if (idle_ms >= limit_ms) {
+                if (keepalive_expired(sess)) {
                     ESP_LOGW(TAG, "keepalive timeout %s", sess->client_id);
                     break;
                 }
@@ -70,43 +102,8 @@ static void handle_client(void *param)
         if (recv_all(sess->sock, pkt, rem) < 0) {
             break;
         }
-        sess->last_rx_ms = now_ms();
-        uint8_t type = header >> 4;
-        switch (type) {
-        case 3:
-            if (handle_publish(sess, header, pkt, rem) != 0) {
-                ESP_LOGW(TAG, "publish parse fail");
-                goto cleanup;
-            }
-            break;
-        case 8:
-            if (handle_subscribe(sess, pkt, rem) < 0) {
-                ESP_LOGW(TAG, "subscribe parse fail");
-                goto cleanup;
-            }
-            break;
-        case 10:
-            if (handle_unsubscribe(sess, pkt, rem) < 0) {
-                ESP_LOGW(TAG, "unsubscribe parse fail");
-                goto cleanup;
-            }
-            break;
-        case 12:
-            send_pingresp(sess->sock);
-            break;
-        case 14:
-            sess->suppress_will = true;
+        if (session_process_packet(sess, header, pkt, rem) != 0) {
             goto cleanup;
-        default:
-            ESP_LOGW(TAG, "unsupported packet type %u", type);
-            goto cleanup;
-        }
-        if (sess->keepalive > 0) {
-            int64_t idle_ms = now_ms() - sess->last_rx_ms;
-            if (idle_ms >= (int64_t)(sess->keepalive * 1500)) {
-                ESP_LOGW(TAG, "keepalive timeout %s", sess->client_id);
-                goto cleanup;
-            }
         }
     }
 
@@ -115,62 +112,100 @@ cleanup:
     lock();
     free_session(sess);
     unlock();
-    vTaskDelete(NULL);
 }
 
-static void accept_task(void *param)
+// Воркер живет всё время работы брокера: после сессии возвращается в очередь, а не удаляется.
+static void session_worker(void *param)
 {
-    (void)param;
+    event_bus_channel_t *channel = s_worker_channels[(size_t)(uintptr_t)param];
     while (1) {
-        struct sockaddr_in6 source_addr;
-        socklen_t addr_len = sizeof(source_addr);
-        int sock = accept(s_listen_sock, (struct sockaddr *)&source_addr, &addr_len);
-        if (sock < 0) {
-            ESP_LOGE(TAG, "accept failed: %d", errno);
-            vTaskDelay(pdMS_TO_TICKS(100));
+        int sock = -1;
+        if (xQueueReceive(s_handoff_queue, &sock, portMAX_DELAY) != pdTRUE) {
             continue;
         }
+        portENTER_CRITICAL(&s_pool_mux);
+        s_idle_workers--;
+        portEXIT_CRITICAL(&s_pool_mux);
 
-        int ka = 1;
-        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &ka, sizeof(ka));
-        struct timeval tmo = {.tv_sec = 5, .tv_usec = 0};
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
-        struct timeval send_tmo = {.tv_sec = 2, .tv_usec = 0};
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_tmo, sizeof(send_tmo));
-
+        configure_accepted_socket(sock);
         lock();
         mqtt_session_t *sess = alloc_session();
-        size_t slot = session_index(sess);
+        if (sess) {
+            sess->sock = sock;
+            sess->task = xTaskGetCurrentTaskHandle();
+            sess->channel = channel;
+        }
         unlock();
         if (!sess) {
             ESP_LOGW(TAG, "too many clients");
             shutdown(sock, SHUT_RDWR);
             closesocket(sock);
+        } else {
+            serve_session(sess);
+        }
+
+        portENTER_CRITICAL(&s_pool_mux);
+        s_idle_workers++;
+        portEXIT_CRITICAL(&s_pool_mux);
+    }
+}
+
+static bool spawn_session_worker(void)
+{
+    portENTER_CRITICAL(&s_pool_mux);
+    size_t idx = s_worker_count;
+    bool full = idx >= MQTT_MAX_CLIENTS;
+    portEXIT_CRITICAL(&s_pool_mux);
+    if (full || !ensure_session_task_storage(idx)) {
+        return false;
+    }
+    if (!s_worker_channels[idx] &&
+        event_bus_channel_open(MQTT_WORKER_CHANNEL_DEPTH, &s_worker_channels[idx]) != ESP_OK) {
+        // Без канала воркер публикует в шину через общую очередь.
+        ESP_LOGW(TAG, "no event bus channel for worker %u", (unsigned)idx);
+    }
+    TaskHandle_t task = xTaskCreateStaticPinnedToCore(session_worker, "mqtt_client", MQTT_CLIENT_STACK,
+                                                      (void *)(uintptr_t)idx, 5, s_session_stacks[idx],
+                                                      s_session_tcbs[idx], BROKER_NET_CORE);
+    if (!task) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_pool_mux);
+    s_worker_count++;
+    s_idle_workers++;
+    portEXIT_CRITICAL(&s_pool_mux);
+    return true;
+}
+
+static void accept_task(void *param)
+{
+    (void)param;
+    while (1) {
+        struct sockaddr_in6 source_addr;
+        socklen_t addr_len = sizeof(source_addr);
+        int sock = accept(s_listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+        if (sock < 0) {
+            ESP_LOGE(TAG, "accept failed: %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
             continue;
         }
-        if (slot >= MQTT_MAX_CLIENTS || !ensure_session_task_storage(slot)) {
-            ESP_LOGE(TAG, "no memory for client task");
+
+        // Accept только передает сокет; setsockopt и выделение сессии делает воркер.
+        int waiting = (int)uxQueueMessagesWaiting(s_handoff_queue);
+        portENTER_CRITICAL(&s_pool_mux);
+        bool pool_busy = s_idle_workers <= waiting;
+        portEXIT_CRITICAL(&s_pool_mux);
+        if (pool_busy && !spawn_session_worker()) {
+            ESP_LOGW(TAG, "too many clients");
             shutdown(sock, SHUT_RDWR);
             closesocket(sock);
-            lock();
-            free_session(sess);
-            unlock();
             continue;
         }
-
-        sess->sock = sock;
-        TaskHandle_t task = xTaskCreateStatic(handle_client, "mqtt_client", MQTT_CLIENT_STACK, sess, 5,
-                                              s_session_stacks[slot], s_session_tcbs[slot]);
-        if (!task) {
-            ESP_LOGE(TAG, "failed to start client task");
+        if (xQueueSend(s_handoff_queue, &sock, 0) != pdTRUE) {
+            ESP_LOGW(TAG, "handoff queue full");
             shutdown(sock, SHUT_RDWR);
             closesocket(sock);
-            lock();
-            free_session(sess);
-            unlock();
-            continue;
         }
-        sess->task = task;
     }
 }
 
@@ -208,14 +243,30 @@ esp_err_t mqtt_core_start_server(int port)
         esp_timer_start_periodic(s_sweep_timer, MQTT_SWEEP_PERIOD_US);
     }
 
+    if (!s_handoff_queue) {
+        s_handoff_queue = xQueueCreate(MQTT_MAX_CLIENTS, sizeof(int));
+        if (!s_handoff_queue) {
+            closesocket(s_listen_sock);
+            s_listen_sock = -1;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    while (s_worker_count < MQTT_PREWARM_WORKERS) {
+        if (!spawn_session_worker()) {
+            ESP_LOGW(TAG, "pre-started %u of %u session workers",
+                     (unsigned)s_worker_count, (unsigned)MQTT_PREWARM_WORKERS);
+            break;
+        }
+    }
+
     if (!ensure_accept_task_storage()) {
         ESP_LOGE(TAG, "failed to allocate accept task stack");
         closesocket(s_listen_sock);
         s_listen_sock = -1;
         return ESP_ERR_NO_MEM;
     }
-    s_accept_task = xTaskCreateStatic(accept_task, "mqtt_accept", MQTT_ACCEPT_STACK, NULL, 5,
-                                      s_accept_stack, s_accept_tcb);
+    s_accept_task = xTaskCreateStaticPinnedToCore(accept_task, "mqtt_accept", MQTT_ACCEPT_STACK, NULL, 5,
+                                                  s_accept_stack, s_accept_tcb, BROKER_NET_CORE);
     if (!s_accept_task) {
         ESP_LOGE(TAG, "failed to create accept task");
         closesocket(s_listen_sock);
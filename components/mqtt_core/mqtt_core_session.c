@@ -14,7 +14,9 @@ mqtt_session_t *alloc_session(void)
     }
     for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
         if (!s_sessions[i].active) {
+            uint16_t generation = s_sessions[i].generation;
             memset(&s_sessions[i], 0, sizeof(s_sessions[i]));
+            s_sessions[i].generation = (uint16_t)(generation + 1);
             s_sessions[i].active = true;
             s_sessions[i].sock = -1;
             // Pre-CONNECT sessions should not look infinitely idle to the sweep timer.
@@ -53,6 +55,9 @@ void free_session(mqtt_session_t *s)
         }
         return;
     }
+    dedup_detach(s);
+    release_session_subscriptions(s);
+    outbox_reset(s);
     s->active = false;
     s->closing = false;
     if (s->sock >= 0) {
@@ -61,6 +66,10 @@ void free_session(mqtt_session_t *s)
     }
     s->sock = -1;
     s->task = NULL;
+    s->channel = NULL;
+    s->transport = NULL;
+    s->transport_ctx = NULL;
+    s->rx_len = 0;
     if (s_client_count > 0) {
         s_client_count--;
     }
@@ -70,6 +79,7 @@ void sweep_idle_sessions(void)
 {
     int64_t now = now_ms();
     lock();
+    throttle_sweep();
     for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
         mqtt_session_t *s = &s_sessions[i];
         if (!s->active) {
@@ -79,6 +89,8 @@ void sweep_idle_sessions(void)
         int64_t limit_ms = (s->keepalive > 0) ? (int64_t)s->keepalive * 1500 : 60000;
         if (idle_ms >= limit_ms) {
             request_session_close(s, "sweep: closing idle session", 0);
+        } else if (outbox_health(s) == MQTT_CLIENT_STUCK) {
+            request_session_close(s, "sweep: slow consumer stuck", 0);
         }
     }
     unlock();
@@ -88,6 +100,18 @@ void send_will_if_needed(mqtt_session_t *sess)
 {
     if (sess->will.has && !sess->suppress_will) {
         ESP_LOGI(TAG, "sending will for %s", sess->client_id);
-        publish_to_subscribers(sess->will.topic, sess->will.payload, sess->will.qos, sess->will.retain, sess);
+        publish_to_subscribers(sess->will.topic, TOPIC_ID_NONE, sess->will.payload, sess->will.qos, sess->will.retain, sess);
     }
 }
+
+void release_session_subscriptions(mqtt_session_t *sess)
+{
+    if (!sess) {
+        return;
+    }
+    for (size_t i = 0; i < sess->sub_count; ++i) {
+        topic_intern_release(sess->subs[i].filter_id);
+    }
+    memset(sess->subs, 0, sizeof(sess->subs));
+    sess->sub_count = 0;
+}
@@ -0,0 +1,161 @@
+#include "mqtt_core.h"
+#include "mqtt_core_internal.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "mqtt_core";
+
+static mqtt_core_stream_t stream_handle(const mqtt_session_t *sess)
+{
+    return ((uint32_t)sess->generation << 16) | (uint32_t)(session_index(sess) + 1);
+}
+
+static mqtt_session_t *stream_lookup(mqtt_core_stream_t stream)
+{
+    size_t slot = (size_t)(stream & 0xFFFF);
+    if (!s_sessions || slot == 0 || slot > MQTT_MAX_CLIENTS) {
+        return NULL;
+    }
+    mqtt_session_t *sess = &s_sessions[slot - 1];
+    if (!sess->active || !sess->transport || sess->generation != (uint16_t)(stream >> 16)) {
+        return NULL;
+    }
+    return sess;
+}
+
+// Длина заголовка (тип + remaining length) и размер тела; 0 - данных пока недостаточно.
+static int stream_frame_length(const uint8_t *buf, size_t len, size_t *hdr_len, size_t *rem_len)
+{
+    size_t value = 0;
+    size_t multiplier = 1;
+    for (size_t i = 1; i < len; ++i) {
+        value += (size_t)(buf[i] & 127) * multiplier;
+        if ((buf[i] & 128) == 0) {
+            *hdr_len = i + 1;
+            *rem_len = value;
+            return 1;
+        }
+        if (i == 4) {
+            return -1;
+        }
+        multiplier *= 128;
+    }
+    return 0;
+}
+
+esp_err_t mqtt_core_stream_open(const mqtt_core_transport_t *transport, void *ctx, mqtt_core_stream_t *out)
+{
+    if (!transport || !transport->send || !transport->wake || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_sessions || !s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lock();
+    mqtt_session_t *sess = alloc_session();
+    if (!sess) {
+        unlock();
+        ESP_LOGW(TAG, "too many clients (ws)");
+        return ESP_ERR_NO_MEM;
+    }
+    if (!ensure_session_rx_buffer(session_index(sess))) {
+        free_session(sess);
+        unlock();
+        ESP_LOGE(TAG, "no memory for ws rx buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    sess->transport = transport;
+    sess->transport_ctx = ctx;
+    *out = stream_handle(sess);
+    unlock();
+    return ESP_OK;
+}
+
+esp_err_t mqtt_core_stream_feed(mqtt_core_stream_t stream, const uint8_t *data, size_t len)
+{
+    if (!data && len > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    lock();
+    mqtt_session_t *sess = stream_lookup(stream);
+    unlock();
+    if (!sess) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (sess->closing) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t *buf = s_session_rx_bufs[session_index(sess)];
+    while (len > 0) {
+        size_t chunk = MQTT_STREAM_RX_BUF - sess->rx_len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(buf + sess->rx_len, data, chunk);
+        sess->rx_len += chunk;
+        data += chunk;
+        len -= chunk;
+
+        while (sess->rx_len >= 2) {
+            size_t hdr_len = 0;
+            size_t rem_len = 0;
+            int rc = stream_frame_length(buf, sess->rx_len, &hdr_len, &rem_len);
+            if (rc < 0 || rem_len > MQTT_MAX_PACKET) {
+                ESP_LOGW(TAG, "bad remaining length (ws)");
+                request_session_close(sess, "stream framing error", 0);
+                return ESP_ERR_INVALID_SIZE;
+            }
+            if (rc == 0 || sess->rx_len < hdr_len + rem_len) {
+                break;
+            }
+            int res = session_process_packet(sess, buf[0], buf + hdr_len, rem_len);
+            if (res != 0) {
+                request_session_close(sess, res > 0 ? "client disconnect" : "protocol error", 0);
+                return res > 0 ? ESP_OK : ESP_FAIL;
+            }
+            size_t consumed = hdr_len + rem_len;
+            memmove(buf, buf + consumed, sess->rx_len - consumed);
+            sess->rx_len -= consumed;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t mqtt_core_stream_flush(mqtt_core_stream_t stream)
+{
+    lock();
+    mqtt_session_t *sess = stream_lookup(stream);
+    unlock();
+    if (!sess) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (outbox_transport_flush(sess, (uint16_t)(stream >> 16)) >= 0) {
+        return ESP_OK;
+    }
+    lock();
+    if (stream_lookup(stream) == sess) {
+        request_session_close(sess, "outbound flush failed", 0);
+    }
+    unlock();
+    return ESP_FAIL;
+}
+
+void mqtt_core_stream_close(mqtt_core_stream_t stream)
+{
+    lock();
+    mqtt_session_t *sess = stream_lookup(stream);
+    if (sess) {
+        // Дальнейшие закрытия от брокера не должны дергать транспорт владельца.
+        sess->closing = true;
+    }
+    unlock();
+    if (!sess) {
+        return;
+    }
+    send_will_if_needed(sess);
+    lock();
+    free_session(sess);
+    unlock();
+}
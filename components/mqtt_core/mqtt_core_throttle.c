@@ -0,0 +1,102 @@
+#include "mqtt_core_internal.h"
+
+#include "esp_log.h"
+
+// Обратное давление шины событий. Пока event_bus_under_pressure(), воркер не читает сокет клиента,
+// который публикует не реже половины среднего по публикующим клиентам (и не реже
+// CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE в секунду), а только дописывает его исходящую очередь.
+// Непрочитанное копится в TCP окне, и клиент замедляется сам, вместо того чтобы воркер упирался
+// в полный канал шины и терял события по таймауту. WebSocket сессии кормит HTTP сервер, их
+// чтением брокер не управляет.
+
+static const char *TAG = "mqtt_core";
+
+// Порог темпа для текущей секунды; пишет только обход сессий.
+static uint32_t s_throttle_rate = CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE;
+
+static void on_bus_pressure(bool under_pressure, void *arg)
+{
+    (void)arg;
+    if (under_pressure || !s_sessions) {
+        return;
+    }
+    // Задача шины: без s_lock. Воркеры живут все время работы брокера, так что лишнее уведомление
+    // сессии, которая уже вышла из паузы, только прервет ее следующее ожидание.
+    for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
+        mqtt_session_t *s = &s_sessions[i];
+        if (__atomic_load_n(&s->throttled, __ATOMIC_ACQUIRE)) {
+            TaskHandle_t task = s->task;
+            if (task) {
+                xTaskNotifyGive(task);
+            }
+        }
+    }
+}
+
+esp_err_t throttle_init(void)
+{
+#if CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE > 0
+    return event_bus_add_pressure_listener(on_bus_pressure, NULL);
+#else
+    return ESP_OK;
+#endif
+}
+
+void throttle_sweep(void)
+{
+    uint32_t total = 0;
+    uint32_t publishers = 0;
+    for (size_t i = 0; i < MQTT_MAX_CLIENTS; ++i) {
+        mqtt_session_t *s = &s_sessions[i];
+        if (!s->active) {
+            continue;
+        }
+        uint32_t count = __atomic_load_n(&s->pub_count, __ATOMIC_RELAXED);
+        s->pub_rate = count - s->pub_mark;
+        s->pub_mark = count;
+        if (s->pub_rate) {
+            total += s->pub_rate;
+            publishers++;
+        }
+    }
+    // Половина среднего: при почти равных потоках под порог попадают все, а не только те, кто
+    // случайно оказался выше среднего.
+    uint32_t rate = publishers ? total / publishers / 2 : 0;
+    if (rate < CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE) {
+        rate = CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE;
+    }
+    __atomic_store_n(&s_throttle_rate, rate, __ATOMIC_RELAXED);
+}
+
+bool throttle_should_pause(const mqtt_session_t *sess)
+{
+#if CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE > 0
+    if (sess->transport || !event_bus_under_pressure()) {
+        return false;
+    }
+    uint32_t rate = __atomic_load_n(&s_throttle_rate, __ATOMIC_RELAXED);
+    // Текущая секунда тоже считается: клиент, который только начал поток, не ждет обхода.
+    uint32_t current = __atomic_load_n(&sess->pub_count, __ATOMIC_RELAXED) - sess->pub_mark;
+    return sess->pub_rate >= rate || current >= rate;
+#else
+    (void)sess;
+    return false;
+#endif
+}
+
+int throttle_wait(mqtt_session_t *sess)
+{
+    int64_t start = now_ms();
+    __atomic_store_n(&sess->throttled, true, __ATOMIC_RELEASE);
+    ESP_LOGD(TAG, "event bus under pressure, pausing %s", sess->client_id);
+    int rc = 0;
+    while (!sess->closing && event_bus_under_pressure() && now_ms() - start < MQTT_THROTTLE_MAX_MS) {
+        rc = outbox_wait_writable(sess, MQTT_THROTTLE_SLICE_MS);
+        if (rc < 0) {
+            break;
+        }
+    }
+    __atomic_store_n(&sess->throttled, false, __ATOMIC_RELEASE);
+    sess->throttled_ms += (uint32_t)(now_ms() - start);
+    return rc;
+}
@@ -7,8 +7,10 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
 
 #define TEST_QUEUE_DEPTH          512
 #define TEST_EVENT_WAIT_MS        200
@@ -19,19 +21,27 @@
 static QueueHandle_t s_evt_queue;
 static bool s_handler_registered;
 
+// В очередь теста кладется сама ссылка на сообщение шины; получатель освобождает ее.
 static void test_event_handler(const event_bus_message_t *msg)
 {
     if (!s_evt_queue || !msg) {
         return;
     }
-    event_bus_message_t copy = *msg;
-    xQueueSend(s_evt_queue, &copy, 0);
+    const event_bus_message_t *ref = event_bus_message_retain(msg);
+    if (xQueueSend(s_evt_queue, &ref, 0) != pdTRUE) {
+        event_bus_message_release(ref);
+    }
+}
+
+static bool take_event(const event_bus_message_t **out, TickType_t wait)
+{
+    return xQueueReceive(s_evt_queue, out, wait) == pdTRUE;
 }
 
 esp_err_t mqtt_core_test_init_helpers(void)
 {
     if (!s_evt_queue) {
-        s_evt_queue = xQueueCreate(TEST_QUEUE_DEPTH, sizeof(event_bus_message_t));
+        s_evt_queue = xQueueCreate(TEST_QUEUE_DEPTH, sizeof(const event_bus_message_t *));
         if (!s_evt_queue) {
             return ESP_ERR_NO_MEM;
         }
@@ -51,9 +61,9 @@ static void flush_queue(void)
     if (!s_evt_queue) {
         return;
     }
-    event_bus_message_t msg;
-    while (xQueueReceive(s_evt_queue, &msg, 0) == pdTRUE) {
-        // drain pending messages
+    const event_bus_message_t *msg = NULL;
+    while (take_event(&msg, 0)) {
+        event_bus_message_release(msg);
     }
 }
 
@@ -68,7 +78,8 @@ static void clear_retain_table(void)
             s_retain[i].payload = NULL;
         }
         s_retain[i].payload_len = 0;
-        s_retain[i].topic[0] = '\0';
+        topic_intern_release(s_retain[i].topic_id);
+        s_retain[i].topic_id = TOPIC_ID_NONE;
         s_retain[i].qos = 0;
         s_retain[i].in_use = false;
     }
@@ -80,7 +91,8 @@ static retain_entry_t *find_retain_entry(const char *topic)
         return NULL;
     }
     for (size_t i = 0; i < MQTT_RETAIN_MAX; ++i) {
-        if (s_retain[i].in_use && strcmp(s_retain[i].topic, topic) == 0) {
+        const char *stored = topic_intern_str(s_retain[i].topic_id);
+        if (s_retain[i].in_use && stored && strcmp(stored, topic) == 0) {
             return &s_retain[i];
         }
     }
@@ -112,18 +124,31 @@ static void test_mqtt_client_stats_initial(void)
     TEST_ASSERT_EQUAL_UINT8(0, stats.total);
 }
 
+static void expect_no_event(void)
+{
+    const event_bus_message_t *msg = NULL;
+    bool got = take_event(&msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS));
+    if (got) {
+        event_bus_message_release(msg);
+    }
+    TEST_ASSERT_FALSE(got);
+}
+
 static void expect_event(event_bus_type_t type,
                          const char *topic,
                          const char *payload)
 {
     TEST_ASSERT_NOT_NULL(topic);
     TEST_ASSERT_NOT_NULL(payload);
-    event_bus_message_t msg;
-    TEST_ASSERT_EQUAL(pdTRUE,
-                      xQueueReceive(s_evt_queue, &msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
-    TEST_ASSERT_EQUAL(type, msg.type);
-    TEST_ASSERT_EQUAL_STRING(topic, msg.topic);
-    TEST_ASSERT_EQUAL_STRING(payload, msg.payload);
+    const event_bus_message_t *msg = NULL;
+    TEST_ASSERT_TRUE(take_event(&msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+    event_bus_message_t seen = *msg;
+    bool topic_ok = strcmp(topic, msg->topic) == 0;
+    bool payload_ok = strcmp(payload, msg->payload) == 0;
+    event_bus_message_release(msg);
+    TEST_ASSERT_EQUAL(type, seen.type);
+    TEST_ASSERT_TRUE(topic_ok);
+    TEST_ASSERT_TRUE(payload_ok);
 }
 
 static void test_mqtt_inject_dispatch(void)
@@ -135,6 +160,373 @@ static void test_mqtt_inject_dispatch(void)
     expect_event(EVENT_MQTT_MESSAGE, topic, payload);
 }
 
+static volatile uint32_t s_audio_only_calls;
+static volatile event_bus_type_t s_audio_only_last = EVENT_NONE;
+
+static void audio_only_handler(const event_bus_message_t *msg)
+{
+    s_audio_only_last = msg->type;
+    s_audio_only_calls++;
+}
+
+static void test_event_bus_subscribe_type_mask(void)
+{
+    static bool subscribed;
+    if (!subscribed) {
+        TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, event_bus_subscribe(0, audio_only_handler));
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_subscribe(EVENT_BUS_MASK(EVENT_AUDIO_PLAY), audio_only_handler));
+        subscribed = true;
+    }
+    flush_queue();
+    s_audio_only_calls = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_inject_message("misc/topic", "x"));
+    expect_event(EVENT_MQTT_MESSAGE, "misc/topic", "x");
+    TEST_ASSERT_EQUAL_UINT32(0, s_audio_only_calls);
+
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_inject_message("audio/play", "a.mp3"));
+    expect_event(EVENT_AUDIO_PLAY, "audio/play", "a.mp3");
+    expect_event(EVENT_MQTT_MESSAGE, "audio/play", "a.mp3");
+    TEST_ASSERT_EQUAL_UINT32(1, s_audio_only_calls);
+    TEST_ASSERT_EQUAL(EVENT_AUDIO_PLAY, s_audio_only_last);
+}
+
+static void test_event_bus_long_payload_intact(void)
+{
+    // Прежнее фиксированное сообщение обрезало payload до 255 байт.
+    static char payload[700];
+    for (size_t i = 0; i < sizeof(payload) - 1; ++i) {
+        payload[i] = (char)('a' + i % 26);
+    }
+    payload[sizeof(payload) - 1] = 0;
+    flush_queue();
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_inject_message("misc/long", payload));
+    expect_event(EVENT_MQTT_MESSAGE, "misc/long", payload);
+}
+
+static volatile uint32_t s_scenario_calls;
+
+static void scenario_only_handler(const event_bus_message_t *msg)
+{
+    if (strcmp(msg->topic, "test/prio") == 0) {
+        s_scenario_calls++;
+    }
+}
+
+static void test_event_bus_control_survives_telemetry_flood(void)
+{
+    static bool subscribed;
+    if (!subscribed) {
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_subscribe(EVENT_BUS_MASK(EVENT_SCENARIO_TRIGGER), scenario_only_handler));
+        subscribed = true;
+    }
+    TEST_ASSERT_EQUAL(EVENT_BUS_PRIO_CONTROL, event_bus_type_prio(EVENT_SCENARIO_TRIGGER));
+    TEST_ASSERT_EQUAL(EVENT_BUS_PRIO_CONTROL, event_bus_type_prio(EVENT_FLAG_CHANGED));
+    TEST_ASSERT_EQUAL(EVENT_BUS_PRIO_TELEMETRY, event_bus_type_prio(EVENT_MQTT_MESSAGE));
+    TEST_ASSERT_EQUAL(EVENT_BUS_PRIO_TELEMETRY, event_bus_type_prio(EVENT_SYSTEM_STATUS));
+
+    s_scenario_calls = 0;
+    uint32_t control_drops = event_bus_drop_count(EVENT_BUS_PRIO_CONTROL);
+    event_bus_message_t status = {.type = EVENT_SYSTEM_STATUS, .topic = "test/status", .payload = "x"};
+    event_bus_message_t trigger = {.type = EVENT_SCENARIO_TRIGGER, .topic = "test/prio", .payload = "go"};
+    // Кольцо телеметрии забивается без ожидания; управляющее событие все равно принимается сразу.
+    for (int i = 0; i < 256; ++i) {
+        event_bus_post(&status, 0);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&trigger, 0));
+    for (int i = 0; i < 20 && s_scenario_calls == 0; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, s_scenario_calls);
+    TEST_ASSERT_EQUAL_UINT32(control_drops, event_bus_drop_count(EVENT_BUS_PRIO_CONTROL));
+    vTaskDelay(pdMS_TO_TICKS(TEST_EVENT_WAIT_MS));
+    flush_queue();
+}
+
+static volatile uint32_t s_slow_calls;
+static volatile uint32_t s_fast_calls;
+
+static void slow_async_handler(const event_bus_message_t *msg)
+{
+    if (strcmp(msg->topic, "test/async") == 0) {
+        vTaskDelay(pdMS_TO_TICKS(50));
+        s_slow_calls++;
+    }
+}
+
+static void fast_inline_handler(const event_bus_message_t *msg)
+{
+    if (strcmp(msg->topic, "test/async") == 0) {
+        s_fast_calls++;
+    }
+}
+
+static bool find_handler_stats(const char *name, event_bus_handler_stats_t *out)
+{
+    event_bus_handler_stats_t stats[16];
+    size_t count = event_bus_get_handler_stats(stats, 16);
+    for (size_t i = 0; i < count && i < 16; ++i) {
+        if (strcmp(stats[i].name, name) == 0) {
+            *out = stats[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void subscribe_slow_and_fast(void)
+{
+    static bool subscribed;
+    if (!subscribed) {
+        const event_bus_subscribe_opts_t slow = {.name = "test_slow", .depth = 4};
+        const event_bus_subscribe_opts_t fast = {.name = "test_fast"};
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_subscribe_ex(EVENT_BUS_MASK(EVENT_WEB_COMMAND), slow_async_handler, &slow));
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_subscribe_ex(EVENT_BUS_MASK(EVENT_WEB_COMMAND), fast_inline_handler, &fast));
+        subscribed = true;
+    }
+}
+
+static void test_event_bus_async_handler_does_not_stall_bus(void)
+{
+    subscribe_slow_and_fast();
+    event_bus_handler_stats_t before;
+    TEST_ASSERT_TRUE(find_handler_stats("test_slow", &before));
+    TEST_ASSERT_TRUE(before.async);
+    s_slow_calls = 0;
+    s_fast_calls = 0;
+    // Телеметрия: лишнее отбрасывается для медленного обработчика, шина не ждет.
+    event_bus_message_t msg = {.type = EVENT_MQTT_MESSAGE, .topic = "test/async", .payload = "x"};
+    for (int i = 0; i < 8; ++i) {
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(10)));
+    }
+    // Синхронный обработчик получает все 8 раньше, чем медленный успевает обработать второе.
+    for (int i = 0; i < 4 && s_fast_calls < 8; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ASSERT_EQUAL_UINT32(8, s_fast_calls);
+    TEST_ASSERT_LESS_THAN_UINT32(2, s_slow_calls);
+
+    vTaskDelay(pdMS_TO_TICKS(500));
+    event_bus_handler_stats_t after;
+    TEST_ASSERT_TRUE(find_handler_stats("test_slow", &after));
+    uint32_t calls = after.calls - before.calls;
+    uint32_t drops = after.drops - before.drops;
+    TEST_ASSERT_EQUAL_UINT32(s_slow_calls, calls);
+    TEST_ASSERT_EQUAL_UINT32(8, calls + drops);
+    TEST_ASSERT_TRUE(drops > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, after.backlog);
+    TEST_ASSERT_TRUE(after.max_backlog >= 3);
+    TEST_ASSERT_TRUE(after.max_us >= 40000);
+
+    // Управляющие события не отбрасываются: задача шины ждет места в очереди обработчика.
+    s_slow_calls = 0;
+    event_bus_message_t cmd = {.type = EVENT_WEB_COMMAND, .topic = "test/async", .payload = "x"};
+    for (int i = 0; i < 8; ++i) {
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&cmd, pdMS_TO_TICKS(10)));
+    }
+    for (int i = 0; i < 100 && s_slow_calls < 8; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    event_bus_handler_stats_t control;
+    TEST_ASSERT_TRUE(find_handler_stats("test_slow", &control));
+    TEST_ASSERT_EQUAL_UINT32(8, s_slow_calls);
+    TEST_ASSERT_EQUAL_UINT32(after.drops, control.drops);
+    TEST_ASSERT_TRUE(control.stalls > after.stalls);
+    flush_queue();
+}
+
+static SemaphoreHandle_t s_hold_sem;
+static volatile bool s_bus_held;
+static volatile uint32_t s_status_calls;
+static char s_status_last[16];
+
+// Держит задачу шины, пока тест не отпустит s_hold_sem: сообщения копятся в кольце.
+static void hold_bus_handler(const event_bus_message_t *msg)
+{
+    if (strcmp(msg->topic, "test/hold") == 0) {
+        s_bus_held = true;
+        xSemaphoreTake(s_hold_sem, pdMS_TO_TICKS(1000));
+        s_bus_held = false;
+    }
+}
+
+static void status_handler(const event_bus_message_t *msg)
+{
+    if (strcmp(msg->topic, "test/coalesce") == 0) {
+        snprintf(s_status_last, sizeof(s_status_last), "%s", msg->payload);
+        s_status_calls++;
+    }
+}
+
+static void test_event_bus_coalesces_queued_status(void)
+{
+    static bool subscribed;
+    if (!subscribed) {
+        s_hold_sem = xSemaphoreCreateBinary();
+        TEST_ASSERT_NOT_NULL(s_hold_sem);
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_subscribe(EVENT_BUS_MASK(EVENT_RELAY_CMD), hold_bus_handler));
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_subscribe(EVENT_BUS_MASK(EVENT_SYSTEM_STATUS), status_handler));
+        subscribed = true;
+    }
+    TEST_ASSERT_TRUE(event_bus_get_coalesce_types() & EVENT_BUS_MASK(EVENT_SYSTEM_STATUS));
+    s_status_calls = 0;
+    s_status_last[0] = 0;
+    uint32_t coalesced = event_bus_coalesced_count();
+
+    event_bus_message_t hold = {.type = EVENT_RELAY_CMD, .topic = "test/hold", .payload = "1"};
+    TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&hold, pdMS_TO_TICKS(10)));
+    for (int i = 0; i < 20 && !s_bus_held; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    TEST_ASSERT_TRUE(s_bus_held);
+    // Кольцо на 64 слота, значений втрое больше: все они сливаются в одну ожидающую запись.
+    for (int i = 0; i < 200; ++i) {
+        char payload[8];
+        snprintf(payload, sizeof(payload), "%d", i);
+        event_bus_message_t status = {.type = EVENT_SYSTEM_STATUS, .topic = "test/coalesce", .payload = payload};
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&status, 0));
+    }
+    xSemaphoreGive(s_hold_sem);
+    for (int i = 0; i < 20 && s_status_calls == 0; ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    vTaskDelay(pdMS_TO_TICKS(20));
+    TEST_ASSERT_EQUAL_UINT32(1, s_status_calls);
+    TEST_ASSERT_EQUAL_STRING("199", s_status_last);
+    TEST_ASSERT_EQUAL_UINT32(199, event_bus_coalesced_count() - coalesced);
+    vTaskDelay(pdMS_TO_TICKS(TEST_EVENT_WAIT_MS));
+    flush_queue();
+}
+
+static void test_event_bus_post_nowait(void)
+{
+    flush_queue();
+    event_bus_message_t msg = {.type = EVENT_WEB_COMMAND, .topic = "test/nowait", .payload = "short"};
+    TEST_ASSERT_EQUAL(ESP_OK, event_bus_post_nowait(&msg));
+    expect_event(EVENT_WEB_COMMAND, "test/nowait", "short");
+
+    // Длиннее резервного блока: берется из пула, сообщение доходит целиком.
+    static char payload[300];
+    memset(payload, 'n', sizeof(payload) - 1);
+    payload[sizeof(payload) - 1] = 0;
+    msg.payload = payload;
+    TEST_ASSERT_EQUAL(ESP_OK, event_bus_post_nowait(&msg));
+    expect_event(EVENT_WEB_COMMAND, "test/nowait", payload);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, event_bus_post_nowait(NULL));
+}
+
+static uint32_t s_tap_seen;
+static int64_t s_tap_last_us;
+
+static void counting_tap(const event_bus_message_t *msg, int64_t posted_us)
+{
+    if (strcmp(msg->topic, "test/tap") == 0) {
+        s_tap_seen++;
+        s_tap_last_us = posted_us;
+    }
+}
+
+static void test_event_bus_tap_sees_dispatched_messages(void)
+{
+    flush_queue();
+    s_tap_seen = 0;
+    s_tap_last_us = 0;
+    int64_t before = esp_timer_get_time();
+    event_bus_set_tap(counting_tap);
+    event_bus_message_t msg = {.type = EVENT_WEB_COMMAND, .topic = "test/tap", .payload = "1"};
+    TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+    expect_event(EVENT_WEB_COMMAND, "test/tap", "1");
+    msg.payload = "2";
+    TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+    expect_event(EVENT_WEB_COMMAND, "test/tap", "2");
+    event_bus_set_tap(NULL);
+    TEST_ASSERT_EQUAL_UINT32(2, s_tap_seen);
+    TEST_ASSERT_TRUE(s_tap_last_us >= before && s_tap_last_us <= esp_timer_get_time());
+
+    // После разбора шина простаивает (запись трассы и воспроизведение ждут именно этого).
+    bool idle = false;
+    for (int i = 0; i < TEST_EVENT_WAIT_MS && !idle; ++i) {
+        idle = event_bus_is_idle();
+        vTaskDelay(1);
+    }
+    TEST_ASSERT_TRUE(idle);
+}
+
+static void test_event_bus_stats_count_posts(void)
+{
+    flush_queue();
+    event_bus_stats_t before;
+    event_bus_get_stats(&before);
+    event_bus_message_t msg = {.type = EVENT_WEB_COMMAND, .topic = "test/stats", .payload = "x"};
+    for (int i = 0; i < 3; ++i) {
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+        expect_event(EVENT_WEB_COMMAND, "test/stats", "x");
+    }
+    event_bus_stats_t after;
+    event_bus_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(3, after.posted[EVENT_WEB_COMMAND] - before.posted[EVENT_WEB_COMMAND]);
+    TEST_ASSERT_EQUAL_UINT32(3, after.delivered[EVENT_WEB_COMMAND] - before.delivered[EVENT_WEB_COMMAND]);
+    TEST_ASSERT_TRUE(after.ring_hwm[EVENT_BUS_PRIO_CONTROL] >= 1);
+
+    static char json[EVENT_BUS_METRICS_MAX_LEN];
+    TEST_ASSERT_TRUE(event_bus_format_metrics(json, sizeof(json)) > 0);
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"web_command\":"));
+    TEST_ASSERT_EQUAL(0, event_bus_format_metrics(json, 16));
+}
+
+static volatile uint32_t s_pressure_on;
+static volatile uint32_t s_pressure_off;
+
+static void pressure_listener(bool under_pressure, void *arg)
+{
+    (void)arg;
+    if (under_pressure) {
+        s_pressure_on++;
+    } else {
+        s_pressure_off++;
+    }
+}
+
+static void test_event_bus_pressure_follows_handler_backlog(void)
+{
+    static bool listening;
+    subscribe_slow_and_fast();
+    if (!listening) {
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_add_pressure_listener(pressure_listener, NULL));
+        listening = true;
+    }
+    vTaskDelay(pdMS_TO_TICKS(500));
+    flush_queue();
+    TEST_ASSERT_FALSE(event_bus_under_pressure());
+    event_bus_stats_t before;
+    event_bus_get_stats(&before);
+    s_pressure_on = 0;
+    s_pressure_off = 0;
+
+    // Очередь медленного обработчика (4 сообщения, 50 мс на каждое) заполняется выше верхней отметки.
+    event_bus_message_t cmd = {.type = EVENT_WEB_COMMAND, .topic = "test/async", .payload = "x"};
+    for (int i = 0; i < 4; ++i) {
+        TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&cmd, pdMS_TO_TICKS(10)));
+    }
+    for (int i = 0; i < 10 && !event_bus_under_pressure(); ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ASSERT_TRUE(event_bus_under_pressure());
+    TEST_ASSERT_EQUAL_UINT32(1, s_pressure_on);
+
+    // Шине больше нечего разбирать, но давление держится, пока обработчик не разберет очередь.
+    for (int i = 0; i < 100 && event_bus_under_pressure(); ++i) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ASSERT_FALSE(event_bus_under_pressure());
+    TEST_ASSERT_EQUAL_UINT32(1, s_pressure_off);
+    event_bus_stats_t after;
+    event_bus_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(1, after.pressure_episodes - before.pressure_episodes);
+    TEST_ASSERT_TRUE(after.pressure_us - before.pressure_us >= 50000);
+    vTaskDelay(pdMS_TO_TICKS(200));
+    flush_queue();
+}
+
 static void test_mqtt_inject_stress(void)
 {
     const char *typed_topic = "audio/play";
@@ -150,9 +542,7 @@ static void test_mqtt_inject_stress(void)
         }
         expect_event(EVENT_MQTT_MESSAGE, topic, payload);
     }
-    event_bus_message_t leftover;
-    TEST_ASSERT_EQUAL(pdFALSE,
-                      xQueueReceive(s_evt_queue, &leftover, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+    expect_no_event();
 }
 
 typedef struct {
@@ -193,19 +583,18 @@ static void drain_parallel_events(uint32_t total_messages, uint32_t typed_expect
     uint32_t generic_seen = 0;
     uint32_t typed_seen = 0;
     while (generic_seen < total_messages || typed_seen < typed_expected) {
-        event_bus_message_t msg;
-        TEST_ASSERT_EQUAL(pdTRUE,
-                          xQueueReceive(s_evt_queue, &msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
-        if (msg.type == EVENT_AUDIO_PLAY) {
+        const event_bus_message_t *msg = NULL;
+        TEST_ASSERT_TRUE(take_event(&msg, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+        event_bus_type_t type = msg->type;
+        event_bus_message_release(msg);
+        if (type == EVENT_AUDIO_PLAY) {
             typed_seen++;
         } else {
-            TEST_ASSERT_EQUAL(EVENT_MQTT_MESSAGE, msg.type);
+            TEST_ASSERT_EQUAL(EVENT_MQTT_MESSAGE, type);
             generic_seen++;
         }
     }
-    event_bus_message_t leftover;
-    TEST_ASSERT_EQUAL(pdFALSE,
-                      xQueueReceive(s_evt_queue, &leftover, pdMS_TO_TICKS(TEST_EVENT_WAIT_MS)));
+    expect_no_event();
 }
 
 static void test_mqtt_parallel_burst(void)
@@ -259,13 +648,325 @@ static void test_retain_empty_payload_clears_entry(void)
     TEST_ASSERT_NULL(find_retain_entry("quest/retain"));
 }
 
+typedef struct {
+    uint8_t data[64];
+    size_t len;
+    int closes;
+    int wakes;
+} test_stream_sink_t;
+
+static int test_stream_send(void *ctx, const uint8_t *data, size_t len)
+{
+    test_stream_sink_t *sink = (test_stream_sink_t *)ctx;
+    if (sink->len + len > sizeof(sink->data)) {
+        return -1;
+    }
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    return (int)len;
+}
+
+static void test_stream_close(void *ctx)
+{
+    ((test_stream_sink_t *)ctx)->closes++;
+}
+
+static esp_err_t test_stream_wake(void *ctx)
+{
+    ((test_stream_sink_t *)ctx)->wakes++;
+    return ESP_OK;
+}
+
+static void test_mqtt_stream_session_split_frames(void)
+{
+    static const mqtt_core_transport_t transport = {
+        .send = test_stream_send,
+        .close = test_stream_close,
+        .wake = test_stream_wake,
+    };
+    static const uint8_t connect_pkt[] = {
+        0x10, 0x10, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3C,
+        0x00, 0x04, 'w', 's', '-', '1',
+    };
+    static const uint8_t publish_pkt[] = {
+        0x30, 0x0F, 0x00, 0x0A, 'a', 'u', 'd', 'i', 'o', '/', 'p', 'l', 'a', 'y', 'w', 's', '!',
+    };
+    static const uint8_t connack_ok[] = {0x20, 0x02, 0x00, 0x00};
+    test_stream_sink_t sink = {0};
+    mqtt_core_stream_t stream = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_open(&transport, &sink, &stream));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_feed(stream, connect_pkt, 5));
+    TEST_ASSERT_EQUAL_UINT32(0, sink.len);
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_feed(stream, connect_pkt + 5, sizeof(connect_pkt) - 5));
+    // Ответ только встает в очередь сессии; пишет его владелец транспорта.
+    TEST_ASSERT_EQUAL_UINT32(0, sink.len);
+    TEST_ASSERT_EQUAL(1, sink.wakes);
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_flush(stream));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(connack_ok), sink.len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(connack_ok, sink.data, sizeof(connack_ok));
+
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_feed(stream, publish_pkt, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_feed(stream, publish_pkt + 1, sizeof(publish_pkt) - 1));
+    expect_event(EVENT_AUDIO_PLAY, "audio/play", "ws!");
+    expect_event(EVENT_MQTT_MESSAGE, "audio/play", "ws!");
+
+    mqtt_core_stream_close(stream);
+    TEST_ASSERT_EQUAL(0, sink.closes);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, mqtt_core_stream_feed(stream, publish_pkt, sizeof(publish_pkt)));
+    TEST_ASSERT_EQUAL_UINT8(0, mqtt_core_client_count());
+}
+
+static mqtt_core_stream_t open_stream_client(const mqtt_core_transport_t *transport,
+                                             test_stream_sink_t *sink,
+                                             const char *client_id)
+{
+    uint8_t pkt[32];
+    size_t id_len = strlen(client_id);
+    size_t idx = 0;
+    pkt[idx++] = 0x10;
+    pkt[idx++] = (uint8_t)(12 + id_len);
+    static const uint8_t var_hdr[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3C};
+    memcpy(&pkt[idx], var_hdr, sizeof(var_hdr));
+    idx += sizeof(var_hdr);
+    pkt[idx++] = 0x00;
+    pkt[idx++] = (uint8_t)id_len;
+    memcpy(&pkt[idx], client_id, id_len);
+    idx += id_len;
+
+    mqtt_core_stream_t stream = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_open(transport, sink, &stream));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_feed(stream, pkt, idx));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_flush(stream));
+    sink->len = 0;
+    return stream;
+}
+
+static void feed_qos1_publish(mqtt_core_stream_t stream, uint16_t pid, bool dup)
+{
+    const uint8_t pkt[] = {
+        (uint8_t)(0x32 | (dup ? 0x08 : 0x00)), 0x0F, 0x00, 0x09, 'd', 'o', 'o', 'r', '/', 'o', 'p', 'e', 'n',
+        (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF), '1', '!',
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_feed(stream, pkt, sizeof(pkt)));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_stream_flush(stream));
+}
+
+static void expect_puback(test_stream_sink_t *sink, uint16_t pid)
+{
+    const uint8_t puback[] = {0x40, 0x02, (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF)};
+    TEST_ASSERT_EQUAL_UINT32(sizeof(puback), sink->len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(puback, sink->data, sizeof(puback));
+    sink->len = 0;
+}
+
+static void test_mqtt_qos1_dup_suppressed_across_reconnect(void)
+{
+    static const mqtt_core_transport_t transport = {
+        .send = test_stream_send,
+        .close = test_stream_close,
+        .wake = test_stream_wake,
+    };
+    test_stream_sink_t sink = {0};
+
+    mqtt_core_stream_t stream = open_stream_client(&transport, &sink, "dup-1");
+    feed_qos1_publish(stream, 7, false);
+    expect_event(EVENT_MQTT_MESSAGE, "door/open", "1!");
+    expect_puback(&sink, 7);
+
+    feed_qos1_publish(stream, 7, true);
+    expect_puback(&sink, 7);
+    expect_no_event();
+    mqtt_core_stream_close(stream);
+
+    stream = open_stream_client(&transport, &sink, "dup-1");
+    feed_qos1_publish(stream, 7, true);
+    expect_puback(&sink, 7);
+    expect_no_event();
+
+    feed_qos1_publish(stream, 8, true);
+    expect_event(EVENT_MQTT_MESSAGE, "door/open", "1!");
+    expect_puback(&sink, 8);
+    mqtt_core_stream_close(stream);
+}
+
+static void test_topic_intern_refcount_and_stale_id(void)
+{
+    size_t base = topic_intern_count();
+    topic_id_t a = topic_intern_acquire("intern/test/a");
+    TEST_ASSERT_NOT_EQUAL(TOPIC_ID_NONE, a);
+    TEST_ASSERT_EQUAL(a, topic_intern_acquire("intern/test/a"));
+    TEST_ASSERT_EQUAL(a, topic_intern_find("intern/test/a"));
+    TEST_ASSERT_EQUAL_STRING("intern/test/a", topic_intern_str(a));
+    TEST_ASSERT_EQUAL(TOPIC_ID_NONE, topic_intern_find("intern/test/missing"));
+    TEST_ASSERT_EQUAL(base + 1, topic_intern_count());
+
+    topic_intern_release(a);
+    TEST_ASSERT_EQUAL(a, topic_intern_find("intern/test/a"));
+    topic_intern_release(a);
+    TEST_ASSERT_EQUAL(TOPIC_ID_NONE, topic_intern_find("intern/test/a"));
+    TEST_ASSERT_NULL(topic_intern_str(a));
+    TEST_ASSERT_EQUAL(base, topic_intern_count());
+
+    // Повторная вставка получает новое поколение: старый id не должен совпасть.
+    topic_id_t again = topic_intern_acquire("intern/test/a");
+    TEST_ASSERT_NOT_EQUAL(a, again);
+    topic_intern_release(again);
+}
+
+// После заполнения всей таблицы освобожденные слоты снова пустые: поиск и вставка работают,
+// устаревшие id не оживают.
+static void test_topic_intern_reclaims_slots_after_full_churn(void)
+{
+    static topic_id_t ids[TOPIC_INTERN_CAPACITY];
+    char topic[32];
+    size_t base = topic_intern_count();
+    size_t filled = 0;
+    for (size_t i = 0; filled < TOPIC_INTERN_CAPACITY; ++i) {
+        snprintf(topic, sizeof(topic), "intern/churn/%u", (unsigned)i);
+        topic_id_t id = topic_intern_acquire(topic);
+        if (id == TOPIC_ID_NONE) {
+            break;
+        }
+        ids[filled++] = id;
+    }
+    TEST_ASSERT_EQUAL(TOPIC_INTERN_CAPACITY, base + filled);
+    for (size_t i = 1; i < filled; ++i) {
+        topic_intern_release(ids[i]);
+    }
+    TEST_ASSERT_EQUAL(TOPIC_ID_NONE, topic_intern_find("intern/churn/missing"));
+    TEST_ASSERT_EQUAL(TOPIC_ID_NONE, topic_intern_find("intern/churn/1"));
+    TEST_ASSERT_EQUAL(ids[0], topic_intern_find("intern/churn/0"));
+    TEST_ASSERT_NULL(topic_intern_str(ids[1]));
+
+    topic_id_t again = topic_intern_acquire("intern/churn/1");
+    TEST_ASSERT_NOT_EQUAL(TOPIC_ID_NONE, again);
+    TEST_ASSERT_NOT_EQUAL(ids[1], again);
+    TEST_ASSERT_EQUAL(again, topic_intern_find("intern/churn/1"));
+    topic_intern_release(again);
+    topic_intern_release(ids[0]);
+    TEST_ASSERT_EQUAL(base, topic_intern_count());
+}
+
+typedef struct {
+    char topics[4][MQTT_MAX_TOPIC];
+    char last_payload[MQTT_MAX_PAYLOAD];
+    int64_t last_ts;
+    bool ordered;
+    size_t count;
+} journal_probe_t;
+
+static void collect_journal(const mqtt_journal_record_t *rec, void *ctx)
+{
+    journal_probe_t *probe = (journal_probe_t *)ctx;
+    if (probe->count < 4) {
+        strncpy(probe->topics[probe->count], rec->topic, MQTT_MAX_TOPIC - 1);
+    }
+    if (rec->ts_ms < probe->last_ts) {
+        probe->ordered = false;
+    }
+    probe->last_ts = rec->ts_ms;
+    strncpy(probe->last_payload, rec->payload, MQTT_MAX_PAYLOAD - 1);
+    TEST_ASSERT_EQUAL_UINT32(strlen(rec->payload), rec->payload_len);
+    probe->count++;
+}
+
+static void test_mqtt_client_list_reports_stream_session(void)
+{
+    static const mqtt_core_transport_t transport = {
+        .send = test_stream_send,
+        .close = test_stream_close,
+        .wake = test_stream_wake,
+    };
+    test_stream_sink_t sink = {0};
+    mqtt_core_stream_t stream = open_stream_client(&transport, &sink, "list-1");
+
+    mqtt_client_info_t clients[CONFIG_BROKER_MQTT_MAX_CLIENTS];
+    size_t count = mqtt_core_list_clients(clients, CONFIG_BROKER_MQTT_MAX_CLIENTS);
+    TEST_ASSERT_EQUAL_UINT32(1, count);
+    TEST_ASSERT_EQUAL_STRING("list-1", clients[0].client_id);
+    TEST_ASSERT_TRUE(clients[0].websocket);
+    TEST_ASSERT_EQUAL(MQTT_CLIENT_HEALTHY, clients[0].health);
+    TEST_ASSERT_EQUAL_UINT32(0, clients[0].backlog_bytes);
+    TEST_ASSERT_EQUAL_STRING("healthy", mqtt_core_client_health_name(clients[0].health));
+
+    mqtt_client_stats_t stats;
+    mqtt_core_get_client_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT8(1, stats.total);
+    TEST_ASSERT_EQUAL_UINT8(0, stats.lagging);
+    TEST_ASSERT_EQUAL_UINT8(0, stats.stuck);
+
+    mqtt_core_stream_close(stream);
+    TEST_ASSERT_EQUAL_UINT32(0, mqtt_core_list_clients(clients, CONFIG_BROKER_MQTT_MAX_CLIENTS));
+}
+
+static void test_mqtt_journal_query_and_wrap(void)
+{
+#if CONFIG_BROKER_MQTT_JOURNAL
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_journal_set_filters("journal/#"));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_publish("journal/a", "1"));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_publish("journal/b", "2"));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_publish("journal/a", "3"));
+    TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_publish("other/a", "skip"));
+
+    journal_probe_t probe = {.ordered = true};
+    TEST_ASSERT_EQUAL_UINT32(2, mqtt_core_journal_query("journal/a", 8, collect_journal, &probe));
+    TEST_ASSERT_EQUAL_STRING("3", probe.last_payload);
+    memset(&probe, 0, sizeof(probe));
+    probe.ordered = true;
+    TEST_ASSERT_EQUAL_UINT32(2, mqtt_core_journal_query("journal/+", 2, collect_journal, &probe));
+    TEST_ASSERT_EQUAL_STRING("journal/b", probe.topics[0]);
+    TEST_ASSERT_EQUAL_STRING("journal/a", probe.topics[1]);
+    TEST_ASSERT_EQUAL(0, mqtt_core_journal_query("other/#", 8, collect_journal, &probe));
+
+    // Переполняем кольцо: старые записи вытесняются, порядок и последняя запись сохраняются.
+    char payload[300];
+    memset(payload, 'x', sizeof(payload) - 1);
+    payload[sizeof(payload) - 1] = 0;
+    size_t total = (CONFIG_BROKER_MQTT_JOURNAL_SIZE_KB * 1024) / 256;
+    for (size_t i = 0; i < total; ++i) {
+        snprintf(payload, 8, "%06u", (unsigned)i);
+        payload[6] = 'x';
+        TEST_ASSERT_EQUAL(ESP_OK, mqtt_core_publish("journal/wrap", payload));
+    }
+    memset(&probe, 0, sizeof(probe));
+    probe.ordered = true;
+    size_t kept = mqtt_core_journal_query("journal/wrap", total, collect_journal, &probe);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, kept);
+    TEST_ASSERT_LESS_THAN_UINT32(total, kept);
+    TEST_ASSERT_TRUE(probe.ordered);
+    char expected[8];
+    snprintf(expected, sizeof(expected), "%06u", (unsigned)(total - 1));
+    TEST_ASSERT_EQUAL_STRING_LEN(expected, probe.last_payload, 6);
+    TEST_ASSERT_EQUAL(0, mqtt_core_journal_query("journal/a", 8, collect_journal, &probe));
+    mqtt_core_journal_set_filters(CONFIG_BROKER_MQTT_JOURNAL_FILTERS);
+#else
+    TEST_IGNORE_MESSAGE("CONFIG_BROKER_MQTT_JOURNAL disabled");
+#endif
+}
+
 void register_mqtt_core_tests(void)
 {
     RUN_TEST(test_mqtt_topic_map);
     RUN_TEST(test_mqtt_client_stats_initial);
     RUN_TEST(test_mqtt_inject_dispatch);
+    RUN_TEST(test_event_bus_subscribe_type_mask);
+    RUN_TEST(test_event_bus_long_payload_intact);
+    RUN_TEST(test_event_bus_control_survives_telemetry_flood);
+    RUN_TEST(test_event_bus_async_handler_does_not_stall_bus);
+    RUN_TEST(test_event_bus_coalesces_queued_status);
+    RUN_TEST(test_event_bus_post_nowait);
+    RUN_TEST(test_event_bus_tap_sees_dispatched_messages);
+    RUN_TEST(test_event_bus_stats_count_posts);
+    RUN_TEST(test_event_bus_pressure_follows_handler_backlog);
     RUN_TEST(test_mqtt_inject_stress);
     RUN_TEST(test_mqtt_parallel_burst);
     RUN_TEST(test_topic_matches_filter_wildcards);
     RUN_TEST(test_retain_empty_payload_clears_entry);
+    RUN_TEST(test_topic_intern_refcount_and_stale_id);
+    RUN_TEST(test_topic_intern_reclaims_slots_after_full_churn);
+    RUN_TEST(test_mqtt_stream_session_split_frames);
+    RUN_TEST(test_mqtt_qos1_dup_suppressed_across_reconnect);
+    RUN_TEST(test_mqtt_journal_query_and_wrap);
+    RUN_TEST(test_mqtt_client_list_reports_stream_session);
 }
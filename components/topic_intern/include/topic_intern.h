@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Глобальная таблица интернированных топиков: одна копия строки на топик,
+// сравнение топиков сводится к сравнению topic_id_t.
+
+#define TOPIC_INTERN_CAPACITY 256
+#define TOPIC_INTERN_MAX_LEN  96
+
+// Младшие 16 бит - номер слота + 1, старшие - поколение слота, чтобы устаревший id
+// не совпал с топиком, который позже занял тот же слот.
+typedef uint32_t topic_id_t;
+
+#define TOPIC_ID_NONE ((topic_id_t)0)
+
+// Найти или добавить топик, увеличив счетчик ссылок. TOPIC_ID_NONE, если таблица заполнена.
+topic_id_t topic_intern_acquire(const char *topic);
+// Взять дополнительную ссылку на уже интернированный топик.
+void topic_intern_retain(topic_id_t id);
+// Отпустить ссылку; слот освобождается, когда ссылок не осталось.
+void topic_intern_release(topic_id_t id);
+// Только поиск (без вставки): TOPIC_ID_NONE означает, что топик никем не зарегистрирован.
+topic_id_t topic_intern_find(const char *topic);
+// Строка топика; действительна, пока вызывающий держит ссылку.
+const char *topic_intern_str(topic_id_t id);
+uint32_t topic_intern_hash(const char *topic, size_t *out_len);
+size_t topic_intern_count(void);
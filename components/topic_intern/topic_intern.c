@@ -0,0 +1,255 @@
+#include "topic_intern.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+// Открытая адресация с линейным пробированием. Освобожденный слот становится
+// "надгробием" (refs == 0, str == NULL, hash != 0), чтобы не рвать цепочки поиска.
+// Надгробия возвращаются в пустые слоты (см. reclaim_tail_locked / compact_locked), иначе после
+// заполнения таблицы каждый промах topic_intern_find просматривал бы все слоты.
+// Живые записи не переносятся: индекс слота входит в topic_id_t.
+typedef struct {
+    uint32_t hash;
+    uint16_t refs;
+    uint16_t len;
+    uint16_t generation;
+    char *str;
+} topic_slot_t;
+
+static const char *TAG = "topic_intern";
+static topic_slot_t s_slots[TOPIC_INTERN_CAPACITY];
+static size_t s_live = 0;
+static size_t s_tombs = 0;
+static bool s_tombs_dirty = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static topic_id_t make_id(int idx)
+{
+    return ((topic_id_t)s_slots[idx].generation << 16) | (topic_id_t)(idx + 1);
+}
+
+// Слот по id, если id не устарел; вызывать под s_lock или держа ссылку.
+static topic_slot_t *slot_for_id(topic_id_t id)
+{
+    size_t idx = (size_t)(id & 0xFFFF);
+    if (idx == 0 || idx > TOPIC_INTERN_CAPACITY) {
+        return NULL;
+    }
+    topic_slot_t *slot = &s_slots[idx - 1];
+    if (!slot->str || slot->generation != (uint16_t)(id >> 16)) {
+        return NULL;
+    }
+    return slot;
+}
+
+uint32_t topic_intern_hash(const char *topic, size_t *out_len)
+{
+    uint32_t hash = 2166136261u;
+    size_t len = 0;
+    for (const char *p = topic; *p; ++p, ++len) {
+        hash ^= (uint8_t)*p;
+        hash *= 16777619u;
+    }
+    if (out_len) {
+        *out_len = len;
+    }
+    // 0 зарезервирован под пустой слот.
+    return hash ? hash : 1;
+}
+
+// Надгробие, за которым пустой слот, никакую цепочку не продолжает: очищаем его и предыдущие.
+static void reclaim_tail_locked(size_t idx)
+{
+    while (s_slots[idx].hash != 0 && !s_slots[idx].str &&
+           s_slots[(idx + 1) % TOPIC_INTERN_CAPACITY].hash == 0) {
+        s_slots[idx].hash = 0;
+        s_tombs--;
+        idx = (idx + TOPIC_INTERN_CAPACITY - 1) % TOPIC_INTERN_CAPACITY;
+    }
+}
+
+// Очищает надгробия, которые не лежат между домашним слотом и слотом ни одной живой записи.
+// Запускается из длинного промаха поиска, не чаще одного раза между освобождениями слотов.
+static void compact_locked(void)
+{
+    uint32_t needed[(TOPIC_INTERN_CAPACITY + 31) / 32] = {0};
+    for (size_t q = 0; q < TOPIC_INTERN_CAPACITY; ++q) {
+        if (!s_slots[q].str) {
+            continue;
+        }
+        for (size_t p = s_slots[q].hash % TOPIC_INTERN_CAPACITY; p != q; p = (p + 1) % TOPIC_INTERN_CAPACITY) {
+            needed[p / 32] |= 1u << (p % 32);
+        }
+    }
+    for (size_t p = 0; p < TOPIC_INTERN_CAPACITY; ++p) {
+        if (s_slots[p].hash != 0 && !s_slots[p].str && !(needed[p / 32] & (1u << (p % 32)))) {
+            s_slots[p].hash = 0;
+            s_tombs--;
+        }
+    }
+    s_tombs_dirty = false;
+}
+
+static int find_slot_locked(const char *topic, uint32_t hash, size_t len, int *free_slot)
+{
+    size_t idx = hash % TOPIC_INTERN_CAPACITY;
+    if (free_slot) {
+        *free_slot = -1;
+    }
+    size_t probe = 0;
+    for (; probe < TOPIC_INTERN_CAPACITY; ++probe) {
+        topic_slot_t *slot = &s_slots[idx];
+        if (slot->hash == 0) {
+            if (free_slot && *free_slot < 0) {
+                *free_slot = (int)idx;
+            }
+            break;
+        }
+        if (!slot->str) {
+            if (free_slot && *free_slot < 0) {
+                *free_slot = (int)idx;
+            }
+        } else if (slot->hash == hash && slot->len == len && memcmp(slot->str, topic, len) == 0) {
+            return (int)idx;
+        }
+        idx = (idx + 1) % TOPIC_INTERN_CAPACITY;
+    }
+    // Найденный free_slot чистка не портит: надгробие или пустой слот остаются свободными.
+    if (probe >= TOPIC_INTERN_CAPACITY / 8 && s_tombs_dirty) {
+        compact_locked();
+    }
+    return -1;
+}
+
+topic_id_t topic_intern_find(const char *topic)
+{
+    if (!topic || !topic[0]) {
+        return TOPIC_ID_NONE;
+    }
+    size_t len = 0;
+    uint32_t hash = topic_intern_hash(topic, &len);
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot_locked(topic, hash, len, NULL);
+    topic_id_t id = idx < 0 ? TOPIC_ID_NONE : make_id(idx);
+    portEXIT_CRITICAL(&s_lock);
+    return id;
+}
+
+topic_id_t topic_intern_acquire(const char *topic)
+{
+    if (!topic || !topic[0]) {
+        return TOPIC_ID_NONE;
+    }
+    size_t len = 0;
+    uint32_t hash = topic_intern_hash(topic, &len);
+    if (len >= TOPIC_INTERN_MAX_LEN) {
+        ESP_LOGW(TAG, "topic too long to intern (%u)", (unsigned)len);
+        return TOPIC_ID_NONE;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    int idx = find_slot_locked(topic, hash, len, NULL);
+    topic_id_t id = TOPIC_ID_NONE;
+    if (idx >= 0) {
+        s_slots[idx].refs++;
+        id = make_id(idx);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (id != TOPIC_ID_NONE) {
+        return id;
+    }
+
+    // Копию выделяем вне критической секции, затем повторяем поиск (могли опередить).
+    char *copy = heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!copy) {
+        copy = heap_caps_malloc(len + 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (!copy) {
+        return TOPIC_ID_NONE;
+    }
+    memcpy(copy, topic, len + 1);
+
+    int free_slot = -1;
+    portENTER_CRITICAL(&s_lock);
+    idx = find_slot_locked(topic, hash, len, &free_slot);
+    if (idx >= 0) {
+        s_slots[idx].refs++;
+    } else if (free_slot >= 0) {
+        if (s_slots[free_slot].hash != 0) {
+            s_tombs--;
+        }
+        s_slots[free_slot].hash = hash;
+        s_slots[free_slot].len = (uint16_t)len;
+        s_slots[free_slot].refs = 1;
+        s_slots[free_slot].str = copy;
+        s_slots[free_slot].generation++;
+        s_live++;
+        idx = free_slot;
+        copy = NULL;
+    }
+    if (idx >= 0) {
+        id = make_id(idx);
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (copy) {
+        heap_caps_free(copy);
+    }
+    if (idx < 0) {
+        ESP_LOGW(TAG, "intern table full (%d)", TOPIC_INTERN_CAPACITY);
+        return TOPIC_ID_NONE;
+    }
+    return id;
+}
+
+void topic_intern_retain(topic_id_t id)
+{
+    portENTER_CRITICAL(&s_lock);
+    topic_slot_t *slot = slot_for_id(id);
+    if (slot) {
+        slot->refs++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void topic_intern_release(topic_id_t id)
+{
+    char *victim = NULL;
+    portENTER_CRITICAL(&s_lock);
+    topic_slot_t *slot = slot_for_id(id);
+    if (slot && slot->refs > 0) {
+        slot->refs--;
+        if (slot->refs == 0) {
+            victim = slot->str;
+            slot->str = NULL;
+            slot->len = 0;
+            if (s_live > 0) {
+                s_live--;
+            }
+            s_tombs++;
+            s_tombs_dirty = true;
+            reclaim_tail_locked((size_t)(slot - s_slots));
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (victim) {
+        heap_caps_free(victim);
+    }
+}
+
+const char *topic_intern_str(topic_id_t id)
+{
+    topic_slot_t *slot = slot_for_id(id);
+    return slot ? slot->str : NULL;
+}
+
+size_t topic_intern_count(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    size_t count = s_live;
+    portEXIT_CRITICAL(&s_lock);
+    return count;
+}
@@ -10,6 +10,8 @@
 #include "esp_check.h"
 #include "esp_heap_caps.h"
 
+#include "broker_affinity.h"
+
 #include "web_ui_utils.h"
 #include "web_ui_handlers.h"
 #include "web_ui_auth.h"
@@ -55,6 +57,9 @@ static esp_err_t web_http_check(esp_err_t err, const char *context)
 
 static esp_err_t register_guarded_route(const char *uri, httpd_method_t method, const web_route_t *route);
 static esp_err_t register_public_route(const char *uri, httpd_method_t method, esp_err_t (*handler)(httpd_req_t *));
+#if CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t register_websocket_route(const char *uri, const char *subprotocol, esp_err_t (*handler)(httpd_req_t *));
+#endif
 
 static esp_err_t web_ui_restart_state_init(void)
 {
@@ -137,6 +142,23 @@ static esp_err_t register_public_route(const char *uri, httpd_method_t method, e
     return WEB_HTTP_CHECK_CTX(httpd_register_uri_handler(s_server, &desc), uri);
 }
 
+#if CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t register_websocket_route(const char *uri, const char *subprotocol, esp_err_t (*handler)(httpd_req_t *))
+{
+    if (!s_server || !handler) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    httpd_uri_t desc = {
+        .uri = uri,
+        .method = HTTP_GET,
+        .handler = handler,
+        .is_websocket = true,
+        .supported_subprotocol = subprotocol,
+    };
+    return WEB_HTTP_CHECK_CTX(httpd_register_uri_handler(s_server, &desc), uri);
+}
+#endif
+
 static esp_err_t stop_httpd(void)
 {
     if (!s_server) {
@@ -180,6 +202,9 @@ static esp_err_t register_httpd_routes(void)
         {.uri = "/api/audio/volume", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = audio_volume_handler},
         {.uri = "/api/audio/seek", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = audio_seek_handler},
         {.uri = "/api/publish", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = publish_handler},
+        {.uri = "/api/trace/status", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = trace_status_handler},
+        {.uri = "/api/trace/record", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = trace_record_handler},
+        {.uri = "/api/trace/replay", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = trace_replay_handler},
         {.uri = "/api/files", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = files_handler},
         {.uri = "/api/devices/config", .method = HTTP_GET, .guarded = true, .min_role = WEB_USER_ROLE_USER, .redirect_on_fail = false, .fn = devices_config_handler},
         {.uri = "/api/devices/apply", .method = HTTP_POST, .guarded = true, .min_role = WEB_USER_ROLE_ADMIN, .redirect_on_fail = false, .fn = devices_apply_handler},
@@ -214,6 +239,13 @@ static esp_err_t register_httpd_routes(void)
         }
     }
 
+#if CONFIG_HTTPD_WS_SUPPORT
+    esp_err_t ws_err = register_websocket_route("/mqtt", "mqtt", mqtt_ws_handler);
+    if (ws_err != ESP_OK) {
+        return ws_err;
+    }
+#endif
+
     return ESP_OK;
 }
 
@@ -225,7 +257,7 @@ static esp_err_t start_httpd(void)
     }
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
-    config.max_uri_handlers = 40; // many handlers registered
+    config.max_uri_handlers = 44; // many handlers registered (+ /mqtt websocket)
     config.max_open_sockets = 20;  // target max clients (clamped by LWIP budget below)
     // Keep max_open_sockets within LWIP_MAX_SOCKETS budget (httpd uses ~3 internally).
 #ifdef CONFIG_LWIP_MAX_SOCKETS
@@ -241,6 +273,7 @@ static esp_err_t start_httpd(void)
     config.lru_purge_enable = true; // drop oldest sockets instead of refusing new ones
     config.keep_alive_enable = false; // close connections immediately
     config.stack_size = 16384; // avoid stack overflow with larger handlers/pages
+    config.core_id = BROKER_NET_CORE; // рядом с брокером, подальше от runtime/audio
     #if WEB_UI_DEBUG
     ESP_LOGI(TAG, "starting httpd: uri=%d sockets=%d backlog=%d keepalive=%d free_int=%u",
              config.max_uri_handlers, config.max_open_sockets, config.backlog_conn, config.keep_alive_enable,
@@ -217,6 +217,12 @@ static bool web_role_allows(web_user_role_t have, web_user_role_t required)
     return have == WEB_USER_ROLE_ADMIN;
 }
 
+bool web_ui_session_allows(httpd_req_t *req, web_user_role_t min_role)
+{
+    web_user_role_t role = WEB_USER_ROLE_USER;
+    return req && web_session_get_info(req, &role, NULL, 0) && web_role_allows(role, min_role);
+}
+
 static bool web_ui_require_session(httpd_req_t *req, bool redirect_on_fail, web_user_role_t *role_out)
 {
     if (!req) {
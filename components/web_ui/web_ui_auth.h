@@ -24,6 +24,8 @@ esp_err_t auth_login_handler(httpd_req_t *req);
 esp_err_t auth_logout_handler(httpd_req_t *req);
 esp_err_t auth_password_handler(httpd_req_t *req);
 esp_err_t session_info_handler(httpd_req_t *req);
+// Проверка сессии без ответа клиенту (для маршрутов вне auth gate, например WebSocket upgrade).
+bool web_ui_session_allows(httpd_req_t *req, web_user_role_t min_role);
 
 esp_err_t web_sessions_init(void);
 void web_sessions_clear(void);
@@ -23,6 +23,9 @@ esp_err_t logging_config_handler(httpd_req_t *req);
 esp_err_t mqtt_users_handler(httpd_req_t *req);
 esp_err_t publish_handler(httpd_req_t *req);
 esp_err_t ap_stop_handler(httpd_req_t *req);
+esp_err_t trace_status_handler(httpd_req_t *req);
+esp_err_t trace_record_handler(httpd_req_t *req);
+esp_err_t trace_replay_handler(httpd_req_t *req);
 esp_err_t root_get_handler(httpd_req_t *req);
 esp_err_t devices_config_handler(httpd_req_t *req);
 esp_err_t devices_apply_handler(httpd_req_t *req);
@@ -36,3 +39,6 @@ esp_err_t devices_profile_activate_handler(httpd_req_t *req);
 esp_err_t devices_profile_download_handler(httpd_req_t *req);
 esp_err_t devices_variables_handler(httpd_req_t *req);
 esp_err_t devices_templates_handler(httpd_req_t *req);
+#if CONFIG_HTTPD_WS_SUPPORT
+esp_err_t mqtt_ws_handler(httpd_req_t *req);
+#endif
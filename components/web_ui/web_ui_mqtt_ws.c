@@ -0,0 +1,149 @@
+#include "web_ui_handlers.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "mqtt_core.h"
+#include "web_ui_auth.h"
+#include "web_ui_utils.h"
+
+#if CONFIG_HTTPD_WS_SUPPORT
+
+// MQTT поверх WebSocket (subprotocol "mqtt"): кадры отдаются в ту же сессионную машину,
+// что и TCP клиенты. Upgrade принимается только со своего origin и с admin web-сессией
+// (как /api/publish); дальше доступ проверяется на уровне MQTT CONNECT (mqtt users / ACL).
+// Исходящие пакеты копятся в очереди сессии mqtt_core и пишутся только из задачи httpd
+// (httpd_queue_work), поэтому кадры одного сокета не перемежаются, а медленная вкладка
+// не держит публикующие задачи.
+
+static const char *TAG = "web_ui_mqtt_ws";
+
+#define WEB_MQTT_WS_MAX_FRAME 4096
+
+typedef struct {
+    httpd_handle_t server;
+    int fd;
+    mqtt_core_stream_t stream;
+} web_mqtt_ws_ctx_t;
+
+static int ws_transport_send(void *ctx, const uint8_t *data, size_t len)
+{
+    web_mqtt_ws_ctx_t *ws = (web_mqtt_ws_ctx_t *)ctx;
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = (uint8_t *)data,
+        .len = len,
+    };
+    // Вызывается только из ws_flush_work в задаче httpd.
+    if (httpd_ws_send_frame_async(ws->server, ws->fd, &frame) != ESP_OK) {
+        return -1;
+    }
+    return (int)len;
+}
+
+static void ws_transport_close(void *ctx)
+{
+    web_mqtt_ws_ctx_t *ws = (web_mqtt_ws_ctx_t *)ctx;
+    httpd_sess_trigger_close(ws->server, ws->fd);
+}
+
+static void ws_flush_work(void *arg)
+{
+    mqtt_core_stream_flush((mqtt_core_stream_t)(uintptr_t)arg);
+}
+
+static esp_err_t ws_transport_wake(void *ctx)
+{
+    web_mqtt_ws_ctx_t *ws = (web_mqtt_ws_ctx_t *)ctx;
+    // По хэндлу, а не по ctx: к моменту выполнения работы сессия может быть уже закрыта.
+    return httpd_queue_work(ws->server, ws_flush_work, (void *)(uintptr_t)ws->stream);
+}
+
+static const mqtt_core_transport_t s_ws_transport = {
+    .send = ws_transport_send,
+    .close = ws_transport_close,
+    .wake = ws_transport_wake,
+};
+
+static void ws_ctx_free(void *ctx)
+{
+    web_mqtt_ws_ctx_t *ws = (web_mqtt_ws_ctx_t *)ctx;
+    if (!ws) {
+        return;
+    }
+    mqtt_core_stream_close(ws->stream);
+    free(ws);
+}
+
+static esp_err_t ws_open(httpd_req_t *req)
+{
+    // Ответ на handshake httpd уже отправил; ошибка из обработчика закрывает сокет до первого кадра.
+    if (!web_ui_is_same_origin_request(req)) {
+        ESP_LOGW(TAG, "mqtt ws upgrade rejected: foreign origin");
+        return ESP_FAIL;
+    }
+    if (!web_ui_session_allows(req, WEB_USER_ROLE_ADMIN)) {
+        ESP_LOGW(TAG, "mqtt ws upgrade rejected: no admin web session");
+        return ESP_FAIL;
+    }
+    web_mqtt_ws_ctx_t *ws = calloc(1, sizeof(*ws));
+    if (!ws) {
+        return ESP_ERR_NO_MEM;
+    }
+    ws->server = req->handle;
+    ws->fd = httpd_req_to_sockfd(req);
+    esp_err_t err = mqtt_core_stream_open(&s_ws_transport, ws, &ws->stream);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "mqtt stream open failed: %s", esp_err_to_name(err));
+        free(ws);
+        return err;
+    }
+    req->sess_ctx = ws;
+    req->free_ctx = ws_ctx_free;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_ws_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
+        return ws_open(req);
+    }
+    web_mqtt_ws_ctx_t *ws = (web_mqtt_ws_ctx_t *)req->sess_ctx;
+    if (!ws) {
+        return ESP_FAIL;
+    }
+
+    httpd_ws_frame_t frame = {0};
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.type != HTTPD_WS_TYPE_BINARY && frame.type != HTTPD_WS_TYPE_CONTINUE) {
+        return ESP_OK;
+    }
+    if (frame.len == 0) {
+        return ESP_OK;
+    }
+    if (frame.len > WEB_MQTT_WS_MAX_FRAME) {
+        ESP_LOGW(TAG, "ws frame too large (%u)", (unsigned)frame.len);
+        return ESP_FAIL;
+    }
+    uint8_t *buf = heap_caps_malloc(frame.len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    frame.payload = buf;
+    err = httpd_ws_recv_frame(req, &frame, frame.len);
+    if (err == ESP_OK) {
+        err = mqtt_core_stream_feed(ws->stream, buf, frame.len);
+    }
+    heap_caps_free(buf);
+    return err;
+}
+
+#endif // CONFIG_HTTPD_WS_SUPPORT
@@ -133,6 +133,7 @@ static const char s_web_ui_index[] =
 "</div>"
 "<pre id='status_raw' class='muted small' style='display:none;'></pre>"
 "</div>"
+"<div class='card' id='clients_card' style='display:none;'><h3>MQTT Clients</h3><div id='clients_list' class='uid-slots'></div></div>"
 "<div class='card' id='uid_card' style='display:none;'><h3>UID Monitor</h3><div id='uid_monitor_list' class='uid-monitor'></div></div>"
 "</div>"
 "<div class='pane' id='pane-update'>"
@@ -244,7 +245,8 @@ static const char s_web_ui_index[] =
 "function otaPhaseHint(phase){switch(phase){case 'uploading':return 'Firmware transfer is in progress. Wait until the image is fully written.';case 'reboot_required':return 'Firmware image is installed. Review status and press Reboot now when ready.';case 'rebooting':return 'Reboot has been requested. Wait for the board to restart and reconnect.';case 'verify_wait_ready':return 'New image has booted. Waiting for the application to report healthy startup.';case 'verify_pending':return 'Rollback-capable image is awaiting confirmation. The device should confirm automatically after healthy startup.';case 'idle':default:return 'Idle. You can upload a new firmware image.';}}"
 "function renderOtaStatus(ota){const data=ota||{};const phase=data.phase||'idle';setTxt('ota_version',data.version||'n/a');setTxt('ota_running',data.running_partition||'n/a');setTxt('ota_boot',data.boot_partition||'n/a');const states=[otaPhaseLabel(phase)];if(!data.rollback_supported){states.push('No rollback');}setTxt('ota_state',states.join(' · '));setTxt('ota_phase_hint',otaPhaseHint(phase));const rebootBtn=document.getElementById('ota_reboot_btn');if(rebootBtn){rebootBtn.disabled=phase!=='reboot_required';}const uploadBtn=document.getElementById('ota_upload_btn');if(uploadBtn){uploadBtn.disabled=phase==='uploading'||phase==='rebooting';}const fileInput=document.getElementById('ota_file');if(fileInput){fileInput.disabled=phase==='uploading'||phase==='rebooting';}const details=document.getElementById('ota_last_error');if(details){const progress=phase==='uploading'&&data.total_bytes?` Upload ${formatBytes(data.bytes_written||0)} / ${formatBytes(data.total_bytes||0)}.`:'';const message=(data.last_error&&data.last_error.length)?data.last_error:'No OTA errors.';details.textContent=message+progress;details.style.color=(data.last_error&&data.last_error.length)?'#fca5a5':'#94a3b8';}}"
 "function serviceBadge(name,svc){if(!svc||!svc.init_attempted)return `${name}:n/a`;if(!svc.init_ok)return `${name}:init-fail`;if(svc.start_attempted&&!svc.start_ok)return `${name}:start-fail`;if(svc.start_attempted&&svc.start_ok)return `${name}:ok`;return `${name}:init-only`;}"
-"function renderStatus(j){window.__BROKER_STATUS=j||{};setTxt('status_raw',JSON.stringify(j,null,2));setTxt('status_ssid',j.wifi.ssid||'n/a');setTxt('status_ip',j.wifi.sta_ip||'none');const sd=j.sd||{};if(sd.ok){setTxt('status_sd_size',`${humanGb(sd.total)} / free ${humanGb(sd.free)}`);}else{setTxt('status_sd_size','No card');}const mem=j.mem||{};const dram=mem.dram||{};const psram=mem.psram||{};setTxt('status_ram',dram.total_kb?`${dram.free_kb||0} / ${dram.total_kb} KB`:'n/a');setTxt('status_psram',psram.total_kb?`${psram.free_kb||0} / ${psram.total_kb} KB`:'n/a');setTxt('status_clients',j.clients?j.clients.total:0);const services=j.services||{};setTxt('status_services',[serviceBadge('net',services.network),serviceBadge('mqtt',services.mqtt),serviceBadge('audio',services.audio),serviceBadge('ui',services.web_ui)].join(' | '));const webUserInput=document.getElementById('web_user');if(webUserInput){webUserInput.value=(j.web&&j.web.username)||'';}const operatorUser=document.getElementById('op_user');if(operatorUser){operatorUser.value=(j.web&&j.web.operator&&j.web.operator.username)||'';}const operatorToggle=document.getElementById('op_enabled');if(operatorToggle){operatorToggle.checked=!!(j.web&&j.web.operator&&j.web.operator.enabled);}const diagBox=document.getElementById('diag_verbose');if(diagBox){diagBox.checked=!!(j.diag&&j.diag.verbose_logging);}renderOtaStatus(j.ota||{});renderUidMonitor(j.uid_monitor||[]);if(typeof window.__devicesWizardRenderActions==='function'){window.__devicesWizardRenderActions();}}"
+"function renderStatus(j){window.__BROKER_STATUS=j||{};setTxt('status_raw',JSON.stringify(j,null,2));setTxt('status_ssid',j.wifi.ssid||'n/a');setTxt('status_ip',j.wifi.sta_ip||'none');const sd=j.sd||{};if(sd.ok){setTxt('status_sd_size',`${humanGb(sd.total)} / free ${humanGb(sd.free)}`);}else{setTxt('status_sd_size','No card');}const mem=j.mem||{};const dram=mem.dram||{};const psram=mem.psram||{};setTxt('status_ram',dram.total_kb?`${dram.free_kb||0} / ${dram.total_kb} KB`:'n/a');setTxt('status_psram',psram.total_kb?`${psram.free_kb||0} / ${psram.total_kb} KB`:'n/a');const cl=j.clients||{};setTxt('status_clients',(cl.lagging||cl.stuck)?`${cl.total||0} (${cl.lagging||0} lagging, ${cl.stuck||0} stuck)`:(cl.total||0));renderClients(cl.list||[]);const services=j.services||{};setTxt('status_services',[serviceBadge('net',services.network),serviceBadge('mqtt',services.mqtt),serviceBadge('audio',services.audio),serviceBadge('ui',services.web_ui)].join(' | '));const webUserInput=document.getElementById('web_user');if(webUserInput){webUserInput.value=(j.web&&j.web.username)||'';}const operatorUser=document.getElementById('op_user');if(operatorUser){operatorUser.value=(j.web&&j.web.operator&&j.web.operator.username)||'';}const operatorToggle=document.getElementById('op_enabled');if(operatorToggle){operatorToggle.checked=!!(j.web&&j.web.operator&&j.web.operator.enabled);}const diagBox=document.getElementById('diag_verbose');if(diagBox){diagBox.checked=!!(j.diag&&j.diag.verbose_logging);}renderOtaStatus(j.ota||{});renderUidMonitor(j.uid_monitor||[]);if(typeof window.__devicesWizardRenderActions==='function'){window.__devicesWizardRenderActions();}}"
+"function renderClients(list){const card=document.getElementById('clients_card');const wrap=document.getElementById('clients_list');if(!card||!wrap)return;if(!Array.isArray(list)||!list.length){card.style.display='none';wrap.innerHTML='';return;}card.style.display='block';wrap.innerHTML=list.map(c=>{const state=escapeHtml(c.state||'healthy');const backlog=c.backlog?` | queue ${c.backlog} B, ${c.backlog_age_ms||0} ms`:'';const dropped=c.dropped?` | dropped ${c.dropped}`:'';return `<div class=\"uid-slot\"><span class=\"label\">${escapeHtml(c.id||'?')} (${escapeHtml(c.transport||'tcp')})</span>${state}${backlog}${dropped} | send ${c.send_us||0} us</div>`;}).join('');}"
 "function renderUidMonitor(list){const card=document.getElementById('uid_card');const wrap=document.getElementById('uid_monitor_list');if(!card||!wrap)return;if(!Array.isArray(list)||!list.length){card.style.display='none';wrap.innerHTML='';return;}card.style.display='block';wrap.innerHTML=list.map(dev=>{const title=escapeHtml(dev.name||dev.id||'Device');const slots=(dev.slots||[]).map(slot=>{const label=escapeHtml(slot.label||slot.source||`Slot ${slot.index||0}`);const value=slot.last_value?escapeHtml(slot.last_value):'&mdash;';return `<div class=\"uid-slot\"><span class=\"label\">${label}</span><strong>${value}</strong></div>`;}).join('')||\"<div class='muted small'>No slots</div>\";return `<div class=\"uid-device\"><h4>${title}</h4><div class=\"uid-slots\">${slots}</div></div>`;}).join('');}"
 "function renderMqttUsers(list){mqttUsers=Array.isArray(list)?list.map(u=>({client_id:u&&u.client_id?u.client_id:'',username:u&&u.username?u.username:'',password:u&&u.password?u.password:''})):[];const wrap=document.getElementById('mqtt_users_list');if(!wrap)return;if(!mqttUsers.length){wrap.innerHTML=\"<div class='muted small'>No users configured.</div>\";return;}wrap.innerHTML=mqttUsers.map((user,idx)=>`<div class=\"mqtt-user-row\"><input placeholder=\"Client ID\" value=\"${escapeHtml(user.client_id)}\" oninput=\"updateMqttUser(${idx},'client_id',this.value)\"><input placeholder=\"Username\" value=\"${escapeHtml(user.username)}\" oninput=\"updateMqttUser(${idx},'username',this.value)\"><input placeholder=\"Password\" value=\"${escapeHtml(user.password)}\" oninput=\"updateMqttUser(${idx},'password',this.value)\"><button type=\"button\" onclick=\"removeMqttUser(${idx})\">Remove</button></div>`).join('');}"
 "function addMqttUser(){mqttUsers.push({client_id:'',username:'',password:''});renderMqttUsers(mqttUsers);}"
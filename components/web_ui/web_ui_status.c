@@ -13,6 +13,7 @@
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "event_bus.h"
 #include "lwip/ip4_addr.h"
 #include "mqtt_core.h"
 #include "network.h"
@@ -194,6 +195,59 @@ static cJSON *build_signal_monitor_json(void)
     return root;
 }
 
+static cJSON *build_mqtt_clients_json(void)
+{
+    cJSON *root = cJSON_CreateArray();
+    mqtt_client_info_t *clients = heap_caps_calloc(CONFIG_BROKER_MQTT_MAX_CLIENTS, sizeof(mqtt_client_info_t),
+                                                   MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!root || !clients) {
+        heap_caps_free(clients);
+        if (root) {
+            cJSON_Delete(root);
+        }
+        return empty_json_array();
+    }
+    size_t count = mqtt_core_list_clients(clients, CONFIG_BROKER_MQTT_MAX_CLIENTS);
+    for (size_t i = 0; i < count; ++i) {
+        const mqtt_client_info_t *info = &clients[i];
+        cJSON *obj = cJSON_CreateObject();
+        if (!obj) {
+            break;
+        }
+        cJSON_AddStringToObject(obj, "id", info->client_id);
+        cJSON_AddStringToObject(obj, "transport", info->websocket ? "ws" : "tcp");
+        cJSON_AddStringToObject(obj, "state", mqtt_core_client_health_name(info->health));
+        cJSON_AddNumberToObject(obj, "backlog", info->backlog_bytes);
+        cJSON_AddNumberToObject(obj, "backlog_peak", info->backlog_peak);
+        cJSON_AddNumberToObject(obj, "backlog_age_ms", info->backlog_age_ms);
+        cJSON_AddNumberToObject(obj, "send_us", info->send_latency_us);
+        cJSON_AddNumberToObject(obj, "dropped", info->dropped);
+        cJSON_AddNumberToObject(obj, "pub_rate", info->publish_rate);
+        cJSON_AddNumberToObject(obj, "throttled_ms", info->throttled_ms);
+        cJSON_AddItemToArray(root, obj);
+    }
+    heap_caps_free(clients);
+    return root;
+}
+
+// Тот же снимок, что шина публикует в EVENT_BUS_METRICS_TOPIC.
+static cJSON *build_event_bus_json(void)
+{
+    char *buf = heap_caps_malloc(EVENT_BUS_METRICS_MAX_LEN, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        buf = heap_caps_malloc(EVENT_BUS_METRICS_MAX_LEN, MALLOC_CAP_8BIT);
+    }
+    if (!buf) {
+        return cJSON_CreateObject();
+    }
+    cJSON *root = NULL;
+    if (event_bus_format_metrics(buf, EVENT_BUS_METRICS_MAX_LEN) > 0) {
+        root = cJSON_Parse(buf);
+    }
+    heap_caps_free(buf);
+    return root ? root : cJSON_CreateObject();
+}
+
 static cJSON *build_mqtt_users_json(const app_mqtt_config_t *mqtt_cfg)
 {
     cJSON *root = cJSON_CreateArray();
@@ -275,9 +329,11 @@ esp_err_t status_handler(httpd_req_t *req)
     cJSON *signal_monitor = build_signal_monitor_json();
     cJSON *sequence_monitor = build_sequence_monitor_json();
     cJSON *mqtt_users = build_mqtt_users_json(&cfg->mqtt);
+    cJSON *event_bus = build_event_bus_json();
 
     if (!wifi || !mqtt || !audio || !web || !web_operator || !sd || !diag || !mem ||
-        !dram || !psram || !clients || !ota_obj || !services || !uid_monitor || !signal_monitor || !sequence_monitor || !mqtt_users) {
+        !dram || !psram || !clients || !ota_obj || !services || !uid_monitor || !signal_monitor || !sequence_monitor || !mqtt_users ||
+        !event_bus) {
         if (uid_monitor) {
             cJSON_Delete(uid_monitor);
         }
@@ -290,6 +346,9 @@ esp_err_t status_handler(httpd_req_t *req)
         if (mqtt_users) {
             cJSON_Delete(mqtt_users);
         }
+        if (event_bus) {
+            cJSON_Delete(event_bus);
+        }
         cJSON_Delete(root);
         return WEB_HTTP_CHECK(httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem"));
     }
@@ -331,6 +390,11 @@ esp_err_t status_handler(httpd_req_t *req)
     cJSON_AddNumberToObject(psram, "total_kb", psram_total_kb);
 
     cJSON_AddNumberToObject(clients, "total", stats.total);
+    cJSON_AddNumberToObject(clients, "lagging", stats.lagging);
+    cJSON_AddNumberToObject(clients, "stuck", stats.stuck);
+    cJSON_AddNumberToObject(clients, "throttled", stats.throttled);
+    cJSON_AddItemToObject(clients, "list", build_mqtt_clients_json());
+    cJSON_AddItemToObject(root, "event_bus", event_bus);
 
     cJSON_AddStringToObject(ota_obj, "version", ota.app_version);
     cJSON_AddStringToObject(ota_obj, "running_partition", ota.running_partition);
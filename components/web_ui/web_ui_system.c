@@ -14,8 +14,10 @@
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "event_bus.h"
+#include "event_bus_trace.h"
 #include "config_store.h"
 #include "network.h"
+#include "sd_storage.h"
 #include "cJSON.h"
 
 #include "web_ui_page.h"
@@ -276,9 +278,7 @@ esp_err_t publish_handler(httpd_req_t *req)
     ESP_LOGI(TAG, "publish request topic='%s' payload='%s'",
              topic, payload[0] ? payload : "<none>");
 #endif
-    event_bus_message_t msg = {.type = EVENT_WEB_COMMAND};
-    strncpy(msg.topic, topic, sizeof(msg.topic) - 1);
-    strncpy(msg.payload, payload, sizeof(msg.payload) - 1);
+    event_bus_message_t msg = {.type = EVENT_WEB_COMMAND, .topic = topic, .payload = payload};
     esp_err_t err = event_bus_post(&msg, pdMS_TO_TICKS(50));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "publish event dispatch failed: %s", esp_err_to_name(err));
@@ -288,6 +288,102 @@ esp_err_t publish_handler(httpd_req_t *req)
     return web_ui_send_ok(req, "text/plain", "sent");
 }
 
+// Трассы шины лежат в корне SD: имя из запроса приводится к безопасному токену, расширение .evt.
+static esp_err_t trace_path_from_query(const char *query, char *path, size_t path_len)
+{
+    char name_enc[64] = {0};
+    char name[48] = {0};
+    char safe[40];
+    httpd_query_key_value(query, "file", name_enc, sizeof(name_enc));
+    web_ui_url_decode(name, sizeof(name), name_enc);
+    web_ui_sanitize_filename_token(safe, sizeof(safe), name, "events");
+    snprintf(path, path_len, "%s/%s.evt", SD_STORAGE_ROOT_PATH, safe);
+    return sd_storage_mount();
+}
+
+static esp_err_t trace_send_error(httpd_req_t *req, esp_err_t err)
+{
+    if (err == ESP_ERR_INVALID_STATE) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return WEB_HTTP_CHECK(httpd_resp_send(req, "trace busy", HTTPD_RESP_USE_STRLEN));
+    }
+    char msg[64];
+    snprintf(msg, sizeof(msg), "trace failed: %s", esp_err_to_name(err));
+    return WEB_HTTP_CHECK(httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, msg));
+}
+
+esp_err_t trace_status_handler(httpd_req_t *req)
+{
+    event_trace_status_t st;
+    event_trace_get_status(&st);
+    cJSON *root = cJSON_CreateObject();
+    if (!root) {
+        return WEB_HTTP_CHECK(httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no mem"));
+    }
+    cJSON_AddBoolToObject(root, "recording", st.recording);
+    cJSON_AddNumberToObject(root, "records", st.records);
+    cJSON_AddNumberToObject(root, "lost", st.lost);
+    cJSON_AddNumberToObject(root, "bytes", (double)st.bytes);
+    cJSON_AddBoolToObject(root, "replaying", st.replaying);
+    if (st.has_replay) {
+        cJSON *replay = cJSON_AddObjectToObject(root, "last_replay");
+        if (replay) {
+            cJSON_AddNumberToObject(replay, "events", st.last_replay.events);
+            cJSON_AddNumberToObject(replay, "failed", st.last_replay.failed);
+            cJSON_AddNumberToObject(replay, "trace_ms", (double)(st.last_replay.trace_us / 1000));
+            cJSON_AddNumberToObject(replay, "elapsed_ms", (double)(st.last_replay.elapsed_us / 1000));
+            cJSON_AddNumberToObject(replay, "events_per_s", st.last_replay.events_per_s);
+            cJSON_AddBoolToObject(replay, "drained", st.last_replay.drained);
+        }
+    }
+    return WEB_HTTP_CHECK(web_ui_send_json(req, root));
+}
+
+esp_err_t trace_record_handler(httpd_req_t *req)
+{
+    char query[128] = {0};
+    char action[16] = {0};
+    char path[96];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "action", action, sizeof(action));
+    }
+    esp_err_t err;
+    if (strcmp(action, "start") == 0) {
+        err = trace_path_from_query(query, path, sizeof(path));
+        if (err == ESP_OK) {
+            err = event_trace_record_start(path);
+        }
+    } else if (strcmp(action, "stop") == 0) {
+        err = event_trace_record_stop(NULL);
+    } else {
+        return WEB_HTTP_CHECK(httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "action must be start or stop"));
+    }
+    if (err != ESP_OK) {
+        return trace_send_error(req, err);
+    }
+    return trace_status_handler(req);
+}
+
+// speed: 1 - исходный темп, N - в N раз быстрее, 0 - без пауз. Итог - в /api/trace/status.
+esp_err_t trace_replay_handler(httpd_req_t *req)
+{
+    char query[128] = {0};
+    char speed_str[12] = {0};
+    char path[96];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "speed", speed_str, sizeof(speed_str));
+    }
+    uint32_t speed = speed_str[0] ? (uint32_t)strtoul(speed_str, NULL, 10) : 1;
+    esp_err_t err = trace_path_from_query(query, path, sizeof(path));
+    if (err == ESP_OK) {
+        err = event_trace_replay_start(path, speed);
+    }
+    if (err != ESP_OK) {
+        return trace_send_error(req, err);
+    }
+    return trace_status_handler(req);
+}
+
 esp_err_t ap_stop_handler(httpd_req_t *req)
 {
     network_stop_ap();
@@ -1,8 +1,12 @@
 #include <string.h>
 
 #include "unity.h"
+#include "dm_runtime_arena.h"
+#include "dm_runtime_condition.h"
+#include "dm_runtime_flag.h"
 #include "dm_runtime_sequence.h"
 #include "dm_runtime_signal.h"
+#include "dm_runtime_wheel.h"
 
 static void fill_sequence_template(dm_sequence_template_t *tpl, bool reset_on_error, uint32_t timeout_ms)
 {
@@ -348,6 +352,239 @@ static void test_signal_runtime_set_template_resets_state(void)
     TEST_ASSERT_EQUAL_UINT32(80, rt.config.heartbeat_timeout_ms);
 }
 
+static void fill_condition_template(dm_condition_template_t *tpl, device_condition_type_t mode)
+{
+    TEST_ASSERT_NOT_NULL(tpl);
+    memset(tpl, 0, sizeof(*tpl));
+    tpl->mode = mode;
+    tpl->rule_count = 2;
+    strncpy(tpl->rules[0].flag, "door", sizeof(tpl->rules[0].flag) - 1);
+    tpl->rules[0].required_state = true;
+    strncpy(tpl->rules[1].flag, "alarm", sizeof(tpl->rules[1].flag) - 1);
+    tpl->rules[1].required_state = false;
+    strncpy(tpl->true_scenario, "open", sizeof(tpl->true_scenario) - 1);
+    strncpy(tpl->false_scenario, "close", sizeof(tpl->false_scenario) - 1);
+}
+
+static void test_condition_runtime_counters_follow_rule_updates(void)
+{
+    dm_condition_template_t tpl;
+    fill_condition_template(&tpl, DEVICE_CONDITION_ALL);
+    dm_condition_runtime_t rt;
+    dm_condition_runtime_init(&rt, &tpl);
+
+    // Флаги еще не приходили и считаются false: alarm уже совпадает, door нет.
+    TEST_ASSERT_EQUAL_UINT8(1, rt.true_count);
+    TEST_ASSERT_EQUAL_UINT8(1, rt.false_count);
+
+    bool changed = false;
+    dm_condition_runtime_set_rule(&rt, 0, true);
+    TEST_ASSERT_TRUE(dm_condition_runtime_update_result(&rt, &changed));
+    TEST_ASSERT_TRUE(changed);
+    TEST_ASSERT_EQUAL_UINT8(2, rt.true_count);
+    TEST_ASSERT_EQUAL_UINT8(0, rt.false_count);
+
+    dm_condition_runtime_set_rule(&rt, 0, true);
+    TEST_ASSERT_TRUE(dm_condition_runtime_update_result(&rt, &changed));
+    TEST_ASSERT_FALSE(changed);
+    TEST_ASSERT_EQUAL_UINT8(2, rt.true_count);
+
+    dm_condition_runtime_set_rule(&rt, 1, true);
+    TEST_ASSERT_FALSE(dm_condition_runtime_update_result(&rt, &changed));
+    TEST_ASSERT_TRUE(changed);
+    TEST_ASSERT_EQUAL_UINT8(1, rt.true_count);
+    TEST_ASSERT_EQUAL_UINT8(1, rt.false_count);
+
+    dm_condition_runtime_set_rule(&rt, 7, true);
+    TEST_ASSERT_EQUAL_UINT8(1, rt.true_count);
+    TEST_ASSERT_EQUAL_UINT8(1, rt.false_count);
+}
+
+static void test_condition_runtime_handle_flag_matches_by_name_case_insensitive(void)
+{
+    dm_condition_template_t tpl;
+    fill_condition_template(&tpl, DEVICE_CONDITION_ANY);
+    dm_condition_runtime_t rt;
+    dm_condition_runtime_init(&rt, &tpl);
+
+    bool changed = false;
+    bool result = false;
+    TEST_ASSERT_FALSE(dm_condition_runtime_handle_flag(&rt, "window", true, &changed, &result));
+    TEST_ASSERT_TRUE(dm_condition_runtime_handle_flag(&rt, "ALARM", true, &changed, &result));
+    TEST_ASSERT_TRUE(changed);
+    TEST_ASSERT_FALSE(result);
+    TEST_ASSERT_TRUE(dm_condition_runtime_handle_flag(&rt, "Door", true, &changed, &result));
+    TEST_ASSERT_TRUE(changed);
+    TEST_ASSERT_TRUE(result);
+}
+
+static void test_flag_trigger_runtime_rule_fires_only_on_change_to_required_state(void)
+{
+    dm_flag_trigger_template_t tpl;
+    memset(&tpl, 0, sizeof(tpl));
+    tpl.rule_count = 2;
+    strncpy(tpl.rules[0].flag, "door", sizeof(tpl.rules[0].flag) - 1);
+    strncpy(tpl.rules[0].scenario, "open", sizeof(tpl.rules[0].scenario) - 1);
+    tpl.rules[0].required_state = true;
+    strncpy(tpl.rules[1].flag, "alarm", sizeof(tpl.rules[1].flag) - 1);
+    tpl.rules[1].required_state = true;
+    dm_flag_trigger_runtime_t rt;
+    dm_flag_trigger_runtime_init(&rt, &tpl);
+
+    TEST_ASSERT_EQUAL_PTR(&rt.config.rules[0], dm_flag_trigger_runtime_handle_rule(&rt, 0, true));
+    TEST_ASSERT_NULL(dm_flag_trigger_runtime_handle_rule(&rt, 0, true));
+    TEST_ASSERT_NULL(dm_flag_trigger_runtime_handle_rule(&rt, 0, false));
+    TEST_ASSERT_EQUAL_PTR(&rt.config.rules[0], dm_flag_trigger_runtime_handle(&rt, "DOOR", true));
+    // Правило без сценария и индекс за пределами правил ничего не запускают.
+    TEST_ASSERT_NULL(dm_flag_trigger_runtime_handle_rule(&rt, 1, true));
+    TEST_ASSERT_NULL(dm_flag_trigger_runtime_handle_rule(&rt, 5, true));
+}
+
+typedef struct {
+    uint32_t id;
+    char name[36];
+} arena_item_t;
+
+static void test_runtime_arena_packs_items_and_reuses_freed_slots(void)
+{
+    dm_runtime_arena_t arena = DM_RUNTIME_ARENA_INIT(sizeof(arena_item_t));
+    arena_item_t *a = dm_runtime_arena_alloc(&arena);
+    arena_item_t *b = dm_runtime_arena_alloc(&arena);
+    arena_item_t *c = dm_runtime_arena_alloc(&arena);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_NOT_NULL(c);
+    // Один блок, записи подряд с одинаковым шагом.
+    TEST_ASSERT_EQUAL_UINT32(1, arena.block_count);
+    TEST_ASSERT_TRUE((char *)b > (char *)a);
+    TEST_ASSERT_EQUAL_INT((char *)b - (char *)a, (char *)c - (char *)b);
+    TEST_ASSERT_EQUAL_UINT32(3, arena.live);
+
+    b->id = 7;
+    dm_runtime_arena_free(&arena, b);
+    TEST_ASSERT_EQUAL_UINT32(2, arena.live);
+    arena_item_t *d = dm_runtime_arena_alloc(&arena);
+    TEST_ASSERT_EQUAL_PTR(b, d);
+    TEST_ASSERT_EQUAL_UINT32(0, d->id);
+    dm_runtime_arena_release(&arena);
+    TEST_ASSERT_EQUAL_UINT32(0, arena.block_count);
+}
+
+static void test_runtime_arena_reset_reuses_blocks(void)
+{
+    dm_runtime_arena_t arena = DM_RUNTIME_ARENA_INIT(sizeof(arena_item_t));
+    arena_item_t *first = NULL;
+    for (int i = 0; i <= DEVICE_MANAGER_MAX_DEVICES; ++i) {
+        arena_item_t *item = dm_runtime_arena_alloc(&arena);
+        TEST_ASSERT_NOT_NULL(item);
+        if (!first) {
+            first = item;
+        }
+    }
+    // Блок маленьких записей вмещает не больше устройств, чем в конфигурации.
+    TEST_ASSERT_EQUAL_UINT32(2, arena.block_count);
+
+    dm_runtime_arena_reset(&arena);
+    TEST_ASSERT_EQUAL_UINT32(0, arena.live);
+    TEST_ASSERT_EQUAL_PTR(first, dm_runtime_arena_alloc(&arena));
+    for (int i = 0; i < DEVICE_MANAGER_MAX_DEVICES; ++i) {
+        TEST_ASSERT_NOT_NULL(dm_runtime_arena_alloc(&arena));
+    }
+    TEST_ASSERT_EQUAL_UINT32(2, arena.block_count);
+    dm_runtime_arena_release(&arena);
+}
+
+typedef struct {
+    dm_runtime_wheel_t *wheel;
+    dm_runtime_timer_t *victim;
+    int fired;
+} wheel_probe_t;
+
+static void wheel_probe_cb(void *arg)
+{
+    wheel_probe_t *probe = arg;
+    probe->fired++;
+    if (probe->victim) {
+        dm_runtime_wheel_cancel(probe->wheel, probe->victim);
+    }
+}
+
+static void test_runtime_wheel_fires_one_shot_and_periodic_timers(void)
+{
+    dm_runtime_wheel_t wheel;
+    dm_runtime_wheel_init(&wheel, 1000);
+    wheel_probe_t once = {0};
+    wheel_probe_t every = {0};
+    dm_runtime_timer_t t_once;
+    dm_runtime_timer_t t_every;
+    dm_runtime_timer_init(&t_once, wheel_probe_cb, &once);
+    dm_runtime_timer_init(&t_every, wheel_probe_cb, &every);
+    dm_runtime_wheel_schedule(&wheel, &t_once, 1000, 45, 0);
+    dm_runtime_wheel_schedule(&wheel, &t_every, 1000, 100, 100);
+
+    uint64_t deadline = 0;
+    TEST_ASSERT_TRUE(dm_runtime_wheel_next_deadline(&wheel, &deadline));
+    TEST_ASSERT_EQUAL_UINT32(1050, (uint32_t)deadline);
+    TEST_ASSERT_EQUAL_UINT32(0, dm_runtime_wheel_advance(&wheel, 1049));
+    TEST_ASSERT_EQUAL_UINT32(1, dm_runtime_wheel_advance(&wheel, 1050));
+    TEST_ASSERT_FALSE(dm_runtime_timer_armed(&t_once));
+
+    for (uint64_t now = 1060; now <= 1350; now += DM_RUNTIME_WHEEL_TICK_MS) {
+        dm_runtime_wheel_advance(&wheel, now);
+    }
+    TEST_ASSERT_EQUAL_INT(1, once.fired);
+    TEST_ASSERT_EQUAL_INT(3, every.fired);
+    TEST_ASSERT_TRUE(dm_runtime_timer_armed(&t_every));
+
+    dm_runtime_wheel_cancel(&wheel, &t_every);
+    TEST_ASSERT_EQUAL_UINT32(0, dm_runtime_wheel_advance(&wheel, 2000));
+    TEST_ASSERT_FALSE(dm_runtime_wheel_next_deadline(&wheel, &deadline));
+}
+
+static void test_runtime_wheel_callback_may_cancel_due_timer(void)
+{
+    dm_runtime_wheel_t wheel;
+    dm_runtime_wheel_init(&wheel, 0);
+    wheel_probe_t first = {.wheel = &wheel};
+    wheel_probe_t second = {0};
+    dm_runtime_timer_t t_first;
+    dm_runtime_timer_t t_second;
+    dm_runtime_timer_init(&t_first, wheel_probe_cb, &first);
+    dm_runtime_timer_init(&t_second, wheel_probe_cb, &second);
+    dm_runtime_wheel_schedule(&wheel, &t_first, 0, 50, 0);
+    dm_runtime_wheel_schedule(&wheel, &t_second, 0, 50, 0);
+    // Оба срока наступают в одном продвижении; тот, кого вызовут первым, отменяет второго.
+    first.victim = &t_second;
+    second.wheel = &wheel;
+    second.victim = &t_first;
+
+    TEST_ASSERT_EQUAL_UINT32(1, dm_runtime_wheel_advance(&wheel, 100));
+    TEST_ASSERT_EQUAL_INT(1, first.fired + second.fired);
+    TEST_ASSERT_FALSE(dm_runtime_timer_armed(&t_first));
+    TEST_ASSERT_FALSE(dm_runtime_timer_armed(&t_second));
+}
+
+static void test_runtime_wheel_handles_deadlines_beyond_one_turn(void)
+{
+    dm_runtime_wheel_t wheel;
+    dm_runtime_wheel_init(&wheel, 0);
+    wheel_probe_t far = {0};
+    dm_runtime_timer_t t_far;
+    dm_runtime_timer_init(&t_far, wheel_probe_cb, &far);
+    const uint32_t turn_ms = DM_RUNTIME_WHEEL_SLOTS * DM_RUNTIME_WHEEL_TICK_MS;
+    dm_runtime_wheel_schedule(&wheel, &t_far, 0, 3 * turn_ms + 20, 0);
+
+    // Слот таймера проходит несколько раз, но срабатывает только настоящий срок.
+    for (uint64_t now = 0; now < 3 * turn_ms + 20; now += DM_RUNTIME_WHEEL_TICK_MS) {
+        dm_runtime_wheel_advance(&wheel, now);
+    }
+    TEST_ASSERT_EQUAL_INT(0, far.fired);
+    // Задача планировщика могла долго не просыпаться: скачок больше оборота.
+    dm_runtime_wheel_schedule(&wheel, &t_far, 3 * turn_ms, 50, 0);
+    TEST_ASSERT_EQUAL_UINT32(1, dm_runtime_wheel_advance(&wheel, 10 * turn_ms));
+    TEST_ASSERT_EQUAL_INT(1, far.fired);
+}
+
 void register_runtime_pure_tests(void)
 {
     RUN_TEST(test_sequence_runtime_ignores_unrelated_topics);
@@ -368,4 +605,12 @@ void register_runtime_pure_tests(void)
     RUN_TEST(test_signal_runtime_completes_exactly_on_boundary);
     RUN_TEST(test_signal_runtime_tick_after_completion_is_noop);
     RUN_TEST(test_signal_runtime_set_template_resets_state);
+    RUN_TEST(test_condition_runtime_counters_follow_rule_updates);
+    RUN_TEST(test_condition_runtime_handle_flag_matches_by_name_case_insensitive);
+    RUN_TEST(test_flag_trigger_runtime_rule_fires_only_on_change_to_required_state);
+    RUN_TEST(test_runtime_arena_packs_items_and_reuses_freed_slots);
+    RUN_TEST(test_runtime_arena_reset_reuses_blocks);
+    RUN_TEST(test_runtime_wheel_fires_one_shot_and_periodic_timers);
+    RUN_TEST(test_runtime_wheel_callback_may_cancel_due_timer);
+    RUN_TEST(test_runtime_wheel_handles_deadlines_beyond_one_turn);
 }
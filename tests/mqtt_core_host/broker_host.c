@@ -0,0 +1,37 @@
+#include "broker_host.h"
+
+#include <signal.h>
+#include <string.h>
+
+#include "config_store.h"
+#include "esp_log.h"
+#include "event_bus.h"
+#include "mqtt_core.h"
+
+static const char *TAG = "broker_host";
+
+esp_err_t broker_host_start(int port)
+{
+    // Закрытый клиентом сокет не должен ронять процесс на send().
+    signal(SIGPIPE, SIG_IGN);
+
+    app_config_t cfg;
+    memcpy(&cfg, config_store_get(), sizeof(cfg));
+    cfg.mqtt.port = port;
+    config_store_set(&cfg);
+
+    esp_err_t err = event_bus_init();
+    if (err == ESP_OK) {
+        err = event_bus_start();
+    }
+    if (err == ESP_OK) {
+        err = mqtt_core_init();
+    }
+    if (err == ESP_OK) {
+        err = mqtt_core_start();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "broker start failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_err.h"
+
+// Запустить event_bus и mqtt_core в текущем процессе на указанном TCP порту.
+esp_err_t broker_host_start(int port);
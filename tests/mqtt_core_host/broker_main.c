@@ -0,0 +1,47 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "broker_host.h"
+#include "event_bus.h"
+#include "event_bus_trace.h"
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    s_stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+    int port = argc > 1 ? atoi(argv[1]) : 1883;
+    if (broker_host_start(port) != ESP_OK) {
+        return 1;
+    }
+    // BROKER_EVENT_TRACE=<файл> - записывать трассу шины событий до SIGINT/SIGTERM (см. event_replay).
+    const char *trace = getenv("BROKER_EVENT_TRACE");
+    if (trace && event_trace_record_start(trace) != ESP_OK) {
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("mqtt_core host broker listening on %d\n", port);
+    fflush(stdout);
+    while (!s_stop) {
+        pause();
+    }
+    if (trace) {
+        event_trace_status_t st;
+        event_trace_record_stop(&st);
+        printf("event trace %s: %u records, %u lost\n", trace, (unsigned)st.records, (unsigned)st.lost);
+    }
+    // Итоговые счетчики шины (давление, потери, высота колец) - тот же JSON, что в /api/status.
+    static char metrics[EVENT_BUS_METRICS_MAX_LEN];
+    if (event_bus_format_metrics(metrics, sizeof(metrics)) > 0) {
+        printf("event bus %s\n", metrics);
+    }
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#endif
+
+#include "mqtt_core_internal.h"
+#include "topic_intern.h"
+
+// Микробенчмарк кодека mqtt_core: remaining length, строки MQTT, сопоставление фильтров, сборка PUBLISH,
+// промах topic_intern_find (как в handle_publish для топика без подписчиков).
+// Каждый случай сначала проверяется на корректность, затем замеряется: ns/op и cycles/op (TSC на x86).
+
+static volatile uint64_t s_sink;
+static long s_iters = 2000000;
+static int s_failures = 0;
+
+typedef struct {
+    double ns_per_op;
+    double cycles_per_op;
+} bench_result_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef BENCH_HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void report(const char *group, const char *name, bench_result_t r)
+{
+#ifdef BENCH_HAVE_CYCLES
+    printf("%-10s %-34s %8.2f ns/op %8.1f cycles/op\n", group, name, r.ns_per_op, r.cycles_per_op);
+#else
+    printf("%-10s %-34s %8.2f ns/op        n/a cycles/op\n", group, name, r.ns_per_op);
+#endif
+}
+
+static void expect(bool ok, const char *group, const char *name)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL %s %s: unexpected result\n", group, name);
+        s_failures++;
+    }
+}
+
+// Скрыть значение от оптимизатора, чтобы вызов с неизменными аргументами не выносился из цикла.
+#define OPAQUE(x) ({ __asm__ volatile("" : "+r"(x)); })
+
+// expr вычисляется s_iters раз; сумма результатов уходит в s_sink один раз после замера.
+#define BENCH_LOOP(result, expr)                                         \
+    do {                                                                 \
+        uint64_t acc_ = 0;                                               \
+        for (long warm_ = 0; warm_ < s_iters / 10; ++warm_) {            \
+            acc_ += (uint64_t)(expr);                                    \
+            OPAQUE(acc_);                                                \
+        }                                                                \
+        uint64_t c0_ = cycles();                                         \
+        uint64_t t0_ = now_ns();                                         \
+        for (long i_ = 0; i_ < s_iters; ++i_) {                          \
+            acc_ += (uint64_t)(expr);                                    \
+            OPAQUE(acc_);                                                \
+        }                                                                \
+        uint64_t t1_ = now_ns();                                         \
+        uint64_t c1_ = cycles();                                         \
+        s_sink += acc_;                                                  \
+        (result).ns_per_op = (double)(t1_ - t0_) / (double)s_iters;      \
+        (result).cycles_per_op = (double)(c1_ - c0_) / (double)s_iters;  \
+    } while (0)
+
+static void bench_remaining_length(void)
+{
+    static const struct {
+        const char *name;
+        size_t value;
+        size_t bytes;
+    } cases[] = {
+        {"1 byte (100)", 100, 1},
+        {"2 bytes (300)", 300, 2},
+        {"2 bytes (16383)", 16383, 2},
+        {"3 bytes (16384)", 16384, 3},
+        {"4 bytes (2097152)", 2097152, 4},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        uint8_t out[4];
+        size_t n = encode_remaining_length(out, cases[c].value);
+        size_t decoded = 0;
+        for (size_t i = 0; i < n; ++i) {
+            decoded |= (size_t)(out[i] & 0x7F) << (7 * i);
+        }
+        expect(n == cases[c].bytes && decoded == cases[c].value, "remlen", cases[c].name);
+
+        bench_result_t r;
+        size_t value = cases[c].value;
+        BENCH_LOOP(r, (OPAQUE(value), encode_remaining_length(out, value) + out[0]));
+        report("remlen", cases[c].name, r);
+    }
+}
+
+static size_t put_str(uint8_t *buf, const char *s)
+{
+    size_t len = strlen(s);
+    buf[0] = (uint8_t)(len >> 8);
+    buf[1] = (uint8_t)(len & 0xFF);
+    memcpy(buf + 2, s, len);
+    return 2 + len;
+}
+
+static void bench_utf8_str(void)
+{
+    static const struct {
+        const char *name;
+        size_t len;
+    } cases[] = {
+        {"8 chars", 8},
+        {"32 chars", 32},
+        {"95 chars (MQTT_MAX_TOPIC-1)", MQTT_MAX_TOPIC - 1},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        char src[MQTT_MAX_TOPIC];
+        memset(src, 'a', cases[c].len);
+        src[cases[c].len] = 0;
+        uint8_t buf[MQTT_MAX_TOPIC + 2];
+        size_t len = put_str(buf, src);
+        char out[MQTT_MAX_TOPIC];
+        size_t off = 0;
+        expect(parse_utf8_str(buf, len, &off, out, sizeof(out)) == 0 && off == len && strcmp(out, src) == 0,
+               "utf8", cases[c].name);
+
+        bench_result_t r;
+        size_t o = 0;
+        BENCH_LOOP(r, (o = 0, OPAQUE(len), parse_utf8_str(buf, len, &o, out, sizeof(out)) + o + (uint8_t)out[0]));
+        report("utf8", cases[c].name, r);
+    }
+}
+
+static void bench_topic_match(void)
+{
+    static const struct {
+        const char *name;
+        const char *filter;
+        const char *topic;
+        bool match;
+    } cases[] = {
+        {"depth2 exact", "home/temp", "home/temp", true},
+        {"depth2 '#'", "#", "home/temp", true},
+        {"depth4 exact", "home/floor1/kitchen/temp", "home/floor1/kitchen/temp", true},
+        {"depth4 '+' middle", "home/+/kitchen/temp", "home/floor1/kitchen/temp", true},
+        {"depth4 trailing '#'", "home/floor1/#", "home/floor1/kitchen/temp", true},
+        {"depth4 miss first level", "garage/floor1/kitchen/temp", "home/floor1/kitchen/temp", false},
+        {"depth4 miss last level", "home/floor1/kitchen/hum", "home/floor1/kitchen/temp", false},
+        {"depth8 exact", "a1/b2/c3/d4/e5/f6/g7/h8", "a1/b2/c3/d4/e5/f6/g7/h8", true},
+        {"depth8 '+' x3", "a1/+/c3/+/e5/+/g7/h8", "a1/b2/c3/d4/e5/f6/g7/h8", true},
+        {"depth8 '+' then '#'", "a1/+/c3/#", "a1/b2/c3/d4/e5/f6/g7/h8", true},
+        {"depth8 miss last level", "a1/b2/c3/d4/e5/f6/g7/x8", "a1/b2/c3/d4/e5/f6/g7/h8", false},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        const char *filter = cases[c].filter;
+        const char *topic = cases[c].topic;
+        expect(topic_matches_filter(filter, topic) == cases[c].match, "match", cases[c].name);
+
+        bench_result_t r;
+        BENCH_LOOP(r, (OPAQUE(filter), OPAQUE(topic), topic_matches_filter(filter, topic)));
+        report("match", cases[c].name, r);
+    }
+}
+
+static void bench_frame_publish(void)
+{
+    static const struct {
+        const char *name;
+        size_t payload;
+        uint8_t qos;
+    } cases[] = {
+        {"qos0 payload 16", 16, 0},
+        {"qos0 payload 80 (1-byte remlen)", 80, 0},
+        {"qos1 payload 256", 256, 1},
+        {"qos1 payload 900", 900, 1},
+    };
+    static const char topic[] = "home/floor1/kitchen/temp";
+    size_t topic_len = sizeof(topic) - 1;
+    uint8_t buf[MQTT_MAX_PACKET];
+    char payload[MQTT_MAX_PACKET];
+    memset(payload, 'p', sizeof(payload));
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        size_t plen = cases[c].payload;
+        uint8_t qos = cases[c].qos;
+        size_t len = frame_publish(buf, sizeof(buf), topic, topic_len, payload, plen, qos, false, 0x1234);
+        size_t rem = 2 + topic_len + plen + (qos ? 2 : 0);
+        size_t hdr = 1 + (rem < 128 ? 1 : 2);
+        expect(len == hdr + rem && buf[0] == (uint8_t)(0x30 | (qos << 1)) &&
+                   memcmp(buf + hdr + 2, topic, topic_len) == 0,
+               "publish", cases[c].name);
+
+        bench_result_t r;
+        BENCH_LOOP(r, (OPAQUE(plen),
+                       frame_publish(buf, sizeof(buf), topic, topic_len, payload, plen, qos, false, 0x1234) +
+                           buf[len - 1]));
+        report("publish", cases[c].name, r);
+    }
+    expect(frame_publish(buf, sizeof(buf), topic, topic_len, payload, MQTT_MAX_PACKET, 0, false, 0) == 0, "publish",
+           "oversized payload rejected");
+}
+
+// Промах поиска до и после того, как вся таблица побывала занятой: освобожденные слоты
+// должны снова становиться пустыми, иначе промах просматривает все TOPIC_INTERN_CAPACITY слотов.
+static void bench_intern_miss(void)
+{
+    enum { LIVE = 32 };
+    static topic_id_t ids[TOPIC_INTERN_CAPACITY];
+    char topic[48];
+    const char *miss = "sensors/unsubscribed/topic";
+    for (size_t i = 0; i < LIVE; ++i) {
+        snprintf(topic, sizeof(topic), "live/%u", (unsigned)i);
+        ids[i] = topic_intern_acquire(topic);
+    }
+    expect(topic_intern_find(miss) == TOPIC_ID_NONE, "intern", "miss before churn");
+    bench_result_t r;
+    BENCH_LOOP(r, (OPAQUE(miss), topic_intern_find(miss)));
+    report("intern", "find miss, fresh table", r);
+
+    // Заполнить таблицу до отказа и освободить все, кроме LIVE живых записей.
+    size_t filled = LIVE;
+    for (size_t i = 0; filled < TOPIC_INTERN_CAPACITY; ++i) {
+        snprintf(topic, sizeof(topic), "churn/%u", (unsigned)i);
+        topic_id_t id = topic_intern_acquire(topic);
+        if (id == TOPIC_ID_NONE) {
+            break;
+        }
+        ids[filled++] = id;
+    }
+    expect(filled == TOPIC_INTERN_CAPACITY, "intern", "table filled");
+    for (size_t i = LIVE; i < filled; ++i) {
+        topic_intern_release(ids[i]);
+    }
+    expect(topic_intern_count() == LIVE && topic_intern_find(miss) == TOPIC_ID_NONE &&
+               topic_intern_find("live/7") == ids[7] && topic_intern_find("churn/3") == TOPIC_ID_NONE,
+           "intern", "find after churn");
+    BENCH_LOOP(r, (OPAQUE(miss), topic_intern_find(miss)));
+    report("intern", "find miss, after full churn", r);
+    for (size_t i = 0; i < LIVE; ++i) {
+        topic_intern_release(ids[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        s_iters = strtol(argv[1], NULL, 10);
+        if (s_iters <= 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+    printf("mqtt_core codec, %ld iterations per case\n", s_iters);
+    bench_remaining_length();
+    bench_utf8_str();
+    bench_topic_match();
+    bench_frame_publish();
+    bench_intern_miss();
+    if (s_failures) {
+        printf("CODEC BENCH FAIL (%d)\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
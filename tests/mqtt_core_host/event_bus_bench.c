@@ -0,0 +1,537 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_bus.h"
+#include "event_bus_internal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+// Шина под нагрузкой многих производителей: event_bus_post (MPSC кольцо, пачки, task notify) против
+// прежней схемы - очередь FreeRTOS с указателем блока и пробуждением на каждое сообщение.
+// На host очередь - mutex + cond из shim, поэтому сравнение показательно, а не точно.
+// Последний прогон - управляющие события (EVENT_SCENARIO_TRIGGER) на фоне потока телеметрии:
+// ни одно не должно потеряться, задержка от post до обработчика печатается как p50/p99/max.
+// Затем тот же поток телеметрии в медленный асинхронный обработчик, которому между делом приходят
+// EVENT_FLAG_CHANGED: телеметрия для него отбрасывается, флаги - ни один; печатается их задержка.
+// Потом слияние: производители шлют EVENT_SYSTEM_STATUS с растущим номером в свои topic;
+// обработчик должен получить меньше сообщений, чем отправлено, и последний номер каждого topic.
+// В конце - дрожание периодического esp_timer, колбэк которого публикует управляющие события в
+// перегруженную шину: event_bus_post с ожиданием 100 мс против event_bus_post_nowait.
+// Итог - счетчики event_bus_get_stats за все прогоны; принятое = переданное + замененное слиянием.
+
+#define BENCH_MAX_PRODUCERS 64
+#define BENCH_CONTROL_EVENTS 2000
+#define BENCH_FLOOD_PRODUCERS 16
+#define BENCH_STATUS_PRODUCERS 4
+#define BENCH_STATUS_TOPICS_PER_PRODUCER 2
+#define BENCH_STATUS_TOPICS (BENCH_STATUS_PRODUCERS * BENCH_STATUS_TOPICS_PER_PRODUCER)
+#define BENCH_TIMER_TICKS 200
+#define BENCH_TIMER_PERIOD_US 1000
+#define BENCH_TIMER_POSTS_PER_TICK 4
+#define BENCH_STALL_HANDLER_US 1000
+#define BENCH_ASYNC_FLAGS 500
+#define BENCH_ASYNC_DEPTH 32
+#define BENCH_ASYNC_TELEMETRY_US 50
+
+static long s_total = 200000;
+static uint64_t s_delivered;
+static QueueHandle_t s_baseline_queue;
+static uint64_t s_control_latency_ns[BENCH_CONTROL_EVENTS];
+static uint32_t s_control_seen;
+static bool s_flooding;
+static long s_status_last[BENCH_STATUS_TOPICS];
+static uint64_t s_status_delivered;
+
+typedef struct {
+    bool nowait;
+    int64_t start_us;
+    uint32_t ticks;
+    uint32_t posted;
+    uint32_t failed;
+    int64_t lateness_us[BENCH_TIMER_TICKS];
+} timer_run_t;
+
+static timer_run_t s_timer_run;
+static uint32_t s_stall_handled;
+static uint64_t s_flag_latency_ns[BENCH_ASYNC_FLAGS];
+static uint32_t s_flag_seen;
+
+typedef struct {
+    bool baseline;
+    long count;
+    uint64_t post_ns;
+    uint32_t failed;
+} producer_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void count_handler(const event_bus_message_t *msg)
+{
+    (void)msg;
+    __atomic_add_fetch(&s_delivered, 1, __ATOMIC_RELAXED);
+}
+
+// payload - номер события и время post в ns.
+static void control_handler(const event_bus_message_t *msg)
+{
+    unsigned long idx = 0;
+    unsigned long long sent = 0;
+    if (sscanf(msg->payload, "%lu %llu", &idx, &sent) == 2 && idx < BENCH_CONTROL_EVENTS) {
+        s_control_latency_ns[idx] = now_ns() - sent;
+        __atomic_add_fetch(&s_control_seen, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// topic "bench/status/<n>", payload - номер значения.
+static void status_handler(const event_bus_message_t *msg)
+{
+    unsigned topic = 0;
+    long value = 0;
+    if (sscanf(msg->topic, "bench/status/%u", &topic) == 1 && topic < BENCH_STATUS_TOPICS &&
+        sscanf(msg->payload, "%ld", &value) == 1) {
+        if (value > s_status_last[topic]) {
+            __atomic_store_n(&s_status_last[topic], value, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&s_status_delivered, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Медленный управляющий обработчик: шина разбирает 1000 событий/с, таймер дает 4000.
+static void stall_handler(const event_bus_message_t *msg)
+{
+    if (strcmp(msg->topic, "bench/stall") == 0) {
+        usleep(BENCH_STALL_HANDLER_US);
+        __atomic_add_fetch(&s_stall_handled, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Асинхронный: телеметрия стоит BENCH_ASYNC_TELEMETRY_US, флаг "bench/flag/<n>" несет время post в ns.
+static void async_handler(const event_bus_message_t *msg)
+{
+    unsigned idx = 0;
+    unsigned long long sent = 0;
+    if (msg->type == EVENT_MQTT_MESSAGE) {
+        usleep(BENCH_ASYNC_TELEMETRY_US);
+    } else if (sscanf(msg->topic, "bench/flag/%u", &idx) == 1 && idx < BENCH_ASYNC_FLAGS &&
+               sscanf(msg->payload, "%llu", &sent) == 1) {
+        s_flag_latency_ns[idx] = now_ns() - sent;
+        __atomic_add_fetch(&s_flag_seen, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void timer_cb(void *arg)
+{
+    timer_run_t *run = arg;
+    uint32_t tick = run->ticks;
+    if (tick >= BENCH_TIMER_TICKS) {
+        return;
+    }
+    int64_t due = run->start_us + (int64_t)(tick + 1) * BENCH_TIMER_PERIOD_US;
+    run->lateness_us[tick] = esp_timer_get_time() - due;
+    event_bus_message_t msg = {.type = EVENT_CARD_BAD, .topic = "bench/stall", .payload = "x"};
+    for (int i = 0; i < BENCH_TIMER_POSTS_PER_TICK; ++i) {
+        esp_err_t err = run->nowait ? event_bus_post_nowait(&msg) : event_bus_post(&msg, pdMS_TO_TICKS(100));
+        if (err == ESP_OK) {
+            run->posted++;
+        } else {
+            run->failed++;
+        }
+    }
+    __atomic_store_n(&run->ticks, tick + 1, __ATOMIC_RELEASE);
+}
+
+static void *baseline_consumer(void *arg)
+{
+    (void)arg;
+    event_bus_block_t *block = NULL;
+    while (xQueueReceive(s_baseline_queue, &block, portMAX_DELAY) == pdTRUE) {
+        if (!block) {
+            break;
+        }
+        count_handler(&block->msg);
+        event_bus_block_release(block);
+    }
+    return NULL;
+}
+
+static void *producer_thread(void *arg)
+{
+    producer_t *p = arg;
+    event_bus_message_t msg = {
+        .type = EVENT_FLAG_CHANGED,
+        .topic = "bench/flag",
+        .payload = "true",
+    };
+    uint64_t start = now_ns();
+    for (long i = 0; i < p->count; ++i) {
+        if (p->baseline) {
+            event_bus_block_t *block = event_bus_block_create(&msg);
+            if (!block || xQueueSend(s_baseline_queue, &block, portMAX_DELAY) != pdTRUE) {
+                event_bus_block_release(block);
+                p->failed++;
+            }
+        } else if (event_bus_post(&msg, portMAX_DELAY) != ESP_OK) {
+            p->failed++;
+        }
+    }
+    p->post_ns = now_ns() - start;
+    return NULL;
+}
+
+static int run(int producers, bool baseline)
+{
+    pthread_t threads[BENCH_MAX_PRODUCERS];
+    producer_t prod[BENCH_MAX_PRODUCERS] = {0};
+    pthread_t consumer;
+    __atomic_store_n(&s_delivered, 0, __ATOMIC_RELAXED);
+    if (baseline) {
+        pthread_create(&consumer, NULL, baseline_consumer, NULL);
+    }
+    long expected = (s_total / producers) * producers;
+    uint64_t start = now_ns();
+    for (int i = 0; i < producers; ++i) {
+        prod[i].baseline = baseline;
+        prod[i].count = s_total / producers;
+        pthread_create(&threads[i], NULL, producer_thread, &prod[i]);
+    }
+    uint64_t post_ns = 0;
+    uint32_t failed = 0;
+    for (int i = 0; i < producers; ++i) {
+        pthread_join(threads[i], NULL);
+        post_ns += prod[i].post_ns;
+        failed += prod[i].failed;
+    }
+    uint64_t deadline = now_ns() + 5000000000ull;
+    while (__atomic_load_n(&s_delivered, __ATOMIC_RELAXED) < (uint64_t)(expected - failed) && now_ns() < deadline) {
+        sched_yield();
+    }
+    uint64_t elapsed = now_ns() - start;
+    uint64_t delivered = __atomic_load_n(&s_delivered, __ATOMIC_RELAXED);
+    if (baseline) {
+        event_bus_block_t *stop = NULL;
+        xQueueSend(s_baseline_queue, &stop, portMAX_DELAY);
+        pthread_join(consumer, NULL);
+    }
+    printf("%-8s producers %2d: %9.0f msgs/s, %7.1f ns/post, delivered %llu of %ld\n",
+           baseline ? "queue" : "ring", producers, (double)delivered * 1e9 / (double)elapsed,
+           (double)post_ns / (double)expected, (unsigned long long)delivered, expected);
+    if (failed || delivered != (uint64_t)expected) {
+        fprintf(stderr, "FAIL %s producers %d: delivered %llu of %ld (failed posts %u)\n", baseline ? "queue" : "ring",
+                producers, (unsigned long long)delivered, expected, failed);
+        return 1;
+    }
+    return 0;
+}
+
+static void *flood_thread(void *arg)
+{
+    (void)arg;
+    event_bus_message_t msg = {
+        .type = EVENT_MQTT_MESSAGE,
+        .topic = "bench/telemetry",
+        .payload = "telemetry",
+    };
+    while (__atomic_load_n(&s_flooding, __ATOMIC_RELAXED)) {
+        event_bus_post(&msg, pdMS_TO_TICKS(100));
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_control_under_flood(void)
+{
+    pthread_t flood[BENCH_FLOOD_PRODUCERS];
+    __atomic_store_n(&s_control_seen, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_flooding, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < BENCH_FLOOD_PRODUCERS; ++i) {
+        pthread_create(&flood[i], NULL, flood_thread, NULL);
+    }
+    uint32_t control_drops = event_bus_drop_count(EVENT_BUS_PRIO_CONTROL);
+    uint32_t telemetry_drops = event_bus_drop_count(EVENT_BUS_PRIO_TELEMETRY);
+    uint32_t failed = 0;
+    for (unsigned long i = 0; i < BENCH_CONTROL_EVENTS; ++i) {
+        char payload[48];
+        snprintf(payload, sizeof(payload), "%lu %llu", i, (unsigned long long)now_ns());
+        event_bus_message_t msg = {.type = EVENT_SCENARIO_TRIGGER, .topic = "bench/scenario", .payload = payload};
+        if (event_bus_post(&msg, 0) != ESP_OK) {
+            failed++;
+        }
+        sched_yield();
+    }
+    uint64_t deadline = now_ns() + 5000000000ull;
+    while (__atomic_load_n(&s_control_seen, __ATOMIC_RELAXED) < BENCH_CONTROL_EVENTS - failed && now_ns() < deadline) {
+        sched_yield();
+    }
+    __atomic_store_n(&s_flooding, false, __ATOMIC_RELAXED);
+    for (int i = 0; i < BENCH_FLOOD_PRODUCERS; ++i) {
+        pthread_join(flood[i], NULL);
+    }
+    control_drops = event_bus_drop_count(EVENT_BUS_PRIO_CONTROL) - control_drops;
+    telemetry_drops = event_bus_drop_count(EVENT_BUS_PRIO_TELEMETRY) - telemetry_drops;
+    uint32_t seen = __atomic_load_n(&s_control_seen, __ATOMIC_RELAXED);
+    qsort(s_control_latency_ns, BENCH_CONTROL_EVENTS, sizeof(uint64_t), cmp_u64);
+    printf("control under %d-producer telemetry flood: %u of %d delivered, control drops %u, telemetry drops %u, "
+           "latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           BENCH_FLOOD_PRODUCERS, seen, BENCH_CONTROL_EVENTS, control_drops, telemetry_drops,
+           (double)s_control_latency_ns[BENCH_CONTROL_EVENTS / 2] / 1000.0,
+           (double)s_control_latency_ns[BENCH_CONTROL_EVENTS * 99 / 100] / 1000.0,
+           (double)s_control_latency_ns[BENCH_CONTROL_EVENTS - 1] / 1000.0);
+    if (failed || control_drops || seen != BENCH_CONTROL_EVENTS) {
+        fprintf(stderr, "FAIL control events lost under telemetry flood (failed posts %u)\n", failed);
+        return 1;
+    }
+    return 0;
+}
+
+static bool find_handler(const char *name, event_bus_handler_stats_t *out)
+{
+    event_bus_handler_stats_t stats[16];
+    size_t count = event_bus_get_handler_stats(stats, 16);
+    for (size_t i = 0; i < count && i < 16; ++i) {
+        if (strcmp(stats[i].name, name) == 0) {
+            *out = stats[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static int run_async_flags_under_flood(void)
+{
+    const event_bus_subscribe_opts_t opts = {.name = "bench_async", .depth = BENCH_ASYNC_DEPTH};
+    event_bus_mask_t types = EVENT_BUS_MASK(EVENT_MQTT_MESSAGE) | EVENT_BUS_MASK(EVENT_FLAG_CHANGED);
+    if (event_bus_subscribe_ex(types, async_handler, &opts) != ESP_OK) {
+        fprintf(stderr, "FAIL async subscribe\n");
+        return 1;
+    }
+    pthread_t flood[BENCH_FLOOD_PRODUCERS];
+    __atomic_store_n(&s_flooding, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < BENCH_FLOOD_PRODUCERS; ++i) {
+        pthread_create(&flood[i], NULL, flood_thread, NULL);
+    }
+    uint32_t failed = 0;
+    for (unsigned i = 0; i < BENCH_ASYNC_FLAGS; ++i) {
+        char topic[32];
+        char payload[24];
+        snprintf(topic, sizeof(topic), "bench/flag/%u", i);
+        snprintf(payload, sizeof(payload), "%llu", (unsigned long long)now_ns());
+        event_bus_message_t msg = {.type = EVENT_FLAG_CHANGED, .topic = topic, .payload = payload};
+        if (event_bus_post(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
+            failed++;
+        }
+        usleep(200);
+    }
+    uint64_t deadline = now_ns() + 5000000000ull;
+    while (__atomic_load_n(&s_flag_seen, __ATOMIC_RELAXED) < BENCH_ASYNC_FLAGS - failed && now_ns() < deadline) {
+        usleep(1000);
+    }
+    __atomic_store_n(&s_flooding, false, __ATOMIC_RELAXED);
+    for (int i = 0; i < BENCH_FLOOD_PRODUCERS; ++i) {
+        pthread_join(flood[i], NULL);
+    }
+    event_bus_handler_stats_t st = {0};
+    find_handler("bench_async", &st);
+    uint32_t seen = __atomic_load_n(&s_flag_seen, __ATOMIC_RELAXED);
+    qsort(s_flag_latency_ns, BENCH_ASYNC_FLAGS, sizeof(uint64_t), cmp_u64);
+    printf("flags to async handler under telemetry flood: %u of %d delivered, telemetry drops %u, stalls %u, "
+           "latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           seen, BENCH_ASYNC_FLAGS, (unsigned)st.drops, (unsigned)st.stalls,
+           (double)s_flag_latency_ns[BENCH_ASYNC_FLAGS / 2] / 1000.0,
+           (double)s_flag_latency_ns[BENCH_ASYNC_FLAGS * 99 / 100] / 1000.0,
+           (double)s_flag_latency_ns[BENCH_ASYNC_FLAGS - 1] / 1000.0);
+    if (failed || seen != BENCH_ASYNC_FLAGS) {
+        fprintf(stderr, "FAIL flags lost at async handler queue (failed posts %u)\n", failed);
+        return 1;
+    }
+    if (st.drops == 0) {
+        fprintf(stderr, "FAIL telemetry flood did not fill the async handler queue\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void *status_thread(void *arg)
+{
+    int base = (int)(intptr_t)arg * BENCH_STATUS_TOPICS_PER_PRODUCER;
+    long count = s_total / BENCH_STATUS_PRODUCERS;
+    for (long i = 1; i <= count; ++i) {
+        char topic[32];
+        char payload[24];
+        snprintf(topic, sizeof(topic), "bench/status/%d", base + (int)(i % BENCH_STATUS_TOPICS_PER_PRODUCER));
+        snprintf(payload, sizeof(payload), "%ld", i);
+        event_bus_message_t msg = {.type = EVENT_SYSTEM_STATUS, .topic = topic, .payload = payload};
+        event_bus_post(&msg, portMAX_DELAY);
+    }
+    return NULL;
+}
+
+static int run_coalesce(void)
+{
+    pthread_t threads[BENCH_STATUS_PRODUCERS];
+    memset(s_status_last, 0, sizeof(s_status_last));
+    __atomic_store_n(&s_status_delivered, 0, __ATOMIC_RELAXED);
+    uint32_t coalesced = event_bus_coalesced_count();
+    long count = s_total / BENCH_STATUS_PRODUCERS;
+    uint64_t start = now_ns();
+    for (int i = 0; i < BENCH_STATUS_PRODUCERS; ++i) {
+        pthread_create(&threads[i], NULL, status_thread, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < BENCH_STATUS_PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    // Последнее значение topic k - наибольшее i <= count с i % 2 == k % 2.
+    int missing = BENCH_STATUS_TOPICS;
+    uint64_t deadline = now_ns() + 5000000000ull;
+    while (missing && now_ns() < deadline) {
+        missing = 0;
+        for (int t = 0; t < BENCH_STATUS_TOPICS; ++t) {
+            long last = count - ((count - t % BENCH_STATUS_TOPICS_PER_PRODUCER) % BENCH_STATUS_TOPICS_PER_PRODUCER);
+            if (__atomic_load_n(&s_status_last[t], __ATOMIC_RELAXED) != last) {
+                missing++;
+            }
+        }
+        sched_yield();
+    }
+    uint64_t elapsed = now_ns() - start;
+    uint64_t delivered = __atomic_load_n(&s_status_delivered, __ATOMIC_RELAXED);
+    coalesced = event_bus_coalesced_count() - coalesced;
+    long posted = count * BENCH_STATUS_PRODUCERS;
+    printf("coalesce producers %d, %d topics: %ld posted, %llu delivered, %u replaced, %9.0f posts/s\n",
+           BENCH_STATUS_PRODUCERS, BENCH_STATUS_TOPICS, posted, (unsigned long long)delivered, coalesced,
+           (double)posted * 1e9 / (double)elapsed);
+    if (missing || delivered + coalesced != (uint64_t)posted) {
+        fprintf(stderr, "FAIL coalesce: %d topics without final value, %llu delivered + %u replaced != %ld\n", missing,
+                (unsigned long long)delivered, coalesced, posted);
+        return 1;
+    }
+    return 0;
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_timer_jitter(bool nowait)
+{
+    timer_run_t *run = &s_timer_run;
+    memset(run, 0, sizeof(*run));
+    run->nowait = nowait;
+    __atomic_store_n(&s_stall_handled, 0, __ATOMIC_RELAXED);
+    esp_timer_create_args_t args = {.callback = timer_cb, .arg = run, .name = "bench_jitter"};
+    esp_timer_handle_t timer = NULL;
+    if (esp_timer_create(&args, &timer) != ESP_OK) {
+        fprintf(stderr, "FAIL timer create\n");
+        return 1;
+    }
+    run->start_us = esp_timer_get_time();
+    esp_timer_start_periodic(timer, BENCH_TIMER_PERIOD_US);
+    uint64_t deadline = now_ns() + 30000000000ull;
+    while (__atomic_load_n(&run->ticks, __ATOMIC_ACQUIRE) < BENCH_TIMER_TICKS && now_ns() < deadline) {
+        usleep(1000);
+    }
+    esp_timer_stop(timer);
+    esp_timer_delete(timer);
+    // Дождаться, пока шина разберет принятое, чтобы следующий прогон начинался с пустого кольца.
+    while (__atomic_load_n(&s_stall_handled, __ATOMIC_RELAXED) < run->posted && now_ns() < deadline) {
+        usleep(1000);
+    }
+    uint32_t ticks = __atomic_load_n(&run->ticks, __ATOMIC_ACQUIRE);
+    qsort(run->lateness_us, ticks, sizeof(int64_t), cmp_i64);
+    printf("timer %-7s %d ticks x %d posts: %u accepted, %u rejected, lateness p50 %lld us, p99 %lld us, "
+           "max %lld us\n",
+           nowait ? "nowait" : "wait100", BENCH_TIMER_TICKS, BENCH_TIMER_POSTS_PER_TICK, run->posted, run->failed,
+           (long long)run->lateness_us[ticks / 2], (long long)run->lateness_us[ticks * 99 / 100],
+           (long long)run->lateness_us[ticks - 1]);
+    if (ticks != BENCH_TIMER_TICKS || __atomic_load_n(&s_stall_handled, __ATOMIC_RELAXED) != run->posted) {
+        fprintf(stderr, "FAIL timer run %s: %u ticks, %u of %u accepted handled\n", nowait ? "nowait" : "wait100",
+                ticks, __atomic_load_n(&s_stall_handled, __ATOMIC_RELAXED), run->posted);
+        return 1;
+    }
+    return 0;
+}
+
+// Счетчики шины за все прогоны: каждое принятое сообщение либо передано обработчикам, либо заменено слиянием.
+static int report_stats(void)
+{
+    while (!event_bus_is_idle()) {
+        vTaskDelay(1);
+    }
+    event_bus_stats_t st;
+    event_bus_get_stats(&st);
+    uint64_t posted = 0;
+    uint64_t delivered = 0;
+    for (size_t t = 0; t < EVENT_TYPE_COUNT; ++t) {
+        posted += st.posted[t];
+        delivered += st.delivered[t];
+    }
+    printf("stats        posted %llu delivered %llu coalesced %u, ring hwm control %u telemetry %u\n",
+           (unsigned long long)posted, (unsigned long long)delivered, (unsigned)st.coalesced,
+           (unsigned)st.ring_hwm[EVENT_BUS_PRIO_CONTROL], (unsigned)st.ring_hwm[EVENT_BUS_PRIO_TELEMETRY]);
+    for (size_t p = 0; p < EVENT_BUS_PRIO_COUNT; ++p) {
+        printf("stats        %-9s blocked posts %u, wait total %.1f ms, max %u us, drops %u\n",
+               event_bus_prio_name((event_bus_prio_t)p), (unsigned)st.post_blocked[p],
+               st.post_blocked_us[p] / 1000.0, (unsigned)st.post_blocked_max_us[p], (unsigned)st.drops[p]);
+    }
+    if (posted != delivered + st.coalesced) {
+        printf("FAIL stats: posted != delivered + coalesced\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        s_total = strtol(argv[1], NULL, 10);
+        if (s_total <= 0) {
+            fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+            return 2;
+        }
+    }
+    s_baseline_queue = xQueueCreate(EVENT_BUS_RING_LEN, sizeof(event_bus_block_t *));
+    if (!s_baseline_queue || event_bus_init() != ESP_OK ||
+        event_bus_subscribe(EVENT_BUS_MASK(EVENT_FLAG_CHANGED), count_handler) != ESP_OK ||
+        event_bus_subscribe(EVENT_BUS_MASK(EVENT_SCENARIO_TRIGGER), control_handler) != ESP_OK ||
+        event_bus_subscribe(EVENT_BUS_MASK(EVENT_SYSTEM_STATUS), status_handler) != ESP_OK ||
+        event_bus_subscribe(EVENT_BUS_MASK(EVENT_CARD_BAD), stall_handler) != ESP_OK ||
+        event_bus_start() != ESP_OK) {
+        fprintf(stderr, "event bus init failed\n");
+        return 1;
+    }
+    static const int k_producers[] = {1, 4, 16, 64};
+    int failures = 0;
+    printf("event bus, %ld messages per run\n", s_total);
+    for (size_t i = 0; i < sizeof(k_producers) / sizeof(k_producers[0]); ++i) {
+        failures += run(k_producers[i], true);
+        failures += run(k_producers[i], false);
+    }
+    failures += run_control_under_flood();
+    failures += run_async_flags_under_flood();
+    failures += run_coalesce();
+    failures += run_timer_jitter(false);
+    failures += run_timer_jitter(true);
+    failures += report_stats();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,205 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "event_bus.h"
+#include "event_bus_trace.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+// Воспроизведение трассы шины событий на host.
+//   event_replay <trace> [speed]  - трасса (например, записанная mqtt_broker_host с BROKER_EVENT_TRACE
+//                                   или снятая на устройстве) с ускорением speed, 0 - без пауз;
+//   event_replay                  - самопроверка: записать синтетическую сессию, воспроизвести ее
+//                                   без пауз и в 10 раз быстрее и сверить доставку с записью.
+// Обработчики - счетчик в задаче шины и асинхронный с очередью, как у мостов устройства;
+// template_runtime и automation_engine в host-сборку не входят, на устройстве трасса доходит до них
+// через те же подписки.
+
+#define SELFTEST_EVENTS 2000
+#define SELFTEST_GAP_US 200
+#define SELFTEST_PACED_EVENTS 200
+#define SELFTEST_PACED_GAP_US 2000
+// Очередь асинхронного обработчика вмещает всю самопроверку: сверка доставки без потерь.
+#define REPLAY_ASYNC_DEPTH 4096
+
+static uint32_t s_inline_seen[EVENT_TYPE_COUNT];
+static uint32_t s_async_seen;
+static uint64_t s_payload_sum;
+static int s_failures = 0;
+
+static void inline_handler(const event_bus_message_t *msg)
+{
+    s_inline_seen[msg->type]++;
+    for (const char *p = msg->payload; *p; ++p) {
+        s_payload_sum += (uint8_t)*p;
+    }
+}
+
+static void async_handler(const event_bus_message_t *msg)
+{
+    (void)msg;
+    __atomic_add_fetch(&s_async_seen, 1, __ATOMIC_RELAXED);
+}
+
+static void expect(bool ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static uint32_t inline_total(void)
+{
+    uint32_t total = 0;
+    for (size_t t = 0; t < EVENT_TYPE_COUNT; ++t) {
+        total += s_inline_seen[t];
+    }
+    return total;
+}
+
+static void reset_counters(void)
+{
+    memset(s_inline_seen, 0, sizeof(s_inline_seen));
+    __atomic_store_n(&s_async_seen, 0, __ATOMIC_RELAXED);
+    s_payload_sum = 0;
+}
+
+static void print_replay(const char *label, const event_trace_replay_stats_t *st)
+{
+    printf("%-12s events=%-7u failed=%-4u trace=%8.1f ms elapsed=%8.1f ms %9u ev/s%s\n", label,
+           (unsigned)st->events, (unsigned)st->failed, st->trace_us / 1000.0, st->elapsed_us / 1000.0,
+           (unsigned)st->events_per_s, st->drained ? "" : " (not drained)");
+}
+
+static void busy_wait_us(int64_t us)
+{
+    int64_t until = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < until) {
+    }
+}
+
+static void wait_idle(void)
+{
+    while (!event_bus_is_idle()) {
+        vTaskDelay(1);
+    }
+}
+
+// Сессия из смеси типов с интервалом gap_us; возвращает сумму байт payload для сверки.
+static uint64_t record_session(const char *path, int events, int64_t gap_us, event_trace_status_t *rec)
+{
+    static const event_bus_type_t types[] = {EVENT_MQTT_MESSAGE, EVENT_FLAG_CHANGED, EVENT_SCENARIO_TRIGGER,
+                                             EVENT_CARD_OK, EVENT_RELAY_CMD};
+    uint64_t sum = 0;
+    expect(event_trace_record_start(path) == ESP_OK, "record start");
+    for (int i = 0; i < events; ++i) {
+        char topic[48];
+        char payload[64];
+        snprintf(topic, sizeof(topic), "room/%d/sensor/%d", i % 7, i % 13);
+        snprintf(payload, sizeof(payload), "{\"seq\":%d,\"value\":%d}", i, (i * 37) % 1000);
+        for (const char *p = payload; *p; ++p) {
+            sum += (uint8_t)*p;
+        }
+        event_bus_message_t msg = {
+            .type = types[i % (sizeof(types) / sizeof(types[0]))],
+            .topic = topic,
+            .payload = payload,
+            .topic_id = TOPIC_ID_NONE,
+        };
+        expect(event_bus_post(&msg, portMAX_DELAY) == ESP_OK, "record post");
+        busy_wait_us(gap_us);
+    }
+    wait_idle();
+    expect(event_trace_record_stop(rec) == ESP_OK, "record stop");
+    return sum;
+}
+
+static void selftest(void)
+{
+    char path[] = "/tmp/event_replay_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        s_failures++;
+        return;
+    }
+    close(fd);
+
+    // Без слияния: каждое записанное сообщение должно дойти до обработчиков при воспроизведении.
+    event_bus_set_coalesce_types(0);
+    event_trace_status_t rec;
+    uint64_t sum = record_session(path, SELFTEST_EVENTS, SELFTEST_GAP_US, &rec);
+    printf("recorded     records=%-7u lost=%-4u bytes=%llu\n", (unsigned)rec.records, (unsigned)rec.lost,
+           (unsigned long long)rec.bytes);
+    expect(rec.records == SELFTEST_EVENTS && rec.lost == 0, "all events recorded");
+
+    reset_counters();
+    event_trace_replay_stats_t st;
+    expect(event_trace_replay(path, 0, &st) == ESP_OK, "replay 0x");
+    print_replay("replay max", &st);
+    expect(st.events == SELFTEST_EVENTS && st.failed == 0 && st.drained, "replay 0x stats");
+    expect(inline_total() == SELFTEST_EVENTS, "replay 0x inline delivery");
+    expect(__atomic_load_n(&s_async_seen, __ATOMIC_RELAXED) == SELFTEST_EVENTS, "replay 0x async delivery");
+    expect(s_payload_sum == sum, "replay 0x payloads");
+    expect(st.trace_us >= (uint64_t)(SELFTEST_EVENTS - 1) * SELFTEST_GAP_US, "trace keeps intervals");
+
+    // Воспроизведение с темпом: 10x не быстрее записанной длительности / 10.
+    sum = record_session(path, SELFTEST_PACED_EVENTS, SELFTEST_PACED_GAP_US, &rec);
+    expect(rec.records == SELFTEST_PACED_EVENTS && rec.lost == 0, "paced events recorded");
+    reset_counters();
+    expect(event_trace_replay(path, 10, &st) == ESP_OK, "replay 10x");
+    print_replay("replay 10x", &st);
+    expect(st.events == SELFTEST_PACED_EVENTS && st.drained, "replay 10x stats");
+    expect(s_payload_sum == sum, "replay 10x payloads");
+    // Паузы короче миллисекунды накапливаются, поэтому допуск - один тик.
+    expect(st.elapsed_us + 1000 >= st.trace_us / 10, "replay 10x keeps pace");
+    expect(st.elapsed_us < st.trace_us, "replay 10x faster than 1x");
+
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    if (event_bus_init() != ESP_OK || event_bus_start() != ESP_OK) {
+        fprintf(stderr, "event bus start failed\n");
+        return 1;
+    }
+    event_bus_subscribe_opts_t opts = {.name = "replay_async", .depth = REPLAY_ASYNC_DEPTH};
+    if (event_bus_subscribe_ex(EVENT_BUS_MASK_ALL, async_handler, &opts) != ESP_OK ||
+        event_bus_subscribe_ex(EVENT_BUS_MASK_ALL, inline_handler,
+                               &(event_bus_subscribe_opts_t){.name = "replay_inline"}) != ESP_OK) {
+        fprintf(stderr, "subscribe failed\n");
+        return 1;
+    }
+
+    if (argc > 1) {
+        uint32_t speed = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+        event_trace_replay_stats_t st;
+        esp_err_t err = event_trace_replay(argv[1], speed, &st);
+        if (err != ESP_OK) {
+            fprintf(stderr, "replay failed: %s\n", esp_err_to_name(err));
+            return 1;
+        }
+        print_replay(speed ? "replay" : "replay max", &st);
+        for (size_t t = 0; t < EVENT_TYPE_COUNT; ++t) {
+            if (s_inline_seen[t]) {
+                printf("  type %-2u %u\n", (unsigned)t, (unsigned)s_inline_seen[t]);
+            }
+        }
+        return 0;
+    }
+
+    selftest();
+    if (s_failures) {
+        printf("EVENT REPLAY FAIL (%d)\n", s_failures);
+        return 1;
+    }
+    printf("event replay self-test passed\n");
+    return 0;
+}
@@ -0,0 +1,630 @@
+#include "loadgen.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LG_PACKET_MAX 2048
+#define LG_TOPIC_PREFIX "bench/"
+
+typedef struct {
+    const loadgen_opts_t *opts;
+    char client_id[32];
+    int sock;
+    int rcvbuf;
+    bool ok;
+} lg_conn_t;
+
+typedef struct {
+    lg_conn_t *conn;
+    uint64_t received;
+    uint64_t *latencies_ns;
+    size_t latency_cap;
+    size_t latency_count;
+} lg_sub_t;
+
+typedef struct {
+    lg_conn_t *conn;
+    int index;
+    uint64_t sent;
+    uint64_t done_ns;
+} lg_pub_t;
+
+static pthread_barrier_t s_start_barrier;
+static volatile int s_stop_subscribers;
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int send_all(int sock, const uint8_t *buf, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t r = send(sock, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += (size_t)r;
+    }
+    return 0;
+}
+
+// 1 - прочитано, 0 - таймаут до первого байта, -1 - ошибка/закрытие.
+static int recv_exact(int sock, uint8_t *buf, size_t len, bool allow_timeout)
+{
+    size_t got = 0;
+    while (got < len) {
+        ssize_t r = recv(sock, buf + got, len - got, 0);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (got == 0 && allow_timeout) {
+                return 0;
+            }
+            continue;
+        }
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        got += (size_t)r;
+    }
+    return 1;
+}
+
+static int read_packet(int sock, uint8_t *type, uint8_t *body, size_t cap, size_t *len, bool allow_timeout)
+{
+    uint8_t header = 0;
+    int r = recv_exact(sock, &header, 1, allow_timeout);
+    if (r <= 0) {
+        return r;
+    }
+    size_t rem = 0;
+    size_t mult = 1;
+    uint8_t enc = 0;
+    do {
+        if (recv_exact(sock, &enc, 1, false) <= 0 || mult > 128 * 128 * 128) {
+            return -1;
+        }
+        rem += (size_t)(enc & 0x7F) * mult;
+        mult *= 128;
+    } while (enc & 0x80);
+    if (rem > cap || (rem > 0 && recv_exact(sock, body, rem, false) <= 0)) {
+        return -1;
+    }
+    *type = header;
+    *len = rem;
+    return 1;
+}
+
+// Буферизованное чтение подписчика: один recv на пачку пакетов вместо трех на каждый.
+typedef struct {
+    uint8_t buf[16384];
+    size_t start;
+    size_t end;
+} lg_reader_t;
+
+// Как read_packet, но body указывает внутрь буфера и действителен до следующего вызова.
+static int reader_next(int sock, lg_reader_t *rd, uint8_t *type, const uint8_t **body, size_t *len)
+{
+    for (;;) {
+        size_t avail = rd->end - rd->start;
+        const uint8_t *p = rd->buf + rd->start;
+        if (avail >= 2) {
+            size_t rem = 0;
+            size_t mult = 1;
+            size_t idx = 1;
+            bool complete = false;
+            while (idx < avail && idx <= 4) {
+                rem += (size_t)(p[idx] & 0x7F) * mult;
+                mult *= 128;
+                if (!(p[idx++] & 0x80)) {
+                    complete = true;
+                    break;
+                }
+            }
+            if (!complete && idx > 4) {
+                return -1;
+            }
+            if (complete && idx + rem > sizeof(rd->buf)) {
+                return -1;
+            }
+            if (complete && avail >= idx + rem) {
+                *type = p[0];
+                *body = p + idx;
+                *len = rem;
+                rd->start += idx + rem;
+                return 1;
+            }
+        }
+        if (rd->start > 0) {
+            memmove(rd->buf, p, avail);
+            rd->start = 0;
+            rd->end = avail;
+        }
+        ssize_t r = recv(sock, rd->buf + rd->end, sizeof(rd->buf) - rd->end, 0);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        rd->end += (size_t)r;
+    }
+}
+
+static size_t encode_remaining(uint8_t *out, size_t len)
+{
+    size_t idx = 0;
+    do {
+        uint8_t byte = len % 128;
+        len /= 128;
+        if (len) {
+            byte |= 0x80;
+        }
+        out[idx++] = byte;
+    } while (len);
+    return idx;
+}
+
+static void set_recv_timeout(int sock, int ms)
+{
+    struct timeval tv = {.tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int loadgen_client_connect(const char *host, int port, const char *client_id, int rcvbuf)
+{
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *ai = NULL;
+    if (getaddrinfo(host, port_str, &hints, &ai) != 0 || !ai) {
+        return -1;
+    }
+    int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock >= 0 && rcvbuf > 0) {
+        // Маленькое окно приема, чтобы брокер быстро уперся в неотправленное.
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    if (sock < 0 || connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        freeaddrinfo(ai);
+        return -1;
+    }
+    freeaddrinfo(ai);
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    set_recv_timeout(sock, 5000);
+
+    uint8_t pkt[64];
+    size_t id_len = strlen(client_id);
+    if (id_len > 32) {
+        close(sock);
+        return -1;
+    }
+    size_t idx = 0;
+    pkt[idx++] = 0x10;
+    pkt[idx++] = (uint8_t)(12 + id_len);
+    static const uint8_t var_hdr[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3C};
+    memcpy(&pkt[idx], var_hdr, sizeof(var_hdr));
+    idx += sizeof(var_hdr);
+    pkt[idx++] = 0x00;
+    pkt[idx++] = (uint8_t)id_len;
+    memcpy(&pkt[idx], client_id, id_len);
+    idx += id_len;
+
+    uint8_t type = 0;
+    uint8_t body[8];
+    size_t len = 0;
+    if (send_all(sock, pkt, idx) != 0 || read_packet(sock, &type, body, sizeof(body), &len, false) <= 0 ||
+        type != 0x20 || len != 2 || body[1] != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int loadgen_client_subscribe(int sock, const char *filter)
+{
+    uint8_t pkt[LG_PACKET_MAX];
+    size_t flen = strlen(filter);
+    if (flen + 16 > sizeof(pkt)) {
+        return -1;
+    }
+    size_t idx = 0;
+    pkt[idx++] = 0x82;
+    idx += encode_remaining(&pkt[idx], 2 + 2 + flen + 1);
+    pkt[idx++] = 0x00;
+    pkt[idx++] = 0x01;
+    pkt[idx++] = (uint8_t)(flen >> 8);
+    pkt[idx++] = (uint8_t)flen;
+    memcpy(&pkt[idx], filter, flen);
+    idx += flen;
+    pkt[idx++] = 0x00;
+    uint8_t type = 0;
+    uint8_t body[8];
+    size_t len = 0;
+    if (send_all(sock, pkt, idx) != 0 || read_packet(sock, &type, body, sizeof(body), &len, false) <= 0 ||
+        type != 0x90 || len < 3 || body[2] == 0x80) {
+        return -1;
+    }
+    return 0;
+}
+
+int loadgen_client_read_publish(int sock, int timeout_ms, char *topic, size_t topic_cap, char *payload,
+                                size_t payload_cap)
+{
+    uint8_t body[LG_PACKET_MAX];
+    set_recv_timeout(sock, timeout_ms);
+    for (;;) {
+        uint8_t type = 0;
+        size_t len = 0;
+        int r = read_packet(sock, &type, body, sizeof(body), &len, true);
+        if (r <= 0) {
+            return r;
+        }
+        if ((type >> 4) != 3 || len < 2) {
+            continue;
+        }
+        size_t tlen = ((size_t)body[0] << 8) | body[1];
+        size_t off = 2 + tlen + ((type & 0x06) ? 2 : 0);
+        if (off > len || tlen >= topic_cap) {
+            return -1;
+        }
+        memcpy(topic, body + 2, tlen);
+        topic[tlen] = 0;
+        size_t plen = len - off;
+        if (plen >= payload_cap) {
+            plen = payload_cap - 1;
+        }
+        memcpy(payload, body + off, plen);
+        payload[plen] = 0;
+        return 1;
+    }
+}
+
+static void *connect_thread(void *arg)
+{
+    lg_conn_t *c = arg;
+    const loadgen_opts_t *o = c->opts;
+    c->sock = loadgen_client_connect(o->host, o->port, c->client_id, c->rcvbuf);
+    c->ok = c->sock >= 0;
+    return NULL;
+}
+
+static int subscribe(lg_conn_t *c)
+{
+    return loadgen_client_subscribe(c->sock, LG_TOPIC_PREFIX "#");
+}
+
+static void record_latency(lg_sub_t *s, uint64_t ns)
+{
+    if (s->latency_count == s->latency_cap) {
+        size_t cap = s->latency_cap ? s->latency_cap * 2 : 4096;
+        uint64_t *next = realloc(s->latencies_ns, cap * sizeof(uint64_t));
+        if (!next) {
+            return;
+        }
+        s->latencies_ns = next;
+        s->latency_cap = cap;
+    }
+    s->latencies_ns[s->latency_count++] = ns;
+}
+
+static void *subscriber_thread(void *arg)
+{
+    lg_sub_t *s = arg;
+    lg_reader_t rd;
+    rd.start = 0;
+    rd.end = 0;
+    set_recv_timeout(s->conn->sock, 50);
+    pthread_barrier_wait(&s_start_barrier);
+    while (!__atomic_load_n(&s_stop_subscribers, __ATOMIC_ACQUIRE)) {
+        uint8_t type = 0;
+        size_t len = 0;
+        const uint8_t *body = NULL;
+        int r = reader_next(s->conn->sock, &rd, &type, &body, &len);
+        if (r < 0) {
+            break;
+        }
+        if (r == 0 || (type >> 4) != 3 || len < 2) {
+            continue;
+        }
+        uint64_t now = mono_ns();
+        size_t off = 2 + (((size_t)body[0] << 8) | body[1]);
+        if (type & 0x06) {
+            off += 2;
+        }
+        uint64_t sent_ns = 0;
+        while (off < len && body[off] >= '0' && body[off] <= '9') {
+            sent_ns = sent_ns * 10 + (uint64_t)(body[off++] - '0');
+        }
+        if (sent_ns && sent_ns <= now) {
+            record_latency(s, now - sent_ns);
+        }
+        __atomic_add_fetch(&s->received, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *publisher_thread(void *arg)
+{
+    lg_pub_t *p = arg;
+    const loadgen_opts_t *o = p->conn->opts;
+    uint8_t pkt[LG_PACKET_MAX];
+    uint8_t body[16];
+    char topic[32];
+    snprintf(topic, sizeof(topic), LG_TOPIC_PREFIX "%d", p->index);
+    size_t topic_len = strlen(topic);
+    char payload[LG_PACKET_MAX / 2];
+    size_t payload_len = (size_t)o->payload_size;
+    if (payload_len < 24) {
+        payload_len = 24;
+    }
+    if (payload_len >= sizeof(payload)) {
+        payload_len = sizeof(payload) - 1;
+    }
+    memset(payload, 'x', payload_len);
+
+    pthread_barrier_wait(&s_start_barrier);
+    for (int i = 0; i < o->messages; ++i) {
+        uint16_t pid = (uint16_t)(i % 65535 + 1);
+        int n = snprintf(payload, payload_len, "%" PRIu64 "|", mono_ns());
+        payload[n] = 'x';
+        size_t rem = 2 + topic_len + (o->qos ? 2 : 0) + payload_len;
+        size_t idx = 0;
+        pkt[idx++] = (uint8_t)(0x30 | (o->qos ? 0x02 : 0x00));
+        idx += encode_remaining(&pkt[idx], rem);
+        pkt[idx++] = (uint8_t)(topic_len >> 8);
+        pkt[idx++] = (uint8_t)(topic_len & 0xFF);
+        memcpy(&pkt[idx], topic, topic_len);
+        idx += topic_len;
+        if (o->qos) {
+            pkt[idx++] = (uint8_t)(pid >> 8);
+            pkt[idx++] = (uint8_t)(pid & 0xFF);
+        }
+        memcpy(&pkt[idx], payload, payload_len);
+        idx += payload_len;
+        if (send_all(p->conn->sock, pkt, idx) != 0) {
+            break;
+        }
+        if (o->qos) {
+            uint8_t type = 0;
+            size_t len = 0;
+            if (read_packet(p->conn->sock, &type, body, sizeof(body), &len, false) <= 0 || (type >> 4) != 4) {
+                break;
+            }
+        }
+        p->sent++;
+    }
+    p->done_ns = mono_ns();
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t *sorted, size_t n, double pct)
+{
+    if (n == 0) {
+        return 0.0;
+    }
+    size_t idx = (size_t)(pct * (double)(n - 1) + 0.5);
+    return (double)sorted[idx] / 1000.0;
+}
+
+void loadgen_default_opts(loadgen_opts_t *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->host = "127.0.0.1";
+    opts->port = 1883;
+    opts->publishers = 8;
+    opts->subscribers = 4;
+    opts->messages = 2000;
+    opts->qos = 0;
+    opts->payload_size = 64;
+    opts->drain_ms = 2000;
+}
+
+int loadgen_run(const loadgen_opts_t *opts, loadgen_result_t *out)
+{
+    static unsigned s_run = 0;
+    memset(out, 0, sizeof(*out));
+    size_t active = (size_t)(opts->publishers + opts->subscribers);
+    size_t total = active + (size_t)opts->stalled;
+    lg_conn_t *conns = calloc(total, sizeof(lg_conn_t));
+    pthread_t *threads = calloc(total, sizeof(pthread_t));
+    lg_sub_t *subs = calloc((size_t)opts->subscribers + 1, sizeof(lg_sub_t));
+    lg_pub_t *pubs = calloc((size_t)opts->publishers + 1, sizeof(lg_pub_t));
+    if (!conns || !threads || !subs || !pubs) {
+        free(conns);
+        free(threads);
+        free(subs);
+        free(pubs);
+        return -1;
+    }
+    unsigned run = __atomic_add_fetch(&s_run, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < total; ++i) {
+        conns[i].opts = opts;
+        conns[i].sock = -1;
+        bool is_sub = i < (size_t)opts->subscribers;
+        if (i >= active) {
+            conns[i].rcvbuf = 4096;
+            snprintf(conns[i].client_id, sizeof(conns[i].client_id), "lg%d-%u-x%zu", (int)getpid(), run,
+                     i - active);
+            continue;
+        }
+        snprintf(conns[i].client_id, sizeof(conns[i].client_id), "lg%d-%u-%c%zu", (int)getpid(), run,
+                 is_sub ? 's' : 'p', is_sub ? i : i - (size_t)opts->subscribers);
+    }
+
+    // Все клиенты подключаются одновременно, как после перезагрузки точки доступа.
+    uint64_t t0 = mono_ns();
+    for (size_t i = 0; i < total; ++i) {
+        pthread_create(&threads[i], NULL, connect_thread, &conns[i]);
+    }
+    for (size_t i = 0; i < total; ++i) {
+        pthread_join(threads[i], NULL);
+        if (conns[i].ok) {
+            out->connects++;
+        } else {
+            out->connect_failures++;
+        }
+    }
+    double connect_s = (double)(mono_ns() - t0) / 1e9;
+    out->connects_per_s = connect_s > 0 ? out->connects / connect_s : 0;
+
+    int rc = 0;
+    for (int i = 0; i < opts->subscribers; ++i) {
+        if (!conns[i].ok || subscribe(&conns[i]) != 0) {
+            rc = -1;
+        }
+    }
+    for (size_t i = (size_t)opts->subscribers; i < active; ++i) {
+        if (!conns[i].ok) {
+            rc = -1;
+        }
+    }
+    for (size_t i = active; i < total; ++i) {
+        if (!conns[i].ok || subscribe(&conns[i]) != 0) {
+            rc = -1;
+        }
+    }
+    if (rc != 0) {
+        goto done;
+    }
+
+    __atomic_store_n(&s_stop_subscribers, 0, __ATOMIC_RELEASE);
+    pthread_barrier_init(&s_start_barrier, NULL, (unsigned)active + 1);
+    for (int i = 0; i < opts->subscribers; ++i) {
+        subs[i].conn = &conns[i];
+        pthread_create(&threads[i], NULL, subscriber_thread, &subs[i]);
+    }
+    for (int i = 0; i < opts->publishers; ++i) {
+        pubs[i].conn = &conns[opts->subscribers + i];
+        pubs[i].index = i;
+        pthread_create(&threads[opts->subscribers + i], NULL, publisher_thread, &pubs[i]);
+    }
+    pthread_barrier_wait(&s_start_barrier);
+    uint64_t pub_start = mono_ns();
+    uint64_t pub_end = pub_start;
+    for (int i = 0; i < opts->publishers; ++i) {
+        pthread_join(threads[opts->subscribers + i], NULL);
+        out->published += pubs[i].sent;
+        if (pubs[i].done_ns > pub_end) {
+            pub_end = pubs[i].done_ns;
+        }
+    }
+    out->expected = out->published * (uint64_t)opts->subscribers;
+
+    uint64_t deadline = pub_end + (uint64_t)opts->drain_ms * 1000000ull;
+    uint64_t last_rx = pub_end;
+    uint64_t delivered = 0;
+    for (;;) {
+        uint64_t now_delivered = 0;
+        for (int i = 0; i < opts->subscribers; ++i) {
+            now_delivered += __atomic_load_n(&subs[i].received, __ATOMIC_ACQUIRE);
+        }
+        uint64_t now = mono_ns();
+        if (now_delivered != delivered) {
+            delivered = now_delivered;
+            last_rx = now;
+        }
+        // Ждем тишины 200 мс после ожидаемого объема: брокер может доставлять копии.
+        if ((delivered >= out->expected && now - last_rx > 200000000ull) || now > deadline) {
+            break;
+        }
+        usleep(5000);
+    }
+    __atomic_store_n(&s_stop_subscribers, 1, __ATOMIC_RELEASE);
+    size_t lat_total = 0;
+    for (int i = 0; i < opts->subscribers; ++i) {
+        pthread_join(threads[i], NULL);
+        out->delivered += subs[i].received;
+        lat_total += subs[i].latency_count;
+    }
+    pthread_barrier_destroy(&s_start_barrier);
+
+    double pub_s = (double)(pub_end - pub_start) / 1e9;
+    double rx_s = (double)(last_rx - pub_start) / 1e9;
+    out->publish_per_s = pub_s > 0 ? out->published / pub_s : 0;
+    out->deliver_per_s = rx_s > 0 ? out->delivered / rx_s : 0;
+
+    uint64_t *all = malloc((lat_total ? lat_total : 1) * sizeof(uint64_t));
+    if (all) {
+        size_t n = 0;
+        for (int i = 0; i < opts->subscribers; ++i) {
+            memcpy(all + n, subs[i].latencies_ns, subs[i].latency_count * sizeof(uint64_t));
+            n += subs[i].latency_count;
+        }
+        qsort(all, n, sizeof(uint64_t), cmp_u64);
+        out->p50_us = percentile_us(all, n, 0.50);
+        out->p99_us = percentile_us(all, n, 0.99);
+        out->p999_us = percentile_us(all, n, 0.999);
+        out->max_us = n ? (double)all[n - 1] / 1000.0 : 0.0;
+        free(all);
+    }
+
+    if (opts->before_close) {
+        opts->before_close(opts->before_close_ctx);
+    }
+
+done:
+    for (size_t i = 0; i < total; ++i) {
+        if (conns[i].sock >= 0) {
+            static const uint8_t disconnect[] = {0xE0, 0x00};
+            send_all(conns[i].sock, disconnect, sizeof(disconnect));
+            close(conns[i].sock);
+        }
+    }
+    for (int i = 0; i < opts->subscribers; ++i) {
+        free(subs[i].latencies_ns);
+    }
+    free(conns);
+    free(threads);
+    free(subs);
+    free(pubs);
+    return rc;
+}
+
+void loadgen_print(const loadgen_opts_t *opts, const loadgen_result_t *res)
+{
+    printf("clients      : %d publishers, %d subscribers, %d stalled, qos %d, payload %d B\n", opts->publishers,
+           opts->subscribers, opts->stalled, opts->qos, opts->payload_size);
+    printf("connects     : %" PRIu32 " ok, %" PRIu32 " failed, %.0f connects/s\n", res->connects,
+           res->connect_failures, res->connects_per_s);
+    printf("published    : %" PRIu64 " msgs, %.0f msgs/s\n", res->published, res->publish_per_s);
+    printf("delivered    : %" PRIu64 " of %" PRIu64 " expected, %.0f msgs/s\n", res->delivered, res->expected,
+           res->deliver_per_s);
+    printf("latency (us) : p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n", res->p50_us, res->p99_us, res->p999_us,
+           res->max_us);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Нагрузочный MQTT клиент: publishers шлют в bench/<n>, subscribers подписаны на bench/#.
+// Задержка считается по CLOCK_MONOTONIC, записанному в payload при отправке.
+typedef struct {
+    const char *host;
+    int port;
+    int publishers;
+    int subscribers;
+    int messages;       // на каждого publisher
+    int qos;            // 0 или 1 (QoS1 ждет PUBACK перед следующей публикацией)
+    int payload_size;
+    int drain_ms;       // сколько ждать доставки после последней публикации
+    int stalled;        // подписчики bench/#, которые никогда не читают сокет (id "...-x<n>")
+    // Вызывается после доставки, пока соединения еще открыты (проверки на стороне брокера).
+    void (*before_close)(void *ctx);
+    void *before_close_ctx;
+} loadgen_opts_t;
+
+typedef struct {
+    uint32_t connects;
+    uint32_t connect_failures;
+    double connects_per_s;
+    uint64_t published;
+    double publish_per_s;
+    uint64_t expected;
+    uint64_t delivered;
+    double deliver_per_s;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double max_us;
+} loadgen_result_t;
+
+void loadgen_default_opts(loadgen_opts_t *opts);
+// 0 - прогон выполнен (метрики в out), <0 - не удалось подключить клиентов.
+int loadgen_run(const loadgen_opts_t *opts, loadgen_result_t *out);
+void loadgen_print(const loadgen_opts_t *opts, const loadgen_result_t *res);
+
+// Отдельный клиент для сценарных проверок (без потоков loadgen_run).
+// Сокет после успешного CONNACK или -1; rcvbuf > 0 задает SO_RCVBUF до connect.
+int loadgen_client_connect(const char *host, int port, const char *client_id, int rcvbuf);
+// SUBSCRIBE с QoS 0 и ожидание SUBACK; 0 - успех.
+int loadgen_client_subscribe(int sock, const char *filter);
+// Следующий PUBLISH: 1 - получен, 0 - таймаут, <0 - соединение закрыто или ошибка.
+int loadgen_client_read_publish(int sock, int timeout_ms, char *topic, size_t topic_cap, char *payload,
+                                size_t payload_cap);
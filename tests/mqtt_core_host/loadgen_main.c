@@ -0,0 +1,40 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "loadgen.h"
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-H host] [-p port] [-P publishers] [-S subscribers] [-n messages]\n"
+            "          [-q qos] [-s payload_bytes] [-d drain_ms] [-x stalled_subscribers]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    loadgen_opts_t opts;
+    loadgen_default_opts(&opts);
+    int c;
+    while ((c = getopt(argc, argv, "H:p:P:S:n:q:s:d:x:h")) != -1) {
+        switch (c) {
+        case 'H': opts.host = optarg; break;
+        case 'p': opts.port = atoi(optarg); break;
+        case 'P': opts.publishers = atoi(optarg); break;
+        case 'S': opts.subscribers = atoi(optarg); break;
+        case 'n': opts.messages = atoi(optarg); break;
+        case 'q': opts.qos = atoi(optarg) ? 1 : 0; break;
+        case 's': opts.payload_size = atoi(optarg); break;
+        case 'd': opts.drain_ms = atoi(optarg); break;
+        case 'x': opts.stalled = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    loadgen_result_t res;
+    int rc = loadgen_run(&opts, &res);
+    loadgen_print(&opts, &res);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#include "config_store.h"
+
+#include <string.h>
+
+// Host-версия config_store: только конфигурация в памяти, без NVS.
+static app_config_t s_config = {
+    .mqtt = {
+        .broker_id = "host",
+        .port = 1883,
+        .keepalive_seconds = 60,
+    },
+};
+
+esp_err_t config_store_init(void)
+{
+    return ESP_OK;
+}
+
+const app_config_t *config_store_get(void)
+{
+    return &s_config;
+}
+
+esp_err_t config_store_set(const app_config_t *next)
+{
+    if (!next) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(&s_config, next, sizeof(s_config));
+    return ESP_OK;
+}
+
+esp_err_t config_store_reset_defaults(void)
+{
+    memset(&s_config.mqtt.users, 0, sizeof(s_config.mqtt.users));
+    s_config.mqtt.user_count = 0;
+    s_config.mqtt.port = 1883;
+    return ESP_OK;
+}
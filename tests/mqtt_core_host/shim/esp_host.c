@@ -0,0 +1,262 @@
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    default: return "UNKNOWN_ERROR";
+    }
+}
+
+static esp_log_level_t log_threshold(void)
+{
+    static esp_log_level_t level = ESP_LOG_NONE;
+    if (level == ESP_LOG_NONE) {
+        const char *env = getenv("HOST_LOG_LEVEL");
+        switch (env ? env[0] : 'W') {
+        case 'E': level = ESP_LOG_ERROR; break;
+        case 'I': level = ESP_LOG_INFO; break;
+        case 'D': level = ESP_LOG_DEBUG; break;
+        case 'V': level = ESP_LOG_VERBOSE; break;
+        default: level = ESP_LOG_WARN; break;
+        }
+    }
+    return level;
+}
+
+void host_log(esp_log_level_t level, const char *tag, const char *fmt, ...)
+{
+    if (level > log_threshold()) {
+        return;
+    }
+    static const char letters[] = "NEWIDV";
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "%c (%lld) %s: %s\n", letters[level], (long long)(esp_timer_get_time() / 1000), tag, line);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    (void)level;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return realloc(ptr, size);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void)caps;
+    return 0;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_random(void)
+{
+    static __thread unsigned int seed = 0;
+    if (seed == 0) {
+        seed = (unsigned int)(esp_timer_get_time() ^ (intptr_t)&seed);
+    }
+    return ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Каждый таймер обслуживается своим потоком; колбэк вызывается вне мьютекса таймера.
+struct host_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool thread_started;
+    bool active;
+    bool periodic;
+    bool deleted;
+    uint64_t period_us;
+    int64_t due_us;
+};
+
+static void *timer_thread(void *param)
+{
+    struct host_timer *t = param;
+    pthread_mutex_lock(&t->mutex);
+    while (!t->deleted) {
+        if (!t->active) {
+            pthread_cond_wait(&t->cond, &t->mutex);
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+        if (now < t->due_us) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            int64_t wait_us = t->due_us - now;
+            ts.tv_sec += wait_us / 1000000;
+            ts.tv_nsec += (long)(wait_us % 1000000) * 1000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&t->cond, &t->mutex, &ts);
+            continue;
+        }
+        if (t->periodic) {
+            t->due_us += (int64_t)t->period_us;
+        } else {
+            t->active = false;
+        }
+        pthread_mutex_unlock(&t->mutex);
+        t->callback(t->arg);
+        pthread_mutex_lock(&t->mutex);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    pthread_mutex_destroy(&t->mutex);
+    pthread_cond_destroy(&t->cond);
+    free(t);
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out)
+{
+    if (!args || !args->callback || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct host_timer *t = calloc(1, sizeof(*t));
+    if (!t) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    pthread_mutex_init(&t->mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&t->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&t->thread, NULL, timer_thread, t) != 0) {
+        free(t);
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_detach(t->thread);
+    *out = t;
+    return ESP_OK;
+}
+
+static esp_err_t timer_arm(esp_timer_handle_t t, uint64_t us, bool periodic)
+{
+    if (!t) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&t->mutex);
+    if (t->active) {
+        pthread_mutex_unlock(&t->mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->active = true;
+    t->periodic = periodic;
+    t->period_us = us;
+    t->due_us = esp_timer_get_time() + (int64_t)us;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    return timer_arm(timer, period_us, true);
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_arm(timer, timeout_us, false);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t)
+{
+    if (!t) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&t->mutex);
+    bool was_active = t->active;
+    t->active = false;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->mutex);
+    return was_active ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t)
+{
+    if (!t) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&t->mutex);
+    t->deleted = true;
+    t->active = false;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->mutex);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t t)
+{
+    if (!t) {
+        return false;
+    }
+    pthread_mutex_lock(&t->mutex);
+    bool active = t->active;
+    pthread_mutex_unlock(&t->mutex);
+    return active;
+}
@@ -0,0 +1,425 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *param;
+    char name[16];
+    pthread_mutex_t notify_mutex;
+    pthread_cond_t notify_cond;
+    uint32_t notify_value;
+};
+
+struct host_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    size_t item_size;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+struct host_sem {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+static __thread struct host_task *s_current = NULL;
+
+void host_critical_enter(portMUX_TYPE *mux)
+{
+    pthread_mutex_lock(&mux->mutex);
+}
+
+void host_critical_exit(portMUX_TYPE *mux)
+{
+    pthread_mutex_unlock(&mux->mutex);
+}
+
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// Ждать cond, пока pred ложен; false при истечении таймаута.
+static bool wait_for(pthread_cond_t *cond, pthread_mutex_t *mutex, TickType_t ticks,
+                     bool (*pred)(void *), void *arg)
+{
+    if (ticks == portMAX_DELAY) {
+        while (!pred(arg)) {
+            pthread_cond_wait(cond, mutex);
+        }
+        return true;
+    }
+    struct timespec deadline = deadline_after(ticks);
+    while (!pred(arg)) {
+        if (ticks == 0 || pthread_cond_timedwait(cond, mutex, &deadline) == ETIMEDOUT) {
+            return pred(arg);
+        }
+    }
+    return true;
+}
+
+static struct host_task *task_alloc(const char *name)
+{
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (!task) {
+        return NULL;
+    }
+    strncpy(task->name, name ? name : "task", sizeof(task->name) - 1);
+    pthread_mutex_init(&task->notify_mutex, NULL);
+    init_cond(&task->notify_cond);
+    return task;
+}
+
+static void *task_trampoline(void *arg)
+{
+    struct host_task *task = arg;
+    s_current = task;
+    task->fn(task->param);
+    return NULL;
+}
+
+static TaskHandle_t spawn(TaskFunction_t fn, const char *name, void *param, BaseType_t core)
+{
+    struct host_task *task = task_alloc(name);
+    if (!task) {
+        return NULL;
+    }
+    task->fn = fn;
+    task->param = param;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // Привязка к ядру, если на машине оно есть; иначе задача остается без affinity.
+    if (core != tskNO_AFFINITY && core >= 0 && core < sysconf(_SC_NPROCESSORS_ONLN)) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((int)core, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    int rc = pthread_create(&task->thread, &attr, task_trampoline, task);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        free(task);
+        return NULL;
+    }
+    return task;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *out)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, out, tskNO_AFFINITY);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *out, BaseType_t core)
+{
+    (void)stack_depth;
+    (void)priority;
+    TaskHandle_t task = spawn(fn, name, param, core);
+    if (out) {
+        *out = task;
+    }
+    return task ? pdPASS : pdFAIL;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                               UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb)
+{
+    return xTaskCreateStaticPinnedToCore(fn, name, stack_depth, param, priority, stack, tcb, tskNO_AFFINITY);
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                           void *param, UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *tcb, BaseType_t core)
+{
+    (void)stack_depth;
+    (void)priority;
+    (void)stack;
+    (void)tcb;
+    return spawn(fn, name, param, core);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Удалить можно только себя: чужие потоки на host не прерываются.
+    if (task == NULL || task == s_current) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (long)(ticks % 1000) * 1000000L,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!s_current) {
+        // Потоки, созданные не через xTaskCreate (main), получают handle лениво.
+        s_current = task_alloc("main");
+        if (s_current) {
+            s_current->thread = pthread_self();
+        }
+    }
+    return s_current;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->notify_mutex);
+    task->notify_value++;
+    pthread_cond_signal(&task->notify_cond);
+    pthread_mutex_unlock(&task->notify_mutex);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken) {
+        *woken = pdFALSE;
+    }
+}
+
+static bool notify_pending(void *arg)
+{
+    struct host_task *task = arg;
+    return task->notify_value > 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&task->notify_mutex);
+    wait_for(&task->notify_cond, &task->notify_mutex, ticks, notify_pending, task);
+    uint32_t value = task->notify_value;
+    if (value > 0) {
+        task->notify_value = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->notify_mutex);
+    return value;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q));
+    if (!q) {
+        return NULL;
+    }
+    q->items = calloc(length, item_size);
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    q->item_size = item_size;
+    q->capacity = length;
+    pthread_mutex_init(&q->mutex, NULL);
+    init_cond(&q->not_empty);
+    init_cond(&q->not_full);
+    return q;
+}
+
+static bool queue_has_space(void *arg)
+{
+    struct host_queue *q = arg;
+    return q->count < q->capacity;
+}
+
+static bool queue_has_item(void *arg)
+{
+    struct host_queue *q = arg;
+    return q->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (!wait_for(&q->not_full, &q->mutex, ticks, queue_has_space, q)) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    size_t tail = (q->head + q->count) % q->capacity;
+    memcpy(q->items + tail * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void *item, BaseType_t *woken)
+{
+    if (woken) {
+        *woken = pdFALSE;
+    }
+    return xQueueSend(q, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (!wait_for(&q->not_empty, &q->mutex, ticks, queue_has_item, q)) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (!wait_for(&q->not_empty, &q->mutex, ticks, queue_has_item, q)) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t spaces = q->capacity - q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return spaces;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (!q) {
+        return;
+    }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q->items);
+    free(q);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    struct host_sem *sem = calloc(1, sizeof(*sem));
+    if (!sem) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->mutex, NULL);
+    init_cond(&sem->cond);
+    sem->count = initial;
+    sem->max = max;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+static bool sem_available(void *arg)
+{
+    struct host_sem *sem = arg;
+    return sem->count > 0;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->mutex);
+    if (!wait_for(&sem->cond, &sem->mutex, ticks, sem_available, sem)) {
+        pthread_mutex_unlock(&sem->mutex);
+        return pdFALSE;
+    }
+    sem->count--;
+    pthread_mutex_unlock(&sem->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->mutex);
+    if (sem->count >= sem->max) {
+        pthread_mutex_unlock(&sem->mutex);
+        return pdFALSE;
+    }
+    sem->count++;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    if (!sem) {
+        return;
+    }
+    pthread_mutex_destroy(&sem->mutex);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// Минимальная прослойка FreeRTOS поверх pthreads для host-сборки.
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+typedef struct {
+    void *reserved;
+} StaticTask_t;
+
+typedef struct {
+    void *reserved;
+} StaticQueue_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7fffffff
+
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}
+
+void host_critical_enter(portMUX_TYPE *mux);
+void host_critical_exit(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux) host_critical_enter(mux)
+#define portEXIT_CRITICAL(mux) host_critical_exit(mux)
+#define portENTER_CRITICAL_ISR(mux) host_critical_enter(mux)
+#define portEXIT_CRITICAL_ISR(mux) host_critical_exit(mux)
+#define portENTER_CRITICAL_SAFE(mux) host_critical_enter(mux)
+#define portEXIT_CRITICAL_SAFE(mux) host_critical_exit(mux)
+#define taskENTER_CRITICAL(mux) host_critical_enter(mux)
+#define taskEXIT_CRITICAL(mux) host_critical_exit(mux)
+#define portYIELD_FROM_ISR(x) ((void)(x))
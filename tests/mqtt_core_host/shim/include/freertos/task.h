@@ -0,0 +1,29 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *out);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *out, BaseType_t core);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                               UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                           void *param, UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *tcb, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xPortGetCoreID(void);
+
+// Уведомления задач в режиме счетного семафора (xTaskNotifyGive / ulTaskNotifyTake).
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+#define taskYIELD() sched_yield()
+int sched_yield(void);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define closesocket(s) close(s)
+
+// lwIP держит на сокет лишь несколько KB неотправленного, а Linux растит буфер отправки
+// до мегабайт. Принятым сокетам ставится фиксированный SO_SNDBUF (без автоподстройки),
+// чтобы медленный клиент упирался в очередь брокера, как на устройстве.
+int host_lwip_accept(int sock, struct sockaddr *addr, socklen_t *len);
+#define accept(sock, addr, len) host_lwip_accept(sock, addr, len)
@@ -0,0 +1,27 @@
+#pragma once
+
+// Конфигурация для host-сборки mqtt_core (значения по умолчанию из Kconfig.projbuild,
+// число клиентов поднято до максимума для нагрузочных прогонов).
+#ifndef CONFIG_BROKER_MQTT_MAX_CLIENTS
+#define CONFIG_BROKER_MQTT_MAX_CLIENTS 64
+#endif
+#ifndef CONFIG_BROKER_MQTT_PREWARM_WORKERS
+#define CONFIG_BROKER_MQTT_PREWARM_WORKERS 8
+#endif
+#define CONFIG_BROKER_MQTT_JOURNAL 1
+#define CONFIG_BROKER_MQTT_JOURNAL_SIZE_KB 32
+#define CONFIG_BROKER_MQTT_JOURNAL_FILTERS "#"
+#define CONFIG_BROKER_TASK_AFFINITY 1
+#define CONFIG_BROKER_NET_CORE 0
+#define CONFIG_BROKER_APP_CORE 1
+#define CONFIG_FREERTOS_NUMBER_OF_CORES 2
+#define CONFIG_BROKER_MQTT_OUTBOX_KB 8
+#define CONFIG_BROKER_MQTT_LAG_MS 250
+#define CONFIG_BROKER_MQTT_STUCK_MS 3000
+#define CONFIG_BROKER_MQTT_SLOW_SHED_QOS0 1
+#define CONFIG_BROKER_MQTT_CONFLATE_FILTERS ""
+#define CONFIG_BROKER_EVENT_BUS_SLOW_HANDLER_MS 50
+#define CONFIG_BROKER_EVENT_BUS_METRICS_S 30
+#define CONFIG_BROKER_EVENT_BUS_HIGH_WATERMARK 75
+#define CONFIG_BROKER_EVENT_BUS_LOW_WATERMARK 25
+#define CONFIG_BROKER_MQTT_THROTTLE_MIN_RATE 50
@@ -0,0 +1,17 @@
+#include "lwip/sockets.h"
+
+#undef accept
+
+// Начальный размер Linux (tcp_wmem[1]); меньшие значения на loopback упираются в учет
+// truesize мелких сегментов, а не в байты.
+#define HOST_TCP_SNDBUF 16384
+
+int host_lwip_accept(int sock, struct sockaddr *addr, socklen_t *len)
+{
+    int fd = accept(sock, addr, len);
+    if (fd >= 0) {
+        int sndbuf = HOST_TCP_SNDBUF;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    }
+    return fd;
+}
@@ -0,0 +1,569 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <time.h>
+
+#include "broker_host.h"
+#include "event_bus.h"
+#include "loadgen.h"
+#include "mqtt_core.h"
+
+// Брокер и генератор нагрузки в одном процессе: проверка, что host-сборка живая.
+static int run_case(int port, int qos)
+{
+    loadgen_opts_t opts;
+    loadgen_default_opts(&opts);
+    opts.port = port;
+    opts.publishers = 4;
+    opts.subscribers = 2;
+    opts.messages = 200;
+    opts.qos = qos;
+    loadgen_result_t res;
+    int rc = loadgen_run(&opts, &res);
+    loadgen_print(&opts, &res);
+    if (rc != 0 || res.connect_failures != 0) {
+        fprintf(stderr, "FAIL qos%d: clients did not connect\n", qos);
+        return 1;
+    }
+    if (res.published != (uint64_t)opts.publishers * (uint64_t)opts.messages) {
+        fprintf(stderr, "FAIL qos%d: published %llu\n", qos, (unsigned long long)res.published);
+        return 1;
+    }
+    if (res.delivered < res.expected) {
+        fprintf(stderr, "FAIL qos%d: delivered %llu < %llu\n", qos, (unsigned long long)res.delivered,
+                (unsigned long long)res.expected);
+        return 1;
+    }
+    // Мост event_bus -> MQTT не должен возвращать входящую публикацию подписчикам второй раз.
+    if (res.delivered > res.expected) {
+        fprintf(stderr, "FAIL qos%d: delivered %llu > %llu (duplicates)\n", qos, (unsigned long long)res.delivered,
+                (unsigned long long)res.expected);
+        return 1;
+    }
+    return 0;
+}
+
+static bool stalled_client_connected(void)
+{
+    mqtt_client_info_t clients[CONFIG_BROKER_MQTT_MAX_CLIENTS];
+    size_t n = mqtt_core_list_clients(clients, CONFIG_BROKER_MQTT_MAX_CLIENTS);
+    for (size_t i = 0; i < n; ++i) {
+        if (strstr(clients[i].client_id, "-x")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wait_stalled_dropped(void *ctx)
+{
+    bool *dropped = ctx;
+    for (int i = 0; i < (CONFIG_BROKER_MQTT_STUCK_MS + 3000) / 50 && !*dropped; ++i) {
+        *dropped = !stalled_client_connected();
+        usleep(50 * 1000);
+    }
+}
+
+// Подписчик, который не читает сокет, не должен тормозить остальных и отключается.
+// QoS1: такие публикации не отбрасываются политикой, поэтому очередь зависшего клиента растет.
+static int run_stalled_case(int port)
+{
+    bool dropped = false;
+    loadgen_opts_t opts;
+    loadgen_default_opts(&opts);
+    opts.port = port;
+    opts.publishers = 1;
+    opts.subscribers = 2;
+    opts.stalled = 1;
+    opts.messages = 500;
+    opts.payload_size = 480;
+    opts.qos = 1;
+    opts.before_close = wait_stalled_dropped;
+    opts.before_close_ctx = &dropped;
+    loadgen_result_t res;
+    int rc = loadgen_run(&opts, &res);
+    loadgen_print(&opts, &res);
+    if (rc != 0 || res.delivered < res.expected) {
+        fprintf(stderr, "FAIL stalled: delivered %llu < %llu\n", (unsigned long long)res.delivered,
+                (unsigned long long)res.expected);
+        return 1;
+    }
+    if (!dropped) {
+        fprintf(stderr, "FAIL stalled: stuck subscriber was not disconnected\n");
+        return 1;
+    }
+    return 0;
+}
+
+static bool client_connected(const char *client_id)
+{
+    mqtt_client_info_t clients[CONFIG_BROKER_MQTT_MAX_CLIENTS];
+    size_t n = mqtt_core_list_clients(clients, CONFIG_BROKER_MQTT_MAX_CLIENTS);
+    for (size_t i = 0; i < n; ++i) {
+        if (strcmp(clients[i].client_id, client_id) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Медленный подписчик на latest-value топики: очередь не растет, последнее значение доходит.
+static int run_conflate_case(int port)
+{
+    enum { TOPICS = 4, ROUNDS = 400 };
+    const char *id = "smoke-conflate";
+    mqtt_core_set_conflate_filters("conf/#");
+    int sock = loadgen_client_connect("127.0.0.1", port, id, 4096);
+    if (sock < 0 || loadgen_client_subscribe(sock, "conf/#") != 0) {
+        fprintf(stderr, "FAIL conflate: subscriber did not connect\n");
+        mqtt_core_set_conflate_filters("");
+        if (sock >= 0) {
+            close(sock);
+        }
+        return 1;
+    }
+    char topic[32];
+    char payload[224];
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int t = 0; t < TOPICS; ++t) {
+            snprintf(topic, sizeof(topic), "conf/%d", t);
+            int n = snprintf(payload, sizeof(payload), "%d:", r);
+            memset(payload + n, 'v', sizeof(payload) - (size_t)n - 1);
+            payload[sizeof(payload) - 1] = 0;
+            mqtt_core_publish(topic, payload);
+        }
+    }
+    int last[TOPICS];
+    for (int t = 0; t < TOPICS; ++t) {
+        last[t] = -1;
+    }
+    int received = 0;
+    char got_topic[32];
+    while (loadgen_client_read_publish(sock, 500, got_topic, sizeof(got_topic), payload, sizeof(payload)) == 1) {
+        int t = -1;
+        if (sscanf(got_topic, "conf/%d", &t) == 1 && t >= 0 && t < TOPICS) {
+            last[t] = atoi(payload);
+        }
+        received++;
+    }
+    bool connected = client_connected(id);
+    close(sock);
+    mqtt_core_set_conflate_filters("");
+    printf("conflate: published %d received %d\n", TOPICS * ROUNDS, received);
+    if (!connected) {
+        fprintf(stderr, "FAIL conflate: subscriber was disconnected\n");
+        return 1;
+    }
+    if (received >= TOPICS * ROUNDS) {
+        fprintf(stderr, "FAIL conflate: nothing was conflated\n");
+        return 1;
+    }
+    for (int t = 0; t < TOPICS; ++t) {
+        if (last[t] != ROUNDS - 1) {
+            fprintf(stderr, "FAIL conflate: conf/%d ended at %d\n", t, last[t]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Медленный асинхронный обработчик шины (как сценарии на устройстве) и поток QoS0 публикаций:
+// его очередь доходит до верхней отметки, брокер перестает читать публикаторов, и ни одно
+// событие не теряется в очереди обработчика.
+#define PRESSURE_PUBLISHERS 2
+#define PRESSURE_MESSAGES 1000
+#define PRESSURE_DEPTH 256
+#define PRESSURE_HANDLER_US 250
+
+static bool s_pressure_slow = false;
+static uint32_t s_pressure_seen = 0;
+
+static void pressure_handler(const event_bus_message_t *msg)
+{
+    if (!__atomic_load_n(&s_pressure_slow, __ATOMIC_RELAXED) || strncmp(msg->topic, "bench/", 6) != 0) {
+        return;
+    }
+    __atomic_add_fetch(&s_pressure_seen, 1, __ATOMIC_RELAXED);
+    usleep(PRESSURE_HANDLER_US);
+}
+
+static bool find_handler_stats(const char *name, event_bus_handler_stats_t *out)
+{
+    event_bus_handler_stats_t stats[16];
+    size_t n = event_bus_get_handler_stats(stats, 16);
+    for (size_t i = 0; i < n && i < 16; ++i) {
+        if (strcmp(stats[i].name, name) == 0) {
+            *out = stats[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wait_pressure_drained(void *ctx)
+{
+    uint32_t *throttled_ms = ctx;
+    uint32_t expected = PRESSURE_PUBLISHERS * PRESSURE_MESSAGES;
+    for (int i = 0; i < 200 && __atomic_load_n(&s_pressure_seen, __ATOMIC_RELAXED) < expected; ++i) {
+        usleep(50 * 1000);
+    }
+    mqtt_client_info_t clients[CONFIG_BROKER_MQTT_MAX_CLIENTS];
+    size_t n = mqtt_core_list_clients(clients, CONFIG_BROKER_MQTT_MAX_CLIENTS);
+    for (size_t i = 0; i < n; ++i) {
+        *throttled_ms += clients[i].throttled_ms;
+    }
+}
+
+static int run_pressure_case(int port)
+{
+    const event_bus_subscribe_opts_t sub = {.name = "smoke_slow", .depth = PRESSURE_DEPTH};
+    if (event_bus_subscribe_ex(EVENT_BUS_MASK(EVENT_MQTT_MESSAGE), pressure_handler, &sub) != ESP_OK) {
+        fprintf(stderr, "FAIL pressure: subscribe\n");
+        return 1;
+    }
+    event_bus_stats_t before;
+    event_bus_get_stats(&before);
+    __atomic_store_n(&s_pressure_slow, true, __ATOMIC_RELAXED);
+
+    uint32_t throttled_ms = 0;
+    loadgen_opts_t opts;
+    loadgen_default_opts(&opts);
+    opts.port = port;
+    opts.publishers = PRESSURE_PUBLISHERS;
+    opts.subscribers = 1;
+    opts.messages = PRESSURE_MESSAGES;
+    opts.qos = 0;
+    opts.before_close = wait_pressure_drained;
+    opts.before_close_ctx = &throttled_ms;
+    loadgen_result_t res;
+    int rc = loadgen_run(&opts, &res);
+    loadgen_print(&opts, &res);
+    __atomic_store_n(&s_pressure_slow, false, __ATOMIC_RELAXED);
+
+    event_bus_stats_t after;
+    event_bus_get_stats(&after);
+    event_bus_handler_stats_t slow = {0};
+    find_handler_stats("smoke_slow", &slow);
+    uint32_t seen = __atomic_load_n(&s_pressure_seen, __ATOMIC_RELAXED);
+    printf("pressure: handled %u, handler drops %u, episodes %u, throttled %u ms\n", (unsigned)seen,
+           (unsigned)slow.drops, (unsigned)(after.pressure_episodes - before.pressure_episodes),
+           (unsigned)throttled_ms);
+    if (rc != 0 || res.published != (uint64_t)opts.publishers * (uint64_t)opts.messages) {
+        fprintf(stderr, "FAIL pressure: published %llu\n", (unsigned long long)res.published);
+        return 1;
+    }
+    if (slow.drops != 0 || seen != res.published) {
+        fprintf(stderr, "FAIL pressure: slow handler lost events (%u of %llu, drops %u)\n", (unsigned)seen,
+                (unsigned long long)res.published, (unsigned)slow.drops);
+        return 1;
+    }
+    if (after.pressure_episodes == before.pressure_episodes || throttled_ms == 0) {
+        fprintf(stderr, "FAIL pressure: publishers were not throttled\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Внешний транспорт (как WebSocket в web_ui): пакеты встают в очередь сессии, пишет только владелец
+// через mqtt_core_stream_flush. Зависший send не держит публикацию, кадры идут по порядку,
+// а зависшая сессия закрывается по STUCK_MS, как TCP клиент.
+#define STREAM_FRAMES 32
+
+static bool s_stream_block = false;
+static bool s_stream_closed = false;
+static uint32_t s_stream_wakes = 0;
+static uint32_t s_stream_sends = 0;
+static uint8_t s_stream_types[STREAM_FRAMES];
+static char s_stream_payloads[STREAM_FRAMES][8];
+
+static int stream_send(void *ctx, const uint8_t *data, size_t len)
+{
+    (void)ctx;
+    while (__atomic_load_n(&s_stream_block, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+    uint32_t n = s_stream_sends++;
+    if (n < STREAM_FRAMES && len >= 2) {
+        s_stream_types[n] = data[0] & 0xF0;
+        s_stream_payloads[n][0] = 0;
+        // PUBLISH QoS0 с коротким топиком: [0x30][rem][u16 len][topic][payload]
+        if ((data[0] & 0xF0) == 0x30 && len >= 4) {
+            size_t off = 4 + (((size_t)data[2] << 8) | data[3]);
+            size_t plen = len > off ? len - off : 0;
+            if (plen >= sizeof(s_stream_payloads[n])) {
+                plen = sizeof(s_stream_payloads[n]) - 1;
+            }
+            memcpy(s_stream_payloads[n], data + off, plen);
+            s_stream_payloads[n][plen] = 0;
+        }
+    }
+    return (int)len;
+}
+
+static void stream_close_cb(void *ctx)
+{
+    (void)ctx;
+    __atomic_store_n(&s_stream_closed, true, __ATOMIC_RELEASE);
+}
+
+static esp_err_t stream_wake(void *ctx)
+{
+    (void)ctx;
+    __atomic_add_fetch(&s_stream_wakes, 1, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+static const mqtt_core_transport_t s_stream_transport = {
+    .send = stream_send,
+    .close = stream_close_cb,
+    .wake = stream_wake,
+};
+
+static void *stream_flush_thread(void *arg)
+{
+    mqtt_core_stream_flush(*(mqtt_core_stream_t *)arg);
+    return NULL;
+}
+
+static int64_t smoke_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int run_stream_case(void)
+{
+    static const uint8_t connect_pkt[] = {0x10, 24, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60,
+                                          0, 12, 's', 'm', 'o', 'k', 'e', '-', 's', 't', 'r', 'e', 'a', 'm'};
+    static const uint8_t subscribe_pkt[] = {0x82, 9, 0, 1, 0, 4, 'w', 's', '/', '#', 0};
+    mqtt_core_stream_t stream = 0;
+    if (mqtt_core_stream_open(&s_stream_transport, NULL, &stream) != ESP_OK) {
+        fprintf(stderr, "FAIL stream: open\n");
+        return 1;
+    }
+    int fail = 0;
+    mqtt_core_stream_feed(stream, connect_pkt, sizeof(connect_pkt));
+    mqtt_core_stream_feed(stream, subscribe_pkt, sizeof(subscribe_pkt));
+    if (s_stream_sends != 0 || s_stream_wakes != 1) {
+        fprintf(stderr, "FAIL stream: replies were not queued (%u sends, %u wakes)\n", (unsigned)s_stream_sends,
+                (unsigned)s_stream_wakes);
+        fail = 1;
+    }
+    mqtt_core_stream_flush(stream);
+    if (s_stream_sends != 2 || s_stream_types[0] != 0x20 || s_stream_types[1] != 0x90) {
+        fprintf(stderr, "FAIL stream: expected CONNACK, SUBACK\n");
+        fail = 1;
+    }
+
+    // Владелец застрял в send на первом кадре; публикации только встают в очередь.
+    enum { BURST = 10 };
+    __atomic_store_n(&s_stream_block, true, __ATOMIC_RELEASE);
+    char topic[16];
+    char payload[8];
+    mqtt_core_publish("ws/0", "0");
+    pthread_t flusher;
+    pthread_create(&flusher, NULL, stream_flush_thread, &stream);
+    usleep(20 * 1000);
+    int64_t started = smoke_now_us();
+    for (int i = 1; i < BURST; ++i) {
+        snprintf(topic, sizeof(topic), "ws/%d", i);
+        snprintf(payload, sizeof(payload), "%d", i);
+        mqtt_core_publish(topic, payload);
+    }
+    int64_t publish_us = smoke_now_us() - started;
+    __atomic_store_n(&s_stream_block, false, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    printf("stream: %u frames, burst published in %lld us while send blocked\n", (unsigned)s_stream_sends,
+           (long long)publish_us);
+    if (publish_us > 100 * 1000) {
+        fprintf(stderr, "FAIL stream: publish waited for the blocked transport\n");
+        fail = 1;
+    }
+    if (s_stream_sends != 2 + BURST) {
+        fprintf(stderr, "FAIL stream: delivered %u of %d\n", (unsigned)(s_stream_sends - 2), BURST);
+        fail = 1;
+    }
+    for (int i = 0; i < BURST && 2 + i < STREAM_FRAMES; ++i) {
+        snprintf(payload, sizeof(payload), "%d", i);
+        if (s_stream_types[2 + i] != 0x30 || strcmp(s_stream_payloads[2 + i], payload) != 0) {
+            fprintf(stderr, "FAIL stream: frame %d out of order (%s)\n", i, s_stream_payloads[2 + i]);
+            fail = 1;
+            break;
+        }
+    }
+
+    // Send, который не возвращается дольше STUCK_MS, закрывает сессию через sweep.
+    __atomic_store_n(&s_stream_block, true, __ATOMIC_RELEASE);
+    mqtt_core_publish("ws/stuck", "x");
+    pthread_create(&flusher, NULL, stream_flush_thread, &stream);
+    for (int i = 0; i < (CONFIG_BROKER_MQTT_STUCK_MS + 3000) / 50 && !__atomic_load_n(&s_stream_closed, __ATOMIC_ACQUIRE);
+         ++i) {
+        usleep(50 * 1000);
+    }
+    bool closed = __atomic_load_n(&s_stream_closed, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&s_stream_block, false, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    mqtt_core_stream_close(stream);
+    if (!closed) {
+        fprintf(stderr, "FAIL stream: stuck transport session was not closed\n");
+        fail = 1;
+    }
+    return fail;
+}
+
+// Ответ истории больше очереди и сокетных буферов клиента: воркер ждет сокет этого клиента,
+// но не под s_lock - публикации остальных в это время не стоят.
+static int run_history_case(int port)
+{
+    enum { RECORDS = 64, REQUESTS = 2 };
+    char topic[48];
+    char payload[320];
+    mqtt_core_journal_set_filters("hist/#");
+    memset(payload, 'h', sizeof(payload) - 1);
+    payload[sizeof(payload) - 1] = 0;
+    for (int i = 0; i < RECORDS; ++i) {
+        snprintf(topic, sizeof(topic), "hist/%d", i);
+        mqtt_core_publish(topic, payload);
+    }
+    int sock = loadgen_client_connect("127.0.0.1", port, "smoke-history", 2048);
+    if (sock < 0) {
+        fprintf(stderr, "FAIL history: client did not connect\n");
+        mqtt_core_journal_set_filters(CONFIG_BROKER_MQTT_JOURNAL_FILTERS);
+        return 1;
+    }
+    // PUBLISH QoS0 "$SYS/history/get" = "hist/# 64", дважды.
+    static const char get_topic[] = "$SYS/history/get";
+    static const char request[] = "hist/# 64";
+    uint8_t pkt[64];
+    size_t n = 0;
+    pkt[n++] = 0x30;
+    pkt[n++] = (uint8_t)(2 + sizeof(get_topic) - 1 + sizeof(request) - 1);
+    pkt[n++] = 0;
+    pkt[n++] = (uint8_t)(sizeof(get_topic) - 1);
+    memcpy(pkt + n, get_topic, sizeof(get_topic) - 1);
+    n += sizeof(get_topic) - 1;
+    memcpy(pkt + n, request, sizeof(request) - 1);
+    n += sizeof(request) - 1;
+    for (int r = 0; r < REQUESTS; ++r) {
+        if (send(sock, pkt, n, 0) != (ssize_t)n) {
+            fprintf(stderr, "FAIL history: request send\n");
+        }
+    }
+    usleep(300 * 1000);
+    int64_t started = smoke_now_us();
+    mqtt_core_publish("hist-other/x", "1");
+    int64_t publish_us = smoke_now_us() - started;
+
+    int records = 0;
+    int ends = 0;
+    char got_topic[64];
+    while (ends < REQUESTS &&
+           loadgen_client_read_publish(sock, 2000, got_topic, sizeof(got_topic), payload, sizeof(payload)) == 1) {
+        if (strcmp(got_topic, "$SYS/history/end") == 0) {
+            ends++;
+        } else if (strncmp(got_topic, "$SYS/history/hist/", 18) == 0) {
+            records++;
+        }
+    }
+    close(sock);
+    mqtt_core_journal_set_filters(CONFIG_BROKER_MQTT_JOURNAL_FILTERS);
+    printf("history: %d records, %d end markers, publish took %lld us while the reply waited\n", records, ends,
+           (long long)publish_us);
+    if (publish_us > 100 * 1000) {
+        fprintf(stderr, "FAIL history: publish waited for the history reply\n");
+        return 1;
+    }
+    if (records != REQUESTS * RECORDS || ends != REQUESTS) {
+        fprintf(stderr, "FAIL history: expected %d records and %d end markers\n", REQUESTS * RECORDS, REQUESTS);
+        return 1;
+    }
+    return 0;
+}
+
+// Снимок метрик шины доходит до MQTT подписчика: каждая часть помещается в payload MQTT,
+// статистика обработчиков делится на несколько частей.
+#define METRICS_EXTRA_HANDLERS 8
+
+static void metrics_noop_handler(const event_bus_message_t *msg)
+{
+    (void)msg;
+}
+
+static int run_metrics_case(int port)
+{
+    static char names[METRICS_EXTRA_HANDLERS][16];
+    for (int i = 0; i < METRICS_EXTRA_HANDLERS; ++i) {
+        snprintf(names[i], sizeof(names[i]), "smoke_metric%d", i);
+        const event_bus_subscribe_opts_t sub = {.name = names[i]};
+        event_bus_subscribe_ex(EVENT_BUS_MASK(EVENT_CARD_OK), metrics_noop_handler, &sub);
+    }
+    int sock = loadgen_client_connect("127.0.0.1", port, "smoke-metrics", 0);
+    if (sock < 0 || loadgen_client_subscribe(sock, EVENT_BUS_METRICS_TOPIC "/#") != 0) {
+        fprintf(stderr, "FAIL metrics: subscriber did not connect\n");
+        if (sock >= 0) {
+            close(sock);
+        }
+        return 1;
+    }
+    if (event_bus_metrics_publish() != ESP_OK) {
+        fprintf(stderr, "FAIL metrics: publish\n");
+        close(sock);
+        return 1;
+    }
+    bool summary = false;
+    bool posted = false;
+    bool delivered = false;
+    int handlers_seen = 0;
+    int handler_parts = 0;
+    int fail = 0;
+    char topic[64];
+    char payload[1024];
+    while (loadgen_client_read_publish(sock, 500, topic, sizeof(topic), payload, sizeof(payload)) == 1) {
+        size_t len = strlen(payload);
+        if (len == 0 || len >= EVENT_BUS_METRICS_PART_LEN || payload[0] != '{' || payload[len - 1] != '}') {
+            fprintf(stderr, "FAIL metrics: bad part %s (%u bytes)\n", topic, (unsigned)len);
+            fail = 1;
+        }
+        if (strcmp(topic, EVENT_BUS_METRICS_TOPIC) == 0) {
+            summary = strstr(payload, "\"pressure\"") != NULL;
+        } else if (strcmp(topic, EVENT_BUS_METRICS_TOPIC "/posted") == 0) {
+            posted = strstr(payload, "\"mqtt_message\"") != NULL;
+        } else if (strcmp(topic, EVENT_BUS_METRICS_TOPIC "/delivered") == 0) {
+            delivered = strstr(payload, "\"mqtt_message\"") != NULL;
+        } else if (strncmp(topic, EVENT_BUS_METRICS_TOPIC "/handlers/", sizeof(EVENT_BUS_METRICS_TOPIC "/handlers/") - 1) ==
+                   0) {
+            handler_parts++;
+            for (const char *p = payload; (p = strstr(p, "\"name\":\"smoke_metric")) != NULL; ++p) {
+                handlers_seen++;
+            }
+        }
+    }
+    close(sock);
+    printf("metrics: summary %d, posted %d, delivered %d, %d handler parts\n", summary, posted, delivered,
+           handler_parts);
+    if (!summary || !posted || !delivered || handler_parts < 2 || handlers_seen != METRICS_EXTRA_HANDLERS) {
+        fprintf(stderr, "FAIL metrics: missing parts\n");
+        fail = 1;
+    }
+    return fail;
+}
+
+int main(void)
+{
+    int port = 20000 + (int)(getpid() % 20000);
+    if (broker_host_start(port) != ESP_OK) {
+        return 1;
+    }
+    usleep(100 * 1000);
+    int failures = run_case(port, 0) + run_case(port, 1) + run_stalled_case(port) +
+                   run_conflate_case(port) + run_pressure_case(port) + run_stream_case() +
+                   run_history_case(port) + run_metrics_case(port);
+    printf("%s\n", failures ? "SMOKE FAIL" : "SMOKE OK");
+    return failures ? 1 : 0;
+}
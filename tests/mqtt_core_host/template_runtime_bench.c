@@ -0,0 +1,679 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_player.h"
+#include "dm_runtime_scheduler.h"
+#include "dm_runtime_service.h"
+#include "dm_template_runtime.h"
+#include "event_bus.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Бенчмарк диспетчеризации template runtime (components/device_runtime) на host:
+// dm_template_runtime_handle_mqtt для топика без подписчиков и для топика mqtt-триггера
+// при 40 uid + 40 mqtt-trigger + 40 sequence устройствах; dm_template_runtime_handle_flag
+// при 40 flag-trigger (4 правила) + 40 if_condition (8 правил). Время включает блокировку runtime.
+// Перерегистрация конфигурации из 12 устройств: полная (reset + register) и инкрементальная
+// (dm_runtime_service_rebuild). Проверка, что аудио выполняется без блокировки runtime, сверка
+// индекса флагов с линейной моделью на случайных шаблонах и в конце всплеск MQTT через шину,
+// пока блокировку держит другая задача: обработчик runtime должен получить все сообщения.
+
+#define BENCH_DEVICES 40
+
+static long s_iters = 200000;
+static int s_failures = 0;
+
+// Аудио на host не нужно: в замерах плеер не вызывается. Проверка блокировки делает play медленным,
+// как очередь плеера на устройстве, которая ждет до 50 мс.
+static atomic_int s_audio_plays;
+static atomic_int s_audio_delay_ms;
+
+esp_err_t audio_player_play(const char *path)
+{
+    (void)path;
+    atomic_fetch_add(&s_audio_plays, 1);
+    int delay_ms = atomic_load(&s_audio_delay_ms);
+    if (delay_ms > 0) {
+        usleep((useconds_t)delay_ms * 1000);
+    }
+    return ESP_OK;
+}
+
+esp_err_t audio_player_play_seek(const char *path, float ratio)
+{
+    (void)path;
+    (void)ratio;
+    return ESP_OK;
+}
+
+void audio_player_pause(void)
+{
+}
+
+void audio_player_resume(void)
+{
+}
+
+void audio_player_stop(void)
+{
+}
+
+void audio_player_get_status(audio_player_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char *group, const char *name, double ns_per_op)
+{
+    printf("%-10s %-40s %10.1f ns/op\n", group, name, ns_per_op);
+}
+
+static void expect(bool ok, const char *group, const char *name)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL %s %s: unexpected result\n", group, name);
+        s_failures++;
+    }
+}
+
+static void register_dispatch_devices(void)
+{
+    char id[DEVICE_MANAGER_ID_MAX_LEN];
+    for (int d = 0; d < BENCH_DEVICES; ++d) {
+        dm_template_config_t uid = {.type = DM_TEMPLATE_TYPE_UID};
+        uid.data.uid.slot_count = 2;
+        snprintf(uid.data.uid.slots[0].source_id, sizeof(uid.data.uid.slots[0].source_id), "dev%d/r1", d);
+        snprintf(uid.data.uid.slots[1].source_id, sizeof(uid.data.uid.slots[1].source_id), "dev%d/r2", d);
+        snprintf(id, sizeof(id), "uid%d", d);
+        expect(dm_template_runtime_register(&uid, id) == ESP_OK, "dispatch", "register uid");
+
+        dm_template_config_t mqtt = {.type = DM_TEMPLATE_TYPE_MQTT_TRIGGER};
+        mqtt.data.mqtt.rule_count = 1;
+        snprintf(mqtt.data.mqtt.rules[0].topic, sizeof(mqtt.data.mqtt.rules[0].topic), "dev%d/btn", d);
+        snprintf(mqtt.data.mqtt.rules[0].scenario, sizeof(mqtt.data.mqtt.rules[0].scenario), "press");
+        snprintf(id, sizeof(id), "mqtt%d", d);
+        expect(dm_template_runtime_register(&mqtt, id) == ESP_OK, "dispatch", "register mqtt trigger");
+
+        dm_template_config_t seq = {.type = DM_TEMPLATE_TYPE_SEQUENCE_LOCK};
+        seq.data.sequence.step_count = 3;
+        for (int s = 0; s < 3; ++s) {
+            snprintf(seq.data.sequence.steps[s].topic, sizeof(seq.data.sequence.steps[s].topic), "dev%d/seq%d", d, s);
+        }
+        snprintf(id, sizeof(id), "seq%d", d);
+        expect(dm_template_runtime_register(&seq, id) == ESP_OK, "dispatch", "register sequence");
+    }
+}
+
+static double time_mqtt(const char *topic, const char *payload)
+{
+    for (long i = 0; i < s_iters / 10; ++i) {
+        dm_template_runtime_handle_mqtt(topic, payload);
+    }
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < s_iters; ++i) {
+        dm_template_runtime_handle_mqtt(topic, payload);
+    }
+    return (double)(now_ns() - t0) / (double)s_iters;
+}
+
+static void bench_dispatch(void)
+{
+    dm_template_runtime_reset();
+    register_dispatch_devices();
+    expect(!dm_template_runtime_handle_mqtt("sensors/room/temp", "21"), "dispatch", "unmatched topic ignored");
+    expect(dm_template_runtime_handle_mqtt("dev7/btn", "x"), "dispatch", "trigger topic handled");
+    report("dispatch", "mqtt unmatched topic", time_mqtt("sensors/room/temp", "21"));
+    report("dispatch", "mqtt trigger topic", time_mqtt("dev7/btn", "x"));
+}
+
+static double time_flag(const char *flag)
+{
+    for (long i = 0; i < s_iters / 10; ++i) {
+        dm_template_runtime_handle_flag(flag, i & 1);
+    }
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < s_iters; ++i) {
+        dm_template_runtime_handle_flag(flag, i & 1);
+    }
+    return (double)(now_ns() - t0) / (double)s_iters;
+}
+
+static void bench_flags(void)
+{
+    char id[DEVICE_MANAGER_ID_MAX_LEN];
+    dm_template_runtime_reset();
+    for (int d = 0; d < BENCH_DEVICES; ++d) {
+        dm_template_config_t trigger = {.type = DM_TEMPLATE_TYPE_FLAG_TRIGGER};
+        dm_flag_trigger_template_t *flag = &trigger.data.flag;
+        flag->rule_count = 4;
+        for (int r = 0; r < flag->rule_count; ++r) {
+            snprintf(flag->rules[r].flag, sizeof(flag->rules[r].flag), "Dev%d_flag%d", d, r);
+            snprintf(flag->rules[r].scenario, sizeof(flag->rules[r].scenario), "on%d", r);
+            flag->rules[r].required_state = true;
+        }
+        snprintf(id, sizeof(id), "flag%d", d);
+        expect(dm_template_runtime_register(&trigger, id) == ESP_OK, "flag", "register flag trigger");
+
+        dm_template_config_t condition = {.type = DM_TEMPLATE_TYPE_IF_CONDITION};
+        dm_condition_template_t *cond = &condition.data.condition;
+        cond->mode = DEVICE_CONDITION_ALL;
+        cond->rule_count = 8;
+        for (int r = 0; r < cond->rule_count; ++r) {
+            snprintf(cond->rules[r].flag, sizeof(cond->rules[r].flag), "dev%d_cond%d", d, r);
+            cond->rules[r].required_state = true;
+        }
+        snprintf(cond->true_scenario, sizeof(cond->true_scenario), "open");
+        snprintf(id, sizeof(id), "cond%d", d);
+        expect(dm_template_runtime_register(&condition, id) == ESP_OK, "flag", "register condition");
+    }
+    expect(!dm_template_runtime_handle_flag("unrelated_flag", true), "flag", "unknown flag ignored");
+    expect(dm_template_runtime_handle_flag("DEV7_COND3", true), "flag", "condition flag case-insensitive");
+    report("flag", "unknown flag", time_flag("unrelated_flag"));
+    report("flag", "condition flag (1 of 8 rules)", time_flag("DEV7_COND3"));
+    report("flag", "trigger flag (fires every other call)", time_flag("dev7_FLAG2"));
+}
+
+// Побочные действия выполняются после снятия блокировки runtime: пока трек успеха последовательности
+// "запускается" 300 мс, другой вызов runtime проходит сразу.
+static void *effects_sequence_thread(void *arg)
+{
+    (void)arg;
+    dm_template_runtime_handle_mqtt("lock/1", "");
+    dm_template_runtime_handle_mqtt("lock/2", "");
+    return NULL;
+}
+
+static void check_effects_outside_lock(void)
+{
+    dm_template_runtime_reset();
+    dm_template_config_t seq = {.type = DM_TEMPLATE_TYPE_SEQUENCE_LOCK};
+    seq.data.sequence.step_count = 2;
+    snprintf(seq.data.sequence.steps[0].topic, sizeof(seq.data.sequence.steps[0].topic), "lock/1");
+    snprintf(seq.data.sequence.steps[1].topic, sizeof(seq.data.sequence.steps[1].topic), "lock/2");
+    snprintf(seq.data.sequence.success_audio_track, sizeof(seq.data.sequence.success_audio_track), "/sdcard/win.mp3");
+    expect(dm_template_runtime_register(&seq, "lock") == ESP_OK, "effects", "register sequence");
+
+    atomic_store(&s_audio_plays, 0);
+    atomic_store(&s_audio_delay_ms, 300);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, effects_sequence_thread, NULL) != 0) {
+        expect(false, "effects", "thread start");
+        return;
+    }
+    while (atomic_load(&s_audio_plays) == 0) {
+        usleep(1000);
+    }
+    uint64_t t0 = now_ns();
+    dm_template_runtime_handle_flag("unrelated_flag", true);
+    double waited_ms = (double)(now_ns() - t0) / 1e6;
+    pthread_join(thread, NULL);
+    atomic_store(&s_audio_delay_ms, 0);
+    expect(atomic_load(&s_audio_plays) == 1, "effects", "success track played once");
+    expect(waited_ms < 100.0, "effects", "runtime call not blocked by audio");
+    printf("%-10s %-40s %10.3f ms\n", "effects", "runtime call during 300 ms audio", waited_ms);
+}
+
+// Линейная модель: каждая запись проверяет каждое свое правило по имени без учета регистра,
+// как до индекса флагов. Сценарии сверяются с тем, что runtime отправил в шину.
+#define REPLAY_ENTRIES 12
+#define REPLAY_EVENTS 400
+#define REPLAY_MAX_FIRED (REPLAY_ENTRIES * 2)
+
+typedef struct {
+    char device_id[DEVICE_MANAGER_ID_MAX_LEN];
+    dm_template_config_t tpl;
+    bool valid[DM_FLAG_TRIGGER_MAX_RULES];
+    bool state[DM_FLAG_TRIGGER_MAX_RULES];
+    bool has_result;
+    bool result;
+} replay_model_t;
+
+typedef struct {
+    char text[REPLAY_MAX_FIRED][2 * DEVICE_MANAGER_ID_MAX_LEN];
+    size_t count;
+} replay_fired_t;
+
+static replay_fired_t s_bus_fired;
+static atomic_int s_bus_scenarios;
+
+static void replay_add(replay_fired_t *out, const char *device_id, const char *scenario)
+{
+    if (out->count < REPLAY_MAX_FIRED) {
+        // Оба поля не длиннее идентификатора: строка помещается целиком.
+        const int len = DEVICE_MANAGER_ID_MAX_LEN - 1;
+        snprintf(out->text[out->count++], sizeof(out->text[0]), "%.*s:%.*s", len, device_id, len, scenario);
+    }
+}
+
+static void replay_scenario_handler(const event_bus_message_t *msg)
+{
+    atomic_fetch_add(&s_bus_scenarios, 1);
+    replay_add(&s_bus_fired, msg->topic, msg->payload);
+}
+
+static int replay_cmp(const void *a, const void *b)
+{
+    return strcmp((const char *)a, (const char *)b);
+}
+
+static bool model_handle(replay_model_t *model, const char *flag_name, bool state, replay_fired_t *out)
+{
+    bool handled = false;
+    for (size_t e = 0; e < REPLAY_ENTRIES; ++e) {
+        replay_model_t *m = &model[e];
+        if (m->tpl.type == DM_TEMPLATE_TYPE_FLAG_TRIGGER) {
+            const dm_flag_trigger_template_t *tpl = &m->tpl.data.flag;
+            for (uint8_t i = 0; i < tpl->rule_count; ++i) {
+                const dm_flag_trigger_rule_t *rule = &tpl->rules[i];
+                if (!rule->scenario[0] || strcasecmp(rule->flag, flag_name) != 0) {
+                    continue;
+                }
+                bool changed = !m->valid[i] || m->state[i] != state;
+                m->valid[i] = true;
+                m->state[i] = state;
+                if (changed && state == rule->required_state) {
+                    replay_add(out, m->device_id, rule->scenario);
+                    handled = true;
+                    break;
+                }
+            }
+            continue;
+        }
+        const dm_condition_template_t *tpl = &m->tpl.data.condition;
+        bool matched = false;
+        for (uint8_t i = 0; i < tpl->rule_count; ++i) {
+            if (strcasecmp(tpl->rules[i].flag, flag_name) == 0) {
+                m->state[i] = state;
+                matched = true;
+            }
+        }
+        if (!matched) {
+            continue;
+        }
+        handled = true;
+        size_t true_count = 0;
+        for (uint8_t i = 0; i < tpl->rule_count; ++i) {
+            true_count += m->state[i] == tpl->rules[i].required_state;
+        }
+        bool result = tpl->mode == DEVICE_CONDITION_ALL ? true_count == tpl->rule_count : true_count > 0;
+        if (m->has_result && result == m->result) {
+            continue;
+        }
+        m->has_result = true;
+        m->result = result;
+        const char *scenario = result ? tpl->true_scenario : tpl->false_scenario;
+        if (scenario[0]) {
+            replay_add(out, m->device_id, scenario);
+        }
+    }
+    return handled;
+}
+
+static void replay_wait_idle(void)
+{
+    while (!event_bus_is_idle()) {
+        vTaskDelay(1);
+    }
+}
+
+static void replay_seed(unsigned seed)
+{
+    static const char *names[] = {"door", "Door", "LIGHT", "light", "alarm", "Alarm_1", "x"};
+    const unsigned name_count = sizeof(names) / sizeof(names[0]);
+    static replay_model_t model[REPLAY_ENTRIES];
+    unsigned rng = seed;
+    memset(model, 0, sizeof(model));
+    dm_template_runtime_reset();
+    for (int e = 0; e < REPLAY_ENTRIES; ++e) {
+        replay_model_t *m = &model[e];
+        if (e % 2) {
+            dm_flag_trigger_template_t *tpl = &m->tpl.data.flag;
+            m->tpl.type = DM_TEMPLATE_TYPE_FLAG_TRIGGER;
+            tpl->rule_count = 1 + rand_r(&rng) % 4;
+            for (uint8_t r = 0; r < tpl->rule_count; ++r) {
+                snprintf(tpl->rules[r].flag, sizeof(tpl->rules[r].flag), "%s", names[rand_r(&rng) % name_count]);
+                tpl->rules[r].required_state = rand_r(&rng) % 2;
+                if (rand_r(&rng) % 5) {
+                    snprintf(tpl->rules[r].scenario, sizeof(tpl->rules[r].scenario), "s%u", (unsigned)r);
+                }
+            }
+            snprintf(m->device_id, sizeof(m->device_id), "flag%d", e);
+        } else {
+            dm_condition_template_t *tpl = &m->tpl.data.condition;
+            m->tpl.type = DM_TEMPLATE_TYPE_IF_CONDITION;
+            tpl->rule_count = 1 + rand_r(&rng) % 4;
+            tpl->mode = rand_r(&rng) % 2 ? DEVICE_CONDITION_ALL : DEVICE_CONDITION_ANY;
+            for (uint8_t r = 0; r < tpl->rule_count; ++r) {
+                snprintf(tpl->rules[r].flag, sizeof(tpl->rules[r].flag), "%s", names[rand_r(&rng) % name_count]);
+                tpl->rules[r].required_state = rand_r(&rng) % 2;
+            }
+            snprintf(tpl->true_scenario, sizeof(tpl->true_scenario), "T");
+            if (rand_r(&rng) % 3) {
+                snprintf(tpl->false_scenario, sizeof(tpl->false_scenario), "F");
+            }
+            snprintf(m->device_id, sizeof(m->device_id), "cond%d", e);
+        }
+        expect(dm_template_runtime_register(&m->tpl, m->device_id) == ESP_OK, "replay", "register");
+    }
+    size_t fired = 0;
+    size_t mismatches = 0;
+    for (int i = 0; i < REPLAY_EVENTS; ++i) {
+        const char *name = i % 17 == 0 ? "unknown" : names[rand_r(&rng) % name_count];
+        bool state = rand_r(&rng) % 2;
+        replay_fired_t expected = {0};
+        bool expected_handled = model_handle(model, name, state, &expected);
+        s_bus_fired.count = 0;
+        bool handled = dm_template_runtime_handle_flag(name, state);
+        replay_wait_idle();
+        qsort(expected.text, expected.count, sizeof(expected.text[0]), replay_cmp);
+        qsort(s_bus_fired.text, s_bus_fired.count, sizeof(s_bus_fired.text[0]), replay_cmp);
+        bool same = handled == expected_handled && s_bus_fired.count == expected.count;
+        for (size_t k = 0; same && k < expected.count; ++k) {
+            same = strcmp(expected.text[k], s_bus_fired.text[k]) == 0;
+        }
+        if (!same && mismatches++ == 0) {
+            fprintf(stderr, "replay seed %u event %d %s=%d: handled %d/%d, scenarios %u/%u\n", seed, i, name,
+                    (int)state, (int)handled, (int)expected_handled, (unsigned)s_bus_fired.count,
+                    (unsigned)expected.count);
+        }
+        fired += expected.count;
+    }
+    expect(mismatches == 0, "replay", "indexed flags match the linear model");
+    printf("%-10s seed %u: %d events, %u scenarios, %u mismatches\n", "replay", seed, REPLAY_EVENTS,
+           (unsigned)fired, (unsigned)mismatches);
+}
+
+static void replay_flags(void)
+{
+    const event_bus_subscribe_opts_t opts = {.name = "bench_scenarios"};
+    expect(event_bus_subscribe_ex(EVENT_BUS_MASK(EVENT_SCENARIO_TRIGGER), replay_scenario_handler, &opts) == ESP_OK,
+           "replay", "subscribe");
+    // Сценарии замеров могли остаться в кольце.
+    replay_wait_idle();
+    for (unsigned seed = 1; seed <= 4; ++seed) {
+        replay_seed(seed);
+    }
+}
+
+#define FANOUT_DEVICES 100
+
+// Один флаг запускает сценарии 100 устройств: все действия одного захода доходят до шины.
+static void check_fanout(void)
+{
+    char id[DEVICE_MANAGER_ID_MAX_LEN];
+    dm_template_runtime_reset();
+    for (int d = 0; d < FANOUT_DEVICES; ++d) {
+        dm_template_config_t tpl = {.type = DM_TEMPLATE_TYPE_FLAG_TRIGGER};
+        tpl.data.flag.rule_count = 1;
+        snprintf(tpl.data.flag.rules[0].flag, sizeof(tpl.data.flag.rules[0].flag), "fan");
+        tpl.data.flag.rules[0].required_state = true;
+        snprintf(tpl.data.flag.rules[0].scenario, sizeof(tpl.data.flag.rules[0].scenario), "go");
+        snprintf(id, sizeof(id), "fan%d", d);
+        expect(dm_template_runtime_register(&tpl, id) == ESP_OK, "fanout", "register");
+    }
+    atomic_store(&s_bus_scenarios, 0);
+    dm_template_runtime_handle_flag("fan", true);
+    replay_wait_idle();
+    int seen = atomic_load(&s_bus_scenarios);
+    expect(seen == FANOUT_DEVICES, "fanout", "every scenario reached the bus");
+    printf("%-10s one flag, %d devices: %d scenarios on the bus\n", "fanout", FANOUT_DEVICES, seen);
+}
+
+#define BURST_MESSAGES 200
+
+static void *burst_post_thread(void *arg)
+{
+    int *failed = arg;
+    event_bus_message_t msg = {.type = EVENT_MQTT_MESSAGE, .topic = "burst/x", .payload = "1"};
+    for (int i = 0; i < BURST_MESSAGES; ++i) {
+        if (event_bus_post(&msg, pdMS_TO_TICKS(1000)) != ESP_OK) {
+            (*failed)++;
+        }
+    }
+    return NULL;
+}
+
+static bool template_handler_calls(uint32_t *calls)
+{
+    event_bus_handler_stats_t stats[16];
+    size_t count = event_bus_get_handler_stats(stats, 16);
+    for (size_t i = 0; i < count && i < 16; ++i) {
+        if (strcmp(stats[i].name, "template") == 0) {
+            *calls = stats[i].calls;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Пока колесо или API держат блокировку, сообщения копятся в кольце шины, а производители ждут места.
+static void check_burst_while_locked(void)
+{
+    uint32_t before = 0;
+    uint32_t after = 0;
+    int failed = 0;
+    expect(template_handler_calls(&before), "burst", "template handler stats");
+    dm_runtime_scheduler_lock();
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, burst_post_thread, &failed) != 0) {
+        dm_runtime_scheduler_unlock();
+        expect(false, "burst", "thread start");
+        return;
+    }
+    usleep(50 * 1000);
+    dm_runtime_scheduler_unlock();
+    pthread_join(thread, NULL);
+    replay_wait_idle();
+    template_handler_calls(&after);
+    expect(failed == 0, "burst", "posts accepted");
+    expect(after - before == BURST_MESSAGES, "burst", "every message reached the runtime");
+    printf("%-10s %d messages during a 50 ms lock hold: %u handled, %d posts failed\n", "burst", BURST_MESSAGES,
+           (unsigned)(after - before), failed);
+}
+
+#define REBUILD_DEVICES 12
+
+static void rebuild_config_init(device_manager_config_t *cfg)
+{
+    cfg->device_capacity = REBUILD_DEVICES;
+    cfg->device_count = REBUILD_DEVICES;
+    for (int i = 0; i < REBUILD_DEVICES; ++i) {
+        device_descriptor_t *dev = &cfg->devices[i];
+        dm_template_config_t *tpl = &dev->template_config;
+        snprintf(dev->id, sizeof(dev->id), "dev%d", i);
+        dev->template_assigned = true;
+        if (i == 0) {
+            tpl->type = DM_TEMPLATE_TYPE_SEQUENCE_LOCK;
+            tpl->data.sequence.step_count = 2;
+            tpl->data.sequence.timeout_ms = 5000;
+            for (int s = 0; s < 2; ++s) {
+                snprintf(tpl->data.sequence.steps[s].topic, sizeof(tpl->data.sequence.steps[s].topic),
+                         "quest/seq/%d", s + 1);
+            }
+        } else if (i == 1) {
+            tpl->type = DM_TEMPLATE_TYPE_MQTT_TRIGGER;
+            tpl->data.mqtt.rule_count = 1;
+            snprintf(tpl->data.mqtt.rules[0].topic, sizeof(tpl->data.mqtt.rules[0].topic), "quest/button");
+            snprintf(tpl->data.mqtt.rules[0].scenario, sizeof(tpl->data.mqtt.rules[0].scenario), "press");
+        } else if (i == 2) {
+            tpl->type = DM_TEMPLATE_TYPE_FLAG_TRIGGER;
+            tpl->data.flag.rule_count = 1;
+            snprintf(tpl->data.flag.rules[0].flag, sizeof(tpl->data.flag.rules[0].flag), "beam");
+            snprintf(tpl->data.flag.rules[0].scenario, sizeof(tpl->data.flag.rules[0].scenario), "beam_on");
+            tpl->data.flag.rules[0].required_state = true;
+        } else {
+            tpl->type = DM_TEMPLATE_TYPE_UID;
+            tpl->data.uid.slot_count = 1;
+            snprintf(tpl->data.uid.slots[0].source_id, sizeof(tpl->data.uid.slots[0].source_id), "reader/%d", i);
+        }
+    }
+}
+
+static double time_rebuild(const device_manager_config_t *cfg, long rounds, bool full, bool touch)
+{
+    device_manager_config_t *edit = (device_manager_config_t *)cfg;
+    char *scenario = edit->devices[1].template_config.data.mqtt.rules[0].scenario;
+    uint64_t t0 = now_ns();
+    for (long r = 0; r < rounds; ++r) {
+        if (full) {
+            dm_template_runtime_reset();
+            for (int i = 0; i < cfg->device_count; ++i) {
+                dm_template_runtime_register(&cfg->devices[i].template_config, cfg->devices[i].id);
+            }
+            continue;
+        }
+        if (touch) {
+            // Одно устройство меняется на каждом круге: replace только его записей.
+            snprintf(scenario, DEVICE_MANAGER_ID_MAX_LEN, "press%ld", r & 1);
+        }
+        dm_runtime_service_rebuild(cfg);
+    }
+    return (double)(now_ns() - t0) / (double)rounds;
+}
+
+// Байты, которых runtime не читает: хвосты строк после NUL, записи за счетчиком, выравнивание и
+// остаток объединения за шаблоном. Их мусор не должен заменять устройство при rebuild.
+static void rebuild_scribble_unused(device_manager_config_t *cfg)
+{
+    dm_sequence_template_t *seq = &cfg->devices[0].template_config.data.sequence;
+    size_t used = strlen(seq->steps[0].topic) + 1;
+    memset(seq->steps[0].topic + used, 'x', sizeof(seq->steps[0].topic) - used);
+    memset(&seq->steps[5], 0x5a, sizeof(seq->steps[5]));
+    memset((uint8_t *)&seq->step_count + 1, 0xa5, offsetof(dm_sequence_template_t, timeout_ms) -
+                                                       offsetof(dm_sequence_template_t, step_count) - 1);
+
+    dm_mqtt_trigger_template_t *mqtt = &cfg->devices[1].template_config.data.mqtt;
+    used = strlen(mqtt->rules[0].scenario) + 1;
+    memset(mqtt->rules[0].scenario + used, 'y', sizeof(mqtt->rules[0].scenario) - used);
+    memset(&mqtt->rules[3], 0x33, sizeof(mqtt->rules[3]));
+
+    dm_template_config_t *flag = &cfg->devices[2].template_config;
+    memset((uint8_t *)&flag->data + sizeof(flag->data.flag), 0x77, sizeof(flag->data) - sizeof(flag->data.flag));
+}
+
+static void check_rebuild_hash(device_manager_config_t *cfg)
+{
+    dm_runtime_rebuild_stats_t st;
+    expect(dm_runtime_service_rebuild(cfg) == ESP_OK, "rebuild", "rebuild before scribble");
+    rebuild_scribble_unused(cfg);
+    expect(dm_runtime_service_rebuild(cfg) == ESP_OK, "rebuild", "rebuild after scribble");
+    dm_runtime_service_get_rebuild_stats(&st);
+    expect(st.kept == REBUILD_DEVICES && st.updated == 0, "rebuild", "unused bytes keep every device");
+    cfg->devices[2].template_config.data.flag.rules[0].required_state = false;
+    expect(dm_runtime_service_rebuild(cfg) == ESP_OK, "rebuild", "rebuild after change");
+    dm_runtime_service_get_rebuild_stats(&st);
+    expect(st.updated == 1 && st.kept == REBUILD_DEVICES - 1, "rebuild", "a real change replaces one device");
+    printf("%-10s unused bytes scribbled: kept %u; one rule changed: updated %u\n", "rebuild",
+           (unsigned)REBUILD_DEVICES, (unsigned)st.updated);
+}
+
+// Конфигурация больше таблицы runtime: rebuild берет первые DEVICE_MANAGER_MAX_DEVICES, а
+// register_template не принимает сверх них новое устройство.
+static void check_rebuild_overflow(void)
+{
+    const int total = DEVICE_MANAGER_MAX_DEVICES + 2;
+    device_manager_config_t *cfg = calloc(1, sizeof(*cfg) + sizeof(device_descriptor_t) * total);
+    if (!cfg) {
+        expect(false, "rebuild", "overflow config alloc");
+        return;
+    }
+    rebuild_config_init(cfg);
+    for (int i = REBUILD_DEVICES; i < total; ++i) {
+        cfg->devices[i] = cfg->devices[3];
+        snprintf(cfg->devices[i].id, sizeof(cfg->devices[i].id), "dev%d", i);
+    }
+    cfg->device_capacity = total;
+    cfg->device_count = total;
+
+    dm_runtime_rebuild_stats_t st;
+    dm_runtime_service_init();
+    expect(dm_runtime_service_rebuild(cfg) == ESP_OK, "rebuild", "rebuild past the table");
+    dm_runtime_service_get_rebuild_stats(&st);
+    expect(st.added == DEVICE_MANAGER_MAX_DEVICES, "rebuild", "rebuild takes the first 12 devices");
+    expect(dm_runtime_service_rebuild(cfg) == ESP_OK, "rebuild", "second rebuild past the table");
+    dm_runtime_service_get_rebuild_stats(&st);
+    expect(st.kept == DEVICE_MANAGER_MAX_DEVICES && st.added == 0, "rebuild", "tracked devices stay kept");
+    expect(dm_runtime_service_register_template(&cfg->devices[total - 1].template_config, "extra") == ESP_ERR_NO_MEM,
+           "rebuild", "register past the table is refused");
+    expect(dm_runtime_service_register_template(&cfg->devices[3].template_config, "dev3") == ESP_OK, "rebuild",
+           "re-register of a tracked device");
+    printf("%-10s %d devices in config: %u tracked, extra register refused\n", "rebuild", total,
+           (unsigned)st.kept);
+    dm_runtime_service_init();
+    free(cfg);
+}
+
+static void bench_rebuild(void)
+{
+    long rounds = s_iters / 200 > 100 ? s_iters / 200 : 100;
+    device_manager_config_t *cfg =
+        calloc(1, sizeof(*cfg) + sizeof(device_descriptor_t) * REBUILD_DEVICES);
+    if (!cfg) {
+        expect(false, "rebuild", "config alloc");
+        return;
+    }
+    rebuild_config_init(cfg);
+    expect(dm_runtime_service_init() == ESP_OK && dm_runtime_service_rebuild(cfg) == ESP_OK, "rebuild",
+           "initial rebuild");
+    expect(dm_template_runtime_handle_mqtt("quest/button", ""), "rebuild", "trigger after rebuild");
+    report("rebuild", "mqtt trigger topic, 12 devices", time_mqtt("quest/button", ""));
+    report("rebuild", "incremental, no change", time_rebuild(cfg, rounds, false, false));
+    report("rebuild", "incremental, 1 device changed", time_rebuild(cfg, rounds, false, true));
+    expect(dm_template_runtime_handle_mqtt("quest/button", ""), "rebuild", "trigger after incremental rebuild");
+    report("rebuild", "full reset + register", time_rebuild(cfg, rounds, true, false));
+    expect(dm_template_runtime_handle_mqtt("quest/button", "") && dm_template_runtime_handle_flag("beam", true),
+           "rebuild", "dispatch after full re-register");
+    dm_runtime_service_init();
+    rebuild_config_init(cfg);
+    check_rebuild_hash(cfg);
+    dm_runtime_service_init();
+    free(cfg);
+    check_rebuild_overflow();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        s_iters = strtol(argv[1], NULL, 10);
+        if (s_iters <= 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+    // Шина запущена без подписчиков сценариев: сценарии замеров разбираются впустую. Предупреждения
+    // о медленных вызовах исказили бы замер, поэтому по умолчанию только ошибки.
+    setenv("HOST_LOG_LEVEL", "E", 0);
+    if (event_bus_init() != ESP_OK || event_bus_start() != ESP_OK || dm_template_runtime_init() != ESP_OK) {
+        fprintf(stderr, "runtime init failed\n");
+        return 1;
+    }
+    printf("template runtime, %ld iterations per case\n", s_iters);
+    bench_dispatch();
+    bench_flags();
+    bench_rebuild();
+    check_effects_outside_lock();
+    replay_flags();
+    check_fanout();
+    check_burst_while_locked();
+    if (s_failures) {
+        printf("TEMPLATE RUNTIME BENCH FAIL (%d)\n", s_failures);
+        return 1;
+    }
+    return 0;
+}
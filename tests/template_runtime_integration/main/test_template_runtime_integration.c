@@ -6,6 +6,7 @@
 #include "event_bus.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "dm_runtime_service.h"
 #include "dm_template_runtime.h"
 #include "test_template_helpers.h"
 
@@ -42,6 +43,37 @@ static const char *k_sequence_runtime_json =
     " }]"
     "}";
 
+static const char *k_rebuild_runtime_json =
+    "{"
+    " \"schema\":1,"
+    " \"devices\":[{"
+    "   \"id\":\"rebuild_lock\","
+    "   \"display_name\":\"Rebuild Lock\","
+    "   \"template\":{"
+    "     \"type\":\"sequence_lock\","
+    "     \"sequence\":{"
+    "       \"timeout_ms\":5000,"
+    "       \"reset_on_error\":true,"
+    "       \"steps\":["
+    "         {\"topic\":\"quest/rebuild/1\",\"payload\":\"red\",\"payload_required\":true},"
+    "         {\"topic\":\"quest/rebuild/2\",\"payload\":\"blue\",\"payload_required\":true}"
+    "       ]"
+    "     }"
+    "   }"
+    " },{"
+    "   \"id\":\"rebuild_gate\","
+    "   \"display_name\":\"Rebuild Gate\","
+    "   \"template\":{"
+    "     \"type\":\"on_mqtt_event\","
+    "     \"mqtt\":{"
+    "       \"rules\":["
+    "         {\"topic\":\"quest/rebuild/button\",\"payload\":\"press\",\"payload_required\":true,\"scenario\":\"button_press\"}"
+    "       ]"
+    "     }"
+    "   }"
+    " }]"
+    "}";
+
 static const char *k_uid_runtime_json =
     "{"
     " \"schema\":1,"
@@ -661,8 +693,8 @@ static void test_sequence_runtime_event_bus_mqtt_routing_updates_snapshot(void)
     event_bus_message_t msg = {
         .type = EVENT_MQTT_MESSAGE,
     };
-    strncpy(msg.topic, "quest/seq/1", sizeof(msg.topic) - 1);
-    strncpy(msg.payload, "red", sizeof(msg.payload) - 1);
+    msg.topic = "quest/seq/1";
+    msg.payload = "red";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TEST_ASSERT_TRUE(wait_for_sequence_step("seq_lock", 1, pdMS_TO_TICKS(200)));
@@ -676,6 +708,85 @@ static void test_sequence_runtime_event_bus_mqtt_routing_updates_snapshot(void)
     cleanup_template_runtime();
 }
 
+static void test_template_runtime_topic_index_routes_only_listening_entries(void)
+{
+    prepare_template_runtime(false);
+    register_sequence_runtime_from_json();
+    register_uid_runtime_from_json();
+    register_mqtt_runtime_from_json();
+
+    TEST_ASSERT_FALSE(dm_template_runtime_handle_mqtt("quest/unrelated", "red"));
+    TEST_ASSERT_TRUE(dm_template_runtime_handle_mqtt("quest/seq/1", "red"));
+    TEST_ASSERT_FALSE(dm_template_runtime_handle_mqtt("quest/unrelated", "blue"));
+    TEST_ASSERT_TRUE(dm_template_runtime_handle_mqtt("reader/1", "A1"));
+
+    dm_sequence_runtime_snapshot_t snap = {0};
+    TEST_ASSERT_EQUAL(ESP_OK, dm_template_runtime_get_sequence_snapshot("seq_lock", &snap));
+    TEST_ASSERT_EQUAL_UINT8(1, snap.current_step_index);
+    TEST_ASSERT_EQUAL_STRING("active", snap.state);
+
+    dm_uid_runtime_snapshot_t uid = {0};
+    TEST_ASSERT_EQUAL(ESP_OK, dm_template_runtime_get_uid_snapshot("uid_gate", &uid));
+    TEST_ASSERT_TRUE(uid.slots[0].has_value);
+    TEST_ASSERT_FALSE(uid.slots[1].has_value);
+
+    // Индекс пересобирается после сброса: старые записи не получают сообщений.
+    dm_template_runtime_reset();
+    TEST_ASSERT_FALSE(dm_template_runtime_handle_mqtt("quest/seq/1", "red"));
+    register_sequence_runtime_from_json();
+    TEST_ASSERT_TRUE(dm_template_runtime_handle_mqtt("quest/seq/1", "red"));
+    TEST_ASSERT_FALSE(dm_template_runtime_handle_mqtt("reader/1", "A1"));
+    cleanup_template_runtime();
+}
+
+static uint8_t sequence_step(const char *device_id)
+{
+    dm_sequence_runtime_snapshot_t snap = {0};
+    TEST_ASSERT_EQUAL(ESP_OK, dm_template_runtime_get_sequence_snapshot(device_id, &snap));
+    return snap.current_step_index;
+}
+
+static void test_runtime_service_rebuild_replaces_only_changed_devices(void)
+{
+    prepare_template_runtime(false);
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_init());
+    device_manager_config_t *cfg = template_test_parse_config_json(k_rebuild_runtime_json, 2);
+    device_descriptor_t *lock =
+        (device_descriptor_t *)template_test_require_template(cfg, "rebuild_lock", DM_TEMPLATE_TYPE_SEQUENCE_LOCK);
+    device_descriptor_t *gate =
+        (device_descriptor_t *)template_test_require_template(cfg, "rebuild_gate", DM_TEMPLATE_TYPE_MQTT_TRIGGER);
+
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_rebuild(cfg));
+    TEST_ASSERT_TRUE(dm_template_runtime_handle_mqtt("quest/rebuild/1", "red"));
+    TEST_ASSERT_EQUAL_UINT8(1, sequence_step("rebuild_lock"));
+
+    // Изменился чужой шаблон: последовательность не перерегистрируется и не теряет шаг.
+    strcpy(gate->template_config.data.mqtt.rules[0].scenario, "button_press_2");
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_rebuild(cfg));
+    TEST_ASSERT_EQUAL_UINT8(1, sequence_step("rebuild_lock"));
+    TEST_ASSERT_TRUE(dm_template_runtime_handle_mqtt("quest/rebuild/button", "press"));
+
+    // Другой таймаут при тех же шагах: запись заменяется, шаг переносится.
+    lock->template_config.data.sequence.timeout_ms = 6000;
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_rebuild(cfg));
+    TEST_ASSERT_EQUAL_UINT8(1, sequence_step("rebuild_lock"));
+
+    // Другие шаги: прогресс сбрасывается.
+    strcpy(lock->template_config.data.sequence.steps[1].payload, "green");
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_rebuild(cfg));
+    TEST_ASSERT_EQUAL_UINT8(0, sequence_step("rebuild_lock"));
+
+    // Устройство без шаблона снимается, его топики больше никто не слушает.
+    gate->template_assigned = false;
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_rebuild(cfg));
+    TEST_ASSERT_FALSE(dm_template_runtime_handle_mqtt("quest/rebuild/button", "press"));
+    TEST_ASSERT_TRUE(dm_template_runtime_handle_mqtt("quest/rebuild/1", "red"));
+
+    template_test_free_config(cfg);
+    TEST_ASSERT_EQUAL(ESP_OK, dm_runtime_service_init());
+    cleanup_template_runtime();
+}
+
 static void test_signal_runtime_snapshot_and_manual_reset(void)
 {
     prepare_template_runtime(false);
@@ -756,8 +867,7 @@ static void test_signal_runtime_event_bus_routing_updates_snapshot(void)
     event_bus_message_t msg = {
         .type = EVENT_MQTT_MESSAGE,
     };
-    strncpy(msg.topic, "quest/heartbeat", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
+    msg.topic = "quest/heartbeat";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TEST_ASSERT_TRUE(wait_for_signal_state("signal_hold", "active", pdMS_TO_TICKS(200)));
@@ -769,8 +879,7 @@ static void test_signal_runtime_event_bus_routing_updates_snapshot(void)
 
     memset(&msg, 0, sizeof(msg));
     msg.type = EVENT_MQTT_MESSAGE;
-    strncpy(msg.topic, "quest/reset", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
+    msg.topic = "quest/reset";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TEST_ASSERT_TRUE(wait_for_signal_state("signal_hold", "idle", pdMS_TO_TICKS(200)));
@@ -825,10 +934,8 @@ static void test_uid_runtime_event_bus_routing_updates_snapshot(void)
     event_bus_message_t msg = {
         .type = EVENT_MQTT_MESSAGE,
     };
-    strncpy(msg.topic, "reader/1", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
-    strncpy(msg.payload, "A1", sizeof(msg.payload) - 1);
-    msg.payload[sizeof(msg.payload) - 1] = '\0';
+    msg.topic = "reader/1";
+    msg.payload = "A1";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TEST_ASSERT_TRUE(wait_for_uid_slot_value("uid_gate", 0, "A1", pdMS_TO_TICKS(200)));
@@ -840,10 +947,8 @@ static void test_uid_runtime_event_bus_routing_updates_snapshot(void)
 
     memset(&msg, 0, sizeof(msg));
     msg.type = EVENT_MQTT_MESSAGE;
-    strncpy(msg.topic, "quest/start", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
-    strncpy(msg.payload, "go", sizeof(msg.payload) - 1);
-    msg.payload[sizeof(msg.payload) - 1] = '\0';
+    msg.topic = "quest/start";
+    msg.payload = "go";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TickType_t start = xTaskGetTickCount();
@@ -1009,10 +1114,8 @@ static void test_mqtt_trigger_event_bus_routing_posts_scenario_event(void)
     event_bus_message_t msg = {
         .type = EVENT_MQTT_MESSAGE,
     };
-    strncpy(msg.topic, "quest/button", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
-    strncpy(msg.payload, "press", sizeof(msg.payload) - 1);
-    msg.payload[sizeof(msg.payload) - 1] = '\0';
+    msg.topic = "quest/button";
+    msg.payload = "press";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TEST_ASSERT_TRUE(wait_for_scenario_capture_count(1, pdMS_TO_TICKS(200)));
@@ -1088,10 +1191,8 @@ static void test_flag_trigger_event_bus_routing_posts_scenario_event(void)
     event_bus_message_t msg = {
         .type = EVENT_FLAG_CHANGED,
     };
-    strncpy(msg.topic, "beam_ok", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
-    strncpy(msg.payload, "true", sizeof(msg.payload) - 1);
-    msg.payload[sizeof(msg.payload) - 1] = '\0';
+    msg.topic = "beam_ok";
+    msg.payload = "true";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
 
     TEST_ASSERT_TRUE(wait_for_scenario_capture_count(1, pdMS_TO_TICKS(200)));
@@ -1171,19 +1272,15 @@ static void test_condition_event_bus_routing_posts_true_scenario(void)
     event_bus_message_t msg = {
         .type = EVENT_FLAG_CHANGED,
     };
-    strncpy(msg.topic, "beam_ok", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
-    strncpy(msg.payload, "true", sizeof(msg.payload) - 1);
-    msg.payload[sizeof(msg.payload) - 1] = '\0';
+    msg.topic = "beam_ok";
+    msg.payload = "true";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
     TEST_ASSERT_TRUE(wait_for_scenario_capture_count(1, pdMS_TO_TICKS(200)));
 
     memset(&msg, 0, sizeof(msg));
     msg.type = EVENT_FLAG_CHANGED;
-    strncpy(msg.topic, "door_closed", sizeof(msg.topic) - 1);
-    msg.topic[sizeof(msg.topic) - 1] = '\0';
-    strncpy(msg.payload, "true", sizeof(msg.payload) - 1);
-    msg.payload[sizeof(msg.payload) - 1] = '\0';
+    msg.topic = "door_closed";
+    msg.payload = "true";
     TEST_ASSERT_EQUAL(ESP_OK, event_bus_post(&msg, pdMS_TO_TICKS(100)));
     TEST_ASSERT_TRUE(wait_for_scenario_capture_count(2, pdMS_TO_TICKS(200)));
 
@@ -1272,6 +1369,27 @@ static void test_interval_runtime_posts_periodic_scenario_events(void)
     cleanup_template_runtime();
 }
 
+static void test_interval_runtime_unregister_cancels_timer(void)
+{
+    prepare_template_runtime(true);
+    register_interval_runtime_from_json();
+    reset_scenario_capture();
+
+    TEST_ASSERT_TRUE(wait_for_scenario_capture_count(1, pdMS_TO_TICKS(400)));
+    TEST_ASSERT_EQUAL(ESP_OK, dm_template_runtime_unregister("interval_gate"));
+    // Срабатывание, уже стоящее в шине, успевает дойти до захвата.
+    vTaskDelay(pdMS_TO_TICKS(50));
+    taskENTER_CRITICAL(&s_capture_lock);
+    uint32_t count = s_capture.count;
+    taskEXIT_CRITICAL(&s_capture_lock);
+
+    vTaskDelay(pdMS_TO_TICKS(300));
+    taskENTER_CRITICAL(&s_capture_lock);
+    TEST_ASSERT_EQUAL_UINT32(count, s_capture.count);
+    taskEXIT_CRITICAL(&s_capture_lock);
+    cleanup_template_runtime();
+}
+
 static void test_sequence_runtime_reset_on_error_posts_fail_and_restarts(void)
 {
     prepare_template_runtime(true);
@@ -1424,10 +1542,13 @@ void register_template_runtime_integration_tests(void)
     RUN_TEST(test_condition_any_direct_handle_posts_true_and_false_scenarios);
     RUN_TEST(test_condition_matches_case_insensitive_flag_names);
     RUN_TEST(test_interval_runtime_posts_periodic_scenario_events);
+    RUN_TEST(test_interval_runtime_unregister_cancels_timer);
     RUN_TEST(test_sequence_runtime_snapshot_and_manual_reset);
     RUN_TEST(test_sequence_runtime_completion_snapshot);
     RUN_TEST(test_sequence_runtime_timeout_snapshot);
     RUN_TEST(test_sequence_runtime_event_bus_mqtt_routing_updates_snapshot);
+    RUN_TEST(test_template_runtime_topic_index_routes_only_listening_entries);
+    RUN_TEST(test_runtime_service_rebuild_replaces_only_changed_devices);
     RUN_TEST(test_sequence_runtime_reset_on_error_posts_fail_and_restarts);
     RUN_TEST(test_sequence_runtime_without_reset_on_error_keeps_progress);
     RUN_TEST(test_signal_runtime_snapshot_and_manual_reset);